@@ -0,0 +1,508 @@
+/*
+Archive module contains an archival variant of the .csb byte format, meant for cold storage.
+The phrases are split in independent blocks of block_size phrases. For every block, the three phrase streams
+(phrase lengths, start deltas and mismatches) are entropy coded with an order-0 rANS coder.
+A block offset index is stored at the end of the file, so a query only needs to decode the block that covers it.
+
+File layout:
+magic "ISRA" | size | num_bins | block_size | num_blocks | index offset | blocks ... | index
+The index keeps, for every block, its file offset and the source position where it starts.
+
+Functions:
+csb_to_archive
+is_archive
+archive_open
+archive_close
+archive_load_block
+archive_access
+archive_access_range
+archive_to_csb
+-----------------------------------------------------------------------------------------
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "archive.h"
+#include "mem.h"
+#include "trace.h"
+
+#define RANS_SCALE_BITS 12
+#define RANS_TOTFREQ (1 << RANS_SCALE_BITS)
+#define RANS_L (1u << 23)
+
+struct bytebuf {
+	unsigned char * data;
+	size_t len;
+	size_t cap;
+};
+
+static void buf_reserve(struct bytebuf * b, size_t extra) {
+	if (b->len + extra <= b->cap)
+		return;
+	while (b->len + extra > b->cap)
+		b->cap = b->cap ? 2 * b->cap : 1024;
+	b->data = realloc(b->data, b->cap);
+}
+
+static void buf_put(struct bytebuf * b, const void * src, size_t n) {
+	buf_reserve(b, n);
+	memcpy(b->data + b->len, src, n);
+	b->len += n;
+}
+
+static void buf_varint(struct bytebuf * b, uint64_t v) {
+	buf_reserve(b, 10);
+	while (v >= 0x80) {
+		b->data[b->len++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	b->data[b->len++] = (unsigned char)v;
+}
+
+static uint64_t get_varint(unsigned char ** p) {
+	uint64_t v = 0;
+	int shift = 0;
+	unsigned char c;
+	do {
+		c = *(*p)++;
+		v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return v;
+}
+
+static uint64_t zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void normalize_freqs(unsigned int * counts, unsigned int * freqs, size_t n) {
+/* Scales the symbol counts of a stream of n bytes so they add up to RANS_TOTFREQ, keeping every present symbol at frequency >= 1. */
+	int s, largest = 0;
+	long total = 0;
+	for (s = 0; s < 256; ++s) {
+		freqs[s] = 0;
+		if (counts[s]) {
+			freqs[s] = (unsigned int)((uint64_t)counts[s] * RANS_TOTFREQ / n);
+			if (freqs[s] == 0)
+				freqs[s] = 1;
+			total += freqs[s];
+			if (counts[s] > counts[largest])
+				largest = s;
+		}
+	}
+	// the most frequent symbol absorbs the rounding error; if it cannot, steal from the others
+	while (total != RANS_TOTFREQ) {
+		if (total < RANS_TOTFREQ) {
+			freqs[largest] += RANS_TOTFREQ - total;
+			total = RANS_TOTFREQ;
+		}
+		else if (freqs[largest] > total - RANS_TOTFREQ) {
+			freqs[largest] -= total - RANS_TOTFREQ;
+			total = RANS_TOTFREQ;
+		}
+		else {
+			for (s = 0; s < 256 && total > RANS_TOTFREQ; ++s) {
+				if (freqs[s] > 1) {
+					freqs[s] -= 1;
+					total -= 1;
+				}
+			}
+		}
+	}
+}
+
+static void put_stream(struct bytebuf * out, unsigned char * in, size_t n) {
+/* Writes a byte stream to 'out'. The stream is rANS coded (mode 1) unless that would not make it smaller,
+in which case it is stored raw (mode 0). */
+	unsigned int counts[256] = { 0 }, freqs[256], cum[257];
+	size_t i;
+	int s, nsym = 0;
+	buf_varint(out, n);
+	if (n == 0)
+		return;
+	for (i = 0; i < n; ++i)
+		counts[in[i]]++;
+	normalize_freqs(counts, freqs, n);
+	cum[0] = 0;
+	for (s = 0; s < 256; ++s) {
+		cum[s + 1] = cum[s] + freqs[s];
+		if (freqs[s])
+			nsym++;
+	}
+
+	// rANS encodes backwards, so the output is written from the end of the buffer
+	size_t cap = 2 * n + 16;
+	unsigned char * enc = malloc(cap);
+	unsigned char * ptr = enc + cap;
+	uint32_t x = RANS_L;
+	for (i = n; i > 0; --i) {
+		unsigned int f = freqs[in[i - 1]];
+		uint32_t x_max = ((RANS_L >> RANS_SCALE_BITS) << 8) * f;
+		while (x >= x_max) {
+			*--ptr = (unsigned char)(x & 0xff);
+			x >>= 8;
+		}
+		x = ((x / f) << RANS_SCALE_BITS) + (x % f) + cum[in[i - 1]];
+	}
+	ptr -= 4;
+	ptr[0] = (unsigned char)(x >> 0);
+	ptr[1] = (unsigned char)(x >> 8);
+	ptr[2] = (unsigned char)(x >> 16);
+	ptr[3] = (unsigned char)(x >> 24);
+	size_t enc_len = enc + cap - ptr;
+
+	if (enc_len + 2 * nsym + 2 >= n) {
+		unsigned char mode = 0;
+		buf_put(out, &mode, 1);
+		buf_put(out, in, n);
+	}
+	else {
+		unsigned char mode = 1;
+		buf_put(out, &mode, 1);
+		buf_varint(out, nsym - 1);
+		for (s = 0; s < 256; ++s) {
+			if (freqs[s]) {
+				unsigned char sym = (unsigned char)s;
+				buf_put(out, &sym, 1);
+				buf_varint(out, freqs[s] - 1);
+			}
+		}
+		buf_varint(out, enc_len);
+		buf_put(out, ptr, enc_len);
+	}
+	free(enc);
+}
+
+static unsigned char * get_stream(unsigned char ** p, size_t * n) {
+/* Reads a stream written by put_stream starting at *p and returns its decoded bytes. *p is moved past the stream. */
+	*n = get_varint(p);
+	unsigned char * res = malloc(*n + 1);
+	if (*n == 0)
+		return res;
+	unsigned char mode = *(*p)++;
+	if (mode == 0) {
+		memcpy(res, *p, *n);
+		*p += *n;
+		return res;
+	}
+	unsigned int freqs[256] = { 0 }, cum[256];
+	unsigned char cum2sym[RANS_TOTFREQ];
+	int s, nsym = (int)get_varint(p) + 1;
+	while (nsym--) {
+		unsigned char sym = *(*p)++;
+		freqs[sym] = (unsigned int)get_varint(p) + 1;
+	}
+	unsigned int c = 0;
+	for (s = 0; s < 256; ++s) {
+		cum[s] = c;
+		memset(cum2sym + c, s, freqs[s]);
+		c += freqs[s];
+	}
+	size_t enc_len = get_varint(p);
+	unsigned char * ptr = *p;
+	uint32_t x = (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+	ptr += 4;
+	size_t i;
+	for (i = 0; i < *n; ++i) {
+		unsigned char sym = cum2sym[x & (RANS_TOTFREQ - 1)];
+		res[i] = sym;
+		x = freqs[sym] * (x >> RANS_SCALE_BITS) + (x & (RANS_TOTFREQ - 1)) - cum[sym];
+		while (x < RANS_L)
+			x = (x << 8) | *ptr++;
+	}
+	*p += enc_len;
+	return res;
+}
+
+void csb_to_archive(csb * compression, char * filename, int block_size) {
+/* This function receives as input a compressed source (csb struct) and writes it on the -filename- file using the archival format.
+Each block of -block_size- phrases is entropy coded independently. */
+	FILE * fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		printf("Error. Cannot open %s for writing\n", filename);
+		return;
+	}
+	struct trace_span span = trace_begin("write archive");
+	long long size = compression->size, num_bins = compression->lens->size;
+	long long num_blocks = (size - 1 + block_size - 1) / block_size;
+	long long * offsets = malloc((num_blocks + 1) * sizeof(long long));
+	long long * bases = malloc((num_blocks + 1) * sizeof(long long));
+	long long index_offset = 0;
+	fwrite(ARCHIVE_MAGIC, 1, 4, fp);
+	fwrite(&size, sizeof(long long), 1, fp);
+	fwrite(&num_bins, sizeof(long long), 1, fp);
+	fwrite(&block_size, sizeof(int), 1, fp);
+	fwrite(&num_blocks, sizeof(long long), 1, fp);
+	fwrite(&index_offset, sizeof(long long), 1, fp);
+
+	pos_t * lens = compression->lens->arr;
+	pos_t * starts = compression->starts;
+	struct bytebuf block = { 0 }, len_stream = { 0 }, start_stream = { 0 };
+	pos_t b;
+	for (b = 0; b < num_blocks; ++b) {
+		pos_t first = 1 + b * block_size;
+		pos_t last = first + block_size;
+		if (last > compression->size)
+			last = compression->size;
+		block.len = len_stream.len = start_stream.len = 0;
+		// the start deltas are relative to where the previous phrase of the same block would continue,
+		// so a phrase that only ends because of a SNP gets a delta of 0
+		long long expected = 0;
+		pos_t i;
+		for (i = first; i < last; ++i) {
+			buf_varint(&len_stream, lens[i] - lens[i - 1]);
+			buf_varint(&start_stream, zigzag(starts[i] - expected));
+			expected = (long long)starts[i] + lens[i] - lens[i - 1];
+		}
+		buf_varint(&block, last - first);
+		put_stream(&block, len_stream.data, len_stream.len);
+		put_stream(&block, start_stream.data, start_stream.len);
+		put_stream(&block, (unsigned char *)&compression->mismatches[first], last - first);
+		offsets[b] = ftell(fp);
+		bases[b] = lens[first - 1];
+		fwrite(block.data, 1, block.len, fp);
+	}
+	offsets[num_blocks] = ftell(fp);
+	bases[num_blocks] = lens[compression->size - 1];
+	index_offset = offsets[num_blocks];
+	fwrite(offsets, sizeof(long long), num_blocks + 1, fp);
+	fwrite(bases, sizeof(long long), num_blocks + 1, fp);
+	fseek(fp, 4 + 3 * sizeof(long long) + sizeof(int), SEEK_SET);
+	fwrite(&index_offset, sizeof(long long), 1, fp);
+	fseek(fp, 0L, SEEK_END);
+	trace_end(span, ftell(fp));
+	fclose(fp);
+	free(block.data);
+	free(len_stream.data);
+	free(start_stream.data);
+	free(offsets);
+	free(bases);
+}
+
+int is_archive(char * filename) {
+/* This function returns 1 if -filename- was written with csb_to_archive, and 0 otherwise. */
+	char magic[4];
+	FILE * fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return 0;
+	int res = fread(magic, 1, 4, fp) == 4 && memcmp(magic, ARCHIVE_MAGIC, 4) == 0;
+	fclose(fp);
+	return res;
+}
+
+struct archive * archive_open(char * filename) {
+/* This function opens an archive file and loads its header and block index. No block is decoded yet. 
+It returns NULL if the file cannot be read, or if its header gives a block index that does not fit in it. */
+	FILE * fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return NULL;
+	char magic[4];
+	long long index_offset, header[2], num_blocks;
+	struct archive * arc = malloc(sizeof(struct archive));
+	if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, ARCHIVE_MAGIC, 4) != 0) {
+		fclose(fp);
+		free(arc);
+		return NULL;
+	}
+	header[0] = header[1] = num_blocks = index_offset = 0;
+	arc->block_size = 0;
+	fread(header, sizeof(long long), 2, fp);
+	fread(&arc->block_size, sizeof(int), 1, fp);
+	fread(&num_blocks, sizeof(long long), 1, fp);
+	fread(&index_offset, sizeof(long long), 1, fp);
+	fseek(fp, 0L, SEEK_END);
+	long long length = ftell(fp);
+	if (num_blocks < 1 || arc->block_size < 1 || index_offset < 0 || index_offset > length 
+		|| num_blocks >= (length - index_offset) / (2 * (long long)sizeof(long long))) {
+		fclose(fp);
+		free(arc);
+		return NULL;
+	}
+	arc->size = header[0];
+	arc->num_bins = header[1];
+	arc->num_blocks = num_blocks;
+
+	long long * bases = malloc((arc->num_blocks + 1) * sizeof(long long));
+	arc->offsets = malloc((arc->num_blocks + 1) * sizeof(long long));
+	arc->bases = malloc((arc->num_blocks + 1) * sizeof(pos_t));
+	fseek(fp, index_offset, SEEK_SET);
+	fread(arc->offsets, sizeof(long long), arc->num_blocks + 1, fp);
+	fread(bases, sizeof(long long), arc->num_blocks + 1, fp);
+	pos_t b;
+	for (b = 0; b <= arc->num_blocks; ++b)
+		arc->bases[b] = (pos_t)bases[b];
+	free(bases);
+
+	arc->fp = fp;
+	arc->cached_block = -1;
+	arc->cached_size = 0;
+	arc->starts = malloc((arc->block_size + 1) * sizeof(pos_t));
+	arc->lens = malloc((arc->block_size + 1) * sizeof(pos_t));
+	arc->mismatches = malloc((arc->block_size + 1) * sizeof(char));
+	mem_alloc(MEM_ARCHIVE_CACHE, (arc->num_blocks + 1) * (sizeof(long long) + sizeof(pos_t)) + MEM_PHRASE_BYTES(arc->block_size + 1));
+	return arc;
+}
+
+void archive_close(struct archive * arc) {
+	if (arc == NULL)
+		return;
+	fclose(arc->fp);
+	mem_release(MEM_ARCHIVE_CACHE, (arc->num_blocks + 1) * (sizeof(long long) + sizeof(pos_t)) + MEM_PHRASE_BYTES(arc->block_size + 1));
+	free(arc->offsets);
+	free(arc->bases);
+	free(arc->starts);
+	free(arc->lens);
+	free(arc->mismatches);
+	free(arc);
+}
+
+int archive_load_block(struct archive * arc, pos_t block) {
+/* This function decodes the -block- of the archive into the cached arrays (starts, lens, mismatches),
+which are indexed from 1 as in csb; lens[0] holds the source position where the block starts.
+It returns the number of phrases in the block. */
+	if (block == arc->cached_block)
+		return arc->cached_size;
+	size_t nbytes = arc->offsets[block + 1] - arc->offsets[block];
+	unsigned char * data = malloc(nbytes);
+	fseek(arc->fp, arc->offsets[block], SEEK_SET);
+	fread(data, 1, nbytes, arc->fp);
+
+	unsigned char * p = data;
+	size_t n_len, n_start, n_mism;
+	int n = (int)get_varint(&p);
+	unsigned char * len_stream = get_stream(&p, &n_len);
+	unsigned char * start_stream = get_stream(&p, &n_start);
+	unsigned char * mism_stream = get_stream(&p, &n_mism);
+
+	unsigned char * lp = len_stream, * sp = start_stream;
+	long long expected = 0;
+	int i;
+	arc->lens[0] = arc->bases[block];
+	for (i = 1; i <= n; ++i) {
+		pos_t len = (pos_t)get_varint(&lp);
+		arc->lens[i] = arc->lens[i - 1] + len;
+		arc->starts[i] = (pos_t)(expected + unzigzag(get_varint(&sp)));
+		expected = (long long)arc->starts[i] + len;
+	}
+	memcpy(&arc->mismatches[1], mism_stream, n);
+	free(len_stream);
+	free(start_stream);
+	free(mism_stream);
+	free(data);
+	arc->cached_block = block;
+	arc->cached_size = n;
+	return n;
+}
+
+static pos_t archive_find_block(struct archive * arc, pos_t i) {
+/* Binary search on the block index: returns the block whose source range contains position i. */
+	pos_t low = 0, high = arc->num_blocks - 1;
+	while (low < high) {
+		pos_t middle = (low + high + 1) / 2;
+		if (arc->bases[middle] <= i)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+static int block_phrase(struct archive * arc, int n, pos_t i) {
+/* Returns the phrase of the cached block (1..n) that contains source position i. */
+	int low = 1, high = n;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (arc->lens[middle] <= i)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+char archive_access(char * reference, struct archive * arc, pos_t i) {
+/* This function returns the character in position i of the original source stored in the archive, or '\0' if i is out of the source.
+Only the block that covers position i is decoded. */
+	if (i < 0 || i >= arc->bases[arc->num_blocks])
+		return '\0';
+	int n = archive_load_block(arc, archive_find_block(arc, i));
+	int phrase = block_phrase(arc, n, i);
+	pos_t char_index = i - arc->lens[phrase - 1];
+	return (i == arc->lens[phrase] - 1) ? arc->mismatches[phrase] : reference[arc->starts[phrase] + char_index];
+}
+
+char * archive_access_range(char * reference, struct archive * arc, pos_t i, pos_t len) {
+/* This function returns the characters in position [i, i+len) of the original source stored in the archive, cut at the end of the source.
+It returns an empty string if i is out of the source. Only the blocks that cover the range are decoded. */
+	pos_t count = 0;
+	if (i < 0 || i >= arc->bases[arc->num_blocks] || len < 0)
+		len = 0;
+	else if (len > arc->bases[arc->num_blocks] - i)
+		len = arc->bases[arc->num_blocks] - i;
+	char * res = malloc(len * sizeof(char) + 1);
+	pos_t block = archive_find_block(arc, i);
+	while (count < len) {
+		int n = archive_load_block(arc, block);
+		int phrase = block_phrase(arc, n, i + count);
+		for (; phrase <= n && count < len; ++phrase) {
+			pos_t pos = i + count;
+			pos_t end = arc->lens[phrase] - 1;
+			pos_t ref_pos = arc->starts[phrase] + pos - arc->lens[phrase - 1];
+			while (pos < end && count < len) {
+				res[count++] = reference[ref_pos++];
+				pos++;
+			}
+			if (count < len)
+				res[count++] = arc->mismatches[phrase];
+		}
+		block++;
+	}
+	res[len] = '\0';
+	return res;
+}
+
+csb * archive_to_csb(struct archive * arc) {
+/* This function decodes every block of the archive and returns the whole compressed source as a csb struct. */
+	struct trace_span span = trace_begin("decode archive");
+	csb * compressed_source = malloc(sizeof(csb));
+	pos_t *starts = malloc(arc->size * sizeof(pos_t));
+	pos_t *lens = malloc(arc->size * sizeof(pos_t));
+	char *mismatches = malloc(arc->size * sizeof(char));
+	mem_alloc(MEM_PHRASES, MEM_PHRASE_BYTES(arc->size));
+	starts[0] = 0;
+	lens[0] = 0;
+	mismatches[0] = 0;
+	pos_t b, phrase = 1;
+	for (b = 0; b < arc->num_blocks; ++b) {
+		int n = archive_load_block(arc, b);
+		memcpy(&starts[phrase], &arc->starts[1], n * sizeof(pos_t));
+		memcpy(&lens[phrase], &arc->lens[1], n * sizeof(pos_t));
+		memcpy(&mismatches[phrase], &arc->mismatches[1], n * sizeof(char));
+		phrase += n;
+	}
+	trace_end(span, arc->offsets[arc->num_blocks]);
+	compressed_source->starts = starts;
+	compressed_source->lens = create_bins(lens, arc->size, arc->num_bins);
+	compressed_source->size = arc->size;
+	compressed_source->mismatches = mismatches;
+	compressed_source->refs = NULL;
+	compressed_source->num_exceptions = 0;
+	compressed_source->exception_pos = NULL;
+	compressed_source->exception_chars = NULL;
+	compressed_source->exception_index = NULL;
+	compressed_source->strands = NULL;
+	return compressed_source;
+}
@@ -0,0 +1,27 @@
+#define ARCHIVE_MAGIC "ISRA"
+#define ARCHIVE_BLOCK_SIZE 4096
+struct archive {
+	FILE * fp;
+	pos_t size; // number of phrases, counting the leading 0 phrase as in csb
+	pos_t num_bins;
+	int block_size;
+	pos_t num_blocks;
+	long long * offsets; // file offset of each block, plus the end of the last one
+	pos_t * bases; // source position where each block starts, plus the source length
+
+	// last decoded block
+	pos_t cached_block;
+	int cached_size;
+	pos_t * starts;
+	pos_t * lens; // cumulative, lens[0] is the base of the block
+	char * mismatches;
+};
+
+void csb_to_archive(csb * compression, char * filename, int block_size);
+int is_archive(char * filename);
+struct archive * archive_open(char * filename);
+void archive_close(struct archive * arc);
+int archive_load_block(struct archive * arc, pos_t block);
+char archive_access(char * reference, struct archive * arc, pos_t i);
+char * archive_access_range(char * reference, struct archive * arc, pos_t i, pos_t len);
+csb * archive_to_csb(struct archive * arc);
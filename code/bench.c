@@ -0,0 +1,724 @@
+/*
+Bench module contains the 'bench' action, a benchmark harness for the whole pipeline.
+
+Unlike the older functions in measures.c, every phase is run with warmup repetitions first, the random query sets
+are generated from a fixed seed before any timing starts, each operation is timed on its own with a wall clock
+(CLOCK_MONOTONIC, with the timer overhead subtracted), and the latency distribution is reported with percentiles
+(p50/p90/p99/p999) and a log2 histogram. Results can be printed as text, JSON or CSV.
+The metadata includes the live bytes of every structure once the tree and the compressed source are built
+(see mem.c), the bytes per base and the peak RSS of the whole run.
+
+Phases:
+build       suffix tree construction of the reference (one operation per repetition)
+compress    compress_bins of the source (one operation per repetition)
+decompress  decompress_bins (one operation per repetition)
+archive     decoding every block of the archival format (one operation per repetition)
+predecessor     predecessor on random indices (the bins lookup of access_bins alone)
+find_substring  find_substring at random source positions (one phrase of the parse)
+access      access_bins on random indices
+range       access_bins_range on random ranges
+blocked         access_blocks on the same indices (the phrases interleaved in cache-line blocks, see blocks.c)
+blocked_range   access_blocks_range on the same ranges
+directory       directory_predecessor on the same indices (a sample every 2^k positions instead of the bins)
+directory_access    access_directory on the same indices
+
+With --perf 1, every phase is run once more without the per-operation timers (on a fresh query set for the
+query phases), wrapped with the hardware counters of perf.c, and the counts are reported per operation.
+
+Functions:
+bench_now_ns
+bench_timer_overhead
+bench_add_phase
+bench_add_meta
+bench_record
+bench_percentile
+bench_total_ns
+bench_print_report
+bench_free_report
+bench_main
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <sys/utsname.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "archive.h"
+#include "blocks.h"
+#include "cpu.h"
+#include "rng.h"
+#include "perf.h"
+#include "bench.h"
+#include "mem.h"
+
+static volatile char bench_sink; // keeps the compiler from dropping the measured calls
+
+uint64_t bench_now_ns() {
+/* Nanoseconds of the monotonic clock as an integer, so differences stay exact however long the machine has been up. */
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int compare_doubles(const void * a, const void * b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+double bench_timer_overhead() {
+/* Returns the median cost of reading the clock twice, which is subtracted from every timed operation. */
+	int i, n = 10001;
+	double * samples = malloc(n * sizeof(double));
+	for (i = 0; i < n; ++i) {
+		uint64_t t0 = bench_now_ns();
+		uint64_t t1 = bench_now_ns();
+		samples[i] = t1 - t0;
+	}
+	qsort(samples, n, sizeof(double), compare_doubles);
+	double res = samples[n / 2];
+	free(samples);
+	return res;
+}
+
+struct bench_phase * bench_add_phase(struct bench_report * report, char * name) {
+	struct bench_phase * phase = &report->phases[report->num_phases++];
+	memset(phase, 0, sizeof(struct bench_phase));
+	strncpy(phase->name, name, sizeof(phase->name) - 1);
+	return phase;
+}
+
+void bench_add_meta(struct bench_report * report, char * key, int numeric, char * fmt, ...) {
+	if (report->num_meta == BENCH_MAX_META)
+		return;
+	struct bench_meta * meta = &report->meta[report->num_meta++];
+	va_list args;
+	strncpy(meta->key, key, sizeof(meta->key) - 1);
+	meta->key[sizeof(meta->key) - 1] = '\0';
+	va_start(args, fmt);
+	vsnprintf(meta->value, sizeof(meta->value), fmt, args);
+	va_end(args);
+	meta->numeric = numeric;
+}
+
+void bench_record(struct bench_phase * phase, double ns) {
+	if (phase->num_samples == phase->capacity) {
+		phase->capacity = phase->capacity ? 2 * phase->capacity : 1024;
+		phase->samples = realloc(phase->samples, phase->capacity * sizeof(double));
+	}
+	phase->samples[phase->num_samples++] = (ns > 0) ? ns : 0;
+	phase->sorted = 0;
+}
+
+double bench_percentile(struct bench_phase * phase, double p) {
+/* Returns the p-th percentile (0 <= p <= 100) of the samples of the phase, using the nearest-rank method. */
+	if (phase->num_samples == 0)
+		return 0;
+	if (!phase->sorted) {
+		qsort(phase->samples, phase->num_samples, sizeof(double), compare_doubles);
+		phase->sorted = 1;
+	}
+	long rank = (long)ceil(p / 100.0 * phase->num_samples);
+	if (rank < 1)
+		rank = 1;
+	return phase->samples[rank - 1];
+}
+
+double bench_total_ns(struct bench_phase * phase) {
+	double total = 0;
+	long i;
+	for (i = 0; i < phase->num_samples; ++i)
+		total += phase->samples[i];
+	return total;
+}
+
+static void histogram(struct bench_phase * phase, long * buckets) {
+/* Bucket k counts the samples in [2^k, 2^(k+1)) nanoseconds; bucket 0 also takes everything below 1ns. */
+	long i;
+	memset(buckets, 0, BENCH_HIST_BUCKETS * sizeof(long));
+	for (i = 0; i < phase->num_samples; ++i) {
+		int k = (phase->samples[i] < 1) ? 0 : (int)log2(phase->samples[i]);
+		if (k >= BENCH_HIST_BUCKETS)
+			k = BENCH_HIST_BUCKETS - 1;
+		buckets[k]++;
+	}
+}
+
+static char * format_duration(char * buffer, double ns) {
+/* Writes 'ns' with a readable unit (ns, us, ms or s) into 'buffer', which must hold at least 16 chars. */
+	if (ns < 1e4)
+		snprintf(buffer, 16, "%.1fns", ns);
+	else if (ns < 1e7)
+		snprintf(buffer, 16, "%.1fus", ns / 1e3);
+	else if (ns < 1e10)
+		snprintf(buffer, 16, "%.1fms", ns / 1e6);
+	else
+		snprintf(buffer, 16, "%.2fs", ns / 1e9);
+	return buffer;
+}
+
+static void print_counter(FILE * fp, char * format, struct bench_phase * phase, int e, char * missing) {
+/* Prints counter e of the phase per operation, or 'missing' when it was not collected. */
+	if (phase->counted_ops == 0 || phase->counters[e] < 0)
+		fprintf(fp, "%s", missing);
+	else
+		fprintf(fp, format, phase->counters[e] / phase->counted_ops);
+}
+
+static void csv_string(FILE * fp, char * s) {
+/* A CSV field in quotes, with its quotes doubled (RFC 4180), so commas and quotes in names and paths do not shift the columns. */
+	fputc('"', fp);
+	for (; *s; ++s) {
+		if (*s == '"')
+			fputc('"', fp);
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void json_string(FILE * fp, char * s) {
+	fputc('"', fp);
+	for (; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', fp);
+		if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+void bench_print_report(FILE * fp, struct bench_report * report, char * format) {
+/* Prints the report as 'text' (a table), 'json' (metadata, statistics and histograms) or 'csv' (one row per phase). */
+	int p, m, k;
+	if (strcmp(format, "json") == 0) {
+		fprintf(fp, "{\n  \"meta\": {");
+		for (m = 0; m < report->num_meta; ++m) {
+			fprintf(fp, "%s\n    ", m ? "," : "");
+			json_string(fp, report->meta[m].key);
+			fprintf(fp, ": ");
+			if (report->meta[m].numeric)
+				fprintf(fp, "%s", report->meta[m].value);
+			else
+				json_string(fp, report->meta[m].value);
+		}
+		fprintf(fp, "\n  },\n  \"timer_overhead_ns\": %.2f,\n  \"phases\": [", report->timer_overhead_ns);
+		for (p = 0; p < report->num_phases; ++p) {
+			struct bench_phase * phase = &report->phases[p];
+			double total = bench_total_ns(phase);
+			long buckets[BENCH_HIST_BUCKETS];
+			histogram(phase, buckets);
+			fprintf(fp, "%s\n    {\"name\": ", p ? "," : "");
+			json_string(fp, phase->name);
+			fprintf(fp, ", \"ops\": %ld, \"total_s\": %.9f, \"mean_ns\": %.2f, \"min_ns\": %.2f, \"p50_ns\": %.2f, \"p90_ns\": %.2f, \"p99_ns\": %.2f, \"p999_ns\": %.2f, \"max_ns\": %.2f, \"ops_per_s\": %.2f, \"mb_per_s\": %.3f,\n     \"histogram\": [",
+				phase->num_samples, total / 1e9, phase->num_samples ? total / phase->num_samples : 0,
+				bench_percentile(phase, 0), bench_percentile(phase, 50), bench_percentile(phase, 90), bench_percentile(phase, 99), bench_percentile(phase, 99.9), bench_percentile(phase, 100),
+				total > 0 ? phase->num_samples / (total / 1e9) : 0, total > 0 ? phase->bytes / (total / 1e9) / 1e6 : 0);
+			int first = 1;
+			for (k = 0; k < BENCH_HIST_BUCKETS; ++k) {
+				if (buckets[k]) {
+					fprintf(fp, "%s{\"lt_ns\": %.0f, \"count\": %ld}", first ? "" : ", ", pow(2, k + 1), buckets[k]);
+					first = 0;
+				}
+			}
+			fprintf(fp, "]");
+			if (phase->counted_ops) {
+				fprintf(fp, ",\n     \"counters_per_op\": {");
+				for (k = 0; k < PERF_NUM; ++k) {
+					fprintf(fp, "%s\"%s\": ", k ? ", " : "", perf_event_names[k]);
+					print_counter(fp, "%.3f", phase, k, "null");
+				}
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "\n  ]\n}\n");
+	}
+	else if (strcmp(format, "csv") == 0) {
+		for (m = 0; m < report->num_meta; ++m) {
+			csv_string(fp, report->meta[m].key);
+			fputc(',', fp);
+		}
+		fprintf(fp, "phase,ops,total_s,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,ops_per_s,mb_per_s");
+		for (k = 0; k < PERF_NUM; ++k)
+			fprintf(fp, ",%s_per_op", perf_event_names[k]);
+		fprintf(fp, "\n");
+		for (p = 0; p < report->num_phases; ++p) {
+			struct bench_phase * phase = &report->phases[p];
+			double total = bench_total_ns(phase);
+			for (m = 0; m < report->num_meta; ++m) {
+				csv_string(fp, report->meta[m].value);
+				fputc(',', fp);
+			}
+			csv_string(fp, phase->name);
+			fprintf(fp, ",%ld,%.9f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.3f", phase->num_samples, total / 1e9,
+				phase->num_samples ? total / phase->num_samples : 0,
+				bench_percentile(phase, 0), bench_percentile(phase, 50), bench_percentile(phase, 90), bench_percentile(phase, 99), bench_percentile(phase, 99.9), bench_percentile(phase, 100),
+				total > 0 ? phase->num_samples / (total / 1e9) : 0, total > 0 ? phase->bytes / (total / 1e9) / 1e6 : 0);
+			for (k = 0; k < PERF_NUM; ++k) {
+				fprintf(fp, ",");
+				print_counter(fp, "%.3f", phase, k, "");
+			}
+			fprintf(fp, "\n");
+		}
+	}
+	else {
+		for (m = 0; m < report->num_meta; ++m)
+			fprintf(fp, "%-16s %s\n", report->meta[m].key, report->meta[m].value);
+		fprintf(fp, "timer overhead   %.1fns (subtracted)\n\n", report->timer_overhead_ns);
+		// the phase column fits the longest name
+		int width = strlen("phase");
+		for (p = 0; p < report->num_phases; ++p)
+			if ((int)strlen(report->phases[p].name) > width)
+				width = strlen(report->phases[p].name);
+		fprintf(fp, "%-*s %10s %10s %10s %10s %10s %10s %10s %10s\n", width, "phase", "ops", "mean", "p50", "p90", "p99", "p999", "max", "MB/s");
+		for (p = 0; p < report->num_phases; ++p) {
+			struct bench_phase * phase = &report->phases[p];
+			double total = bench_total_ns(phase);
+			char d[6][16];
+			fprintf(fp, "%-*s %10ld %10s %10s %10s %10s %10s %10s %10.2f\n", width, phase->name, phase->num_samples,
+				format_duration(d[0], phase->num_samples ? total / phase->num_samples : 0),
+				format_duration(d[1], bench_percentile(phase, 50)), format_duration(d[2], bench_percentile(phase, 90)), format_duration(d[3], bench_percentile(phase, 99)),
+				format_duration(d[4], bench_percentile(phase, 99.9)), format_duration(d[5], bench_percentile(phase, 100)),
+				total > 0 ? phase->bytes / (total / 1e9) / 1e6 : 0);
+		}
+		int counted = 0;
+		for (p = 0; p < report->num_phases; ++p)
+			counted |= report->phases[p].counted_ops != 0;
+		if (counted) {
+			fprintf(fp, "\nhardware events per operation (n/a: counter not available or never scheduled)\n%-*s", width, "phase");
+			for (k = 0; k < PERF_NUM; ++k)
+				fprintf(fp, " %14s", perf_event_names[k]);
+			fprintf(fp, " %8s\n", "IPC");
+			for (p = 0; p < report->num_phases; ++p) {
+				struct bench_phase * phase = &report->phases[p];
+				if (phase->counted_ops == 0)
+					continue;
+				fprintf(fp, "%-*s", width, phase->name);
+				for (k = 0; k < PERF_NUM; ++k)
+					print_counter(fp, " %14.2f", phase, k, "            n/a");
+				if (phase->counters[PERF_CYCLES] > 0 && phase->counters[PERF_INSTRUCTIONS] >= 0)
+					fprintf(fp, " %8.2f\n", phase->counters[PERF_INSTRUCTIONS] / phase->counters[PERF_CYCLES]);
+				else
+					fprintf(fp, " %8s\n", "n/a");
+			}
+		}
+	}
+}
+
+void bench_free_report(struct bench_report * report) {
+	int p;
+	for (p = 0; p < report->num_phases; ++p)
+		free(report->phases[p].samples);
+	report->num_phases = 0;
+}
+
+// ----------------------------------------------------
+// Measured operations
+
+struct bench_ctx {
+	char * reference;
+	char * source;
+	SuffixTree * tree;
+	csb * compressed;
+	int bin_factor;
+	struct parse_options parse;
+	pos_t range_len;
+	char * archive_filename;
+	struct phrase_blocks * blocks; // the same phrases in the layout of blocks.c
+	struct directory * directory; // over the lens of compressed, see create_directory
+};
+
+typedef void (*bench_op)(struct bench_ctx * ctx, pos_t arg); // arg is the query (a source position or key), which the whole-input phases ignore
+
+static void op_build(struct bench_ctx * ctx, pos_t arg) {
+	(void)arg;
+	SuffixTree * tree = buildSuffixTree(ctx->reference, treeThreads);
+	bench_sink ^= (char)tree->root->suffixIndex;
+	freeSuffixTree(tree);
+}
+
+static void op_compress(struct bench_ctx * ctx, pos_t arg) {
+	(void)arg;
+	csb * compressed = compress_bins_ext(ctx->tree, ctx->reference, ctx->source, ctx->bin_factor, &ctx->parse);
+	bench_sink ^= (char)compressed->size;
+	free_csb(compressed);
+}
+
+static void op_decompress(struct bench_ctx * ctx, pos_t arg) {
+	(void)arg;
+	char * source = decompress_bins(ctx->reference, ctx->compressed);
+	bench_sink ^= source[0];
+	free(source);
+}
+
+static void op_archive(struct bench_ctx * ctx, pos_t arg) {
+	(void)arg;
+	struct archive * arc = archive_open(ctx->archive_filename);
+	pos_t b;
+	for (b = 0; b < arc->num_blocks; ++b)
+		bench_sink ^= (char)archive_load_block(arc, b);
+	archive_close(arc);
+}
+
+static void op_predecessor(struct bench_ctx * ctx, pos_t i) {
+	bench_sink ^= (char)predecessor(ctx->compressed->lens, i, ctx->compressed->size);
+}
+
+static void op_directory(struct bench_ctx * ctx, pos_t i) {
+	bench_sink ^= (char)directory_predecessor(ctx->directory, i, ctx->compressed->size);
+}
+
+static void op_directory_access(struct bench_ctx * ctx, pos_t i) {
+	bench_sink ^= access_directory(ctx->reference, ctx->compressed, ctx->directory, i);
+}
+
+static void op_find_substring(struct bench_ctx * ctx, pos_t i) {
+	pos_t tuple[2];
+	bench_sink ^= find_substring(ctx->tree, ctx->reference, &ctx->source[i], tuple);
+}
+
+static void op_access(struct bench_ctx * ctx, pos_t i) {
+	bench_sink ^= access_bins(ctx->reference, ctx->compressed, i);
+}
+
+static void op_range(struct bench_ctx * ctx, pos_t i) {
+	char * res = access_bins_range(ctx->reference, ctx->compressed, i, ctx->range_len);
+	bench_sink ^= res[0];
+	free(res);
+}
+
+static void op_blocked(struct bench_ctx * ctx, pos_t i) {
+	bench_sink ^= access_blocks(ctx->reference, ctx->blocks, i);
+}
+
+static void op_blocked_range(struct bench_ctx * ctx, pos_t i) {
+	char * res = access_blocks_range(ctx->reference, ctx->blocks, i, ctx->range_len);
+	bench_sink ^= res[0];
+	free(res);
+}
+
+static void run_whole(struct bench_phase * phase, struct bench_options * opt, struct bench_ctx * ctx, bench_op op, double bytes, double overhead, struct perf_counters * pc) {
+/* Runs 'op' once per repetition, each run being one sample. With counters, one more run is counted. */
+	int rep;
+	for (rep = 0; rep < opt->warmup + opt->reps; ++rep) {
+		uint64_t t0 = bench_now_ns();
+		op(ctx, 0);
+		uint64_t t1 = bench_now_ns();
+		if (rep >= opt->warmup) {
+			bench_record(phase, (double)(t1 - t0) - overhead);
+			phase->bytes += bytes;
+		}
+	}
+	if (pc != NULL) {
+		perf_start(pc);
+		op(ctx, 0);
+		perf_stop(pc, phase->counters);
+		phase->counted_ops = 1;
+	}
+}
+
+static void run_queries(struct bench_phase * phase, struct bench_options * opt, struct bench_ctx * ctx, bench_op op, pos_t * queries, long n, double bytes, double overhead, struct perf_counters * pc) {
+/* Runs 'op' on every query of the pre-generated set; repetition 'rep' uses queries[rep * n .. (rep + 1) * n),
+so no index is queried twice in a row and the cache is not warmed artificially.
+With counters, the set after the last repetition is run once more, untimed, between perf_start and perf_stop. */
+	int rep;
+	long q;
+	for (rep = 0; rep < opt->warmup + opt->reps; ++rep) {
+		pos_t * set = &queries[(long)rep * n];
+		for (q = 0; q < n; ++q) {
+			uint64_t t0 = bench_now_ns();
+			op(ctx, set[q]);
+			uint64_t t1 = bench_now_ns();
+			if (rep >= opt->warmup) {
+				bench_record(phase, (double)(t1 - t0) - overhead);
+				phase->bytes += bytes;
+			}
+		}
+	}
+	if (pc != NULL && n > 0) {
+		pos_t * set = &queries[(long)(opt->warmup + opt->reps) * n];
+		perf_start(pc);
+		for (q = 0; q < n; ++q)
+			op(ctx, set[q]);
+		perf_stop(pc, phase->counters);
+		phase->counted_ops = n;
+	}
+}
+
+static int phase_enabled(struct bench_options * opt, char * name) {
+	size_t len = strlen(name);
+	char * p = opt->phases;
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == opt->phases || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+static void add_machine_meta(struct bench_report * report) {
+	struct utsname uts;
+	char line[256], cpu[128] = "unknown";
+	FILE * fp = fopen("/proc/cpuinfo", "r");
+	if (fp != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			char * colon = strchr(line, ':');
+			if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+				snprintf(cpu, sizeof(cpu), "%s", colon + 2);
+				cpu[strcspn(cpu, "\n")] = '\0';
+				break;
+			}
+		}
+		fclose(fp);
+	}
+	if (uname(&uts) == 0) {
+		bench_add_meta(report, "host", 0, "%s", uts.nodename);
+		bench_add_meta(report, "machine", 0, "%s %s", uts.sysname, uts.machine);
+	}
+	bench_add_meta(report, "cpu", 0, "%s", cpu);
+	bench_add_meta(report, "cpu_level", 0, "%s", cpu_level_name(cpu_level()));
+#ifdef __VERSION__
+	bench_add_meta(report, "compiler", 0, "%s", __VERSION__);
+#endif
+	bench_add_meta(report, "pos_bits", 1, "%d", (int)(8 * sizeof(pos_t)));
+	bench_add_meta(report, "timestamp", 1, "%lld", (long long)time(NULL));
+}
+
+static void add_memory_meta(struct bench_report * report, pos_t reference_len, pos_t source_len) {
+/* Adds the live bytes of every structure counted by mem.c, and the bytes per reference and source base. */
+	int c;
+	char key[32];
+	for (c = 0; c < MEM_NUM; ++c) {
+		snprintf(key, sizeof(key), "mem_%s", mem_category_names[c]);
+		bench_add_meta(report, key, 1, "%lld", mem_counters[c].bytes);
+	}
+	bench_add_meta(report, "tree_bytes_per_base", 1, "%.2f", (double)(mem_counters[MEM_TREE_NODES].bytes + mem_counters[MEM_TREE_ENDS].bytes) / reference_len);
+	bench_add_meta(report, "csb_bytes_per_base", 1, "%.4f", (double)(mem_counters[MEM_PHRASES].bytes + mem_counters[MEM_BINS].bytes) / source_len);
+}
+
+static void usage() {
+	printf("BENCH command-line input: \n [reference filename] [source filename] (optional flags) \n");
+	printf("  --bin-factor N   bin factor used to compress (default 1) \n");
+	printf("  --snp-run K      keep substitutions followed by K matching bases inside phrases, as exceptions (default 0, off) \n");
+	printf("  --rc 1           also match phrases against the reverse complement of the reference \n");
+	printf("  --queries N      random indices per repetition (default 100000) \n");
+	printf("  --ranges N       random ranges per repetition (default 10000) \n");
+	printf("  --range-len L    length of the random ranges (default 100) \n");
+	printf("  --reps N         measured repetitions of every phase (default 5) \n");
+	printf("  --warmup N       repetitions run before measuring (default 1) \n");
+	printf("  --seed S         seed of the query sets (default 42) \n");
+	printf("  --phases LIST    comma separated subset of build,compress,decompress,archive,predecessor,find_substring,access,range,\n                   blocked,blocked_range,directory,directory_access (default all) \n");
+	printf("  --dir-k K        windows of 2^K positions in the directory phases (default about one sample per phrase) \n");
+	printf("  --perf 1         also count hardware events (cycles, instructions, cache, branch and dTLB misses) per operation \n");
+	printf("  --format F       text, json or csv (default text) \n");
+	printf("  --out FILE       write the report to FILE instead of the standard output \n");
+}
+
+int bench_main(int argc, char * argv[]) {
+/* Entry point of the 'bench' action. argv[0] is the reference filename, argv[1] the source filename and the rest are flags. */
+	struct bench_options opt = { 1, 100000, 10000, 100, 5, 1, 42, "text", NULL, "build,compress,decompress,archive,predecessor,find_substring,access,range,blocked,blocked_range,directory,directory_access", 0, 0, 0, -1 };
+	int a;
+	if (argc < 2) {
+		usage();
+		return 1;
+	}
+	for (a = 2; a < argc; a += 2) {
+		if (a + 1 >= argc) {
+			printf("Missing value for %s \n", argv[a]);
+			return 1;
+		}
+		if (strcmp(argv[a], "--bin-factor") == 0)
+			opt.bin_factor = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--snp-run") == 0)
+			opt.snp_run = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--rc") == 0)
+			opt.reverse_complement = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--queries") == 0)
+			opt.queries = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--ranges") == 0)
+			opt.ranges = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--range-len") == 0)
+			opt.range_len = atoll(argv[a + 1]);
+		else if (strcmp(argv[a], "--reps") == 0)
+			opt.reps = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--warmup") == 0)
+			opt.warmup = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--seed") == 0)
+			opt.seed = strtoull(argv[a + 1], NULL, 10);
+		else if (strcmp(argv[a], "--phases") == 0)
+			opt.phases = argv[a + 1];
+		else if (strcmp(argv[a], "--format") == 0)
+			opt.format = argv[a + 1];
+		else if (strcmp(argv[a], "--out") == 0)
+			opt.output = argv[a + 1];
+		else if (strcmp(argv[a], "--perf") == 0)
+			opt.perf = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--dir-k") == 0)
+			opt.dir_k = atoi(argv[a + 1]);
+		else {
+			printf("Unknown flag %s \n", argv[a]);
+			usage();
+			return 1;
+		}
+	}
+	if (opt.bin_factor < 1 || opt.snp_run < 0 || opt.reps < 1 || opt.warmup < 0 || opt.queries < 0 || opt.ranges < 0 || opt.range_len < 1 || opt.dir_k < -1 || opt.dir_k > DIRECTORY_MAX_K) {
+		printf("Incorrect command. Numeric flags must be positive \n");
+		return 1;
+	}
+	if (strcmp(opt.format, "text") != 0 && strcmp(opt.format, "json") != 0 && strcmp(opt.format, "csv") != 0) {
+		printf("Error. Unknown format %s, it must be text, json or csv \n", opt.format);
+		return 1;
+	}
+
+	struct bench_ctx ctx;
+	struct bench_report report;
+	memset(&report, 0, sizeof(report));
+	struct ref_table * refs;
+	ctx.reference = load_references(argv[0], &refs);
+	ctx.source = load_file(argv[1], 0);
+	if (ctx.reference == NULL || ctx.source == NULL) {
+		printf("Error. Cannot read %s \n", ctx.reference == NULL ? argv[0] : argv[1]);
+		return 1;
+	}
+	ctx.bin_factor = opt.bin_factor;
+	ctx.parse.snp_run = opt.snp_run;
+	ctx.parse.reverse_complement = opt.reverse_complement;
+	ctx.range_len = opt.range_len;
+	pos_t reference_len = strlen(ctx.reference);
+	pos_t source_len = strlen(ctx.source);
+	if (opt.range_len >= source_len)
+		ctx.range_len = opt.range_len = source_len - 1;
+
+	// the structures every phase reads are built once, outside of the measurements
+	ctx.tree = buildSuffixTree(ctx.reference, treeThreads);
+	ctx.compressed = compress_bins_ext(ctx.tree, ctx.reference, ctx.source, opt.bin_factor, &ctx.parse);
+	if (ctx.compressed == NULL) {
+		printf("Error. %s has a character that is not in the reference \n", argv[1]);
+		return 1;
+	}
+	ctx.compressed->refs = refs;
+
+	// all the query sets are generated before timing anything, with one more set for the counting pass
+	struct rng rng;
+	long i, total_queries = (long)(opt.warmup + opt.reps + 1) * opt.queries, total_ranges = (long)(opt.warmup + opt.reps + 1) * opt.ranges;
+	pos_t * queries = malloc((total_queries + 1) * sizeof(pos_t));
+	pos_t * ranges = malloc((total_ranges + 1) * sizeof(pos_t));
+	rng_seed(&rng, opt.seed);
+	for (i = 0; i < total_queries; ++i)
+		queries[i] = rng_below(&rng, source_len);
+	for (i = 0; i < total_ranges; ++i)
+		ranges[i] = rng_below(&rng, source_len - opt.range_len);
+
+	report.timer_overhead_ns = bench_timer_overhead();
+	add_machine_meta(&report);
+	bench_add_meta(&report, "reference", 0, "%s", argv[0]);
+	bench_add_meta(&report, "source", 0, "%s", argv[1]);
+	bench_add_meta(&report, "reference_len", 1, "%lld", (long long)reference_len);
+	bench_add_meta(&report, "source_len", 1, "%lld", (long long)source_len);
+	bench_add_meta(&report, "phrases", 1, "%lld", (long long)ctx.compressed->size);
+	bench_add_meta(&report, "bins", 1, "%lld", (long long)ctx.compressed->lens->size);
+	bench_add_meta(&report, "bin_factor", 1, "%d", opt.bin_factor);
+	bench_add_meta(&report, "snp_run", 1, "%d", opt.snp_run);
+	bench_add_meta(&report, "reverse_complement", 1, "%d", opt.reverse_complement);
+	bench_add_meta(&report, "exceptions", 1, "%lld", (long long)ctx.compressed->num_exceptions);
+	bench_add_meta(&report, "reps", 1, "%d", opt.reps);
+	bench_add_meta(&report, "warmup", 1, "%d", opt.warmup);
+	bench_add_meta(&report, "seed", 1, "%llu", opt.seed);
+	bench_add_meta(&report, "range_len", 1, "%lld", (long long)opt.range_len);
+	add_memory_meta(&report, reference_len, source_len);
+
+	struct perf_counters counters, * pc = NULL;
+	if (opt.perf) {
+		if (perf_open(&counters) > 0)
+			pc = &counters;
+		else
+			fprintf(stderr, "Hardware counters are not available (no PMU, or perf_event_paranoid too high), continuing without them \n");
+		bench_add_meta(&report, "perf_counters", 1, "%d", counters.num_available);
+	}
+
+	double overhead = report.timer_overhead_ns;
+	if (phase_enabled(&opt, "build"))
+		run_whole(bench_add_phase(&report, "build"), &opt, &ctx, op_build, reference_len, overhead, pc);
+	if (phase_enabled(&opt, "compress"))
+		run_whole(bench_add_phase(&report, "compress"), &opt, &ctx, op_compress, source_len, overhead, pc);
+	if (phase_enabled(&opt, "decompress"))
+		run_whole(bench_add_phase(&report, "decompress"), &opt, &ctx, op_decompress, source_len, overhead, pc);
+	if (phase_enabled(&opt, "archive")) {
+		char archive_filename[] = "/tmp/isrlz_archive_XXXXXX";
+		int fd = mkstemp(archive_filename);
+		if (fd != -1) {
+			fclose(fdopen(fd, "w"));
+			csb_to_archive(ctx.compressed, archive_filename, ARCHIVE_BLOCK_SIZE);
+			ctx.archive_filename = archive_filename;
+			run_whole(bench_add_phase(&report, "archive"), &opt, &ctx, op_archive, source_len, overhead, pc);
+			remove(archive_filename);
+		}
+	}
+	if (phase_enabled(&opt, "predecessor"))
+		run_queries(bench_add_phase(&report, "predecessor"), &opt, &ctx, op_predecessor, queries, opt.queries, 0, overhead, pc);
+	if (phase_enabled(&opt, "find_substring"))
+		run_queries(bench_add_phase(&report, "find_substring"), &opt, &ctx, op_find_substring, queries, opt.queries, 0, overhead, pc);
+	if (phase_enabled(&opt, "access"))
+		run_queries(bench_add_phase(&report, "access"), &opt, &ctx, op_access, queries, opt.queries, 1, overhead, pc);
+	if (phase_enabled(&opt, "range"))
+		run_queries(bench_add_phase(&report, "range"), &opt, &ctx, op_range, ranges, opt.ranges, opt.range_len, overhead, pc);
+	if (phase_enabled(&opt, "blocked") || phase_enabled(&opt, "blocked_range")) {
+		ctx.blocks = build_phrase_blocks(ctx.compressed, opt.bin_factor);
+		if (ctx.blocks == NULL)
+			fprintf(stderr, "The phrases do not fit in phrase blocks (a block spans 2^32 positions or more), skipping the blocked phases \n");
+		else {
+			bench_add_meta(&report, "phrase_block_bytes", 1, "%lld", (long long)ctx.blocks->num_blocks * PHRASE_BLOCK_BYTES);
+			if (phase_enabled(&opt, "blocked"))
+				run_queries(bench_add_phase(&report, "blocked"), &opt, &ctx, op_blocked, queries, opt.queries, 1, overhead, pc);
+			if (phase_enabled(&opt, "blocked_range"))
+				run_queries(bench_add_phase(&report, "blocked_range"), &opt, &ctx, op_blocked_range, ranges, opt.ranges, opt.range_len, overhead, pc);
+			free_phrase_blocks(ctx.blocks);
+		}
+	}
+	if (phase_enabled(&opt, "directory") || phase_enabled(&opt, "directory_access")) {
+		pos_t * lens = ctx.compressed->lens->arr;
+		int k = (opt.dir_k >= 0) ? opt.dir_k : directory_k(lens, ctx.compressed->size);
+		ctx.directory = create_directory(lens, ctx.compressed->size, k);
+		bench_add_meta(&report, "directory_k", 1, "%d", k);
+		bench_add_meta(&report, "directory_bytes", 1, "%lld", MEM_DIRECTORY_BYTES(ctx.directory->num));
+		bench_add_meta(&report, "largest_window", 1, "%lld", (long long)largest_window(ctx.directory));
+		bench_add_meta(&report, "largest_bin", 1, "%lld", (long long)largest_bin(ctx.compressed->lens, ctx.compressed->size));
+		if (phase_enabled(&opt, "directory"))
+			run_queries(bench_add_phase(&report, "directory"), &opt, &ctx, op_directory, queries, opt.queries, 0, overhead, pc);
+		if (phase_enabled(&opt, "directory_access"))
+			run_queries(bench_add_phase(&report, "directory_access"), &opt, &ctx, op_directory_access, queries, opt.queries, 1, overhead, pc);
+		free_directory(ctx.directory);
+	}
+	if (pc != NULL)
+		perf_close(pc);
+
+	bench_add_meta(&report, "peak_rss", 1, "%lld", mem_peak_rss());
+	FILE * out = stdout;
+	if (opt.output != NULL && (out = fopen(opt.output, "w")) == NULL) {
+		printf("Error. Cannot open %s for writing\n", opt.output);
+		out = stdout;
+	}
+	bench_print_report(out, &report, opt.format);
+	if (out != stdout)
+		fclose(out);
+
+	bench_free_report(&report);
+	free(queries);
+	free(ranges);
+	free_csb(ctx.compressed);
+	freeSuffixTree(ctx.tree);
+	unload_file(ctx.reference, 1);
+	unload_file(ctx.source, 0);
+	return 0;
+}
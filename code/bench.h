@@ -0,0 +1,56 @@
+#define BENCH_MAX_PHASES 16
+#define BENCH_HIST_BUCKETS 48
+#define BENCH_MAX_META 48
+
+struct bench_options {
+	int bin_factor;
+	long queries; // point queries per repetition
+	long ranges; // range queries per repetition
+	pos_t range_len;
+	int reps;
+	int warmup; // repetitions run before measuring, not reported
+	unsigned long long seed;
+	char * format; // text, json or csv
+	char * output; // NULL for stdout
+	char * phases; // comma separated list of phases to run
+	int perf; // count hardware events around every phase, see perf.c
+	int snp_run; // tolerant parse, see compress_bins_ext (0 disables it)
+	int reverse_complement; // also search the reverse strand, see find_reverse in rlz.c
+	int dir_k; // windows of 2^dir_k positions in the directory phases, -1 for directory_k
+};
+
+struct bench_phase {
+	char name[32];
+	double * samples; // nanoseconds per operation, timer overhead already subtracted
+	long num_samples;
+	long capacity;
+	double bytes; // bytes processed by the measured operations, for throughput
+	int sorted;
+	double counters[PERF_NUM]; // hardware events of the counting pass, -1 when unavailable
+	long counted_ops; // operations in the counting pass, 0 when counters were not collected
+};
+
+struct bench_meta {
+	char key[32];
+	char value[128];
+	int numeric; // printed without quotes in JSON
+};
+
+struct bench_report {
+	struct bench_phase phases[BENCH_MAX_PHASES];
+	int num_phases;
+	struct bench_meta meta[BENCH_MAX_META]; // parameters, inputs and machine, so runs can be compared
+	int num_meta;
+	double timer_overhead_ns;
+};
+
+uint64_t bench_now_ns();
+double bench_timer_overhead();
+struct bench_phase * bench_add_phase(struct bench_report * report, char * name);
+void bench_add_meta(struct bench_report * report, char * key, int numeric, char * fmt, ...);
+void bench_record(struct bench_phase * phase, double ns);
+double bench_percentile(struct bench_phase * phase, double p);
+double bench_total_ns(struct bench_phase * phase);
+void bench_print_report(FILE * fp, struct bench_report * report, char * format);
+void bench_free_report(struct bench_report * report);
+int bench_main(int argc, char * argv[]);
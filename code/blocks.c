@@ -0,0 +1,342 @@
+/*
+Blocks module stores the phrases of a compressed source interleaved, in blocks of one cache line each.
+
+The csb struct keeps the cumulative lengths, the reference starts, the mismatches and the strand bits in separate arrays,
+so access_bins reads a line of each of them, besides the bins and the reference. A phrase block holds the ends of
+PHRASE_BLOCK_PHRASES consecutive phrases (relative to the first position of the block, in 32 bits), their starts,
+mismatches and strand bits in 64 bytes. The bins are built over the first position of every block, and the binary
+search inside a bin probes the blocks themselves, so its last probe already holds everything the query needs.
+The same blocks are written to disk as they are in memory, so file_to_phrase_blocks reads them without decoding.
+Exceptions of the tolerant parse are kept aside, as in the csb struct.
+
+Functions:
+build_phrase_blocks
+free_phrase_blocks
+access_blocks
+access_blocks_range
+phrase_blocks_to_file
+file_to_phrase_blocks
+is_phrase_blocks
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "blocks.h"
+#include "mem.h"
+#include "trace.h"
+
+static struct phrase_block * alloc_blocks(pos_t num_blocks) {
+	void * blocks = NULL;
+	if (posix_memalign(&blocks, PHRASE_BLOCK_BYTES, num_blocks * sizeof(struct phrase_block)) != 0)
+		return NULL;
+	mem_alloc(MEM_PHRASES, num_blocks * sizeof(struct phrase_block));
+	return blocks;
+}
+
+static void index_block_exceptions(struct phrase_blocks * pb) {
+/* Sets exception_index, the first exception of every phrase (size + 1 entries), from the ends of the phrases. */
+	pos_t p, e = 0;
+	if (pb->num_exceptions == 0) {
+		pb->exception_index = NULL;
+		return;
+	}
+	pb->exception_index = malloc((pb->size + 1) * sizeof(pos_t));
+	pb->exception_index[0] = 0;
+	for (p = 1; p < pb->size; ++p) {
+		struct phrase_block * block = &pb->blocks[(p - 1) / PHRASE_BLOCK_PHRASES];
+		pb->exception_index[p] = e;
+		while (e < pb->num_exceptions && pb->exception_pos[e] < block->base + block->ends[(p - 1) % PHRASE_BLOCK_PHRASES])
+			e++;
+	}
+	pb->exception_index[pb->size] = pb->num_exceptions;
+}
+
+static struct bins * create_block_bins(struct phrase_blocks * pb, int bin_factor) {
+/* The bins only keep their starts: the keys are the first positions of the blocks, read from the blocks themselves. */
+	pos_t * keys = malloc(pb->num_blocks * sizeof(pos_t)), b;
+	for (b = 0; b < pb->num_blocks; ++b)
+		keys[b] = pb->blocks[b].base;
+	struct bins * bins = create_bins(keys, pb->num_blocks, ceil((double)pb->num_blocks / bin_factor));
+	bins->arr = NULL;
+	free(keys);
+	return bins;
+}
+
+struct phrase_blocks * build_phrase_blocks(csb * comp_source, int bin_factor) {
+/* This function returns the phrases of comp_source in phrase blocks, with one bin every -bin_factor- blocks.
+It returns NULL if the phrases of a block span 2^32 source positions or more, which 32-bit ends cannot hold. */
+	struct trace_span span = trace_begin("build phrase blocks");
+	pos_t * lens = comp_source->lens->arr, p, b;
+	pos_t num_blocks = (comp_source->size - 1 + PHRASE_BLOCK_PHRASES - 1) / PHRASE_BLOCK_PHRASES;
+	if (num_blocks == 0)
+		num_blocks = 1;
+	for (b = 0; b < num_blocks; ++b) {
+		pos_t last = (b + 1) * PHRASE_BLOCK_PHRASES;
+		if (last > comp_source->size - 1)
+			last = comp_source->size - 1;
+		if (lens[last] - lens[b * PHRASE_BLOCK_PHRASES] > 0xFFFFFFFFLL) {
+			trace_end(span, 0);
+			return NULL;
+		}
+	}
+	struct phrase_blocks * pb = malloc(sizeof(struct phrase_blocks));
+	pb->blocks = alloc_blocks(num_blocks);
+	memset(pb->blocks, 0, num_blocks * sizeof(struct phrase_block));
+	pb->num_blocks = num_blocks;
+	pb->size = comp_source->size;
+	pb->length = lens[comp_source->size - 1];
+	for (b = 0; b < num_blocks; ++b) {
+		struct phrase_block * block = &pb->blocks[b];
+		int j;
+		block->base = lens[b * PHRASE_BLOCK_PHRASES];
+		for (j = 0; j < PHRASE_BLOCK_PHRASES; ++j) {
+			p = b * PHRASE_BLOCK_PHRASES + j + 1;
+			if (p >= comp_source->size) {
+				block->ends[j] = 0xFFFFFFFFu; // stops the scan of access_blocks on the last block
+				continue;
+			}
+			block->ends[j] = lens[p] - block->base;
+			block->starts[j] = comp_source->starts[p];
+			block->mismatches[j] = comp_source->mismatches[p];
+			if (PHRASE_IS_REVERSE(comp_source, p))
+				block->strands |= 1 << j;
+			block->count++;
+		}
+	}
+	pb->num_exceptions = comp_source->num_exceptions;
+	pb->exception_pos = malloc(pb->num_exceptions * sizeof(pos_t));
+	pb->exception_chars = malloc(pb->num_exceptions * sizeof(char));
+	memcpy(pb->exception_pos, comp_source->exception_pos, pb->num_exceptions * sizeof(pos_t));
+	memcpy(pb->exception_chars, comp_source->exception_chars, pb->num_exceptions * sizeof(char));
+	mem_alloc(MEM_PHRASES, MEM_EXCEPTION_BYTES(pb->num_exceptions));
+	index_block_exceptions(pb);
+	pb->bins = create_block_bins(pb, bin_factor);
+	trace_end(span, num_blocks * sizeof(struct phrase_block));
+	return pb;
+}
+
+void free_phrase_blocks(struct phrase_blocks * pb) {
+	if (pb == NULL)
+		return;
+	mem_release(MEM_PHRASES, pb->num_blocks * sizeof(struct phrase_block));
+	mem_release(MEM_PHRASES, MEM_EXCEPTION_BYTES(pb->num_exceptions));
+	mem_release(MEM_BINS, MEM_BINS_BYTES(pb->bins->size));
+	free(pb->blocks);
+	free(pb->exception_pos);
+	free(pb->exception_chars);
+	free(pb->exception_index);
+	free(pb->bins->starts);
+	free(pb->bins);
+	free(pb);
+}
+
+static pos_t block_predecessor(struct phrase_blocks * pb, pos_t i) {
+/* Returns the last block whose first position is not above i. The bin of i is found by interpolation, as in predecessor,
+and it is binary searched on the blocks. */
+	struct bins * bins = pb->bins;
+	if (i >= bins->last_key)
+		return pb->num_blocks - 1;
+	pos_t index = bin_index(pb->blocks[0].base, bins->last_key, i, bins->size);
+	pos_t low = bins->starts[index], high = bins->starts[index + 1] + 1;
+	if (high > pb->num_blocks - 1)
+		high = pb->num_blocks - 1;
+	while (low < high) {
+		pos_t middle = (low + high + 1) / 2;
+		if (pb->blocks[middle].base <= i)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+static char exception_at(struct phrase_blocks * pb, pos_t phrase, pos_t i) {
+/* Returns the exception at source position i of -phrase-, 0 if there is none. */
+	pos_t e;
+	for (e = pb->exception_index[phrase]; e < pb->exception_index[phrase + 1] && pb->exception_pos[e] <= i; ++e)
+		if (pb->exception_pos[e] == i)
+			return pb->exception_chars[e];
+	return 0;
+}
+
+char access_blocks(char * reference, struct phrase_blocks * pb, pos_t i) {
+/* This function returns the character in position i of the source, as access_bins does, or '\0' if i is out of the source. */
+	if (i < 0 || i >= pb->length)
+		return '\0';
+	pos_t b = block_predecessor(pb, i);
+	struct phrase_block * block = &pb->blocks[b];
+	unsigned int off = i - block->base;
+	int j = 0;
+	while (off >= block->ends[j])
+		j++;
+	if (pb->exception_index != NULL) {
+		char c = exception_at(pb, b * PHRASE_BLOCK_PHRASES + j + 1, i);
+		if (c)
+			return c;
+	}
+	if (off == block->ends[j] - 1)
+		return block->mismatches[j];
+	off -= j ? block->ends[j - 1] : 0;
+	if (block->strands >> j & 1)
+		return complement_base(reference[block->starts[j] - off]);
+	return reference[block->starts[j] + off];
+}
+
+char * access_blocks_range(char * reference, struct phrase_blocks * pb, pos_t i, pos_t len) {
+/* This function returns the characters in position [i, i+len) of the source, as access_bins_range does, cut at the end of the source. 
+It returns an empty string if i is out of the source. */
+	if (i < 0 || i >= pb->length || len < 0)
+		len = 0;
+	else if (len > pb->length - i)
+		len = pb->length - i;
+	char * res = malloc(len * sizeof(char) + 1);
+	if (len == 0) {
+		res[0] = '\0';
+		return res;
+	}
+	pos_t b = block_predecessor(pb, i), count = 0, k;
+	struct phrase_block * block = &pb->blocks[b];
+	unsigned int off = i - block->base;
+	int j = 0;
+	while (off >= block->ends[j])
+		j++;
+	pos_t first = b * PHRASE_BLOCK_PHRASES + j + 1;
+	while (count < len && b < pb->num_blocks) {
+		unsigned int from = j ? block->ends[j - 1] : 0;
+		pos_t n = (pos_t)block->ends[j] - 1 - off;
+		if (n > len - count)
+			n = len - count;
+		if (block->strands >> j & 1) {
+			char * src = &reference[block->starts[j] - (off - from)];
+			for (k = 0; k < n; ++k)
+				res[count + k] = complement_base(src[-k]);
+		}
+		else
+			memcpy(&res[count], &reference[block->starts[j] + off - from], n);
+		count += n;
+		if (count < len)
+			res[count++] = block->mismatches[j];
+		off = block->ends[j];
+		if (++j == block->count) {
+			block = &pb->blocks[++b];
+			off = 0;
+			j = 0;
+		}
+	}
+	res[count] = '\0';
+	if (pb->exception_index != NULL) {
+		pos_t e = pb->exception_index[first];
+		while (e < pb->num_exceptions && pb->exception_pos[e] < i)
+			e++;
+		for (; e < pb->num_exceptions && pb->exception_pos[e] < i + count; ++e)
+			res[pb->exception_pos[e] - i] = pb->exception_chars[e];
+	}
+	return res;
+}
+
+void phrase_blocks_to_file(struct phrase_blocks * pb, char * filename) {
+/* This function writes the phrase blocks on the -filename- file: a header (magic, version, width of pos_t, phrases, blocks, bins and 
+exceptions), the blocks exactly as they are in memory (little-endian), the bin starts and the exceptions. The blocks and the bin starts 
+hold pos_t values, so the width tells a reader built with other positions (see ISRLZ_POS32) that it cannot use them.
+Like the archival format, it does not store the table of references. */
+	struct trace_span span = trace_begin("write phrase blocks");
+	FILE * fp = fopen(filename, "wb");
+	unsigned char version = PHRASE_BLOCKS_VERSION, width = sizeof(pos_t);
+	long long header[4] = { pb->size, pb->num_blocks, pb->bins->size, pb->num_exceptions };
+	pos_t b;
+	fwrite(PHRASE_BLOCKS_MAGIC, 1, 4, fp);
+	fwrite(&version, 1, 1, fp);
+	fwrite(&width, 1, 1, fp);
+	fwrite(header, sizeof(long long), 4, fp);
+	for (b = 0; b < pb->num_blocks; ++b)
+		fwrite(&pb->blocks[b], sizeof(struct phrase_block), 1, fp);
+	fwrite(pb->bins->starts, sizeof(pos_t), pb->bins->size + 1, fp);
+	fwrite(pb->exception_pos, sizeof(pos_t), pb->num_exceptions, fp);
+	fwrite(pb->exception_chars, sizeof(char), pb->num_exceptions, fp);
+	trace_end(span, ftell(fp));
+	fclose(fp);
+}
+
+struct phrase_blocks * file_to_phrase_blocks(char * filename) {
+/* This function reads a file written by phrase_blocks_to_file. It returns NULL if the file cannot be read, if its positions are 
+not as wide as pos_t, or if its counts do not agree with each other and with the size of the file, so a damaged or cut file is 
+never read past its end nor allocated what its header claims. */
+	FILE * fp = fopen(filename, "rb");
+	char magic[4];
+	unsigned char version, width = 8;
+	long long header[4], left;
+	if (fp == NULL)
+		return NULL;
+	if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, PHRASE_BLOCKS_MAGIC, 4) != 0 || fread(&version, 1, 1, fp) != 1 
+		|| (version >= 2 && fread(&width, 1, 1, fp) != 1) || fread(header, sizeof(long long), 4, fp) != 4) {
+		fclose(fp);
+		return NULL;
+	}
+	left = ftell(fp);
+	fseek(fp, 0L, SEEK_END);
+	left = ftell(fp) - left;
+	fseek(fp, -left, SEEK_END);
+	// every count is checked against the bytes left before they are multiplied
+	long long size = header[0], num_blocks = header[1], num_bins = header[2], num_exceptions = header[3];
+	if (version < 1 || version > PHRASE_BLOCKS_VERSION || width != sizeof(pos_t) || size < 1 || num_blocks < 1 || num_bins < 1 || num_exceptions < 0 
+		|| num_blocks > left / (long long)sizeof(struct phrase_block) || num_blocks != (size - 1 + PHRASE_BLOCK_PHRASES - 1) / PHRASE_BLOCK_PHRASES + (size == 1) 
+		|| num_bins > num_blocks || num_exceptions > left 
+		|| num_blocks * (long long)sizeof(struct phrase_block) + (num_bins + 1) * (long long)sizeof(pos_t) + num_exceptions * (long long)(sizeof(pos_t) + 1) != left) {
+		fclose(fp);
+		return NULL;
+	}
+	struct trace_span span = trace_begin("read phrase blocks");
+	struct phrase_blocks * pb = calloc(1, sizeof(struct phrase_blocks));
+	pb->size = size;
+	pb->num_blocks = num_blocks;
+	pb->num_exceptions = num_exceptions;
+	pb->blocks = alloc_blocks(pb->num_blocks);
+	pb->bins = malloc(sizeof(struct bins));
+	pb->bins->size = num_bins;
+	pb->bins->starts = malloc((pb->bins->size + 1) * sizeof(pos_t));
+	pb->bins->arr = NULL;
+	pb->exception_pos = malloc(pb->num_exceptions * sizeof(pos_t) + 1);
+	pb->exception_chars = malloc(pb->num_exceptions * sizeof(char) + 1);
+	mem_alloc(MEM_BINS, MEM_BINS_BYTES(pb->bins->size));
+	mem_alloc(MEM_PHRASES, MEM_EXCEPTION_BYTES(pb->num_exceptions));
+	if (pb->blocks == NULL || pb->bins->starts == NULL || pb->exception_pos == NULL || pb->exception_chars == NULL
+		|| fread(pb->blocks, sizeof(struct phrase_block), pb->num_blocks, fp) != (size_t)pb->num_blocks
+		|| fread(pb->bins->starts, sizeof(pos_t), pb->bins->size + 1, fp) != (size_t)pb->bins->size + 1
+		|| fread(pb->exception_pos, sizeof(pos_t), pb->num_exceptions, fp) != (size_t)pb->num_exceptions
+		|| fread(pb->exception_chars, sizeof(char), pb->num_exceptions, fp) != (size_t)pb->num_exceptions
+		|| pb->blocks[pb->num_blocks - 1].count > PHRASE_BLOCK_PHRASES) {
+		trace_end(span, 0);
+		fclose(fp);
+		if (pb->blocks == NULL) // nothing was counted for them
+			pb->num_blocks = 0;
+		free_phrase_blocks(pb);
+		return NULL;
+	}
+	struct phrase_block * last = &pb->blocks[pb->num_blocks - 1];
+	pb->length = last->base + (last->count ? last->ends[last->count - 1] : 0);
+	pb->bins->covered = pb->num_blocks;
+	pb->bins->last_key = last->base;
+	trace_end(span, ftell(fp));
+	fclose(fp);
+	index_block_exceptions(pb);
+	return pb;
+}
+
+int is_phrase_blocks(char * filename) {
+/* Returns 1 if -filename- was written by phrase_blocks_to_file. */
+	char magic[4];
+	FILE * fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return 0;
+	int res = fread(magic, 1, 4, fp) == 4 && memcmp(magic, PHRASE_BLOCKS_MAGIC, 4) == 0;
+	fclose(fp);
+	return res;
+}
@@ -0,0 +1,34 @@
+#define PHRASE_BLOCK_BYTES 64 // one cache line
+#define PHRASE_BLOCK_PHRASES 4
+#define PHRASE_BLOCKS_MAGIC "ISRB"
+#define PHRASE_BLOCKS_VERSION 2 // the version is followed by the width of pos_t; version 1 files have none and 8-byte positions
+
+struct phrase_block {
+	pos_t base; // source position where the first phrase of the block starts
+	unsigned int ends[PHRASE_BLOCK_PHRASES]; // end of every phrase (after its mismatch), relative to base
+	pos_t starts[PHRASE_BLOCK_PHRASES];
+	char mismatches[PHRASE_BLOCK_PHRASES];
+	unsigned char strands; // bit j set if phrase j is copied from the reverse complement
+	unsigned char count; // phrases in the block, fewer than PHRASE_BLOCK_PHRASES only in the last one
+	char padding[PHRASE_BLOCK_BYTES - sizeof(pos_t) - PHRASE_BLOCK_PHRASES * (sizeof(unsigned int) + sizeof(pos_t) + sizeof(char)) - 2];
+};
+
+struct phrase_blocks {
+	struct phrase_block * blocks; // aligned to PHRASE_BLOCK_BYTES
+	pos_t num_blocks;
+	pos_t size; // phrases, as in the csb struct (the first one is empty)
+	pos_t length; // of the source, terminator included
+	struct bins * bins; // over the first position of every block, without the array (see block_predecessor)
+	pos_t num_exceptions;
+	pos_t * exception_pos;
+	char * exception_chars;
+	pos_t * exception_index; // first exception of every phrase (size + 1 entries), NULL without exceptions
+};
+
+struct phrase_blocks * build_phrase_blocks(csb * comp_source, int bin_factor);
+void free_phrase_blocks(struct phrase_blocks * pb);
+char access_blocks(char * reference, struct phrase_blocks * pb, pos_t i);
+char * access_blocks_range(char * reference, struct phrase_blocks * pb, pos_t i, pos_t len);
+void phrase_blocks_to_file(struct phrase_blocks * pb, char * filename);
+struct phrase_blocks * file_to_phrase_blocks(char * filename);
+int is_phrase_blocks(char * filename);
@@ -0,0 +1,1935 @@
+/*
+Check module is the regression suite of the 'test check' action (also 'make check').
+
+Every check generates its own inputs with gen.c in a temporary directory, runs one feature end to end and compares
+the result with the plain text it started from, so the suite needs no data files. The seed of the inputs is fixed
+(--seed changes it) and the directory is removed at the end. A failing check prints the first difference it finds.
+
+Checks:
+roundtrip      compress_bins (plain, tolerant and with the reverse strand), decompress_bins, access_bins, access_bins_range,
+               and the .csb and archive files of a generated strain
+wide_offsets   a source longer than 2^32 bases, which needs 5-byte offsets, through access_bins and the .csb and archive files.
+               Its phrases are those of a real parse repeated, since parsing 4 Gbases would take minutes. An ISRLZ_POS32 build
+               checks instead that load_file and file_to_csb refuse inputs past its 32-bit positions
+variants       the VCF records of strains with SNPs, indels and N runs (plain, tolerant and reverse strand parses) are sorted,
+               do not overlap, give back the source when they are applied to the reference, and are minimal and left-aligned;
+               two adjacent SNPs give a 2-base MNV and a duplicated repeat unit one left-aligned insertion
+liftover       every source position (and a few out of it) of a strain with inversions and N runs is lifted to a reference base
+               that gives its character, or is novel; every hit of the inverse index maps back to its reference positions
+directory      access_directory gives the source at every position, and directory_predecessor the phrase of predecessor,
+               for directories of several k over a tolerant, reverse strand parse (k 0 has a window per position)
+append         a strain compressed in five pieces (one of them empty) with append_bins, written to its .csb file and read
+               back after every piece (plain, tolerant and reverse strand parses), equals the parse of the whole strain, and so
+               does its .csb file extended by segments from file_to_csb_end, which only add bytes at its end; a file with its
+               last segment cut short is refused
+blocks         access_blocks and access_blocks_range of the phrase blocks of a tolerant, reverse strand parse (in memory and
+               read back from their file) give the source, and an index out of the source gives '\0' or an empty range.
+               Copies of the file cut short, with wrong counts or positions of another width are refused
+files          file_to_csb returns NULL for files that are not .csb files (phrase blocks, random bytes, an empty file)
+               or that are cut short, instead of allocating what their header claims
+search         the positions of patterns taken from a strain (and of random ones) in its plain, tolerant and reverse strand parses
+               are those of a scan of the strain, also for a source of one base where nothing is found
+tree           buildSuffixTreeParallel with 2 and 4 threads gives the tree of the serial build, node by node, for a
+               generated reference, one with a long satellite and a tandem repeat of AC, where the parallel sort falls
+               back to the serial build
+kernels        cpu_match, cpu_rank and cpu_reverse_complement of every level up to the machine's give the results of the
+               portable loops, and the parse and decompression of a strain are the same at every level. The sources of
+               cpu_match have only the LOAD_TAIL bytes after their end, so a sanitizer build catches reads past it
+library        the isrlz_* API of libisrlz (linked from libisrlz.a): a strain compressed against an indexed reference, saved and
+               opened again, gives the strain through isrlz_access and isrlz_extract, also from 4 threads querying the same
+               source at once, and positions out of it or a reference that is not indexed give the documented errors
+references     load_references of three references indexes them with a separator after each; a strain of the first followed by
+               one of the third, compressed against them (forward and reverse strand), gives the source, copies every phrase
+               from one reference, mostly the right one, and its .csb file keeps the table, which check_references matches
+               against the same list only (not reordered, shorter or a single reference)
+composition    composition_range of random ranges and composition_windows of random tracks (windows of 1, 37 and 1000
+               characters) give the counts of a scan of the strain, for plain, tolerant and reverse strand parses and indexes
+               sampled every 1, 7 and COMPOSITION_SAMPLE positions
+diff           diff_sources of a strain and copies of it with substitutions, a cut end or an insertion (plain, tolerant and
+               reverse strand parses, also mixed) gives the intervals of a scan of both texts, and proves most bases equal
+               from the phrases when the copies are close
+select         sketches hold every distinct k-mer once at scale 1 and the hashes below the threshold at scale 10, and do
+               not depend on the strand when canonical; sketch_files matches sketch_sequence and names the first missing file;
+               among an unrelated candidate, the reference with 3% and 0.5% SNPs, the reference and its reverse complement,
+               select_reference picks the one with the fewest phrases on both strands, with estimates within a factor of 2
+extract        read_bed skips comments, track and browser lines and refuses malformed lines; extract_regions of unsorted,
+               overlapping, empty and named regions (none, two, and 500 of them) with 1, 3 and 8 threads writes every region
+               of the strain, in the order of the file
+
+Functions:
+check_main
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "archive.h"
+#include "blocks.h"
+#include "rng.h"
+#include "gen.h"
+#include "variants.h"
+#include "liftover.h"
+#include "composition.h"
+#include "diff.h"
+#include "extract.h"
+#include "sketch.h"
+#include "search.h"
+#include "cpu.h"
+#include "perf.h"
+#include "bench.h"
+#include "check.h"
+#include "libisrlz.h"
+#include "mem.h"
+
+#define CHECK_PATH 4096
+
+struct check_context {
+	char dir[CHECK_PATH]; // temporary directory of the inputs
+	unsigned long long seed;
+	const char * name; // running check
+};
+
+struct check_data {
+	char reference_filename[CHECK_PATH];
+	char source_filename[CHECK_PATH];
+	char * reference; // load_file(reference_filename, 1)
+	char * source; // load_file(source_filename, 0), ending with '$'
+	pos_t reference_len; // without the N padding and '$'
+	pos_t source_len; // with the '$'
+	SuffixTree * tree;
+};
+
+static int check_fail(struct check_context * ctx, const char * format, ...) {
+/* Prints why the running check failed and returns 1, so a check can end with 'return check_fail(...)'. */
+	va_list args;
+	printf("  %s: ", ctx->name);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	return 1;
+}
+
+static void check_path(struct check_context * ctx, char * dst, const char * name) {
+	snprintf(dst, CHECK_PATH, "%s/%s", ctx->dir, name);
+}
+
+static struct gen_options check_gen_options(struct check_context * ctx) {
+/* The defaults of the 'gen' action, with the seed of the suite. */
+	struct gen_options opt = { ctx->seed, "uniform", 3, 0.41, 1, NULL, 0.001, 0.0001, 3, 0, 1000, 0, 100, 0, 10000, 20 };
+	return opt;
+}
+
+static int check_generate(struct check_context * ctx, const char * prefix, pos_t len, pos_t flank, struct gen_options * opt, struct check_data * data) {
+/* This function writes a reference of -len- bases and one strain of it, as 'gen' does, into the directory of the suite,
+loads both and builds the suffix tree of the reference. The first and last -flank- bases of the reference are copied into the
+strain unchanged, so it starts and ends where the reference does. It returns 0, or 1 if a file cannot be written or read. */
+	struct rng rng;
+	struct gen_stats stats;
+	rng_seed(&rng, opt->seed);
+	memset(data, 0, sizeof(struct check_data));
+	snprintf(data->reference_filename, CHECK_PATH, "%s/%s_ref.fsa", ctx->dir, prefix);
+	snprintf(data->source_filename, CHECK_PATH, "%s/%s_strain1.fsa", ctx->dir, prefix);
+	char * reference = gen_reference(&rng, opt, len);
+	FILE * fp = fopen(data->reference_filename, "w");
+	if (reference == NULL || fp == NULL) {
+		free(reference);
+		return check_fail(ctx, "cannot write %s", data->reference_filename);
+	}
+	fwrite(reference, 1, len, fp);
+	fclose(fp);
+	pos_t hotspots[1];
+	int failed = gen_strain(data->source_filename, &reference[flank], len - 2 * flank, &rng, opt, hotspots, &stats);
+	if (!failed && flank > 0) {
+		char * strain = load_file(data->source_filename, 0);
+		fp = strain == NULL ? NULL : fopen(data->source_filename, "w");
+		failed = fp == NULL;
+		if (!failed) {
+			fwrite(reference, 1, flank, fp);
+			fwrite(strain, 1, strlen(strain) - 1, fp);
+			fwrite(&reference[len - flank], 1, flank, fp);
+			fclose(fp);
+		}
+		unload_file(strain, 0);
+	}
+	free(reference);
+	if (failed)
+		return check_fail(ctx, "cannot write %s", data->source_filename);
+	data->reference = load_file(data->reference_filename, 1);
+	data->source = load_file(data->source_filename, 0);
+	if (data->reference == NULL || data->source == NULL)
+		return check_fail(ctx, "cannot read the generated files");
+	data->reference_len = len;
+	data->source_len = strlen(data->source);
+	data->tree = buildSuffixTree(data->reference, 1);
+	return 0;
+}
+
+static void check_free_data(struct check_data * data) {
+	if (data->tree != NULL)
+		freeSuffixTree(data->tree);
+	unload_file(data->reference, 1);
+	unload_file(data->source, 0);
+}
+
+static int check_same_csb(struct check_context * ctx, const char * what, csb * expected, csb * found) {
+/* Compares the phrases of two compressed sources and returns 0 if they are the same. */
+	pos_t i;
+	if (found == NULL)
+		return check_fail(ctx, "%s: cannot be read", what);
+	if (found->size != expected->size)
+		return check_fail(ctx, "%s: %lld phrases instead of %lld", what, (long long)found->size, (long long)expected->size);
+	for (i = 0; i < expected->size; ++i)
+		if (found->starts[i] != expected->starts[i] || found->lens->arr[i] != expected->lens->arr[i] || found->mismatches[i] != expected->mismatches[i])
+			return check_fail(ctx, "%s: phrase %lld differs", what, (long long)i);
+	return 0;
+}
+
+static int check_access(struct check_context * ctx, const char * what, char * reference, csb * comp_source, char * source, pos_t source_len, long ranges) {
+/* Checks access_bins on every position of the source and access_bins_range on -ranges- random ranges. */
+	pos_t i;
+	long r;
+	struct rng rng;
+	for (i = 0; i < source_len - 1; ++i)
+		if (access_bins(reference, comp_source, i) != source[i])
+			return check_fail(ctx, "%s: access_bins(%lld) is '%c' instead of '%c'", what, (long long)i, access_bins(reference, comp_source, i), source[i]);
+	rng_seed(&rng, ctx->seed);
+	for (r = 0; r < ranges; ++r) {
+		pos_t len = 1 + rng_below(&rng, 1000);
+		if (len > source_len - 1)
+			len = source_len - 1;
+		i = rng_below(&rng, source_len - len);
+		char * res = access_bins_range(reference, comp_source, i, len);
+		int differs = memcmp(res, &source[i], len) != 0;
+		free(res);
+		if (differs)
+			return check_fail(ctx, "%s: access_bins_range(%lld, %lld) differs from the source", what, (long long)i, (long long)len);
+	}
+	return 0;
+}
+
+static int check_roundtrip(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.005;
+	opt.indel = 0.0005;
+	opt.sv = 4;
+	opt.n_runs = 2;
+	if (check_generate(ctx, "roundtrip", 200000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	int failed = 0, k;
+	char csb_filename[CHECK_PATH], archive_filename[CHECK_PATH];
+	check_path(ctx, csb_filename, "roundtrip.csb");
+	check_path(ctx, archive_filename, "roundtrip.isra");
+
+	csb * comp_source = compress_bins(data.tree, data.reference, data.source, 4);
+	char * decompressed = decompress_bins(data.reference, comp_source);
+	if (strcmp(decompressed, data.source) != 0)
+		failed = check_fail(ctx, "decompress_bins differs from the source");
+	free(decompressed);
+	if (!failed)
+		failed = check_access(ctx, "bins", data.reference, comp_source, data.source, data.source_len, 1000);
+
+	if (!failed) {
+		csb_to_file(comp_source, csb_filename);
+		csb * stored = file_to_csb(csb_filename);
+		failed = check_same_csb(ctx, ".csb file", comp_source, stored);
+		if (!failed && offset_width(stored) != 4)
+			failed = check_fail(ctx, "offset width %d instead of 4", offset_width(stored));
+		if (!failed)
+			failed = check_access(ctx, ".csb file", data.reference, stored, data.source, data.source_len, 100);
+		if (stored != NULL)
+			free_csb(stored);
+	}
+	if (!failed) {
+		csb_to_archive(comp_source, archive_filename, 256);
+		struct archive * arc = archive_open(archive_filename);
+		pos_t i;
+		if (arc == NULL)
+			failed = check_fail(ctx, "archive: cannot be read");
+		for (i = 0; !failed && i < data.source_len - 1; i += 7)
+			if (archive_access(data.reference, arc, i) != data.source[i])
+				failed = check_fail(ctx, "archive_access(%lld) differs from the source", (long long)i);
+		pos_t outside[] = { -1, -1000, data.source_len, data.source_len + 1000 };
+		for (i = 0; !failed && i < 4; ++i) {
+			char * res = archive_access_range(data.reference, arc, outside[i], 10);
+			if (archive_access(data.reference, arc, outside[i]) != '\0' || res[0] != '\0')
+				failed = check_fail(ctx, "archive: position %lld is out of the source but it is accessed", (long long)outside[i]);
+			free(res);
+		}
+		if (!failed) {
+			char * res = archive_access_range(data.reference, arc, data.source_len - 5, 100);
+			if (strcmp(res, &data.source[data.source_len - 5]) != 0)
+				failed = check_fail(ctx, "archive_access_range is not cut at the end of the source");
+			free(res);
+		}
+		if (!failed) {
+			csb * decoded = archive_to_csb(arc);
+			failed = check_same_csb(ctx, "archive", comp_source, decoded);
+			free_csb(decoded);
+		}
+		if (arc != NULL)
+			archive_close(arc);
+	}
+	free_csb(comp_source);
+
+	// the tolerant parse and the reverse strand, which the archive does not store
+	for (k = 0; k < 2 && !failed; ++k) {
+		struct parse_options parse = { 3, k };
+		comp_source = compress_bins_ext(data.tree, data.reference, data.source, 2, &parse);
+		decompressed = decompress_bins(data.reference, comp_source);
+		if (strcmp(decompressed, data.source) != 0)
+			failed = check_fail(ctx, "decompress_bins differs from the source (snp run 3, reverse strand %d)", k);
+		free(decompressed);
+		if (!failed)
+			failed = check_access(ctx, k ? "reverse strand" : "snp run", data.reference, comp_source, data.source, data.source_len, 1000);
+		if (!failed) {
+			csb_to_file(comp_source, csb_filename);
+			csb * stored = file_to_csb(csb_filename);
+			failed = check_same_csb(ctx, ".csb file", comp_source, stored);
+			if (!failed)
+				failed = check_access(ctx, ".csb file", data.reference, stored, data.source, data.source_len, 100);
+			if (stored != NULL)
+				free_csb(stored);
+		}
+		free_csb(comp_source);
+	}
+	remove(csb_filename);
+	remove(archive_filename);
+	check_free_data(&data);
+	return failed;
+}
+
+#ifdef ISRLZ_POS32
+static int check_wide_offsets(struct check_context * ctx) {
+/* 32-bit positions cannot address a source of 2^32 bases, so this build checks that inputs past them are refused:
+load_file of a (sparse) file one byte longer than LOAD_MAX_SOURCE or LOAD_MAX_REFERENCE, and file_to_csb of a file
+with 5-byte offsets. A small genome still gets 4-byte offsets. */
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	if (check_generate(ctx, "wide", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	char filename[CHECK_PATH];
+	int failed = 0, add_N;
+	check_path(ctx, filename, "wide_long.fsa");
+	FILE * fp;
+	for (add_N = 0; add_N <= 1 && !failed; ++add_N) {
+		char * text = NULL;
+		// a single byte at the end leaves a sparse file
+		fp = fopen(filename, "w");
+		if (fp == NULL || fseek(fp, (long)(add_N ? LOAD_MAX_REFERENCE : LOAD_MAX_SOURCE), SEEK_SET) != 0 || fputc('A', fp) == EOF)
+			failed = check_fail(ctx, "cannot write %s", filename);
+		if (fp != NULL)
+			fclose(fp);
+		if (failed)
+			break;
+		if ((text = load_file(filename, add_N)) != NULL)
+			failed = check_fail(ctx, "load_file(%d) reads a file longer than 32-bit positions address", add_N);
+		unload_file(text, add_N);
+	}
+	remove(filename);
+
+	csb * parse = compress_bins(data.tree, data.reference, data.source, 1);
+	if (!failed && offset_width(parse) != 4)
+		failed = check_fail(ctx, "offset width %d instead of 4 for %lld bases", offset_width(parse), (long long)data.source_len);
+	check_path(ctx, filename, "wide.csb");
+	csb_to_file(parse, filename);
+	fp = fopen(filename, "r+b");
+	if (!failed && fp == NULL)
+		failed = check_fail(ctx, "cannot write %s", filename);
+	if (fp != NULL) {
+		fseek(fp, 5, SEEK_SET); // after the magic and the version
+		fputc(5, fp);
+		fclose(fp);
+	}
+	csb * stored = failed ? NULL : file_to_csb(filename);
+	if (stored != NULL) {
+		failed = check_fail(ctx, "file_to_csb reads 5-byte offsets into 32-bit positions");
+		free_csb(stored);
+	}
+	remove(filename);
+	free_csb(parse);
+	check_free_data(&data);
+	return failed;
+}
+#else
+static char wide_char(char * source, pos_t length, pos_t i, pos_t total) {
+/* The character in position i of the wide source: copies of the source (without its '$', length -length-), where the
+last phrase of every copy but the last ends with 'A' instead of the terminator. */
+	pos_t offset = i % length;
+	if (offset == length - 1)
+		return i == total - 1 ? '$' : 'A';
+	return source[offset];
+}
+
+static int check_wide_offsets(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.0005; // long phrases keep the phrase arrays of the copies small
+	if (check_generate(ctx, "wide", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	int failed = 0;
+	csb * parse = compress_bins(data.tree, data.reference, data.source, 1);
+	pos_t length = data.source_len, phrases = parse->size - 1; // every copy holds the phrases 1..size-1 of the parse
+	pos_t copies = ((1LL << 32) + length) / length + 1, c, p, i;
+	pos_t size = copies * phrases + 1, total = copies * length;
+
+	// the parse of the copies, phrase after phrase, as compress_bins would find it
+	pos_t * starts = malloc(size * sizeof(pos_t));
+	pos_t * lens = malloc(size * sizeof(pos_t));
+	char * mismatches = malloc(size);
+	mem_alloc(MEM_PHRASES, MEM_PHRASE_BYTES(size));
+	starts[0] = lens[0] = 0;
+	mismatches[0] = 0;
+	for (c = 0, i = 1; c < copies; ++c)
+		for (p = 1; p <= phrases; ++p, ++i) {
+			starts[i] = parse->starts[p];
+			lens[i] = c * length + parse->lens->arr[p];
+			mismatches[i] = (p == phrases && c < copies - 1) ? 'A' : parse->mismatches[p];
+		}
+	csb wide = { starts, create_bins(lens, size, size / 4), size, mismatches, NULL, 0, NULL, NULL, NULL, NULL };
+	free_csb(parse);
+
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	if (offset_width(&wide) != 5)
+		failed = check_fail(ctx, "offset width %d instead of 5 for %lld bases", offset_width(&wide), (long long)total);
+	// every position around 2^32, and random ones
+	for (i = (1LL << 32) - 100000; !failed && i < (1LL << 32) + 100000; ++i)
+		if (access_bins(data.reference, &wide, i) != wide_char(data.source, length, i, total))
+			failed = check_fail(ctx, "access_bins(%lld) differs from the source", (long long)i);
+	for (c = 0; !failed && c < 100000; ++c) {
+		i = rng_below(&rng, total);
+		if (access_bins(data.reference, &wide, i) != wide_char(data.source, length, i, total))
+			failed = check_fail(ctx, "access_bins(%lld) differs from the source", (long long)i);
+	}
+
+	char csb_filename[CHECK_PATH], archive_filename[CHECK_PATH];
+	check_path(ctx, csb_filename, "wide.csb");
+	check_path(ctx, archive_filename, "wide.isra");
+	if (!failed) {
+		csb_to_file(&wide, csb_filename);
+		csb * stored = file_to_csb(csb_filename);
+		failed = check_same_csb(ctx, ".csb file", &wide, stored);
+		for (c = 0; !failed && c < 100000; ++c) {
+			i = rng_below(&rng, total);
+			if (access_bins(data.reference, stored, i) != wide_char(data.source, length, i, total))
+				failed = check_fail(ctx, ".csb file: access_bins(%lld) differs from the source", (long long)i);
+		}
+		if (stored != NULL)
+			free_csb(stored);
+		remove(csb_filename);
+	}
+	if (!failed) {
+		csb_to_archive(&wide, archive_filename, ARCHIVE_BLOCK_SIZE);
+		struct archive * arc = archive_open(archive_filename);
+		if (arc == NULL)
+			failed = check_fail(ctx, "archive: cannot be read");
+		for (c = 0; !failed && c < 2000; ++c) { // every query decodes a block
+			i = rng_below(&rng, total);
+			if (archive_access(data.reference, arc, i) != wide_char(data.source, length, i, total))
+				failed = check_fail(ctx, "archive_access(%lld) differs from the source", (long long)i);
+		}
+		if (arc != NULL)
+			archive_close(arc);
+		remove(archive_filename);
+	}
+	mem_release(MEM_PHRASES, MEM_PHRASE_BYTES(size));
+	mem_release(MEM_BINS, MEM_BINS_BYTES(wide.lens->size));
+	free(starts);
+	free(lens);
+	free(mismatches);
+	free(wide.lens->starts);
+	free(wide.lens);
+	check_free_data(&data);
+	return failed;
+}
+#endif
+
+static int compare_variants(const void * a, const void * b) {
+	const struct variant * x = (const struct variant *)a, * y = (const struct variant *)b;
+	return (x->ref_pos > y->ref_pos) - (x->ref_pos < y->ref_pos);
+}
+
+static int replay_variants(struct check_context * ctx, struct check_data * data, struct variant * variants, pos_t num) {
+/* Applies the variants, in reference order, to the reference and compares the result with the source. */
+	char * text = malloc(data->source_len + 1);
+	pos_t j, cur = 0, n = 0, length = data->reference_len, source_len = data->source_len - 1;
+	qsort(variants, num, sizeof(struct variant), compare_variants);
+	for (j = 0; j <= num; ++j) {
+		struct variant * v = &variants[j];
+		pos_t to = (j < num) ? v->ref_pos : length, add = (j == num) ? 0 : (v->sv_len == 0) ? (pos_t)strlen(v->alt) : 1;
+		if (to < cur) {
+			free(text);
+			return check_fail(ctx, "the record at %lld overlaps the one before it", (long long)v->ref_pos + 1);
+		}
+		if (j < num && (v->type == VARIANT_BND || (v->sv_len > 0 && v->type != VARIANT_DEL))) {
+			free(text);
+			return check_fail(ctx, "the record at %lld (%s) cannot be applied", (long long)v->ref_pos + 1, v->alt);
+		}
+		if (n + (to - cur) + add > source_len) {
+			free(text);
+			return check_fail(ctx, "the records give a longer text than the source, at reference position %lld", (long long)to + 1);
+		}
+		memcpy(&text[n], &data->reference[cur], to - cur);
+		n += to - cur;
+		if (j == num)
+			break;
+		if (v->sv_len > 0) {
+			text[n++] = data->reference[v->ref_pos];
+			cur = v->ref_pos + 1 + v->sv_len;
+		}
+		else {
+			memcpy(&text[n], v->alt, add);
+			n += add;
+			cur = v->ref_pos + v->ref_len;
+		}
+	}
+	for (j = 0; j < n && text[j] == data->source[j]; ++j);
+	free(text);
+	if (n != source_len || j < n)
+		return check_fail(ctx, "the records give back %lld characters, which differ from the source from position %lld", (long long)n, (long long)j);
+	return 0;
+}
+
+static int check_normalized(struct check_context * ctx, struct check_data * data, struct variant * variants, pos_t num) {
+/* Checks that the explicit alleles of the variants, sorted by replay_variants, are minimal and left-aligned: a substitution differs
+at its first and last base, an indel (or a complex event) shares at most its padding base at the start and does not end with a base REF and ALT
+share, unless the record before it or the start of the reference keeps it from moving left. */
+	pos_t j, prev_end = 0;
+	for (j = 0; j < num; ++j) {
+		struct variant * v = &variants[j];
+		char * ref = &data->reference[v->ref_pos];
+		pos_t al = strlen(v->alt), rl = v->ref_len, min_len = rl < al ? rl : al;
+		int substitution = v->type == VARIANT_SNV || v->type == VARIANT_MNV;
+		if (v->type == VARIANT_BND || v->sv_len > 0 || (v->reverse && !substitution))
+			;
+		else if (substitution && (rl != al || ref[0] == v->alt[0] || ref[rl - 1] == v->alt[al - 1] || (v->type == VARIANT_SNV) != (rl == 1)))
+			return check_fail(ctx, "the %s at %lld, %.*s to %s, is not minimal", v->type == VARIANT_SNV ? "SNV" : "MNV", (long long)v->ref_pos + 1, (int)rl, ref, v->alt);
+		else if (!substitution && min_len > 1 && ref[0] == v->alt[0])
+			return check_fail(ctx, "the indel at %lld, %.*s to %s, is not minimal", (long long)v->ref_pos + 1, (int)rl, ref, v->alt);
+		else if (!substitution && ref[rl - 1] == v->alt[al - 1] && v->ref_pos > prev_end)
+			return check_fail(ctx, "the indel at %lld, %.*s to %s, is not left-aligned", (long long)v->ref_pos + 1, (int)rl, ref, v->alt);
+		if (v->ref_pos + (v->sv_len > 0 ? 1 + v->sv_len : rl) > prev_end)
+			prev_end = v->ref_pos + (v->sv_len > 0 ? 1 + v->sv_len : rl);
+	}
+	return 0;
+}
+
+static int check_variant_events(struct check_context * ctx, struct check_data * data) {
+/* Writes a strain of the reference with SNPs at two adjacent positions and a repeat unit of 3 bases written twice, and checks that they
+give a 2-base MNV and one 3-base insertion at the start of the repeat, whatever chance matches the parse finds around them. It changes
+the reference and its tree. */
+	pos_t len = data->reference_len, snp = 9000, dup = 20000, j, num, found = 0, q;
+	char * reference = data->reference, * source = calloc(len + 5 + LOAD_TAIL, 1);
+	// a tandem repeat of the unit reference[dup - 3, dup), made long enough here for the left-alignment to matter
+	reference[dup - 6] = reference[dup - 3];
+	reference[dup - 5] = reference[dup - 2];
+	reference[dup - 4] = reference[dup - 1];
+	memcpy(source, reference, dup);
+	memcpy(&source[dup], &reference[dup - 3], 3);
+	memcpy(&source[dup + 3], &reference[dup], len - dup);
+	// the insertion moves left while the base before it repeats the unit
+	for (q = dup - 3; reference[q - 1] == reference[q + 2]; --q);
+	source[snp] = "ACGT"[(strchr("ACGT", reference[snp]) - "ACGT" + 1) % 4];
+	source[snp + 1] = "ACGT"[(strchr("ACGT", reference[snp + 1]) - "ACGT" + 2) % 4];
+	source[len + 3] = '$';
+	source[len + 4] = '\0';
+	freeSuffixTree(data->tree);
+	data->tree = buildSuffixTree(reference, 1);
+	struct parse_options parse = { 0, 0 };
+	struct variant * variants;
+	csb * comp_source = compress_bins_ext(data->tree, reference, source, 1, &parse);
+	num = find_variants(reference, comp_source, 0, len + 3, &variants);
+	int failed = 0;
+	for (j = 0; j < num && !failed; ++j) {
+		struct variant * v = &variants[j];
+		if (v->ref_pos == snp && v->type == VARIANT_MNV && v->ref_len == 2 && strncmp(v->alt, &source[snp], 2) == 0 && v->source_pos == snp)
+			found |= 1;
+		else if (v->ref_pos == q - 1 && v->type == VARIANT_INS && v->ref_len == 1 && strlen(v->alt) == 4 && memcmp(v->alt, &reference[q - 1], 4) == 0)
+			found |= 2;
+		else
+			failed = check_fail(ctx, "unexpected record at %lld: %.*s to %s", (long long)v->ref_pos + 1, (int)v->ref_len, &reference[v->ref_pos], v->alt);
+	}
+	if (!failed && found != 3)
+		failed = check_fail(ctx, "%s is missing from %lld records", (found & 1) ? "the left-aligned insertion" : "the MNV of the adjacent SNPs", (long long)num);
+	free_variants(variants, num);
+	free_csb(comp_source);
+	free(source);
+	return failed;
+}
+
+static int check_variants(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	pos_t n_lens[] = { 5, 12, 20, 25, 30 }, j;
+	int failed = 0, round, num_runs = sizeof(n_lens) / sizeof(n_lens[0]);
+	for (round = 0; round < 3 && !failed; ++round) {
+		opt.seed = ctx->seed + round;
+		opt.snp = round ? 0.01 : 0.001;
+		opt.indel = round ? 0.002 : 0.0005;
+		if (check_generate(ctx, "variants", 100000, 100, &opt, &data) != 0) {
+			check_free_data(&data);
+			return 1;
+		}
+		// N runs short enough to be written explicitly, the longer ones are copied from the N padding of the reference
+		for (j = 0; j < num_runs; ++j)
+			memset(&data.source[(j + 1) * (data.source_len / (num_runs + 1))], 'N', n_lens[j]);
+		// the tolerant parse from the second round on, and the reverse strand in the last one
+		struct parse_options parse = { round ? 3 : 0, round == 2 };
+		struct variant * variants;
+		csb * comp_source = compress_bins_ext(data.tree, data.reference, data.source, 1, &parse);
+		pos_t num = find_variants(data.reference, comp_source, 0, data.source_len - 1, &variants);
+		failed = replay_variants(ctx, &data, variants, num);
+		if (!failed)
+			failed = check_normalized(ctx, &data, variants, num);
+		if (!failed && round == 0)
+			failed = check_variant_events(ctx, &data);
+		free_variants(variants, num);
+		free_csb(comp_source);
+		check_free_data(&data);
+	}
+	return failed;
+}
+
+static int check_liftover(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.005;
+	opt.indel = 0.0005;
+	opt.sv = 4;
+	if (check_generate(ctx, "liftover", 200000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	// N runs copied from the N padding of the reference, one of them at the end of the source
+	pos_t n_lens[] = { 5, 20, 30 }, j, len = data.source_len - 1, x;
+	for (j = 0; j < 3; ++j)
+		memset(&data.source[(j + 1) * (len / 4)], 'N', n_lens[j]);
+	memset(&data.source[len - 25], 'N', 25);
+	struct parse_options parse = { 3, 1 };
+	csb * comp_source = compress_bins_ext(data.tree, data.reference, data.source, 1, &parse);
+
+	int failed = 0;
+	pos_t num = len + 4;
+	pos_t * positions = malloc(num * sizeof(pos_t));
+	struct lift * lifts = malloc(num * sizeof(struct lift));
+	for (j = 0; j < num; ++j)
+		positions[j] = j - 2;
+	liftover_positions(data.reference, comp_source, positions, num, lifts);
+	for (j = 0; j < num && !failed; ++j) {
+		pos_t i = positions[j];
+		struct lift * l = &lifts[j];
+		char c = (l->ref_pos >= 0 && l->ref_pos < data.reference_len) ? data.reference[l->ref_pos] : 0;
+		if (i < 0 || i >= len) {
+			if (l->kind != LIFT_UNMAPPED)
+				failed = check_fail(ctx, "position %lld is out of the source but it is not unmapped", (long long)i);
+		}
+		else if (l->kind == LIFT_NOVEL || l->kind == LIFT_UNMAPPED) {
+			if (l->kind == LIFT_UNMAPPED || l->ref_pos != -1)
+				failed = check_fail(ctx, "position %lld is novel with reference position %lld", (long long)i, (long long)l->ref_pos);
+		}
+		else if (c == 0)
+			failed = check_fail(ctx, "position %lld is lifted to %lld, which is not a reference base", (long long)i, (long long)l->ref_pos);
+		else if (l->kind == LIFT_COPIED && (l->reverse ? complement_base(c) : c) != data.source[i])
+			failed = check_fail(ctx, "position %lld is copied from reference position %lld, which does not hold its character", (long long)i, (long long)l->ref_pos);
+		else if (data.source[i] == 'N')
+			failed = check_fail(ctx, "position %lld is an N lifted to reference position %lld", (long long)i, (long long)l->ref_pos);
+	}
+
+	// the hits of random reference regions go back to the same reference positions
+	struct liftover_index * index = liftover_index_build(data.reference, comp_source);
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	for (j = 0; j < index->num && !failed; ++j)
+		if (index->intervals[j].ref_end > data.reference_len)
+			failed = check_fail(ctx, "the index holds the reference interval [%lld, %lld)", (long long)index->intervals[j].ref_start, (long long)index->intervals[j].ref_end);
+	for (j = 0; j < 1000 && !failed; ++j) {
+		pos_t start = rng_below(&rng, data.reference_len), end = start + 1 + rng_below(&rng, 2000), h;
+		struct lift_interval * hits;
+		pos_t num_hits = liftover_reference(index, start, end, &hits);
+		for (h = 0; h < num_hits && !failed; ++h)
+			for (x = hits[h].ref_start; x < hits[h].ref_end && !failed; ++x) {
+				pos_t i = hits[h].reverse ? hits[h].src_start + (hits[h].ref_end - 1 - x) : hits[h].src_start + (x - hits[h].ref_start);
+				if (x < start || x >= end || i < 0 || i >= len || lifts[i + 2].ref_pos != x)
+					failed = check_fail(ctx, "reference position %lld of the hit [%lld, %lld) maps back to source position %lld", (long long)x,
+						(long long)hits[h].ref_start, (long long)hits[h].ref_end, (long long)i);
+			}
+		free(hits);
+	}
+	liftover_index_free(index);
+	free(positions);
+	free(lifts);
+	free_csb(comp_source);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_directory(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.sv = 4;
+	if (check_generate(ctx, "directory", 50000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	struct parse_options parse = { 3, 1 };
+	csb * comp_source = compress_bins_ext(data.tree, data.reference, data.source, 2, &parse);
+	pos_t * lens = comp_source->lens->arr, size = comp_source->size, i;
+	int ks[] = { 0, 3, directory_k(lens, size), 12 }, k, failed = 0;
+	for (k = 0; k < 4 && !failed; ++k) {
+		struct directory * dir = create_directory(lens, size, ks[k]);
+		for (i = 0; i < data.source_len && !failed; ++i) {
+			if (directory_predecessor(dir, i, size) != predecessor(comp_source->lens, i, size))
+				failed = check_fail(ctx, "k %d: directory_predecessor(%lld) differs from predecessor", ks[k], (long long)i);
+			else if (access_directory(data.reference, comp_source, dir, i) != data.source[i])
+				failed = check_fail(ctx, "k %d: access_directory(%lld) differs from the source", ks[k], (long long)i);
+		}
+		free_directory(dir);
+	}
+	free_csb(comp_source);
+	check_free_data(&data);
+	return failed;
+}
+
+static char * check_piece(char * source, pos_t from, pos_t to) {
+/* Returns source[from, to) ending with '$', as load_file leaves it. */
+	char * piece = calloc(to - from + 2 + LOAD_TAIL, 1);
+	memcpy(piece, &source[from], to - from);
+	piece[to - from] = '$';
+	return piece;
+}
+
+static unsigned char * check_read_bytes(char * filename, long long * n) {
+/* Returns the bytes of a file and their number in n, NULL if it cannot be read. */
+	FILE * fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return NULL;
+	fseek(fp, 0L, SEEK_END);
+	*n = ftell(fp);
+	fseek(fp, 0L, SEEK_SET);
+	unsigned char * bytes = malloc(*n + 1);
+	fread(bytes, 1, *n, fp);
+	fclose(fp);
+	return bytes;
+}
+
+static int check_append_segments(struct check_context * ctx, char * csb_filename, SuffixTree * tree, char * reference, char * source, 
+	pos_t * cuts, int pieces, struct parse_options * parse) {
+/* Appends the pieces of source after the first one to the .csb file of the first one with file_to_csb_end and csb_append_to_file, 
+the last two in the same segment, and checks that the file only grows at its end. Cutting the last byte must make the file unreadable. */
+	char * piece = check_piece(source, cuts[0], cuts[1]);
+	csb * comp_source = compress_bins_ext(tree, reference, piece, 1, parse);
+	free(piece);
+	csb_to_file(comp_source, csb_filename);
+	free_csb(comp_source);
+	int failed = 0, j;
+	long long n = 0, m = 0;
+	unsigned char * before = check_read_bytes(csb_filename, &n), * after = NULL;
+	for (j = 1; j < pieces && !failed; ++j) {
+		pos_t first;
+		csb * end = file_to_csb_end(csb_filename, &first);
+		if (end == NULL) {
+			failed = check_fail(ctx, "file_to_csb_end cannot read %s after %d pieces", csb_filename, j);
+			break;
+		}
+		for (; j < pieces && !failed; ++j) {
+			piece = check_piece(source, cuts[j], cuts[j + 1]);
+			if (append_bins(tree, reference, end, piece, parse) != 0)
+				failed = check_fail(ctx, "append_bins fails on piece %d of the end of the file", j);
+			free(piece);
+			if (j != pieces - 2)
+				break;
+		}
+		if (!failed && csb_append_to_file(end, first, csb_filename) != 0)
+			failed = check_fail(ctx, "csb_append_to_file cannot write %s", csb_filename);
+		free_csb(end);
+		after = failed ? NULL : check_read_bytes(csb_filename, &m);
+		if (!failed && (after == NULL || m <= n || memcmp(before, after, n) != 0))
+			failed = check_fail(ctx, "csb_append_to_file changes %s before its end", csb_filename);
+		free(before);
+		before = after;
+		n = m;
+	}
+	if (!failed) {
+		FILE * fp = fopen(csb_filename, "wb");
+		fwrite(before, 1, n - 1, fp);
+		fclose(fp);
+		pos_t first;
+		csb * cut = file_to_csb(csb_filename), * end = file_to_csb_end(csb_filename, &first);
+		if (cut != NULL || end != NULL)
+			failed = check_fail(ctx, "a .csb file with its last segment cut short is read");
+		free_csb(cut);
+		free_csb(end);
+		fp = fopen(csb_filename, "wb");
+		fwrite(before, 1, n, fp);
+		fclose(fp);
+	}
+	free(before);
+	return failed;
+}
+
+static int check_append(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.005;
+	opt.sv = 4;
+	if (check_generate(ctx, "append", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	char csb_filename[CHECK_PATH];
+	check_path(ctx, csb_filename, "append.csb");
+	pos_t len = data.source_len - 1, cuts[] = { 0, len / 3, len / 3 + 7, len / 3 + 7, 2 * len / 3, len };
+	int failed = 0, k, j, pieces = 5;
+	for (k = 0; k < 3 && !failed; ++k) {
+		struct parse_options parse = { k == 1 ? 3 : 0, k == 2 };
+		csb * whole = compress_bins_ext(data.tree, data.reference, data.source, 1, &parse);
+		char * piece = check_piece(data.source, cuts[0], cuts[1]);
+		csb * comp_source = compress_bins_ext(data.tree, data.reference, piece, 1, &parse);
+		free(piece);
+		for (j = 1; j < pieces && !failed; ++j) {
+			csb_to_file(comp_source, csb_filename);
+			free_csb(comp_source);
+			comp_source = file_to_csb(csb_filename);
+			piece = check_piece(data.source, cuts[j], cuts[j + 1]);
+			if (comp_source == NULL)
+				failed = check_fail(ctx, "%s cannot be read", csb_filename);
+			else if (append_bins(data.tree, data.reference, comp_source, piece, &parse) != 0)
+				failed = check_fail(ctx, "append_bins fails on piece %d", j);
+			free(piece);
+		}
+		if (!failed) {
+			csb_to_file(comp_source, csb_filename);
+			csb * stored = file_to_csb(csb_filename);
+			failed = check_same_csb(ctx, "appended", whole, comp_source) || check_same_csb(ctx, "appended .csb file", whole, stored);
+			if (!failed)
+				failed = check_access(ctx, "appended", data.reference, stored, data.source, data.source_len, 1000);
+			free_csb(stored);
+		}
+		if (!failed)
+			failed = check_append_segments(ctx, csb_filename, data.tree, data.reference, data.source, cuts, pieces, &parse);
+		if (!failed) {
+			csb * stored = file_to_csb(csb_filename);
+			failed = check_same_csb(ctx, "appended segments", whole, stored);
+			if (!failed)
+				failed = check_access(ctx, "appended segments", data.reference, stored, data.source, data.source_len, 1000);
+			free_csb(stored);
+		}
+		free_csb(comp_source);
+		free_csb(whole);
+	}
+	remove(csb_filename);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_damaged_blocks(struct check_context * ctx, char * filename, pos_t num_blocks) {
+/* This function rewrites the phrase blocks file -filename- cut short or with wrong counts or width, and checks that
+file_to_phrase_blocks refuses every copy. A version 1 file (no width, 8-byte positions) is still read. It returns 0, or 1
+at the first copy that is read. */
+	FILE * fp = fopen(filename, "rb");
+	fseek(fp, 0L, SEEK_END);
+	long long n = ftell(fp), counts = 6; // the counts follow the magic, the version and the width
+	fseek(fp, 0L, SEEK_SET);
+	unsigned char * file = malloc(n);
+	fread(file, 1, n, fp);
+	fclose(fp);
+	char damaged[CHECK_PATH];
+	check_path(ctx, damaged, "damaged.blk");
+	const char * what[] = { "a file cut in its header", "a file cut in its blocks", "a file cut in its exceptions", 
+		"no blocks", "more blocks than the file holds", "more bins than blocks", "a negative number of exceptions", "positions of another width" };
+	int failed = 0, k;
+	for (k = 0; k < 9 && !failed; ++k) {
+		unsigned char * copy = malloc(n);
+		long long len = n, value;
+		memcpy(copy, file, n);
+		if (k == 0)
+			len = 20;
+		else if (k == 1)
+			len = counts + 32 + PHRASE_BLOCK_BYTES * (num_blocks / 2);
+		else if (k == 2)
+			len = n - 1;
+		else if (k >= 3 && k <= 6) {
+			int field = k == 6 ? 3 : k == 5 ? 2 : 1;
+			memcpy(&value, &copy[counts + 8 * field], 8);
+			value = k == 3 ? 0 : k == 4 ? value + 1000000000000LL : k == 5 ? num_blocks + 1 : -1;
+			memcpy(&copy[counts + 8 * field], &value, 8);
+		}
+		else if (k == 7)
+			copy[5] = sizeof(pos_t) == 8 ? 4 : 8;
+		else { // version 1: no width
+			copy[4] = 1;
+			memmove(&copy[5], &copy[6], n - 6);
+			len = n - 1;
+		}
+		fp = fopen(damaged, "wb");
+		fwrite(copy, 1, len, fp);
+		fclose(fp);
+		free(copy);
+		struct phrase_blocks * pb = file_to_phrase_blocks(damaged);
+		if (k < 8 && pb != NULL)
+			failed = check_fail(ctx, "%s is read as phrase blocks", what[k]);
+		if (k == 8 && (pb == NULL) != (sizeof(pos_t) != 8))
+			failed = check_fail(ctx, "a version 1 file is %s", pb == NULL ? "not read" : "read with 4-byte positions");
+		if (pb != NULL)
+			free_phrase_blocks(pb);
+	}
+	remove(damaged);
+	free(file);
+	return failed;
+}
+
+static int check_blocks(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.sv = 4;
+	if (check_generate(ctx, "blocks", 50000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	char filename[CHECK_PATH];
+	check_path(ctx, filename, "blocks.blk");
+	struct parse_options parse = { 3, 1 };
+	csb * comp_source = compress_bins_ext(data.tree, data.reference, data.source, 2, &parse);
+	struct phrase_blocks * blocks = build_phrase_blocks(comp_source, 1);
+	phrase_blocks_to_file(blocks, filename);
+	struct phrase_blocks * stored = file_to_phrase_blocks(filename);
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	pos_t len = data.source_len, i, t;
+	int failed = stored == NULL ? check_fail(ctx, "%s cannot be read", filename) : 0, k;
+	for (k = 0; k < 2 && !failed; ++k) {
+		struct phrase_blocks * pb = k ? stored : blocks;
+		const char * what = k ? "file" : "memory";
+		for (i = 0; i < len && !failed; ++i)
+			if (access_blocks(data.reference, pb, i) != data.source[i])
+				failed = check_fail(ctx, "%s: access_blocks(%lld) differs from the source", what, (long long)i);
+		for (t = 0; t < 1000 && !failed; ++t) {
+			pos_t from = rng_below(&rng, len), n = rng_below(&rng, 3000), expected = (n < len - from) ? n : len - from;
+			char * res = access_blocks_range(data.reference, pb, from, n);
+			if ((pos_t)strlen(res) != expected || memcmp(res, &data.source[from], expected) != 0)
+				failed = check_fail(ctx, "%s: access_blocks_range(%lld, %lld) differs from the source", what, (long long)from, (long long)n);
+			free(res);
+		}
+		pos_t outside[] = { -1, -1000, len, len + 1000 };
+		for (t = 0; t < 4 && !failed; ++t) {
+			char * res = access_blocks_range(data.reference, pb, outside[t], 10);
+			if (access_blocks(data.reference, pb, outside[t]) != '\0' || res[0] != '\0')
+				failed = check_fail(ctx, "%s: position %lld is out of the source but it is accessed", what, (long long)outside[t]);
+			free(res);
+		}
+	}
+	if (!failed)
+		failed = check_damaged_blocks(ctx, filename, blocks->num_blocks);
+	free_phrase_blocks(blocks);
+	if (stored != NULL)
+		free_phrase_blocks(stored);
+	remove(filename);
+	free_csb(comp_source);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_files(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	if (check_generate(ctx, "files", 20000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	char filename[CHECK_PATH], csb_filename[CHECK_PATH];
+	check_path(ctx, filename, "files.bad");
+	check_path(ctx, csb_filename, "files.csb");
+	csb * comp_source = compress_bins(data.tree, data.reference, data.source, 1);
+	csb_to_file(comp_source, csb_filename);
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	int failed = 0, k;
+	long long j;
+	for (k = 0; k < 6 && !failed; ++k) {
+		FILE * fp;
+		const char * what[] = { "phrase blocks", "random bytes", "an empty file", "a .csb file cut in its header", 
+			"a .csb file cut in its phrases", "a headerless file with a huge size" };
+		if (k == 0) {
+			struct phrase_blocks * blocks = build_phrase_blocks(comp_source, 1);
+			phrase_blocks_to_file(blocks, filename);
+			free_phrase_blocks(blocks);
+		}
+		else if (k == 3 || k == 4) {
+			FILE * in = fopen(csb_filename, "rb");
+			fp = fopen(filename, "wb");
+			long long cut = (k == 3) ? 10 : 200;
+			for (j = 0; j < cut; ++j)
+				fputc(fgetc(in), fp);
+			fclose(in);
+			fclose(fp);
+		}
+		else {
+			fp = fopen(filename, "wb");
+			if (k == 1)
+				for (j = 0; j < 4096; ++j)
+					fputc((int)rng_below(&rng, 256), fp);
+			if (k == 5) {
+				int header[2] = { 0x7fffffff, 1 };
+				fwrite(header, sizeof(int), 2, fp);
+				fwrite(header, sizeof(int), 2, fp);
+			}
+			fclose(fp);
+		}
+		csb * stored = file_to_csb(filename);
+		if (stored != NULL) {
+			failed = check_fail(ctx, "%s is read as a compressed source of %lld phrases", what[k], (long long)stored->size);
+			free_csb(stored);
+		}
+	}
+	remove(filename);
+	remove(csb_filename);
+	free_csb(comp_source);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_search(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.005;
+	opt.sv = 4;
+	if (check_generate(ctx, "search", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	struct parse_options snp_run = { 3, 0 }, reverse = { 0, 1 };
+	// a source of one base finds no occurrence of longer patterns
+	char * one = calloc(2 + 1 + LOAD_TAIL, 1);
+	strcpy(one, "A$");
+	csb * sources[4];
+	sources[0] = compress_bins(data.tree, data.reference, data.source, 4);
+	sources[1] = compress_bins_ext(data.tree, data.reference, data.source, 2, &snp_run);
+	sources[2] = compress_bins_ext(data.tree, data.reference, data.source, 2, &reverse);
+	sources[3] = compress_bins(data.tree, data.reference, one, 1);
+
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	pos_t len = data.source_len - 1, t, i, k;
+	pos_t * expected = malloc(len * sizeof(pos_t));
+	char pattern[41];
+	int failed = 0, s;
+	for (t = 0; t < 300 && !failed; ++t) {
+		pos_t m = 4 + rng_below(&rng, 37), num = 0;
+		if (t % 4 == 3) {
+			for (i = 0; i < m; ++i)
+				pattern[i] = "ACGT"[rng_below(&rng, 4)];
+		}
+		else
+			memcpy(pattern, &data.source[rng_below(&rng, len - m + 1)], m);
+		pattern[m] = '\0';
+		for (i = 0; i + m <= len; ++i)
+			if (memcmp(&data.source[i], pattern, m) == 0)
+				expected[num++] = i;
+		struct search_result * results = search_sources(data.tree, data.reference, sources, 4, pattern, 2);
+		for (s = 0; s < 4 && !failed; ++s) {
+			pos_t found = s < 3 ? num : 0;
+			if (results[s].count != found)
+				failed = check_fail(ctx, "source %d: %lld occurrences of %s instead of %lld", s, (long long)results[s].count, pattern, (long long)found);
+			for (k = 0; k < results[s].count && !failed; ++k)
+				if (results[s].positions[k] != expected[k])
+					failed = check_fail(ctx, "source %d: occurrence %lld of %s at %lld instead of %lld", s, (long long)k, pattern, 
+						(long long)results[s].positions[k], (long long)expected[k]);
+		}
+		free_search_results(results, 4);
+	}
+	free(expected);
+	for (s = 0; s < 4; ++s)
+		free_csb(sources[s]);
+	free(one);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_same_tree(struct check_context * ctx, const char * what, char * text, SuffixTree * expected, SuffixTree * found) {
+/* This function walks both trees side by side, with a stack since repeats make them deep, and compares the edge labels,
+suffix indexes and children of every pair of nodes. It returns 0, or 1 at the first difference. */
+	Node ** stack = malloc(4 * (expected->size + 1) * sizeof(Node *));
+	pos_t sp = 0;
+	int failed = 0;
+	stack[sp++] = expected->root;
+	stack[sp++] = found->root;
+	while (sp > 0 && !failed) {
+		Node * f = stack[--sp], * e = stack[--sp];
+		int es, fs;
+		pos_t len = e == expected->root ? 0 : edgeLength(e);
+		if (e != expected->root && (edgeLength(f) != len || memcmp(&text[e->start], &text[f->start], len) != 0))
+			failed = check_fail(ctx, "%s: edge [%lld, %lld] instead of [%lld, %lld]", what, (long long)f->start, (long long)*f->end,
+				(long long)e->start, (long long)*e->end);
+		else if (e->suffixIndex != f->suffixIndex)
+			failed = check_fail(ctx, "%s: suffix index %lld instead of %lld", what, (long long)f->suffixIndex, (long long)e->suffixIndex);
+		Node * ec = firstChild(expected, e, &es), * fc = firstChild(found, f, &fs);
+		for (; ec != NULL && fc != NULL && !failed; ec = nextChild(expected, e, ec, &es), fc = nextChild(found, f, fc, &fs)) {
+			stack[sp++] = ec;
+			stack[sp++] = fc;
+		}
+		if (!failed && (ec != NULL || fc != NULL))
+			failed = check_fail(ctx, "%s: a node at %lld has other children", what, (long long)e->start);
+	}
+	free(stack);
+	return failed;
+}
+
+static int check_tree(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	if (check_generate(ctx, "tree", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	pos_t len = 50000, i;
+	char * texts[3];
+	const char * names[3] = { "reference", "satellite", "AC repeat" };
+	texts[0] = data.reference;
+	// a satellite of AGGCT in the middle of the reference, and a text of AC only
+	texts[1] = strdup(data.reference);
+	for (i = 0; i < 30000; ++i)
+		texts[1][20000 + i] = "AGGCT"[i % 5];
+	texts[2] = malloc(len + 2);
+	for (i = 0; i < len; ++i)
+		texts[2][i] = "AC"[i % 2];
+	texts[2][len] = '$';
+	texts[2][len + 1] = '\0';
+	int failed = 0, t, threads;
+	for (t = 0; t < 3 && !failed; ++t) {
+		SuffixTree * expected = t ? buildSuffixTree(texts[t], 1) : data.tree;
+		for (threads = 2; threads <= 4 && !failed; threads += 2) {
+			char what[64];
+			snprintf(what, sizeof(what), "%s, %d threads", names[t], threads);
+			SuffixTree * found = buildSuffixTreeParallel(texts[t], threads);
+			failed = check_same_tree(ctx, what, texts[t], expected, found);
+			freeSuffixTree(found);
+		}
+		if (t)
+			freeSuffixTree(expected);
+	}
+	free(texts[1]);
+	free(texts[2]);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_kernel_level(struct check_context * ctx, int level, struct check_data * data, csb * expected) {
+/* This function compares the kernels of -level- (already selected) with the portable loops on random inputs, 
+then parses the strain of -data- with the reverse strand and compares it with -expected-, the parse of the portable kernels. */
+	struct rng rng;
+	rng_seed(&rng, ctx->seed + level);
+	const char * bases = "ACGTacgtNn$";
+	pos_t len = 4096, j, k, t;
+	char * a = malloc(len);
+	char * dst = malloc(len);
+	pos_t keys[CPU_RANK_MAX + 8];
+	int failed = 0;
+	for (j = 0; j < len; ++j)
+		a[j] = bases[rng_below(&rng, 4)];
+	for (t = 0; t < 2000 && !failed; ++t) {
+		// b is a copy of a part of a with a few differences, allocated with only the tail of load_file after it
+		pos_t start = rng_below(&rng, len), n = 1 + rng_below(&rng, len - start < 300 ? len - start : 300);
+		pos_t b_len = rng_below(&rng, n + 1), expected_match;
+		char * b = calloc(b_len + 1 + LOAD_TAIL, 1);
+		memcpy(b, &a[start], b_len);
+		for (k = rng_below(&rng, 3); k > 0 && b_len > 0; --k)
+			b[rng_below(&rng, b_len)] = 'N';
+		for (expected_match = 0; expected_match < n && a[start + expected_match] == b[expected_match]; ++expected_match);
+		if (cpu_match(&a[start], b, n) != expected_match)
+			failed = check_fail(ctx, "%s: cpu_match gives %lld instead of %lld", cpu_level_name(level), (long long)cpu_match(&a[start], b, n), (long long)expected_match);
+		free(b);
+
+		pos_t num = rng_below(&rng, CPU_RANK_MAX + 8), key = rng_below(&rng, 1000), count = 0;
+		for (k = 0; k < num; ++k) {
+			keys[k] = (k ? keys[k - 1] : 0) + rng_below(&rng, 60);
+			count += keys[k] <= key;
+		}
+		if (!failed && cpu_rank(keys, num, key) != count)
+			failed = check_fail(ctx, "%s: cpu_rank gives %lld instead of %lld", cpu_level_name(level), (long long)cpu_rank(keys, num, key), (long long)count);
+
+		pos_t rc_len = rng_below(&rng, 200), end = rc_len + rng_below(&rng, len - rc_len);
+		for (k = 0; k < rc_len; ++k)
+			a[end - k] = bases[rng_below(&rng, 11)];
+		cpu_reverse_complement(dst, &a[end], rc_len);
+		for (k = 0; k < rc_len && !failed; ++k)
+			if (dst[k] != complement_base(a[end - k]))
+				failed = check_fail(ctx, "%s: cpu_reverse_complement gives %c for %c", cpu_level_name(level), dst[k], a[end - k]);
+		for (k = 0; k < rc_len; ++k)
+			a[end - k] = bases[rng_below(&rng, 4)];
+	}
+	free(a);
+	free(dst);
+
+	if (!failed) {
+		struct parse_options parse = { 3, 1 };
+		csb * comp_source = compress_bins_ext(data->tree, data->reference, data->source, 2, &parse);
+		char * decompressed = decompress_bins(data->reference, comp_source);
+		failed = check_same_csb(ctx, cpu_level_name(level), expected, comp_source);
+		if (!failed && strcmp(decompressed, data->source) != 0)
+			failed = check_fail(ctx, "%s: decompress_bins differs from the source", cpu_level_name(level));
+		free(decompressed);
+		free_csb(comp_source);
+	}
+	return failed;
+}
+
+static int check_kernels(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.sv = 4;
+	if (check_generate(ctx, "kernels", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	int selected = cpu_level(), top = cpu_detect(), level, failed = 0;
+	// the parse of the portable kernels is the one every level is compared with
+	struct parse_options parse = { 3, 1 };
+	cpu_select(CPU_PORTABLE);
+	csb * expected = compress_bins_ext(data.tree, data.reference, data.source, 2, &parse);
+	for (level = CPU_PORTABLE; level <= top && !failed; ++level) {
+		cpu_select(level);
+		failed = check_kernel_level(ctx, level, &data, expected);
+	}
+	cpu_select(selected);
+	free_csb(expected);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_multi_reference_parse(struct check_context * ctx, struct check_data * data, char * source, pos_t source_len) {
+/* Compresses -source- against the references of -data- (in that order), checks the table, the parse and its .csb file, and
+that check_references refuses other lists. It returns 0, or 1 at the first difference. */
+	char list[3 * CHECK_PATH + 2], csb_filename[CHECK_PATH];
+	struct ref_table * refs;
+	int failed = 0, k, r;
+	pos_t p;
+	snprintf(list, sizeof(list), "%s,%s,%s", data[0].reference_filename, data[1].reference_filename, data[2].reference_filename);
+	char * reference = load_references(list, &refs);
+	if (reference == NULL || refs == NULL || refs->num != 3)
+		failed = check_fail(ctx, "load_references does not index the three references of %s", list);
+	for (r = 0; r < 3 && !failed; ++r) {
+		pos_t start = refs->starts[r], len = refs->starts[r + 1] - start - 1;
+		if (len != data[r].reference_len || memcmp(&reference[start], data[r].reference, len) != 0 || reference[start + len] != REF_SEPARATOR)
+			failed = check_fail(ctx, "reference %d is not at [%lld, %lld) followed by a separator", r, (long long)start, (long long)(start + len));
+		else if (find_reference(refs, start) != r || find_reference(refs, start + len) != r)
+			failed = check_fail(ctx, "find_reference does not give reference %d from %lld to %lld", r, (long long)start, (long long)(start + len));
+	}
+	check_path(ctx, csb_filename, "references.csb");
+	for (k = 0; k < 2 && !failed; ++k) {
+		struct parse_options parse = { 0, k };
+		SuffixTree * tree = buildSuffixTree(reference, 1);
+		csb * comp_source = compress_bins_ext(tree, reference, source, 2, &parse);
+		freeSuffixTree(tree);
+		comp_source->refs = refs;
+		failed = check_access(ctx, k ? "reverse strand" : "forward strand", reference, comp_source, source, source_len, 100);
+		// the forward phrases (the reverse ones are read backwards) are copied from one reference, and the middle one gives few bases
+		pos_t bases[3] = { 0, 0, 0 };
+		for (p = 1; p < comp_source->size && !failed; ++p) {
+			pos_t len = comp_source->lens->arr[p] - comp_source->lens->arr[p - 1] - 1;
+			r = phrase_reference(comp_source, p);
+			bases[r] += len;
+			if (len > 0 && !PHRASE_IS_REVERSE(comp_source, p) && comp_source->starts[p] + len > refs->starts[r + 1] - 1)
+				failed = check_fail(ctx, "phrase %lld runs from reference %d into the next one", (long long)p, r);
+		}
+		if (!failed && bases[1] * 10 > source_len)
+			failed = check_fail(ctx, "%lld bases copied from the reference the source is not made of", (long long)bases[1]);
+		if (!failed) {
+			csb_to_file(comp_source, csb_filename);
+			csb * stored = file_to_csb(csb_filename);
+			failed = check_same_csb(ctx, ".csb file", comp_source, stored);
+			if (!failed && (stored->refs == NULL || check_references(stored->refs, refs) != 0))
+				failed = check_fail(ctx, "the .csb file does not keep the table of references");
+			// the same files in another order, one file less, or a single reference (once, check_references prints why)
+			const char * lists[3][3] = { { data[1].reference_filename, data[0].reference_filename, data[2].reference_filename },
+				{ data[0].reference_filename, data[1].reference_filename, NULL }, { data[0].reference_filename, NULL, NULL } };
+			for (r = 0; r < 3 && !failed && k == 0; ++r) {
+				struct ref_table * other;
+				snprintf(list, sizeof(list), "%s%s%s%s%s", lists[r][0], lists[r][1] ? "," : "", lists[r][1] ? lists[r][1] : "", 
+					lists[r][2] ? "," : "", lists[r][2] ? lists[r][2] : "");
+				char * other_reference = load_references(list, &other);
+				if (check_references(stored->refs, other) == 0)
+					failed = check_fail(ctx, "check_references accepts %s", list);
+				unload_file(other_reference, 1);
+				free_ref_table(other);
+			}
+			if (stored != NULL)
+				free_csb(stored);
+		}
+		comp_source->refs = NULL;
+		free_csb(comp_source);
+	}
+	if (!failed) {
+		snprintf(list, sizeof(list), "%s,%s/missing.fsa", data[0].reference_filename, ctx->dir);
+		struct ref_table * other;
+		char * other_reference = load_references(list, &other);
+		if (other_reference != NULL || other != NULL)
+			failed = check_fail(ctx, "load_references reads a list with a missing file");
+	}
+	remove(csb_filename);
+	unload_file(reference, 1);
+	free_ref_table(refs);
+	return failed;
+}
+
+static int check_multi_reference(struct check_context * ctx) {
+	struct check_data data[3];
+	struct gen_options opt = check_gen_options(ctx);
+	const char * prefixes[3] = { "references_a", "references_b", "references_c" };
+	int failed = 0, r;
+	memset(data, 0, sizeof(data));
+	for (r = 0; r < 3 && !failed; ++r) {
+		opt.seed = ctx->seed + r;
+		failed = check_generate(ctx, prefixes[r], 30000, 0, &opt, &data[r]);
+	}
+	if (!failed) {
+		// a strain of the first reference followed by one of the third
+		pos_t first = data[0].source_len - 1, second = data[2].source_len - 1;
+		char * source = calloc(first + second + 2 + LOAD_TAIL, 1);
+		memcpy(source, data[0].source, first);
+		memcpy(&source[first], data[2].source, second + 1);
+		failed = check_multi_reference_parse(ctx, data, source, first + second + 1);
+		free(source);
+	}
+	for (r = 0; r < 3; ++r)
+		check_free_data(&data[r]);
+	return failed;
+}
+
+static int composition_code(char c) {
+/* The slot of c in the counts of composition.c: A, C, G, T, and N for anything else. */
+	const char * bases = "ACGT", * p = strchr(bases, c);
+	return (c != '\0' && p != NULL) ? (int)(p - bases) : 4;
+}
+
+static int check_same_counts(struct check_context * ctx, const char * what, pos_t from, pos_t len, char * source, pos_t * counts) {
+/* Compares counts with the composition of source[from, from+len). */
+	pos_t expected[COMPOSITION_BASES] = { 0, 0, 0, 0, 0 }, i;
+	int b;
+	for (i = from; i < from + len; ++i)
+		expected[composition_code(source[i])]++;
+	for (b = 0; b < COMPOSITION_BASES; ++b)
+		if (counts[b] != expected[b])
+			return check_fail(ctx, "%s of [%lld, %lld): %lld %c instead of %lld", what, (long long)from, (long long)(from + len), 
+				(long long)counts[b], "ACGTN"[b], (long long)expected[b]);
+	return 0;
+}
+
+static int check_composition(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.005;
+	opt.sv = 4;
+	if (check_generate(ctx, "composition", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	struct parse_options parses[3] = { { 0, 0 }, { 3, 0 }, { 0, 1 } };
+	int samples[3] = { 1, 7, COMPOSITION_SAMPLE }, failed = 0, k, s, t;
+	pos_t len = data.source_len, windows[3] = { 1, 37, 1000 };
+	pos_t * counts = malloc((len + 1) * COMPOSITION_BASES * sizeof(pos_t));
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	for (k = 0; k < 3 && !failed; ++k) {
+		csb * comp_source = compress_bins_ext(data.tree, data.reference, data.source, 2, &parses[k]);
+		for (s = 0; s < 3 && !failed; ++s) {
+			struct composition_index * index = composition_index_build(data.reference, samples[s]);
+			composition_range(index, data.reference, comp_source, 0, len, counts);
+			failed = check_same_counts(ctx, "composition_range", 0, len, data.source, counts);
+			for (t = 0; t < 300 && !failed; ++t) {
+				pos_t from = rng_below(&rng, len), n = rng_below(&rng, (t % 3 ? 200 : len) + 1);
+				if (n > len - from)
+					n = len - from;
+				composition_range(index, data.reference, comp_source, from, n, counts);
+				failed = check_same_counts(ctx, "composition_range", from, n, data.source, counts);
+			}
+			for (t = 0; t < 9 && !failed; ++t) {
+				pos_t window = windows[t % 3], from = rng_below(&rng, len), to = from + rng_below(&rng, (len - from) + 1), w, num;
+				if (t % 3 == 0 && to - from > 5000) // a window per position
+					to = from + 5000;
+				num = composition_windows(index, data.reference, comp_source, from, to, window, counts);
+				if (num != (to - from + window - 1) / window)
+					failed = check_fail(ctx, "%lld windows of %lld instead of %lld", (long long)num, (long long)window, (long long)((to - from + window - 1) / window));
+				for (w = 0; w < num && !failed; ++w) {
+					pos_t start = from + w * window;
+					failed = check_same_counts(ctx, "composition_windows", start, (start + window < to) ? window : to - start, 
+						data.source, &counts[w * COMPOSITION_BASES]);
+				}
+			}
+			composition_index_free(index);
+		}
+		free_csb(comp_source);
+	}
+	free(counts);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_diff_pair(struct check_context * ctx, const char * what, char * reference, csb * a, csb * b, char * text_a, char * text_b) {
+/* Compares diff_sources of a and b with the intervals where the texts they were compressed from differ. */
+	struct diff_interval * intervals, * expected = NULL;
+	struct diff_stats stats;
+	pos_t num = diff_sources(reference, a, b, &intervals, &stats), num_expected = 0, capacity = 0, i, differing = 0;
+	pos_t len_a = strlen(text_a) - 1, len_b = strlen(text_b) - 1, common = len_a < len_b ? len_a : len_b, longest = len_a + len_b - common;
+	int failed = 0;
+	for (i = 0; i < longest; ++i) {
+		if (i < common && text_a[i] == text_b[i])
+			continue;
+		differing++;
+		if (num_expected > 0 && expected[num_expected - 1].end == i)
+			expected[num_expected - 1].end = i + 1;
+		else {
+			if (num_expected == capacity) {
+				capacity = capacity ? 2 * capacity : 256;
+				expected = realloc(expected, capacity * sizeof(struct diff_interval));
+			}
+			expected[num_expected].start = i;
+			expected[num_expected++].end = i + 1;
+		}
+	}
+	if (num != num_expected)
+		failed = check_fail(ctx, "%s: %lld intervals instead of %lld", what, (long long)num, (long long)num_expected);
+	for (i = 0; i < num && !failed; ++i)
+		if (intervals[i].start != expected[i].start || intervals[i].end != expected[i].end)
+			failed = check_fail(ctx, "%s: interval [%lld, %lld) instead of [%lld, %lld)", what, (long long)intervals[i].start, 
+				(long long)intervals[i].end, (long long)expected[i].start, (long long)expected[i].end);
+	if (!failed && (stats.differing != differing || stats.skipped + stats.decoded != common))
+		failed = check_fail(ctx, "%s: %lld differing, %lld skipped and %lld decoded positions out of %lld, instead of %lld differing", what, 
+			(long long)stats.differing, (long long)stats.skipped, (long long)stats.decoded, (long long)common, (long long)differing);
+	free(intervals);
+	free(expected);
+	return failed;
+}
+
+static int check_diff(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.snp = 0.005;
+	opt.sv = 4;
+	if (check_generate(ctx, "diff", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	pos_t len = data.source_len - 1, i;
+	// the strain itself, with 200 substitutions, cut 500 bases short and with 20 bases inserted in the middle
+	char * texts[4];
+	const char * names[4] = { "the same strain", "substitutions", "a cut end", "an insertion" };
+	for (i = 0; i < 4; ++i) {
+		texts[i] = calloc(len + 20 + 2 + LOAD_TAIL, 1);
+		memcpy(texts[i], data.source, len + 1);
+	}
+	for (i = 0; i < 200; ++i) {
+		pos_t x = rng_below(&rng, len);
+		texts[1][x] = texts[1][x] == 'A' ? 'C' : 'A';
+		texts[2][x] = texts[1][x];
+	}
+	memcpy(&texts[2][len - 500], "$", 2);
+	memmove(&texts[3][len / 2 + 20], &texts[3][len / 2], len / 2 + 2);
+	for (i = 0; i < 20; ++i)
+		texts[3][len / 2 + i] = "ACGT"[rng_below(&rng, 4)];
+
+	struct parse_options parses[3] = { { 0, 0 }, { 3, 0 }, { 0, 1 } };
+	csb * compressed[3][4];
+	int failed = 0, k, t;
+	for (k = 0; k < 3; ++k)
+		for (t = 0; t < 4; ++t)
+			compressed[k][t] = compress_bins_ext(data.tree, data.reference, texts[t], 2, &parses[k]);
+	// every parse against itself, and the plain parse of the strain against the others
+	for (k = 0; k < 5 && !failed; ++k) {
+		int pa = k < 3 ? k : 0, pb = k < 3 ? k : k - 2;
+		for (t = 0; t < 4 && !failed; ++t) {
+			char what[128];
+			snprintf(what, sizeof(what), "%s, parses %d and %d", names[t], pa, pb);
+			failed = check_diff_pair(ctx, what, data.reference, compressed[pa][0], compressed[pb][t], texts[0], texts[t]);
+			if (!failed && t < 2 && pa == pb) {
+				struct diff_interval * intervals;
+				struct diff_stats stats;
+				diff_sources(data.reference, compressed[pa][0], compressed[pb][t], &intervals, &stats);
+				free(intervals);
+				if (stats.skipped < len / 2)
+					failed = check_fail(ctx, "%s: only %lld of %lld positions skipped", what, (long long)stats.skipped, (long long)len);
+			}
+		}
+	}
+	for (k = 0; k < 3; ++k)
+		for (t = 0; t < 4; ++t)
+			free_csb(compressed[k][t]);
+	for (i = 0; i < 4; ++i)
+		free(texts[i]);
+	check_free_data(&data);
+	return failed;
+}
+
+static int check_extract_output(struct check_context * ctx, char * filename, struct region * regions, pos_t num, char * source, int threads) {
+/* Reads the FASTA records written by extract_regions and compares them with the regions of the source. */
+	FILE * fp = fopen(filename, "r");
+	char * line = NULL, header[256];
+	size_t capacity = 0;
+	ssize_t n;
+	pos_t j;
+	int failed = fp == NULL ? check_fail(ctx, "%s cannot be read", filename) : 0;
+	for (j = 0; j < num && !failed; ++j) {
+		struct region * r = &regions[j];
+		pos_t len = r->end - r->start;
+		if (r->name != NULL)
+			snprintf(header, sizeof(header), ">%s\n", r->name);
+		else
+			snprintf(header, sizeof(header), ">%s:%lld-%lld\n", r->chrom, (long long)r->start, (long long)r->end);
+		if (getline(&line, &capacity, fp) == -1 || strcmp(line, header) != 0)
+			failed = check_fail(ctx, "%d threads: record %lld is not named %s", threads, (long long)j, header);
+		else if ((n = getline(&line, &capacity, fp)) != len + 1 || memcmp(line, &source[r->start], len) != 0)
+			failed = check_fail(ctx, "%d threads: record %lld differs from [%lld, %lld) of the source", threads, (long long)j,
+				(long long)r->start, (long long)r->end);
+	}
+	if (!failed && getline(&line, &capacity, fp) != -1)
+		failed = check_fail(ctx, "%d threads: more records than regions", threads);
+	free(line);
+	if (fp != NULL)
+		fclose(fp);
+	return failed;
+}
+
+static int check_extract(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.sv = 4;
+	if (check_generate(ctx, "extract", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	char bed_filename[CHECK_PATH], out_filename[CHECK_PATH];
+	check_path(ctx, bed_filename, "extract.bed");
+	check_path(ctx, out_filename, "extract.fa");
+	struct parse_options parse = { 3, 0 };
+	csb * comp_source = compress_bins_ext(data.tree, data.reference, data.source, 2, &parse);
+	struct rng rng;
+	rng_seed(&rng, ctx->seed);
+	pos_t len = data.source_len - 1, num, error_line, j;
+	pos_t sizes[3] = { 0, 2, 500 };
+	int threads[3] = { 1, 3, 8 }, failed = 0, k, t;
+	for (k = 0; k < 3 && !failed; ++k) {
+		FILE * fp = fopen(bed_filename, "w");
+		fprintf(fp, "# regions of the strain\ntrack name=check\nbrowser position chr1:1-100\n\n");
+		for (j = 0; j < sizes[k]; ++j) {
+			pos_t start = rng_below(&rng, len), end = start + rng_below(&rng, 2000);
+			if (j == 0)
+				start = end = 17; // an empty region
+			if (j == 1)
+				end = len; // the end of the source
+			if (end > len)
+				end = len;
+			if (j % 3 == 2)
+				fprintf(fp, "chr1\t%lld\t%lld\n", (long long)start, (long long)end);
+			else
+				fprintf(fp, "chr1\t%lld\t%lld\tregion_%lld\t0\t+\n", (long long)start, (long long)end, (long long)j);
+		}
+		fclose(fp);
+		struct region * regions = read_bed(bed_filename, &num, &error_line);
+		if (regions == NULL || num != sizes[k])
+			failed = check_fail(ctx, "read_bed gives %lld regions instead of %lld", (long long)num, (long long)sizes[k]);
+		for (t = 0; t < 3 && !failed; ++t) {
+			pos_t expected = 0, bases;
+			fp = fopen(out_filename, "w");
+			bases = extract_regions(data.reference, comp_source, regions, num, fp, threads[t]);
+			fclose(fp);
+			for (j = 0; j < num; ++j)
+				expected += regions[j].end - regions[j].start;
+			if (bases != expected)
+				failed = check_fail(ctx, "%d threads: %lld bases written instead of %lld", threads[t], (long long)bases, (long long)expected);
+			else
+				failed = check_extract_output(ctx, out_filename, regions, num, data.source, threads[t]);
+		}
+		free_regions(regions, num);
+	}
+	// a start after the end, a missing column and a position that is not a number, on line 3
+	const char * malformed[3] = { "chr1\t50\t40\n", "chr1\t50\n", "chr1\t5x\t40\n" };
+	for (k = 0; k < 3 && !failed; ++k) {
+		FILE * fp = fopen(bed_filename, "w");
+		fprintf(fp, "# comment\nchr1\t0\t10\n%s", malformed[k]);
+		fclose(fp);
+		struct region * regions = read_bed(bed_filename, &num, &error_line);
+		if (regions != NULL || error_line != 3)
+			failed = check_fail(ctx, "read_bed reads %s with error line %lld", malformed[k], (long long)error_line);
+		free_regions(regions, num);
+	}
+	if (!failed && (read_bed(ctx->dir, &num, &error_line) != NULL || error_line != 0)) // a directory is not a BED file
+		failed = check_fail(ctx, "read_bed reads a directory");
+	remove(bed_filename);
+	remove(out_filename);
+	free_csb(comp_source);
+	check_free_data(&data);
+	return failed;
+}
+
+static int compare_codes(const void * a, const void * b) {
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return (x > y) - (x < y);
+}
+
+static int check_sketch_kmers(struct check_context * ctx, struct rng * rng) {
+/* A sketch at scale 1 keeps every k-mer: compares its size with the distinct k-mers of a short text with runs of N. */
+	pos_t len = 3000, i, j, distinct = 0;
+	int k = 5, failed = 0;
+	char * text = calloc(len + 1, 1);
+	for (i = 0; i < len; ++i)
+		text[i] = (rng_below(rng, 100) == 0) ? 'N' : "ACGT"[rng_below(rng, 4)];
+	unsigned long long * codes = malloc(len * sizeof(unsigned long long));
+	for (i = 0; i + k <= len; ++i) {
+		unsigned long long code = 0;
+		for (j = 0; j < k && text[i + j] != 'N'; ++j)
+			code = (code << 2) | (strchr("ACGT", text[i + j]) - "ACGT");
+		if (j == k)
+			codes[distinct++] = code;
+	}
+	qsort(codes, distinct, sizeof(unsigned long long), compare_codes);
+	for (i = 0, j = 0; i < distinct; ++i)
+		if (j == 0 || codes[i] != codes[j - 1])
+			codes[j++] = codes[i];
+	struct sketch sk;
+	sketch_sequence(text, k, 1, 0, &sk);
+	if (sk.length != len || sk.num != j)
+		failed = check_fail(ctx, "sketch of %lld distinct %d-mers holds %lld hashes", (long long)j, k, (long long)sk.num);
+	for (i = 1; i < sk.num && !failed; ++i)
+		if (sk.hashes[i] <= sk.hashes[i - 1])
+			failed = check_fail(ctx, "sketch hashes are not sorted and distinct at %lld", (long long)i);
+	// at scale 10, the hashes below 2^64 / 10
+	struct sketch scaled;
+	sketch_sequence(text, k, 10, 0, &scaled);
+	for (i = 0, j = 0; i < sk.num; ++i)
+		j += (sk.hashes[i] <= ~0ULL / 10);
+	if (!failed && (scaled.num != j || sketch_common(&scaled, &sk) != j))
+		failed = check_fail(ctx, "sketch at scale 10 holds %lld hashes instead of %lld", (long long)scaled.num, (long long)j);
+	free_sketch(&scaled);
+	free_sketch(&sk);
+	free(codes);
+	free(text);
+	return failed;
+}
+
+static int check_same_sketch(struct check_context * ctx, const char * what, struct sketch * expected, struct sketch * found) {
+	if (found->num != expected->num || found->length != expected->length 
+		|| memcmp(found->hashes, expected->hashes, expected->num * sizeof(unsigned long long)) != 0)
+		return check_fail(ctx, "%s: %lld hashes of %lld bases instead of %lld of %lld", what, (long long)found->num, (long long)found->length, 
+			(long long)expected->num, (long long)expected->length);
+	return 0;
+}
+
+#define SELECT_CANDIDATES 5
+
+static int check_select(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	if (check_generate(ctx, "select", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	struct rng rng;
+	rng_seed(&rng, ctx->seed + 1); // not the stream of the reference, or the unrelated candidate would be a shifted copy of it
+	int failed = check_sketch_kmers(ctx, &rng), c, best = 0;
+	// candidates: unrelated, the reference with 3% and 0.5% SNPs, the reference and its reverse complement
+	pos_t len = data.reference_len, i;
+	double snps[SELECT_CANDIDATES] = { 0, 0.03, 0.005, 0, 0 };
+	char names[SELECT_CANDIDATES + 1][CHECK_PATH], * filenames[SELECT_CANDIDATES + 1];
+	struct sketch sketches[SELECT_CANDIDATES + 1], source_sketch, reverse_sketch;
+	pos_t phrases[SELECT_CANDIDATES];
+	double estimates[SELECT_CANDIDATES];
+	struct parse_options parse = { 0, 1 }; // the canonical sketches stand for compression on both strands
+	memset(sketches, 0, sizeof(sketches));
+	for (c = 0; c < SELECT_CANDIDATES && !failed; ++c) {
+		char * candidate = (c == 0) ? gen_reference(&rng, &opt, len) : malloc(len);
+		for (i = 0; i < len && c > 0; ++i) {
+			char base = (c == 4) ? "TGCA"[strchr("ACGT", data.reference[len - 1 - i]) - "ACGT"] : data.reference[i];
+			if (snps[c] > 0 && rng_double(&rng) < snps[c])
+				base = "ACGT"[(strchr("ACGT", base) - "ACGT" + 1 + rng_below(&rng, 3)) % 4];
+			candidate[i] = base;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "select_candidate%d.fsa", c);
+		check_path(ctx, names[c], name);
+		filenames[c] = names[c];
+		FILE * fp = fopen(names[c], "w");
+		if (fp == NULL) {
+			free(candidate);
+			failed = check_fail(ctx, "cannot write %s", names[c]);
+			break;
+		}
+		fwrite(candidate, 1, len, fp);
+		fclose(fp);
+		free(candidate);
+		char * reference = load_file(names[c], 1);
+		SuffixTree * tree = buildSuffixTree(reference, 1);
+		csb * comp_source = compress_bins_ext(tree, reference, data.source, 2, &parse);
+		phrases[c] = comp_source->size - 1;
+		free_csb(comp_source);
+		freeSuffixTree(tree);
+		unload_file(reference, 1);
+	}
+	check_path(ctx, names[SELECT_CANDIDATES], "select_missing.fsa");
+	filenames[SELECT_CANDIDATES] = names[SELECT_CANDIDATES];
+	if (!failed && sketch_files(filenames, SELECT_CANDIDATES + 1, SKETCH_K, SKETCH_SCALE, 1, sketches, 3) != SELECT_CANDIDATES)
+		failed = check_fail(ctx, "sketch_files does not report the missing file");
+	for (c = 0; c < SELECT_CANDIDATES && !failed; ++c) {
+		char * text = load_file(names[c], 0);
+		struct sketch sk;
+		sketch_sequence(text, SKETCH_K, SKETCH_SCALE, 1, &sk);
+		failed = check_same_sketch(ctx, names[c], &sk, &sketches[c]);
+		free_sketch(&sk);
+		unload_file(text, 0);
+	}
+	if (!failed) {
+		sketch_sequence(data.source, SKETCH_K, SKETCH_SCALE, 1, &source_sketch);
+		char * reverse = calloc(data.source_len, 1);
+		cpu_reverse_complement(reverse, &data.source[data.source_len - 2], data.source_len - 1);
+		sketch_sequence(reverse, SKETCH_K, SKETCH_SCALE, 1, &reverse_sketch);
+		failed = check_same_sketch(ctx, "canonical sketch of the reverse complement", &source_sketch, &reverse_sketch);
+		free(reverse);
+		for (c = 1; c < SELECT_CANDIDATES; ++c)
+			if (phrases[c] < phrases[best])
+				best = c;
+		c = select_reference(&source_sketch, sketches, SELECT_CANDIDATES, estimates);
+		// the reference and its reverse complement have the same estimate and about the same phrases
+		if (!failed && (estimates[3] != estimates[4] || phrases[c] > phrases[best] * 1.05))
+			failed = check_fail(ctx, "select_reference picks candidate %d with %lld phrases instead of %lld", c, (long long)phrases[c], 
+				(long long)phrases[best]);
+		for (c = 0; c < SELECT_CANDIDATES && !failed; ++c)
+			if (estimates[c] > 2 * phrases[c] || 2 * estimates[c] < phrases[c])
+				failed = check_fail(ctx, "candidate %d: %.0f phrases estimated, %lld actual", c, estimates[c], (long long)phrases[c]);
+		free_sketch(&source_sketch);
+		free_sketch(&reverse_sketch);
+	}
+	for (c = 0; c <= SELECT_CANDIDATES; ++c) {
+		free_sketch(&sketches[c]);
+		remove(names[c]);
+	}
+	check_free_data(&data);
+	return failed;
+}
+
+struct library_worker {
+	isrlz_source * src;
+	char * source; // the plain text the source was compressed from
+	unsigned long long seed;
+	long long errors; // queries that gave another text
+};
+
+static void * library_queries(void * arg) {
+/* Runs random isrlz_access and isrlz_extract queries with a query context of its own, as every thread of a program would. */
+	struct library_worker * w = (struct library_worker *)arg;
+	isrlz_query * query = isrlz_query_create(w->src);
+	long long length = isrlz_source_length(w->src), i, len, q;
+	char buffer[1000];
+	struct rng rng;
+	rng_seed(&rng, w->seed);
+	for (q = 0; q < 20000; ++q) {
+		i = rng_below(&rng, length);
+		if (q % 4 == 3) {
+			len = rng_below(&rng, sizeof(buffer));
+			long long written = isrlz_extract(query, i, len, buffer);
+			if (written != (len < length - i ? len : length - i) || memcmp(buffer, &w->source[i], written) != 0)
+				w->errors++;
+		}
+		else if (isrlz_access(query, i) != (unsigned char)w->source[i])
+			w->errors++;
+	}
+	isrlz_query_free(query);
+	return NULL;
+}
+
+static int check_library(struct check_context * ctx) {
+	struct check_data data;
+	struct gen_options opt = check_gen_options(ctx);
+	opt.sv = 4;
+	if (check_generate(ctx, "library", 100000, 0, &opt, &data) != 0) {
+		check_free_data(&data);
+		return 1;
+	}
+	int failed = 0, t;
+	long long length = data.source_len - 1;
+	char * text = malloc(length + 1), csb_filename[CHECK_PATH], c;
+	memcpy(text, data.source, length);
+	text[length] = '\0';
+	check_path(ctx, csb_filename, "library.csb");
+	isrlz_reference * ref = isrlz_reference_open(data.reference_filename);
+	if (ref == NULL)
+		failed = check_fail(ctx, "isrlz_reference_open cannot read %s", data.reference_filename);
+	else if (isrlz_source_compress(ref, text, 2, 3) != NULL)
+		failed = check_fail(ctx, "isrlz_source_compress compresses against a reference that is not indexed");
+	else if (isrlz_reference_index(ref, 1, 1) != 0)
+		failed = check_fail(ctx, "isrlz_reference_index fails");
+	isrlz_source * compressed = failed ? NULL : isrlz_source_compress(ref, text, 2, 3);
+	if (!failed && compressed == NULL)
+		failed = check_fail(ctx, "isrlz_source_compress fails");
+	if (!failed && isrlz_source_length(compressed) != length)
+		failed = check_fail(ctx, "isrlz_source_length %lld instead of %lld", isrlz_source_length(compressed), length);
+	if (!failed && isrlz_source_save(compressed, csb_filename) != 0)
+		failed = check_fail(ctx, "isrlz_source_save cannot write %s", csb_filename);
+	isrlz_source * src = failed ? NULL : isrlz_source_open(ref, csb_filename);
+	if (!failed && src == NULL)
+		failed = check_fail(ctx, "isrlz_source_open cannot read %s", csb_filename);
+	if (!failed && isrlz_source_phrases(src) != isrlz_source_phrases(compressed))
+		failed = check_fail(ctx, "%lld phrases read back instead of %lld", isrlz_source_phrases(src), isrlz_source_phrases(compressed));
+
+	// the threads share the source, every one with its own query context
+	struct library_worker workers[4];
+	pthread_t ids[4];
+	for (t = 0; t < 4 && !failed; ++t) {
+		workers[t].src = t % 2 ? src : compressed;
+		workers[t].source = text;
+		workers[t].seed = ctx->seed + t;
+		workers[t].errors = 0;
+		if (pthread_create(&ids[t], NULL, library_queries, &workers[t]) != 0)
+			failed = check_fail(ctx, "cannot start a thread");
+	}
+	while (--t >= 0) {
+		pthread_join(ids[t], NULL);
+		if (!failed && workers[t].errors > 0)
+			failed = check_fail(ctx, "thread %d: %lld queries differ from the strain", t, workers[t].errors);
+	}
+
+	if (!failed) {
+		isrlz_query * query = isrlz_query_create(src);
+		if (isrlz_access(query, -1) != -1 || isrlz_access(query, length) != -1)
+			failed = check_fail(ctx, "isrlz_access out of the source does not give -1");
+		else if (isrlz_extract(query, length, 10, &c) != 0 || isrlz_extract(query, length + 1, 10, &c) != -1 || isrlz_extract(query, 0, -1, &c) != -1)
+			failed = check_fail(ctx, "isrlz_extract out of the source does not give 0 or -1");
+		isrlz_query_free(query);
+	}
+	isrlz_source_free(src);
+	isrlz_source_free(compressed);
+	isrlz_reference_free(ref);
+	remove(csb_filename);
+	free(text);
+	check_free_data(&data);
+	return failed;
+}
+
+static struct {
+	const char * name;
+	int (*run)(struct check_context * ctx);
+} checks[] = {
+	{ "roundtrip", check_roundtrip },
+	{ "wide_offsets", check_wide_offsets },
+	{ "variants", check_variants },
+	{ "liftover", check_liftover },
+	{ "directory", check_directory },
+	{ "append", check_append },
+	{ "blocks", check_blocks },
+	{ "files", check_files },
+	{ "search", check_search },
+	{ "tree", check_tree },
+	{ "kernels", check_kernels },
+	{ "library", check_library },
+	{ "references", check_multi_reference },
+	{ "composition", check_composition },
+	{ "diff", check_diff },
+	{ "select", check_select },
+	{ "extract", check_extract },
+};
+
+static void usage() {
+	printf("Usage: isrlz test check [--seed S] [--only LIST] \n");
+	printf("  --seed S     seed of the generated inputs (default 42) \n");
+	printf("  --only LIST  comma separated checks to run, out of: ");
+	int c, num = sizeof(checks) / sizeof(checks[0]);
+	for (c = 0; c < num; ++c)
+		printf("%s%s", c ? "," : "", checks[c].name);
+	printf(" \n");
+}
+
+static int in_list(const char * list, const char * name) {
+	size_t len = strlen(name);
+	const char * p;
+	for (p = list; p != NULL; p = strchr(p, ',')) {
+		if (*p == ',')
+			p++;
+		if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+	}
+	return 0;
+}
+
+static void remove_dir(char * dir) {
+/* Removes the temporary directory of the suite and the files a failed check left in it. */
+	char path[CHECK_PATH];
+	struct dirent * ent;
+	DIR * d = opendir(dir);
+	if (d != NULL) {
+		while ((ent = readdir(d)) != NULL) {
+			if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			remove(path);
+		}
+		closedir(d);
+	}
+	remove(dir);
+}
+
+int check_main(int argc, char * argv[]) {
+/* Entry point of 'test check'. It runs the checks and returns 0 if all of them pass, 1 otherwise. */
+	struct check_context ctx;
+	char * only = NULL;
+	int a, c, num = sizeof(checks) / sizeof(checks[0]), run = 0, failed = 0;
+	ctx.seed = 42;
+	for (a = 0; a < argc; a += 2) {
+		if (a + 1 >= argc) {
+			printf("Missing value for %s \n", argv[a]);
+			usage();
+			return 1;
+		}
+		if (strcmp(argv[a], "--seed") == 0)
+			ctx.seed = strtoull(argv[a + 1], NULL, 10);
+		else if (strcmp(argv[a], "--only") == 0)
+			only = argv[a + 1];
+		else {
+			printf("Unknown option %s \n", argv[a]);
+			usage();
+			return 1;
+		}
+	}
+	const char * tmp = getenv("TMPDIR");
+	snprintf(ctx.dir, sizeof(ctx.dir), "%s/isrlz_check_XXXXXX", tmp != NULL ? tmp : "/tmp");
+	if (mkdtemp(ctx.dir) == NULL) {
+		printf("Error. Cannot create a temporary directory in %s \n", tmp != NULL ? tmp : "/tmp");
+		return 1;
+	}
+	for (c = 0; c < num; ++c) {
+		if (only != NULL && !in_list(only, checks[c].name))
+			continue;
+		ctx.name = checks[c].name;
+		uint64_t start = bench_now_ns();
+		int result = checks[c].run(&ctx);
+		printf("%-16s %s (%.2fs) \n", checks[c].name, result ? "FAILED" : "ok", (bench_now_ns() - start) / 1e9);
+		fflush(stdout);
+		run++;
+		failed += result != 0;
+	}
+	remove_dir(ctx.dir);
+	if (run == 0) {
+		printf("No check matches %s \n", only);
+		usage();
+		return 1;
+	}
+	printf("%d checks, %d failed \n", run, failed);
+	return failed != 0;
+}
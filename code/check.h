@@ -0,0 +1 @@
+int check_main(int argc, char * argv[]);
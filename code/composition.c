@@ -0,0 +1,147 @@
+/*
+Composition module answers base composition queries (counts of A, C, G, T and N, hence GC content) over ranges of a
+compressed source without extracting them.
+
+The composition index keeps, every 'sample' positions of the reference, the number of each base before that position,
+so the composition of any reference span costs two lookups and a scan of less than 2 * sample characters.
+The composition of a source range is then the sum, phrase by phrase, of the reference spans that the phrases copy
+(complemented for reverse phrases), plus their mismatch characters, corrected by the exceptions of the tolerant parse.
+Its cost is proportional to the phrases in the range, not to its length.
+composition_windows walks the phrases once for a whole track of consecutive windows (GC content per window).
+
+Functions:
+composition_index_build
+composition_index_free
+composition_range
+composition_windows
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "composition.h"
+#include "mem.h"
+#include "trace.h"
+
+static int base_code(char c) {
+/* A, C, G and T are 0 to 3, and any other character is counted as N. */
+	switch (c) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+		default: return 4;
+	}
+}
+
+struct composition_index * composition_index_build(char * reference, int sample) {
+/* This function returns the composition index of reference, with prefix counts every -sample- positions.
+It takes COMPOSITION_BASES * 8 / sample bytes per reference base, counted as reference memory. */
+	struct trace_span span = trace_begin("composition index");
+	struct composition_index * index = malloc(sizeof(struct composition_index));
+	pos_t len = strlen(reference), i;
+	pos_t num_samples = len / sample + 1;
+	index->length = len;
+	index->sample = sample;
+	index->counts = calloc(num_samples * COMPOSITION_BASES, sizeof(pos_t));
+	mem_alloc(MEM_REFERENCE, num_samples * COMPOSITION_BASES * sizeof(pos_t));
+	pos_t running[COMPOSITION_BASES] = { 0, 0, 0, 0, 0 };
+	for (i = 0; i < len; ++i) {
+		if (i % sample == 0)
+			memcpy(&index->counts[i / sample * COMPOSITION_BASES], running, sizeof(running));
+		running[base_code(reference[i])]++;
+	}
+	if (len % sample == 0)
+		memcpy(&index->counts[len / sample * COMPOSITION_BASES], running, sizeof(running));
+	trace_end(span, len);
+	return index;
+}
+
+void composition_index_free(struct composition_index * index) {
+	if (index == NULL)
+		return;
+	mem_release(MEM_REFERENCE, (index->length / index->sample + 1) * COMPOSITION_BASES * sizeof(pos_t));
+	free(index->counts);
+	free(index);
+}
+
+static void add_prefix(struct composition_index * index, char * reference, pos_t x, int sign, int reverse, pos_t * counts) {
+/* This function adds (sign 1) or subtracts (sign -1) the composition of reference[0, x) to counts, complemented if -reverse- is set. */
+	pos_t k = x / index->sample, j;
+	pos_t * sampled = &index->counts[k * COMPOSITION_BASES];
+	int b;
+	for (b = 0; b < COMPOSITION_BASES; ++b)
+		counts[(reverse && b < 4) ? 3 - b : b] += sign * sampled[b];
+	for (j = k * index->sample; j < x; ++j) {
+		b = base_code(reference[j]);
+		counts[(reverse && b < 4) ? 3 - b : b] += sign;
+	}
+}
+
+static pos_t add_phrases(struct composition_index * index, char * reference, csb * comp_source, pos_t i, pos_t len, pos_t phrase, pos_t * counts) {
+/* This function adds the composition of source[i, i+len) to counts, -phrase- being the phrase that contains position i.
+It returns the phrase that contains position i+len, so consecutive ranges do not need another predecessor query. */
+	pos_t * lens = comp_source->lens->arr, end = i + len, pos = i, e;
+	while (pos < end && phrase < comp_source->size) {
+		pos_t base = lens[phrase - 1], stop = lens[phrase], s = comp_source->starts[phrase];
+		int reverse = PHRASE_IS_REVERSE(comp_source, phrase);
+		pos_t n = ((stop - 1 < end) ? stop - 1 : end) - pos;
+		if (n > 0) {
+			// the copied part of the phrase in [pos, pos+n) is reference[s+off, s+off+n), or reference[s-off-n+1, s-off] read backwards
+			pos_t off = pos - base;
+			add_prefix(index, reference, reverse ? s - off + 1 : s + off + n, 1, reverse, counts);
+			add_prefix(index, reference, reverse ? s - off - n + 1 : s + off, -1, reverse, counts);
+			if (comp_source->exception_index != NULL) {
+				for (e = comp_source->exception_index[phrase]; e < comp_source->exception_index[phrase + 1]; ++e) {
+					pos_t x = comp_source->exception_pos[e];
+					if (x < pos || x >= pos + n)
+						continue;
+					int copied = base_code(reference[reverse ? s - (x - base) : s + (x - base)]);
+					counts[(reverse && copied < 4) ? 3 - copied : copied]--;
+					counts[base_code(comp_source->exception_chars[e])]++;
+				}
+			}
+			pos += n;
+		}
+		if (pos < end && pos == stop - 1) {
+			counts[base_code(comp_source->mismatches[phrase])]++;
+			pos++;
+		}
+		if (pos == stop)
+			phrase++;
+	}
+	return phrase;
+}
+
+void composition_range(struct composition_index * index, char * reference, csb * comp_source, pos_t i, pos_t len, pos_t * counts) {
+/* This function stores in counts (COMPOSITION_BASES entries: A, C, G, T and N) the composition of source[i, i+len). */
+	memset(counts, 0, COMPOSITION_BASES * sizeof(pos_t));
+	if (len <= 0)
+		return;
+	pos_t phrase = predecessor(comp_source->lens, i, comp_source->size) + 1;
+	add_phrases(index, reference, comp_source, i, len, phrase, counts);
+}
+
+pos_t composition_windows(struct composition_index * index, char * reference, csb * comp_source, pos_t from, pos_t to, pos_t window, pos_t * counts) {
+/* This function stores in counts the composition of the consecutive windows of -window- characters that cover source[from, to)
+(the last one may be shorter), COMPOSITION_BASES entries per window, and returns the number of windows.
+counts must hold (to - from + window - 1) / window windows. Only the first window needs a predecessor query. */
+	struct trace_span span = trace_begin("composition windows");
+	pos_t w = 0, start;
+	if (from >= to) {
+		trace_end(span, 0);
+		return 0;
+	}
+	pos_t phrase = predecessor(comp_source->lens, from, comp_source->size) + 1;
+	memset(counts, 0, (to - from + window - 1) / window * COMPOSITION_BASES * sizeof(pos_t));
+	for (start = from; start < to; start += window, ++w)
+		phrase = add_phrases(index, reference, comp_source, start, (start + window < to) ? window : to - start, phrase, &counts[w * COMPOSITION_BASES]);
+	trace_end(span, to - from);
+	return w;
+}
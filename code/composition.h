@@ -0,0 +1,13 @@
+#define COMPOSITION_BASES 5 // A, C, G, T and N
+#define COMPOSITION_SAMPLE 64 // reference positions between two prefix counts
+
+struct composition_index {
+	pos_t length; // of the reference
+	int sample;
+	pos_t * counts; // COMPOSITION_BASES counts of reference[0, k*sample) for every k
+};
+
+struct composition_index * composition_index_build(char * reference, int sample);
+void composition_index_free(struct composition_index * index);
+void composition_range(struct composition_index * index, char * reference, csb * comp_source, pos_t i, pos_t len, pos_t * counts);
+pos_t composition_windows(struct composition_index * index, char * reference, csb * comp_source, pos_t from, pos_t to, pos_t window, pos_t * counts);
@@ -0,0 +1,302 @@
+/*
+Cpu module binds the vectorized kernels of the hot loops to the instruction sets of the machine, at run time,
+so a single baseline x86-64 binary uses SSE4.2, AVX2 or AVX-512 wherever they are available.
+
+cpu_init detects the level (cpu_detect) and sets the function pointers below, which start on the portable kernels,
+so code that runs before cpu_init (or on other architectures) is still correct. The ISRLZ_CPU environment variable
+('portable', 'sse2', 'sse4.2', 'avx2' or 'avx512') caps the level: the fallbacks can be checked on the same binary
+and the same machine, and a level above what the machine supports is never selected.
+The kernels are compiled with target attributes, so the Makefile needs no ISA flags.
+
+cpu_match      common prefix of two strings (the edge comparison of find_substring)
+cpu_rank       number of keys not greater than a key (the search inside a bin of predecessor)
+cpu_reverse_complement   the copy of reverse phrases (access_bins_range and decompress_bins)
+Forward phrases are copied with memcpy, which the C library already dispatches in the same way.
+
+Functions:
+cpu_detect
+cpu_init
+cpu_select
+cpu_level
+cpu_level_name
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CPU_X86
+#include <immintrin.h>
+#endif
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "cpu.h"
+
+static const char * level_names[CPU_LEVELS] = { "portable", "sse2", "sse4.2", "avx2", "avx512" };
+static int selected = -1;
+
+static pos_t match_portable(const char * a, const char * b, pos_t n) {
+	pos_t j = 0;
+	while (j < n && a[j] == b[j])
+		++j;
+	return j;
+}
+
+static pos_t rank_portable(const pos_t * arr, pos_t n, pos_t key) {
+	pos_t j, count = 0;
+	for (j = 0; j < n; ++j)
+		count += arr[j] <= key;
+	return count;
+}
+
+static void reverse_complement_portable(char * dst, const char * src, pos_t len) {
+	pos_t j;
+	for (j = 0; j < len; ++j)
+		dst[j] = complement_base(src[-j]);
+}
+
+pos_t (*cpu_match)(const char * a, const char * b, pos_t n) = match_portable;
+pos_t (*cpu_rank)(const pos_t * arr, pos_t n, pos_t key) = rank_portable;
+void (*cpu_reverse_complement)(char * dst, const char * src, pos_t len) = reverse_complement_portable;
+
+#ifdef CPU_X86
+
+static pos_t match_sse2(const char * a, const char * b, pos_t n) {
+/* Only b (the source) can end before n, at its terminator, which differs from a. The loads of b go at most 15 bytes past it,
+into the LOAD_TAIL zero bytes that load_file and the other builders of sources leave after the text. */
+	pos_t j = 0;
+	while (j < n) {
+		if (j + 16 <= n) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(a + j)), y = _mm_loadu_si128((const __m128i *)(b + j));
+			unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xffff;
+			if (diff)
+				return j + __builtin_ctz(diff);
+			j += 16;
+			continue;
+		}
+		if (a[j] != b[j])
+			return j;
+		++j;
+	}
+	return n;
+}
+
+__attribute__((target("sse4.2")))
+static pos_t match_sse42(const char * a, const char * b, pos_t n) {
+	pos_t j = 0;
+	while (j < n) {
+		if (j + 16 <= n) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(a + j)), y = _mm_loadu_si128((const __m128i *)(b + j));
+			int first = _mm_cmpestri(x, 16, y, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_EACH | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+			if (first < 16)
+				return j + first;
+			j += 16;
+			continue;
+		}
+		if (a[j] != b[j])
+			return j;
+		++j;
+	}
+	return n;
+}
+
+__attribute__((target("avx2")))
+static pos_t match_avx2(const char * a, const char * b, pos_t n) {
+	pos_t j = 0;
+	while (j < n) {
+		if (j + 32 <= n) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(a + j)), y = _mm256_loadu_si256((const __m256i *)(b + j));
+			unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+			if (diff)
+				return j + __builtin_ctz(diff);
+			j += 32;
+			continue;
+		}
+		if (a[j] != b[j])
+			return j;
+		++j;
+	}
+	return n;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static pos_t match_avx512(const char * a, const char * b, pos_t n) {
+	pos_t j = 0;
+	while (j < n) {
+		if (j + 64 <= n) {
+			__m512i x = _mm512_loadu_si512((const void *)(a + j)), y = _mm512_loadu_si512((const void *)(b + j));
+			unsigned long long diff = _mm512_cmpneq_epi8_mask(x, y);
+			if (diff)
+				return j + __builtin_ctzll(diff);
+			j += 64;
+			continue;
+		}
+		if (a[j] != b[j])
+			return j;
+		++j;
+	}
+	return n;
+}
+
+#ifndef ISRLZ_POS32
+// the keys are counted as 64-bit integers, 32-bit builds keep the portable loop
+
+__attribute__((target("sse4.2")))
+static pos_t rank_sse42(const pos_t * arr, pos_t n, pos_t key) {
+	const __m128i k = _mm_set1_epi64x(key);
+	pos_t j = 0, greater = 0;
+	for (; j + 2 <= n; j += 2)
+		greater += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(_mm_loadu_si128((const __m128i *)(arr + j)), k))));
+	for (; j < n; ++j)
+		greater += arr[j] > key;
+	return n - greater;
+}
+
+__attribute__((target("avx2")))
+static pos_t rank_avx2(const pos_t * arr, pos_t n, pos_t key) {
+	const __m256i k = _mm256_set1_epi64x(key);
+	pos_t j = 0, greater = 0;
+	for (; j + 4 <= n; j += 4)
+		greater += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i *)(arr + j)), k))));
+	for (; j < n; ++j)
+		greater += arr[j] > key;
+	return n - greater;
+}
+
+__attribute__((target("avx512f")))
+static pos_t rank_avx512(const pos_t * arr, pos_t n, pos_t key) {
+	const __m512i k = _mm512_set1_epi64(key);
+	pos_t j = 0, greater = 0;
+	for (; j + 8 <= n; j += 8)
+		greater += __builtin_popcount(_mm512_cmpgt_epi64_mask(_mm512_loadu_si512((const void *)(arr + j)), k));
+	if (j < n)
+		greater += __builtin_popcount(_mm512_mask_cmpgt_epi64_mask((1 << (n - j)) - 1, _mm512_maskz_loadu_epi64((1 << (n - j)) - 1, arr + j), k));
+	return n - greater;
+}
+
+#endif
+
+static void reverse_complement_sse2(char * dst, const char * src, pos_t len) {
+/* 16 characters are reversed and complemented at a time, as complement_base does: A and T (either case) are xored with 0x15,
+C and G with 4, and the rest are kept. */
+	const __m128i lower = _mm_set1_epi8(0x20), x_at = _mm_set1_epi8(0x15), x_cg = _mm_set1_epi8(4);
+	const __m128i a = _mm_set1_epi8('a'), c = _mm_set1_epi8('c'), g = _mm_set1_epi8('g'), t = _mm_set1_epi8('t');
+	pos_t j = 0;
+	for (; j + 16 <= len; j += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src - j - 15));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+		__m128i l = _mm_or_si128(v, lower);
+		__m128i at = _mm_or_si128(_mm_cmpeq_epi8(l, a), _mm_cmpeq_epi8(l, t));
+		__m128i cg = _mm_or_si128(_mm_cmpeq_epi8(l, c), _mm_cmpeq_epi8(l, g));
+		v = _mm_xor_si128(v, _mm_or_si128(_mm_and_si128(at, x_at), _mm_and_si128(cg, x_cg)));
+		_mm_storeu_si128((__m128i *)(dst + j), v);
+	}
+	for (; j < len; ++j)
+		dst[j] = complement_base(src[-j]);
+}
+
+__attribute__((target("avx2")))
+static void reverse_complement_avx2(char * dst, const char * src, pos_t len) {
+/* As reverse_complement_sse2 with 32 characters: the bytes are reversed inside each 128-bit lane, then the lanes are swapped. */
+	const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	const __m256i lower = _mm256_set1_epi8(0x20), x_at = _mm256_set1_epi8(0x15), x_cg = _mm256_set1_epi8(4);
+	const __m256i a = _mm256_set1_epi8('a'), c = _mm256_set1_epi8('c'), g = _mm256_set1_epi8('g'), t = _mm256_set1_epi8('t');
+	pos_t j = 0;
+	for (; j + 32 <= len; j += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src - j - 31));
+		v = _mm256_shuffle_epi8(v, reverse);
+		v = _mm256_permute2x128_si256(v, v, 1);
+		__m256i l = _mm256_or_si256(v, lower);
+		__m256i at = _mm256_or_si256(_mm256_cmpeq_epi8(l, a), _mm256_cmpeq_epi8(l, t));
+		__m256i cg = _mm256_or_si256(_mm256_cmpeq_epi8(l, c), _mm256_cmpeq_epi8(l, g));
+		v = _mm256_xor_si256(v, _mm256_or_si256(_mm256_and_si256(at, x_at), _mm256_and_si256(cg, x_cg)));
+		_mm256_storeu_si256((__m256i *)(dst + j), v);
+	}
+	reverse_complement_sse2(dst + j, src - j, len - j);
+}
+
+#endif
+
+int cpu_detect() {
+/* This function returns the highest level that the processor and the operating system support. */
+#ifdef CPU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return CPU_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return CPU_AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return CPU_SSE42;
+	return CPU_SSE2;
+#else
+	return CPU_PORTABLE;
+#endif
+}
+
+int cpu_init() {
+/* This function selects the kernels of the detected level, capped by ISRLZ_CPU, and returns the level. Later calls only return it. */
+	if (selected >= 0)
+		return selected;
+	int level = cpu_detect(), k;
+	char * cap = getenv("ISRLZ_CPU");
+	if (cap != NULL && *cap != '\0') {
+		for (k = 0; k < CPU_LEVELS && strcmp(cap, level_names[k]) != 0; ++k);
+		if (k == CPU_LEVELS)
+			fprintf(stderr, "Unknown ISRLZ_CPU %s, the detected level %s is used \n", cap, level_names[level]);
+		else if (k < level)
+			level = k;
+	}
+	return cpu_select(level);
+}
+
+int cpu_select(int level) {
+/* This function sets the kernels of -level-, capped by the detected one, and returns the level set. The checks use it to compare 
+every level with the portable kernels on the same machine. */
+	if (level > cpu_detect())
+		level = cpu_detect();
+	cpu_match = match_portable;
+	cpu_rank = rank_portable;
+	cpu_reverse_complement = reverse_complement_portable;
+#ifdef CPU_X86
+	if (level >= CPU_SSE2) {
+		cpu_match = match_sse2;
+		cpu_reverse_complement = reverse_complement_sse2;
+	}
+	if (level >= CPU_SSE42) {
+		cpu_match = match_sse42;
+#ifndef ISRLZ_POS32
+		cpu_rank = rank_sse42;
+#endif
+	}
+	if (level >= CPU_AVX2) {
+		cpu_match = match_avx2;
+#ifndef ISRLZ_POS32
+		cpu_rank = rank_avx2;
+#endif
+		cpu_reverse_complement = reverse_complement_avx2;
+	}
+	if (level >= CPU_AVX512) {
+		cpu_match = match_avx512;
+#ifndef ISRLZ_POS32
+		cpu_rank = rank_avx512;
+#endif
+	}
+#endif
+	selected = level;
+	return level;
+}
+
+int cpu_level() {
+	return cpu_init();
+}
+
+const char * cpu_level_name(int level) {
+	return (level >= 0 && level < CPU_LEVELS) ? level_names[level] : "unknown";
+}
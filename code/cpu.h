@@ -0,0 +1,13 @@
+enum cpu_level { CPU_PORTABLE, CPU_SSE2, CPU_SSE42, CPU_AVX2, CPU_AVX512, CPU_LEVELS };
+#define CPU_RANK_MAX 32 // largest bin range that predecessor counts with cpu_rank instead of a binary search
+#define CPU_MATCH_MIN 16 // shorter edges are compared in place by find_substring
+
+extern pos_t (*cpu_match)(const char * a, const char * b, pos_t n); // length of the common prefix of a and b, at most n; b is read up to 63 bytes past its first difference (see LOAD_TAIL)
+extern pos_t (*cpu_rank)(const pos_t * arr, pos_t n, pos_t key); // number of arr[0, n) not greater than key
+extern void (*cpu_reverse_complement)(char * dst, const char * src, pos_t len); // dst[j] = complement_base(src[-j])
+
+int cpu_detect();
+int cpu_init();
+int cpu_select(int level);
+int cpu_level();
+const char * cpu_level_name(int level);
@@ -0,0 +1,133 @@
+/*
+Diff module compares two sources compressed against the same reference, position by position, without decompressing them.
+
+The phrases of both sources are merged by source position into segments where neither source changes phrase.
+Where both sources copy the segment from the same reference offsets (same strand), their characters are provably equal
+up to the first exception of the tolerant parse that they do not share, so that part is skipped and the exception is
+decoded alone. Every other segment (a mismatch
+character, copies from different offsets) is decoded from both sources with access_bins_range and compared.
+For near-identical strains almost every base is skipped, so the cost follows the phrases and the differences.
+
+Functions:
+diff_sources
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "diff.h"
+#include "trace.h"
+
+static void add_interval(struct diff_interval ** list, pos_t * num, pos_t * capacity, pos_t start, pos_t end) {
+/* Appends [start, end), merged with the last interval if they touch. */
+	if (*num > 0 && (*list)[*num - 1].end == start) {
+		(*list)[*num - 1].end = end;
+		return;
+	}
+	if (*num == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : 256;
+		*list = realloc(*list, *capacity * sizeof(struct diff_interval));
+	}
+	(*list)[*num].start = start;
+	(*list)[*num].end = end;
+	(*num)++;
+}
+
+static pos_t first_exception(csb * comp_source, pos_t phrase, pos_t x, pos_t * last) {
+/* Returns the first exception of phrase -phrase- at or after source position x, and sets *last past the exceptions of the phrase. */
+	if (comp_source->exception_index == NULL) {
+		*last = 0;
+		return 0;
+	}
+	pos_t e = comp_source->exception_index[phrase];
+	*last = comp_source->exception_index[phrase + 1];
+	while (e < *last && comp_source->exception_pos[e] < x)
+		e++;
+	return e;
+}
+
+static pos_t exceptions_differ(csb * a, pos_t pa, csb * b, pos_t pb, pos_t x, pos_t y) {
+/* Returns the first source position in [x, y) where phrases pa of a and pb of b do not have the same exception (position and 
+character), or y if they have the same ones. */
+	pos_t last_a, last_b, ea = first_exception(a, pa, x, &last_a), eb = first_exception(b, pb, x, &last_b);
+	for (;;) {
+		pos_t za = (ea < last_a && a->exception_pos[ea] < y) ? a->exception_pos[ea] : y;
+		pos_t zb = (eb < last_b && b->exception_pos[eb] < y) ? b->exception_pos[eb] : y;
+		if (za != zb || (za < y && a->exception_chars[ea] != b->exception_chars[eb]))
+			return za < zb ? za : zb;
+		if (za == y)
+			return y;
+		ea++;
+		eb++;
+	}
+}
+
+static pos_t reference_offset(csb * comp_source, pos_t phrase, pos_t x) {
+/* The reference position that source position x, inside the copied part of phrase -phrase-, is copied from. */
+	pos_t off = x - comp_source->lens->arr[phrase - 1];
+	return PHRASE_IS_REVERSE(comp_source, phrase) ? comp_source->starts[phrase] - off : comp_source->starts[phrase] + off;
+}
+
+pos_t diff_sources(char * reference, csb * a, csb * b, struct diff_interval ** intervals, struct diff_stats * stats) {
+/* This function stores in *intervals (to be freed by the caller) the maximal source intervals where a and b differ, and returns
+their number. If the sources have different lengths, the extra characters of the longer one are one more interval. */
+	struct trace_span span = trace_begin("diff");
+	pos_t * lens_a = a->lens->arr, * lens_b = b->lens->arr;
+	pos_t len_a = lens_a[a->size - 1] - 1, len_b = lens_b[b->size - 1] - 1; // without the terminators
+	pos_t common = (len_a < len_b) ? len_a : len_b;
+	pos_t pa = 1, pb = 1, x = 0, num = 0, capacity = 0, j;
+	struct diff_interval * list = NULL;
+	memset(stats, 0, sizeof(struct diff_stats));
+	while (x < common) {
+		while (lens_a[pa] <= x)
+			pa++;
+		while (lens_b[pb] <= x)
+			pb++;
+		// the copied parts end before the mismatch of each phrase
+		pos_t ya = lens_a[pa] - 1, yb = lens_b[pb] - 1, y;
+		int same = 0;
+		if (x < ya && x < yb) {
+			y = (ya < yb) ? ya : yb;
+			if (y > common)
+				y = common;
+			if (PHRASE_IS_REVERSE(a, pa) == PHRASE_IS_REVERSE(b, pb) && reference_offset(a, pa, x) == reference_offset(b, pb, x)) {
+				// equal up to the first exception that only one of them has, which is decoded alone
+				pos_t z = exceptions_differ(a, pa, b, pb, x, y);
+				same = z > x;
+				y = same ? z : x + 1;
+			}
+		}
+		else
+			y = x + 1;
+		if (same)
+			stats->skipped += y - x;
+		else {
+			char * text_a = access_bins_range(reference, a, x, y - x);
+			char * text_b = access_bins_range(reference, b, x, y - x);
+			stats->decoded += y - x;
+			for (j = 0; j < y - x; ++j) {
+				if (text_a[j] != text_b[j]) {
+					add_interval(&list, &num, &capacity, x + j, x + j + 1);
+					stats->differing++;
+				}
+			}
+			free(text_a);
+			free(text_b);
+		}
+		x = y;
+	}
+	if (len_a != len_b) {
+		pos_t longest = (len_a > len_b) ? len_a : len_b;
+		add_interval(&list, &num, &capacity, common, longest);
+		stats->differing += longest - common;
+	}
+	trace_end(span, common);
+	*intervals = list;
+	return num;
+}
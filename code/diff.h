@@ -0,0 +1,11 @@
+struct diff_interval {
+	pos_t start, end; // source positions, end excluded
+};
+
+struct diff_stats {
+	pos_t skipped; // positions proven equal from the phrases alone
+	pos_t decoded; // positions decoded and compared
+	pos_t differing;
+};
+
+pos_t diff_sources(char * reference, csb * a, csb * b, struct diff_interval ** intervals, struct diff_stats * stats);
@@ -0,0 +1,196 @@
+/*
+Extract module writes many regions of a compressed source, read from a BED file, as FASTA records.
+
+The regions are handled in batches of consecutive lines (EXTRACT_BATCH_BASES bases at most, or a single longer region).
+The regions of a batch are sorted by start and split into one slice per thread with about the same number of bases.
+Every thread decodes its slice in increasing order with access_bins_into, whose phrase cursor saves the predecessor
+query of most regions, straight into its place in the batch buffer. The batch is then written in the input order,
+through a stdio buffer of EXTRACT_WRITE_BUFFER bytes.
+
+Functions:
+read_bed
+free_regions
+extract_regions
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "extract.h"
+#include "trace.h"
+
+struct region_key {
+	pos_t start; // start of the region, kept next to its index so the sort needs no global state
+	pos_t index;
+};
+
+struct extract_slice {
+	char * reference;
+	csb * comp_source;
+	struct region * regions;
+	struct region_key * order; // regions of the batch, sorted by start
+	pos_t from, to; // range of order decoded by this slice
+	pos_t * offsets; // where every region of the batch goes in buffer
+	char * buffer;
+};
+
+struct region * read_bed(char * filename, pos_t * num, pos_t * error_line) {
+/* This function returns the regions of a BED file (chrom, start and end, 0-based and end excluded, then an optional name), and their number in num.
+Empty lines, comments and 'track' or 'browser' lines are skipped. It returns NULL if the file cannot be read (error_line 0)
+or if a line is malformed (error_line is its number). */
+	FILE * fp = fopen(filename, "r");
+	char * line = NULL;
+	size_t line_capacity = 0;
+	pos_t capacity = 1024, line_number = 0;
+	*num = 0;
+	*error_line = 0;
+	if (fp == NULL)
+		return NULL;
+	struct region * regions = malloc(capacity * sizeof(struct region));
+	while (getline(&line, &line_capacity, fp) != -1) {
+		line_number++;
+		char * chrom = strtok(line, " \t\r\n");
+		if (chrom == NULL || chrom[0] == '#' || strcmp(chrom, "track") == 0 || strcmp(chrom, "browser") == 0)
+			continue;
+		char * start = strtok(NULL, " \t\r\n"), * end = strtok(NULL, " \t\r\n"), * name = strtok(NULL, " \t\r\n"), * rest;
+		if (start == NULL || end == NULL) {
+			*error_line = line_number;
+			break;
+		}
+		long long s = strtoll(start, &rest, 10), e;
+		if (*rest != '\0' || (e = strtoll(end, &rest, 10), *rest != '\0') || s < 0 || e < s) {
+			*error_line = line_number;
+			break;
+		}
+		if (*num == capacity) {
+			capacity *= 2;
+			regions = realloc(regions, capacity * sizeof(struct region));
+		}
+		regions[*num].chrom = strdup(chrom);
+		regions[*num].name = (name != NULL) ? strdup(name) : NULL;
+		regions[*num].start = s;
+		regions[*num].end = e;
+		(*num)++;
+	}
+	int read_error = ferror(fp); // a directory, for one, opens but cannot be read
+	free(line);
+	fclose(fp);
+	if (*error_line != 0 || read_error) {
+		free_regions(regions, *num);
+		return NULL;
+	}
+	return regions;
+}
+
+void free_regions(struct region * regions, pos_t num) {
+	pos_t j;
+	if (regions == NULL)
+		return;
+	for (j = 0; j < num; ++j) {
+		free(regions[j].chrom);
+		free(regions[j].name);
+	}
+	free(regions);
+}
+
+static int compare_starts(const void * a, const void * b) {
+	const struct region_key * x = a, * y = b;
+	if (x->start != y->start)
+		return (x->start > y->start) - (x->start < y->start);
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+static void * extract_worker(void * arg) {
+	struct extract_slice * slice = arg;
+	pos_t k, cursor = 0;
+	for (k = slice->from; k < slice->to; ++k) {
+		struct region * r = &slice->regions[slice->order[k].index];
+		access_bins_into(slice->reference, slice->comp_source, r->start, r->end - r->start, &slice->buffer[slice->offsets[slice->order[k].index]], &cursor);
+	}
+	return NULL;
+}
+
+pos_t extract_regions(char * reference, csb * comp_source, struct region * regions, pos_t num, FILE * out, int threads) {
+/* This function writes every region of the source (which must end before the source does) to out as a FASTA record, in the input order,
+named after the region (or chrom:start-end if it has no name), with -threads- threads. It returns the number of bases written.
+Nothing must have been written to out before, since its buffer is set here. */
+	struct trace_span span = trace_begin("extract");
+	pos_t first = 0, last, j, bases = 0;
+	struct region_key * order = malloc(num * sizeof(struct region_key));
+	pos_t * offsets = malloc(num * sizeof(pos_t));
+	struct extract_slice * slices = malloc(threads * sizeof(struct extract_slice));
+	pthread_t * ids = malloc(threads * sizeof(pthread_t));
+	char * buffer = NULL;
+	pos_t buffer_capacity = 0;
+	setvbuf(out, NULL, _IOFBF, EXTRACT_WRITE_BUFFER);
+	while (first < num) {
+		// the batch [first, last) and the place of every region in its buffer
+		pos_t batch_bases = 0;
+		for (last = first; last < num && (last == first || batch_bases + regions[last].end - regions[last].start <= EXTRACT_BATCH_BASES); ++last) {
+			offsets[last] = batch_bases;
+			batch_bases += regions[last].end - regions[last].start;
+		}
+		if (batch_bases > buffer_capacity) {
+			buffer_capacity = batch_bases;
+			buffer = realloc(buffer, buffer_capacity);
+		}
+		for (j = first; j < last; ++j) {
+			order[j].start = regions[j].start;
+			order[j].index = j;
+		}
+		qsort(&order[first], last - first, sizeof(struct region_key), compare_starts);
+
+		// one slice of about batch_bases / threads bases per thread, in start order
+		int t, num_slices = 0, started = 0;
+		pos_t k = first, done = 0;
+		for (t = 0; t < threads && k < last; ++t) {
+			slices[t].reference = reference;
+			slices[t].comp_source = comp_source;
+			slices[t].regions = regions;
+			slices[t].order = order;
+			slices[t].offsets = offsets;
+			slices[t].buffer = buffer - offsets[first];
+			slices[t].from = k;
+			while (k < last && (t == threads - 1 || done < batch_bases / threads * (t + 1))) {
+				done += regions[order[k].index].end - regions[order[k].index].start;
+				k++;
+			}
+			slices[t].to = k;
+			num_slices++;
+		}
+		for (t = 1; t < num_slices; ++t)
+			if (pthread_create(&ids[started], NULL, extract_worker, &slices[t]) == 0)
+				started++;
+			else
+				extract_worker(&slices[t]);
+		extract_worker(&slices[0]);
+		for (t = 0; t < started; ++t)
+			pthread_join(ids[t], NULL);
+
+		for (j = first; j < last; ++j) {
+			if (regions[j].name != NULL)
+				fprintf(out, ">%s\n", regions[j].name);
+			else
+				fprintf(out, ">%s:%lld-%lld\n", regions[j].chrom, (long long)regions[j].start, (long long)regions[j].end);
+			fwrite(&buffer[offsets[j] - offsets[first]], 1, regions[j].end - regions[j].start, out);
+			fputc('\n', out);
+		}
+		bases += batch_bases;
+		first = last;
+	}
+	fflush(out);
+	free(buffer);
+	free(order);
+	free(offsets);
+	free(slices);
+	free(ids);
+	trace_end(span, bases);
+	return bases;
+}
@@ -0,0 +1,12 @@
+#define EXTRACT_BATCH_BASES (64LL << 20) // bases decoded before a batch is written
+#define EXTRACT_WRITE_BUFFER (4 << 20) // bytes of the output stdio buffer
+
+struct region {
+	char * chrom;
+	char * name; // NULL if the BED line has no name column
+	pos_t start, end; // source positions, end excluded
+};
+
+struct region * read_bed(char * filename, pos_t * num, pos_t * error_line);
+void free_regions(struct region * regions, pos_t num);
+pos_t extract_regions(char * reference, csb * comp_source, struct region * regions, pos_t num, FILE * out, int threads);
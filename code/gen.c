@@ -0,0 +1,421 @@
+/*
+Gen module contains the 'gen' action, a generator of synthetic references and strains, so compression, bins and
+access can be measured at any scale (from megabases to billions of bases) without private data sets.
+
+The reference is either uniform (each base drawn with the given GC content) or an order-k Markov chain whose
+transition weights are random and raised to the 'skew' exponent, which gives low-complexity, repetitive regions.
+An existing reference can be used instead.
+Every strain is written while walking the reference once:
+- point mutations (SNPs, and insertions or deletions of geometric length) are placed with geometric gaps, and
+  the rate is multiplied by 'hotspot_boost' inside the mutation hotspots, which are shared by all the strains;
+- structural rearrangements (inversions, tandem duplications, large deletions and transpositions of a distant
+  segment) and runs of N are drawn beforehand at uniform positions.
+Phrase density follows the mutation rates and the skew of the phrase lengths (get_delta) follows the hotspots,
+so sweeping those flags sweeps the inputs of the interpolation search.
+
+Output files contain only the sequence (no header nor line breaks), as load_file expects.
+
+Functions:
+gen_reference
+gen_strain
+gen_main
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "rng.h"
+#include "gen.h"
+
+#define GEN_BUFFER 65536
+
+enum gen_event_type { GEN_INVERSION, GEN_DUPLICATION, GEN_DELETION, GEN_TRANSPOSITION, GEN_N_RUN };
+
+struct gen_event {
+	pos_t pos;
+	pos_t len;
+	int type;
+};
+
+struct gen_writer {
+	FILE * fp;
+	char buffer[GEN_BUFFER];
+	size_t used;
+	pos_t written;
+};
+
+static const char bases[] = "ACGT";
+
+static void put_chars(struct gen_writer * w, char * s, pos_t len) {
+	while (len > 0) {
+		size_t chunk = GEN_BUFFER - w->used;
+		if ((pos_t)chunk > len)
+			chunk = len;
+		memcpy(&w->buffer[w->used], s, chunk);
+		w->used += chunk;
+		w->written += chunk;
+		s += chunk;
+		len -= chunk;
+		if (w->used == GEN_BUFFER) {
+			fwrite(w->buffer, 1, w->used, w->fp);
+			w->used = 0;
+		}
+	}
+}
+
+static void put_char(struct gen_writer * w, char c) {
+	put_chars(w, &c, 1);
+}
+
+static int base_code(char c) {
+	switch (c) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+	}
+	return -1;
+}
+
+static char complement(char c) {
+	int b = base_code(c);
+	return b < 0 ? c : bases[3 - b];
+}
+
+static pos_t geometric_gap(struct rng * rng, double p) {
+/* Returns the number of failures before the first success of trials with probability p (0 if p >= 1). */
+	if (p >= 1)
+		return 0;
+	return (pos_t)floor(log(1 - rng_double(rng)) / log(1 - p));
+}
+
+static pos_t geometric_len(struct rng * rng, pos_t mean) {
+/* Returns a length >= 1 with the given mean. */
+	if (mean <= 1)
+		return 1;
+	return 1 + geometric_gap(rng, 1.0 / mean);
+}
+
+static char random_base(struct rng * rng, double gc) {
+	double u = rng_double(rng);
+	if (u < gc)
+		return u < gc / 2 ? 'C' : 'G';
+	return u < gc + (1 - gc) / 2 ? 'A' : 'T';
+}
+
+char * gen_reference(struct rng * rng, struct gen_options * opt, pos_t len) {
+/* Returns a random reference of length len, from the model in opt (uniform or markov). */
+	char * reference = malloc(len + 1);
+	if (reference == NULL)
+		return NULL;
+	pos_t i;
+	if (strcmp(opt->model, "markov") != 0) {
+		for (i = 0; i < len; ++i)
+			reference[i] = random_base(rng, opt->gc);
+		reference[len] = '\0';
+		return reference;
+	}
+	// cumulative transition probabilities of every context, in 2 bits per base
+	long contexts = 1L << (2 * opt->order), ctx;
+	double * cumulative = malloc(contexts * 4 * sizeof(double));
+	if (cumulative == NULL) {
+		free(reference);
+		return NULL;
+	}
+	int b;
+	for (ctx = 0; ctx < contexts; ++ctx) {
+		double weights[4], total = 0;
+		for (b = 0; b < 4; ++b) {
+			double bias = (b == 1 || b == 2) ? opt->gc : 1 - opt->gc;
+			weights[b] = pow(-log(1 - rng_double(rng)), opt->skew) * bias;
+			total += weights[b];
+		}
+		double acc = 0;
+		for (b = 0; b < 4; ++b) {
+			acc += weights[b] / total;
+			cumulative[ctx * 4 + b] = acc;
+		}
+	}
+	ctx = 0;
+	for (i = 0; i < len; ++i) {
+		if (i < opt->order)
+			b = base_code(random_base(rng, opt->gc));
+		else {
+			double u = rng_double(rng);
+			for (b = 0; b < 3 && u >= cumulative[ctx * 4 + b]; ++b);
+		}
+		reference[i] = bases[b];
+		ctx = ((ctx << 2) | b) & (contexts - 1);
+	}
+	reference[len] = '\0';
+	free(cumulative);
+	return reference;
+}
+
+static int compare_events(const void * a, const void * b) {
+	pos_t x = ((struct gen_event *)a)->pos, y = ((struct gen_event *)b)->pos;
+	return (x > y) - (x < y);
+}
+
+int gen_strain(char * filename, char * reference, pos_t len, struct rng * rng, struct gen_options * opt, pos_t * hotspots, struct gen_stats * stats) {
+/* Writes into filename a strain derived from the reference (see the module description) and fills stats.
+'hotspots' holds the sorted starts of opt->hotspots hotspots. Returns 0 on success, 1 if the file cannot be written. */
+	struct gen_writer * w = malloc(sizeof(struct gen_writer));
+	long num_events = opt->sv + opt->n_runs, e;
+	struct gen_event * events = malloc((num_events + 1) * sizeof(struct gen_event));
+	if (w == NULL || events == NULL || (w->fp = fopen(filename, "w")) == NULL) {
+		free(w);
+		free(events);
+		return 1;
+	}
+	w->used = 0;
+	w->written = 0;
+	memset(stats, 0, sizeof(struct gen_stats));
+
+	for (e = 0; e < num_events; ++e) {
+		events[e].pos = rng_below(rng, len);
+		events[e].type = e < opt->sv ? (int)rng_below(rng, 4) : GEN_N_RUN;
+		events[e].len = geometric_len(rng, e < opt->sv ? opt->sv_len : opt->n_len);
+		if (events[e].len > len - events[e].pos)
+			events[e].len = len - events[e].pos;
+	}
+	qsort(events, num_events, sizeof(struct gen_event), compare_events);
+
+	double rate = opt->snp + opt->indel;
+	double max_rate = rate * (opt->hotspots > 0 && opt->hotspot_boost > 1 ? opt->hotspot_boost : 1);
+	if (max_rate > 0.5)
+		max_rate = 0.5;
+	pos_t pos = 0, next_point = max_rate > 0 ? geometric_gap(rng, max_rate) : len, h = 0, k;
+	e = 0;
+	while (pos < len) {
+		while (e < num_events && events[e].pos < pos) // overlapped by a previous event
+			e++;
+		if (e < num_events && events[e].pos == pos) {
+			struct gen_event * ev = &events[e++];
+			if (ev->type == GEN_INVERSION) {
+				for (k = ev->len - 1; k >= 0; --k)
+					put_char(w, complement(reference[pos + k]));
+				pos += ev->len;
+			}
+			else if (ev->type == GEN_DUPLICATION)
+				put_chars(w, &reference[pos], ev->len); // the segment is copied again by the walk
+			else if (ev->type == GEN_DELETION)
+				pos += ev->len;
+			else if (ev->type == GEN_TRANSPOSITION) {
+				pos_t from = rng_below(rng, len - ev->len + 1);
+				put_chars(w, &reference[from], ev->len);
+			}
+			else {
+				for (k = 0; k < ev->len; ++k)
+					put_char(w, 'N');
+				stats->n_bases += ev->len;
+				pos += ev->len;
+			}
+			if (ev->type != GEN_N_RUN)
+				stats->rearrangements++;
+			continue;
+		}
+		pos_t end = len;
+		if (next_point < end)
+			end = next_point;
+		if (e < num_events && events[e].pos < end)
+			end = events[e].pos;
+		put_chars(w, &reference[pos], end - pos);
+		pos = end;
+		if (pos != next_point || pos >= len)
+			continue;
+
+		// candidate point mutation, kept with probability rate(pos) / max_rate
+		while (h < opt->hotspots && hotspots[h] + opt->hotspot_len <= pos)
+			h++;
+		double local = rate * (h < opt->hotspots && hotspots[h] <= pos ? opt->hotspot_boost : 1);
+		if (rng_double(rng) * max_rate < local) {
+			int b = base_code(reference[pos]);
+			if (rng_double(rng) * rate < opt->snp) {
+				if (b >= 0) {
+					put_char(w, bases[(b + 1 + rng_below(rng, 3)) % 4]);
+					stats->snps++;
+					pos++;
+				}
+			}
+			else if (rng_double(rng) < 0.5) {
+				pos_t l = geometric_len(rng, opt->indel_len);
+				for (k = 0; k < l; ++k)
+					put_char(w, random_base(rng, opt->gc));
+				stats->insertions++;
+			}
+			else {
+				pos_t l = geometric_len(rng, opt->indel_len);
+				pos += l < len - pos ? l : len - pos;
+				stats->deletions++;
+			}
+		}
+		next_point = pos + 1 + geometric_gap(rng, max_rate);
+	}
+	fwrite(w->buffer, 1, w->used, w->fp);
+	fclose(w->fp);
+	stats->length = w->written;
+	free(w);
+	free(events);
+	return 0;
+}
+
+static int compare_pos(const void * a, const void * b) {
+	pos_t x = *(pos_t *)a, y = *(pos_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void usage() {
+	printf("GEN command-line input: \n [output prefix] [reference length] [number of strains] (optional flags) \n");
+	printf("Writes [output prefix]_ref.fsa and [output prefix]_strain1.fsa ... Lengths accept the suffixes k, M and G. \n");
+	printf("  --seed S           seed of the generator (default 42) \n");
+	printf("  --model M          uniform or markov reference (default uniform) \n");
+	printf("  --order K          context length of the markov model, at most %d (default 3) \n", GEN_MAX_ORDER);
+	printf("  --gc F             GC content (default 0.41) \n");
+	printf("  --skew F           skew of the markov transitions, 1 is mild, 4 is very repetitive (default 1) \n");
+	printf("  --reference FILE   derive the strains from FILE instead of a generated reference ([reference length] is ignored) \n");
+	printf("  --snp F            SNPs per base (default 0.001) \n");
+	printf("  --indel F          indels per base (default 0.0001) \n");
+	printf("  --indel-len L      mean indel length (default 3) \n");
+	printf("  --sv N             structural rearrangements per strain (default 0) \n");
+	printf("  --sv-len L         mean rearrangement length (default 1000) \n");
+	printf("  --n-runs N         runs of N per strain (default 0) \n");
+	printf("  --n-len L          mean length of the N runs (default 100) \n");
+	printf("  --hotspots N       mutation hotspots shared by the strains (default 0) \n");
+	printf("  --hotspot-len L    hotspot length (default 10000) \n");
+	printf("  --hotspot-boost F  mutation rate multiplier inside a hotspot (default 20) \n");
+}
+
+static pos_t parse_length(char * s) {
+/* Parses a length with an optional k, M or G suffix. */
+	char * end;
+	double v = strtod(s, &end);
+	if (*end == 'k' || *end == 'K')
+		v *= 1e3;
+	else if (*end == 'm' || *end == 'M')
+		v *= 1e6;
+	else if (*end == 'g' || *end == 'G')
+		v *= 1e9;
+	return (pos_t)v;
+}
+
+int gen_main(int argc, char * argv[]) {
+/* Entry point of the 'gen' action. argv[0] is the output prefix, argv[1] the reference length, argv[2] the number of strains and the rest are flags. */
+	struct gen_options opt = { 42, "uniform", 3, 0.41, 1, NULL, 0.001, 0.0001, 3, 0, 1000, 0, 100, 0, 10000, 20 };
+	int a;
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+	for (a = 3; a < argc; a += 2) {
+		if (a + 1 >= argc) {
+			printf("Missing value for %s \n", argv[a]);
+			return 1;
+		}
+		if (strcmp(argv[a], "--seed") == 0)
+			opt.seed = strtoull(argv[a + 1], NULL, 10);
+		else if (strcmp(argv[a], "--model") == 0)
+			opt.model = argv[a + 1];
+		else if (strcmp(argv[a], "--order") == 0)
+			opt.order = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--gc") == 0)
+			opt.gc = atof(argv[a + 1]);
+		else if (strcmp(argv[a], "--skew") == 0)
+			opt.skew = atof(argv[a + 1]);
+		else if (strcmp(argv[a], "--reference") == 0)
+			opt.reference = argv[a + 1];
+		else if (strcmp(argv[a], "--snp") == 0)
+			opt.snp = atof(argv[a + 1]);
+		else if (strcmp(argv[a], "--indel") == 0)
+			opt.indel = atof(argv[a + 1]);
+		else if (strcmp(argv[a], "--indel-len") == 0)
+			opt.indel_len = parse_length(argv[a + 1]);
+		else if (strcmp(argv[a], "--sv") == 0)
+			opt.sv = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--sv-len") == 0)
+			opt.sv_len = parse_length(argv[a + 1]);
+		else if (strcmp(argv[a], "--n-runs") == 0)
+			opt.n_runs = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--n-len") == 0)
+			opt.n_len = parse_length(argv[a + 1]);
+		else if (strcmp(argv[a], "--hotspots") == 0)
+			opt.hotspots = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--hotspot-len") == 0)
+			opt.hotspot_len = parse_length(argv[a + 1]);
+		else if (strcmp(argv[a], "--hotspot-boost") == 0)
+			opt.hotspot_boost = atof(argv[a + 1]);
+		else {
+			printf("Unknown flag %s \n", argv[a]);
+			usage();
+			return 1;
+		}
+	}
+	long strains = atol(argv[2]), s;
+	pos_t len = parse_length(argv[1]);
+	if (strains < 0 || opt.order < 0 || opt.order > GEN_MAX_ORDER || opt.gc <= 0 || opt.gc >= 1 || opt.snp < 0 || opt.indel < 0 || opt.sv < 0 || opt.n_runs < 0 || opt.hotspots < 0
+		|| opt.indel_len < 1 || opt.sv_len < 1 || opt.n_len < 1 || opt.hotspot_len < 1 || (opt.reference == NULL && len < 1)) {
+		printf("Incorrect command. Check the numeric arguments \n");
+		return 1;
+	}
+
+	struct rng rng;
+	char filename[4096];
+	char * reference;
+	rng_seed(&rng, opt.seed);
+	if (opt.reference != NULL) {
+		reference = load_file(opt.reference, 0);
+		if (reference == NULL) {
+			printf("Error. Cannot read %s \n", opt.reference);
+			return 1;
+		}
+		len = strlen(reference) - 1; // without the '$' added by load_file
+		reference[len] = '\0';
+	}
+	else {
+		reference = gen_reference(&rng, &opt, len);
+		snprintf(filename, sizeof(filename), "%s_ref.fsa", argv[0]);
+		FILE * fp = reference == NULL ? NULL : fopen(filename, "w");
+		if (fp == NULL) {
+			printf("Error. Cannot write %s \n", filename);
+			free(reference);
+			return 1;
+		}
+		fwrite(reference, 1, len, fp);
+		fclose(fp);
+		printf("%s: %lld bases, %s model \n", filename, (long long)len, opt.model);
+	}
+	if (len < 1) {
+		printf("Error. Empty reference \n");
+		free(reference);
+		return 1;
+	}
+
+	pos_t * hotspots = malloc((opt.hotspots + 1) * sizeof(pos_t));
+	for (s = 0; s < opt.hotspots; ++s)
+		hotspots[s] = rng_below(&rng, len);
+	qsort(hotspots, opt.hotspots, sizeof(pos_t), compare_pos);
+
+	for (s = 1; s <= strains; ++s) {
+		struct gen_stats stats;
+		snprintf(filename, sizeof(filename), "%s_strain%ld.fsa", argv[0], s);
+		if (gen_strain(filename, reference, len, &rng, &opt, hotspots, &stats) != 0) {
+			printf("Error. Cannot write %s \n", filename);
+			free(hotspots);
+			free(reference);
+			return 1;
+		}
+		printf("%s: %lld bases, %lld SNPs, %lld insertions, %lld deletions, %lld rearrangements, %lld N \n", filename, (long long)stats.length,
+			(long long)stats.snps, (long long)stats.insertions, (long long)stats.deletions, (long long)stats.rearrangements, (long long)stats.n_bases);
+	}
+	free(hotspots);
+	free(reference);
+	return 0;
+}
@@ -0,0 +1,33 @@
+#define GEN_MAX_ORDER 8
+
+struct gen_options {
+	unsigned long long seed;
+	char * model; // uniform or markov
+	int order; // context length of the markov model
+	double gc; // GC content
+	double skew; // exponent applied to the markov transition weights, higher is more skewed
+	char * reference; // existing reference to derive the strains from, NULL to generate one
+	double snp; // SNPs per base
+	double indel; // indels per base
+	pos_t indel_len; // mean indel length
+	long sv; // structural rearrangements per strain
+	pos_t sv_len; // mean rearrangement length
+	long n_runs; // runs of N per strain
+	pos_t n_len; // mean length of the N runs
+	long hotspots; // mutation hotspots, shared by all the strains
+	pos_t hotspot_len;
+	double hotspot_boost; // point mutation rate multiplier inside a hotspot
+};
+
+struct gen_stats {
+	pos_t length;
+	pos_t snps;
+	pos_t insertions;
+	pos_t deletions;
+	pos_t rearrangements;
+	pos_t n_bases;
+};
+
+char * gen_reference(struct rng * rng, struct gen_options * opt, pos_t len);
+int gen_strain(char * filename, char * reference, pos_t len, struct rng * rng, struct gen_options * opt, pos_t * hotspots, struct gen_stats * stats);
+int gen_main(int argc, char * argv[]);
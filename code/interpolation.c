@@ -10,10 +10,18 @@ get_delta
 largest_bin
 largest_bin_index
 create_bins
+set_last_bin
+extend_bins
 
 bs_predecessor
 predecessor
 
+directory_k
+create_directory
+directory_predecessor
+largest_window
+free_directory
+
 -----------------------------------------------------------------------------------------
 */
 
@@ -22,21 +30,25 @@ predecessor
 #include <stdlib.h>
 #include <math.h>
 
+#include "types.h"
 #include "interpolation.h"
+#include "cpu.h"
+#include "mem.h"
+#include "trace.h"
 
 
-int bin_index(int x1, int xn, int xi, int size) {
+pos_t bin_index(pos_t x1, pos_t xn, pos_t xi, pos_t size) {
 /* this function uses interpolation to return the index of the bin that contains 'xi'. */
 	if (x1 == xi)
 		return 0;
 	return ceil(size*(double)(xi - x1) / (xn - x1)) - 1;
 }
 
-double get_delta(struct bins * bins, int size) {
+double get_delta(struct bins * bins, pos_t size) {
 /* this function computes the maximum gap ratio (max_gap/min_gap) of an ordered list of integers (stored on a bins structure). */
-	int min = bins->arr[size - 1], max = 0, i;
+	pos_t min = bins->arr[size - 1], max = 0, i;
 	for (i = 1; i < size; ++i) {
-		int gap = bins->arr[i] - bins->arr[i - 1];
+		pos_t gap = bins->arr[i] - bins->arr[i - 1];
 		if (gap < min)
 			min = gap;
 		if (gap > max)
@@ -46,9 +58,9 @@ double get_delta(struct bins * bins, int size) {
 }
 
 
-int largest_bin(struct bins * csbins, int n){
+pos_t largest_bin(struct bins * csbins, pos_t n){
 /* This function returns the number of elements of the fullest bin in the 'csbins' structure */ 
-	int max_len = 0, i, new_len; 
+	pos_t max_len = 0, i, new_len; 
 	for (i = 0; i < csbins->size - 1; ++i){
 		new_len = csbins->starts[i+1] - csbins->starts[i] + 1;
 		if (new_len > max_len)
@@ -59,9 +71,9 @@ int largest_bin(struct bins * csbins, int n){
 	return max_len; 
 }
 
-int largest_bin_index(struct bins * bins, int n) {
+pos_t largest_bin_index(struct bins * bins, pos_t n) {
 /* This function returns the index of the fullest bin in the 'bins' structure */ 
-	int max_len = 0, i, new_len, ind; 
+	pos_t max_len = 0, i, new_len, ind = 0; 
 	for (i = 0; i < bins->size - 1; ++i){
 		new_len = bins->starts[i+1] - bins->starts[i] + 1;
 		if (new_len > max_len) {
@@ -75,20 +87,22 @@ int largest_bin_index(struct bins * bins, int n) {
 }
 
 
-struct bins * create_bins(int *arr, int size, int num_bins)
+struct bins * create_bins(pos_t *arr, pos_t size, pos_t num_bins)
 {
 /* Given an array of ordered integers, this function creates and returns a bin structure with size/bin_factor bins. 
 The structure consists of the starting positions of the bins, the array itself, and the number of bins. */ 
+	struct trace_span span = trace_begin("build bins");
 	struct bins * my_bins = malloc(sizeof(struct bins));
-	int *starts = malloc(num_bins * sizeof(int));
-	int x1 = arr[0];
-	int xn = arr[size - 1];
-	int i;
-
-	int j = 1; // because the first element is always in the first bin
-	int count = 1;
+	pos_t *starts = malloc((num_bins + 1) * sizeof(pos_t));
+	mem_alloc(MEM_BINS, MEM_BINS_BYTES(num_bins));
+	pos_t x1 = arr[0];
+	pos_t xn = arr[size - 1];
+	pos_t i;
+
+	pos_t j = 1; // because the first element is always in the first bin
+	pos_t count = 1;
 	for (i = 0; i < num_bins; ++i) { 
-		while (bin_index(x1,xn,arr[j],num_bins) == i) {
+		while (j < size && bin_index(x1,xn,arr[j],num_bins) == i) {
 			count += 1;
 			j += 1;
 		}
@@ -101,18 +115,43 @@ The structure consists of the starting positions of the bins, the array itself,
 		}
 		count = 0;
 	}
+	set_last_bin(starts, size, num_bins);
 	my_bins->starts = starts;
 	my_bins->arr = arr;
 	my_bins->size = num_bins;
+	my_bins->covered = size;
+	my_bins->last_key = arr[size - 1];
+	trace_end(span, size * sizeof(pos_t));
 	return my_bins;
 }
 
-int bs_predecessor(int *arr, int len, int key) {
+void set_last_bin(pos_t *starts, pos_t size, pos_t num_bins) {
+/* The search range of bin i ends where bin i+1 starts, so one extra entry is kept after the last bin. 
+It points to the element before the last one, so the binary search of the last bin never reads past the array. */ 
+	starts[num_bins] = (size > 1) ? size - 2 : 0;
+}
+
+struct bins * extend_bins(struct bins * bins, pos_t *arr, pos_t size) {
+/* Given the bins of the first elements of 'arr' (which may have been reallocated), this function returns the bins of its first 'size' elements. 
+The appended elements are not spread into the bins, since every bin boundary depends on the last element: they are left in a tail that predecessor 
+binary searches. The last covered element may have changed too (append_bins parses the last phrase again), so the bins keep its former value as last_key. Once the tail exceeds 1/BINS_TAIL_FRACTION of the covered elements, the bins are created again with the same elements per bin, 
+so appending costs O(1) amortized per element and the tail search stays short. */
+	bins->arr = arr;
+	if ((size - bins->covered) * BINS_TAIL_FRACTION <= bins->covered)
+		return bins;
+	pos_t num_bins = ceil((double)size * bins->size / bins->covered);
+	mem_release(MEM_BINS, MEM_BINS_BYTES(bins->size));
+	free(bins->starts);
+	free(bins);
+	return create_bins(arr, size, num_bins);
+}
+
+pos_t bs_predecessor(pos_t *arr, pos_t len, pos_t key) {
 /* This function performs a predecessor call of number 'key' on the array 'arr' of length 'len' using binary search. */  
-	int high = len;
-	int low = 0;
+	pos_t high = len;
+	pos_t low = 0;
 	while (high - low > 1) {
-		int middle = (high + low) / 2;
+		pos_t middle = (high + low) / 2;
 		if (key < arr[middle])
 			high = middle;
 		else if (key > arr[middle])
@@ -123,14 +162,93 @@ int bs_predecessor(int *arr, int len, int key) {
 	return (key == arr[high]) ? high : low;
 }
 
-int predecessor(struct bins * bins, int key, int size){
+pos_t predecessor(struct bins * bins, pos_t key, pos_t size){
 /* This function returns the predecessor of 'key' in the bin structure 'bins' by 
-first performing an interpolation search to find the correct bin and then binary searching with the 'bs_predecessor' function. */  
-	int index = bin_index(bins->arr[0], bins->arr[size - 1], key, bins->size);
+first performing an interpolation search to find the correct bin and then binary searching with the 'bs_predecessor' function 
+(or counting the keys with cpu_rank, for bins of CPU_RANK_MAX keys at most). 
+Keys from last_key on are binary searched in the tail left by extend_bins, which starts after the last element below last_key. */  
+	pos_t index = bin_index(bins->arr[0], bins->last_key, key, bins->size);
 	if (key < bins->arr[0])
 		return 0;
 	if (key > bins->arr[size - 1])
 		return size - 1;
-	return bins->starts[index] + bs_predecessor(&bins->arr[bins->starts[index]], bins->starts[index + 1] - bins->starts[index] + 1, key);
+	if (key >= bins->last_key) {
+		pos_t low = (bins->covered > 1) ? bins->covered - 2 : 0;
+		return low + bs_predecessor(&bins->arr[low], size - 1 - low, key);
+	}
+	pos_t start = bins->starts[index], len = bins->starts[index + 1] - start + 1;
+	if (len <= CPU_RANK_MAX) {
+		// the keys are strictly increasing: bs_predecessor returns how many keys after the first one are not greater than key, at most len - 1 unless arr[len] is key
+		pos_t rank = cpu_rank(&bins->arr[start + 1], len, key);
+		return start + ((rank == len && bins->arr[start + len] != key) ? len - 1 : rank);
+	}
+	return start + bs_predecessor(&bins->arr[start], len, key);
+}
+
+
+int directory_k(pos_t *arr, pos_t size) {
+/* This function returns the k of a directory with about one sample per element of 'arr': the log2 of the mean gap, rounded up. */
+	pos_t span = arr[size - 1] - arr[0];
+	int k = 0;
+	while (k < DIRECTORY_MAX_K && (span >> k) > size)
+		k++;
+	return k;
 }
 
+struct directory * create_directory(pos_t *arr, pos_t size, int k) {
+/* Given an array of strictly increasing integers, this function creates and returns its directory: the predecessor of every 
+position arr[0] + w * 2^k, up to the last element, and of one more position. It takes 8 bytes per 2^k positions of the span, 
+so k trades memory for the length of the last search, whatever the gaps. 'arr' is not copied, the directory must be built again 
+if it is reallocated. */
+	struct trace_span span = trace_begin("build directory");
+	struct directory * dir = malloc(sizeof(struct directory));
+	pos_t w, j = 0;
+	dir->k = k;
+	dir->arr = arr;
+	dir->num = ((arr[size - 1] - arr[0]) >> k) + 1;
+	dir->samples = malloc((dir->num + 1) * sizeof(pos_t));
+	mem_alloc(MEM_BINS, MEM_DIRECTORY_BYTES(dir->num));
+	for (w = 0; w <= dir->num; ++w) {
+		pos_t x = (w == dir->num) ? arr[size - 1] : arr[0] + (w << k);
+		while (j + 1 < size && arr[j + 1] <= x)
+			j++;
+		dir->samples[w] = j;
+	}
+	trace_end(span, size * sizeof(pos_t));
+	return dir;
+}
+
+pos_t directory_predecessor(struct directory * dir, pos_t key, pos_t size) {
+/* This function returns the predecessor of 'key' as predecessor does, from the samples of its window: the keys between them 
+are at most 2^k, counted with cpu_rank up to CPU_RANK_MAX keys and binary searched otherwise, in at most k + 1 steps. */
+	pos_t *arr = dir->arr;
+	if (key < arr[0])
+		return 0;
+	if (key >= arr[size - 1])
+		return size - 1;
+	pos_t w = (key - arr[0]) >> dir->k;
+	pos_t low = dir->samples[w], n = dir->samples[w + 1] - low;
+	// arr[low] <= key, and arr[low + n] (the predecessor of the start of the next window) may be too, bs_predecessor needs a greater last key
+	if (n <= CPU_RANK_MAX)
+		return low + cpu_rank(&arr[low + 1], n, key);
+	if (key >= arr[low + n])
+		return low + n;
+	return low + bs_predecessor(&arr[low], n, key);
+}
+
+pos_t largest_window(struct directory * dir) {
+/* This function returns the most elements that a search of 'dir' goes through, as largest_bin does for the bins. */
+	pos_t max_len = 0, w;
+	for (w = 0; w < dir->num; ++w)
+		if (dir->samples[w + 1] - dir->samples[w] + 1 > max_len)
+			max_len = dir->samples[w + 1] - dir->samples[w] + 1;
+	return max_len;
+}
+
+void free_directory(struct directory * dir) {
+	if (dir == NULL)
+		return;
+	mem_release(MEM_BINS, MEM_DIRECTORY_BYTES(dir->num));
+	free(dir->samples);
+	free(dir);
+}
@@ -1,14 +1,38 @@
 struct bins
 {
-	int *starts;
-	int *arr;
-	int size;
+	pos_t *starts; // num_bins + 1 entries, see set_last_bin
+	pos_t *arr;
+	pos_t size;
+	pos_t covered; // elements of arr split into the bins, the ones appended after them are binary searched (see extend_bins)
+	pos_t last_key; // arr[covered - 1] when the bins were created, the upper end of the interpolation
 };
-int bin_index(int x1, int xn, int xi, int size);
-struct bins * create_bins(int *arr, int size, int num_bins);
-int predecessor(struct bins * bins, int key, int size);
-double get_delta(struct bins * bins, int size);
-int largest_bin(struct bins * csbins, int n);
-int largest_bin_index(struct bins * bins, int n);
+
+/* a sample every 2^k positions: samples[w] is the predecessor of arr[0] + w * 2^k, so the predecessor of a key 
+of window w is between samples[w] and samples[w + 1], at most 2^k keys apart however skewed the gaps are */
+struct directory
+{
+	pos_t *samples; // num + 1 entries
+	pos_t *arr;
+	pos_t num; // windows of 2^k positions
+	int k;
+};
+
+#define DIRECTORY_MAX_K 40 // windows of up to 2^40 positions
+#define BINS_TAIL_FRACTION 16 // extend_bins builds the bins again when the tail exceeds 1/16 of the covered elements
+
+pos_t bin_index(pos_t x1, pos_t xn, pos_t xi, pos_t size);
+struct bins * create_bins(pos_t *arr, pos_t size, pos_t num_bins);
+void set_last_bin(pos_t *starts, pos_t size, pos_t num_bins);
+struct bins * extend_bins(struct bins * bins, pos_t *arr, pos_t size);
+pos_t bs_predecessor(pos_t *arr, pos_t len, pos_t key);
+pos_t predecessor(struct bins * bins, pos_t key, pos_t size);
+int directory_k(pos_t *arr, pos_t size);
+struct directory * create_directory(pos_t *arr, pos_t size, int k);
+pos_t directory_predecessor(struct directory * dir, pos_t key, pos_t size);
+pos_t largest_window(struct directory * dir);
+void free_directory(struct directory * dir);
+double get_delta(struct bins * bins, pos_t size);
+pos_t largest_bin(struct bins * csbins, pos_t n);
+pos_t largest_bin_index(struct bins * bins, pos_t n);
 double average_bin(struct bins * bins);
 int median_bin(struct bins * bins);
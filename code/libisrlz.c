@@ -0,0 +1,199 @@
+/*
+Libisrlz module is the library interface (libisrlz.h): opaque handles over the reference text and its suffix tree,
+the compressed source and a per-thread query cursor, so programs do not depend on the internal structures.
+Every state the calls need lives in the handles; see libisrlz.h for what may be shared between threads.
+
+Functions:
+isrlz_reference_open
+isrlz_reference_index
+isrlz_reference_free
+isrlz_source_compress
+isrlz_source_open
+isrlz_source_save
+isrlz_source_length
+isrlz_source_phrases
+isrlz_source_free
+isrlz_query_create
+isrlz_query_free
+isrlz_access
+isrlz_extract
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "archive.h"
+#include "cpu.h"
+#include "libisrlz.h"
+#include "mem.h"
+
+struct isrlz_reference {
+	char * text; // as returned by load_references
+	struct ref_table * refs; // NULL for a single reference
+	SuffixTree * tree; // NULL until isrlz_reference_index
+	int reverse_complement;
+};
+
+struct isrlz_source {
+	isrlz_reference * ref;
+	csb * comp_source; // its refs field is NULL, the table of the reference is used
+};
+
+struct isrlz_query {
+	isrlz_source * src;
+	pos_t phrase; // cursor of access_bins_into
+};
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void init_kernels() {
+	cpu_init();
+}
+
+static void drop_index(isrlz_reference * ref) {
+	if (ref->tree != NULL)
+		freeSuffixTree(ref->tree);
+	ref->tree = NULL;
+}
+
+isrlz_reference * isrlz_reference_open(const char * filenames) {
+/* This function loads a reference, or several given as a comma separated list, as the command line does. It returns NULL if a file cannot be read. */
+	pthread_once(&kernels_once, init_kernels);
+	isrlz_reference * ref = calloc(1, sizeof(isrlz_reference));
+	ref->text = load_references((char *)filenames, &ref->refs);
+	if (ref->text == NULL) {
+		free(ref);
+		return NULL;
+	}
+	return ref;
+}
+
+int isrlz_reference_index(isrlz_reference * ref, int threads, int reverse_complement) {
+/* This function builds the suffix tree that isrlz_source_compress needs, with -threads- threads, over the reference. With -reverse_complement- 
+set, the sources are also matched against its reverse complement, with the same tree. A previous index is replaced. It returns 0, or 1 if threads < 1. */
+	if (threads < 1)
+		return 1;
+	drop_index(ref);
+	ref->reverse_complement = reverse_complement != 0;
+	ref->tree = buildSuffixTree(ref->text, threads);
+	return 0;
+}
+
+void isrlz_reference_free(isrlz_reference * ref) {
+	if (ref == NULL)
+		return;
+	drop_index(ref);
+	unload_file(ref->text, 1);
+	free_ref_table(ref->refs);
+	free(ref);
+}
+
+isrlz_source * isrlz_source_compress(isrlz_reference * ref, const char * text, int bin_factor, int snp_run) {
+/* This function compresses -text- against an indexed reference, as the 'compress' action does with its bin factor and snp run.
+It returns NULL if the reference has not been indexed, the parameters are out of range, -text- is longer than LOAD_MAX_SOURCE
+or it has a character that is not in the reference. */
+	if (ref->tree == NULL || bin_factor < 1 || snp_run < 0 || strlen(text) > (size_t)LOAD_MAX_SOURCE)
+		return NULL;
+	struct parse_options opt = { snp_run, ref->reverse_complement };
+	// the source ends with '$' and the zero tail, as load_file leaves it
+	pos_t len = strlen(text);
+	char * source = calloc(len + 2 + LOAD_TAIL, 1);
+	memcpy(source, text, len);
+	source[len] = '$';
+	source[len + 1] = '\0';
+	mem_alloc(MEM_SOURCE, len + 2);
+	csb * comp_source = compress_bins_ext(ref->tree, ref->text, source, bin_factor, &opt);
+	unload_file(source, 0);
+	if (comp_source == NULL)
+		return NULL;
+	isrlz_source * src = malloc(sizeof(isrlz_source));
+	src->ref = ref;
+	src->comp_source = comp_source;
+	return src;
+}
+
+isrlz_source * isrlz_source_open(isrlz_reference * ref, const char * filename) {
+/* This function reads a .csb file, or an archive (decoded whole), compressed against -ref-.
+It returns NULL if the file cannot be read, or if it was compressed against other references. */
+	csb * comp_source = file_to_csb((char *)filename);
+	if (comp_source == NULL)
+		return NULL;
+	if (!is_archive((char *)filename) && check_references(comp_source->refs, ref->refs) != 0) {
+		free_csb(comp_source);
+		return NULL;
+	}
+	free_ref_table(comp_source->refs);
+	comp_source->refs = NULL;
+	isrlz_source * src = malloc(sizeof(isrlz_source));
+	src->ref = ref;
+	src->comp_source = comp_source;
+	return src;
+}
+
+int isrlz_source_save(isrlz_source * src, const char * filename) {
+/* This function writes the source as a .csb file, with the table of references if there are several. It returns 0, or 1 if the file cannot be written. */
+	FILE * fp = fopen(filename, "wb");
+	if (fp == NULL)
+		return 1;
+	fclose(fp);
+	src->comp_source->refs = src->ref->refs;
+	csb_to_file(src->comp_source, (char *)filename);
+	src->comp_source->refs = NULL;
+	return 0;
+}
+
+long long isrlz_source_length(isrlz_source * src) {
+/* Returns the length of the source, without the '$' that ends it. */
+	return src->comp_source->lens->arr[src->comp_source->size - 1] - 1;
+}
+
+long long isrlz_source_phrases(isrlz_source * src) {
+	return src->comp_source->size - 1;
+}
+
+void isrlz_source_free(isrlz_source * src) {
+	if (src == NULL)
+		return;
+	free_csb(src->comp_source);
+	free(src);
+}
+
+isrlz_query * isrlz_query_create(isrlz_source * src) {
+/* Returns a query context over -src-. Contexts are not shared between threads, they are cheap enough to have one per thread. */
+	isrlz_query * query = malloc(sizeof(isrlz_query));
+	query->src = src;
+	query->phrase = 0;
+	return query;
+}
+
+void isrlz_query_free(isrlz_query * query) {
+	free(query);
+}
+
+int isrlz_access(isrlz_query * query, long long i) {
+/* Returns the character at position i of the source, or -1 if i is out of it. */
+	char c;
+	if (i < 0 || i >= isrlz_source_length(query->src))
+		return -1;
+	access_bins_into(query->src->ref->text, query->src->comp_source, i, 1, &c, &query->phrase);
+	return (unsigned char)c;
+}
+
+long long isrlz_extract(isrlz_query * query, long long i, long long len, char * dst) {
+/* This function writes the characters in positions [i, i+len) of the source into dst (no terminator), cut at the end of the source,
+and returns how many were written, or -1 if i is out of the source or len is negative. */
+	long long length = isrlz_source_length(query->src);
+	if (i < 0 || i > length || len < 0)
+		return -1;
+	if (len > length - i)
+		len = length - i;
+	return access_bins_into(query->src->ref->text, query->src->comp_source, i, len, dst, &query->phrase) - i;
+}
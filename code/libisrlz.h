@@ -0,0 +1,35 @@
+/*
+libisrlz: the compression and random access of isrlz as a library, built with 'make lib' as libisrlz.a and libisrlz.so.
+This is the only header a program needs; the structures are opaque and positions are long long.
+
+A reference (one file, or a comma separated list indexed together) is loaded once and can be shared by any number of sources.
+Its suffix tree is only needed to compress, and is built by isrlz_reference_index. A source is compressed against a reference
+or read from a .csb file or an archive. Queries go through a query context, which keeps the phrase of the last query so
+increasing positions avoid most predecessor searches.
+
+Thread safety: there is no global state besides the memory counters (atomic) and the kernels chosen once by the first
+isrlz_reference_open. A reference and the sources opened against it are read-only once built, so any number of threads can
+compress against the same indexed reference and query the same source at the same time, each thread with its own query context.
+Indexing, saving and freeing a handle must not overlap other calls on it, and a reference must outlive its sources.
+Every object is freed by its own call, which frees everything the object allocated.
+*/
+
+typedef struct isrlz_reference isrlz_reference;
+typedef struct isrlz_source isrlz_source;
+typedef struct isrlz_query isrlz_query;
+
+isrlz_reference * isrlz_reference_open(const char * filenames);
+int isrlz_reference_index(isrlz_reference * ref, int threads, int reverse_complement);
+void isrlz_reference_free(isrlz_reference * ref);
+
+isrlz_source * isrlz_source_compress(isrlz_reference * ref, const char * text, int bin_factor, int snp_run);
+isrlz_source * isrlz_source_open(isrlz_reference * ref, const char * filename);
+int isrlz_source_save(isrlz_source * src, const char * filename);
+long long isrlz_source_length(isrlz_source * src);
+long long isrlz_source_phrases(isrlz_source * src);
+void isrlz_source_free(isrlz_source * src);
+
+isrlz_query * isrlz_query_create(isrlz_source * src);
+void isrlz_query_free(isrlz_query * query);
+int isrlz_access(isrlz_query * query, long long i);
+long long isrlz_extract(isrlz_query * query, long long i, long long len, char * dst);
@@ -0,0 +1,252 @@
+/*
+Liftover module maps coordinates between a source and its reference, in both directions, from the phrases alone.
+
+A source position inside the copied part of a phrase is aligned to the reference position it is copied from
+(starts[p] + offset, or starts[p] - offset on the reverse strand), also when an exception of the tolerant parse
+changes its character. The mismatch that closes a phrase is aligned to the next reference position when the next
+phrase goes on copying from there (a SNP), and is novel otherwise. Positions that are not reference bases (the N padding
+after the references, which matches the N runs of a source, and the separators between them) are novel too.
+The inverse index holds the maximal runs of aligned positions, sorted by reference start, as an implicit interval
+tree (the sorted array is the in-order layout of a balanced tree, and every node keeps the largest end of its subtree),
+so the source intervals that cover a reference interval cost O(log n) plus the number of hits.
+
+Functions:
+liftover_positions
+liftover_index_build
+liftover_index_free
+liftover_reference
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "liftover.h"
+#include "mem.h"
+#include "trace.h"
+
+static int is_reference_base(char * reference, pos_t length, pos_t pos) {
+/* Returns 0 for the positions of the indexed text at or past the end of their reference: the REF_SEPARATOR after every reference
+of an index and the N padding after the last one, from -length- on (see reference_length). */
+	return pos >= 0 && pos < length && reference[pos] != REF_SEPARATOR;
+}
+
+static int closes_in_place(csb * comp_source, pos_t phrase) {
+/* Returns 1 if the mismatch of -phrase- is a substitution: the phrase copies something and the next one
+goes on copying, on the same strand, right after the reference position of the mismatch. */
+	pos_t * lens = comp_source->lens->arr;
+	pos_t n = lens[phrase] - lens[phrase - 1] - 1;
+	if (n == 0 || phrase + 1 >= comp_source->size || lens[phrase + 1] - lens[phrase] == 1)
+		return 0;
+	int reverse = PHRASE_IS_REVERSE(comp_source, phrase);
+	if (PHRASE_IS_REVERSE(comp_source, phrase + 1) != reverse)
+		return 0;
+	return reverse ? comp_source->starts[phrase + 1] == comp_source->starts[phrase] - n - 1 : comp_source->starts[phrase + 1] == comp_source->starts[phrase] + n + 1;
+}
+
+void liftover_positions(char * reference, csb * comp_source, pos_t * positions, pos_t num, struct lift * lifts) {
+/* This function stores in lifts[j] the alignment of source position positions[j], LIFT_UNMAPPED if it is out of the source.
+The phrase of the last position is kept, so sorted positions only search the bins when they leave it. */
+	struct trace_span span = trace_begin("liftover positions");
+	pos_t * lens = comp_source->lens->arr, phrase = 0, j, e, length = reference_length(reference);
+	for (j = 0; j < num; ++j) {
+		pos_t i = positions[j];
+		struct lift * l = &lifts[j];
+		if (i < 0 || i >= lens[comp_source->size - 1] - 1) {
+			l->kind = LIFT_UNMAPPED;
+			l->ref_pos = -1;
+			l->reverse = 0;
+			continue;
+		}
+		if (phrase == 0 || i < lens[phrase - 1] || i >= lens[phrase])
+			phrase = predecessor(comp_source->lens, i, comp_source->size) + 1;
+		pos_t off = i - lens[phrase - 1], s = comp_source->starts[phrase];
+		l->reverse = PHRASE_IS_REVERSE(comp_source, phrase);
+		l->ref_pos = l->reverse ? s - off : s + off;
+		l->kind = LIFT_COPIED;
+		if (i == lens[phrase] - 1)
+			l->kind = closes_in_place(comp_source, phrase) ? LIFT_MISMATCH : LIFT_NOVEL;
+		else if (comp_source->exception_index != NULL) {
+			for (e = comp_source->exception_index[phrase]; e < comp_source->exception_index[phrase + 1] && comp_source->exception_pos[e] <= i; ++e)
+				if (comp_source->exception_pos[e] == i)
+					l->kind = LIFT_MISMATCH;
+		}
+		if (l->kind == LIFT_NOVEL || !is_reference_base(reference, length, l->ref_pos)) {
+			l->kind = LIFT_NOVEL;
+			l->ref_pos = -1;
+		}
+	}
+	trace_end(span, num);
+}
+
+static int compare_intervals(const void * a, const void * b) {
+	const struct lift_interval * x = a, * y = b;
+	if (x->ref_start != y->ref_start)
+		return (x->ref_start > y->ref_start) - (x->ref_start < y->ref_start);
+	return (x->ref_end > y->ref_end) - (x->ref_end < y->ref_end);
+}
+
+static int index_prepare(struct lift_interval * a, pos_t n) {
+/* This function sets max_end on every interval of the implicit tree over a[0, n): the leaves are the even indexes,
+and the node of level k at index i has its children at i - 2^(k-1) and i + 2^(k-1). Missing right children
+(beyond n) take the largest end of the last complete subtree. It returns the level of the root. */
+	pos_t i, last_i = 0, last = 0;
+	int k;
+	for (i = 0; i < n; i += 2) {
+		last_i = i;
+		last = a[i].max_end = a[i].ref_end;
+	}
+	for (k = 1; (1LL << k) <= n; ++k) {
+		pos_t x = 1LL << (k - 1), step = x << 2;
+		for (i = (x << 1) - 1; i < n; i += step) {
+			pos_t left = a[i - x].max_end, right = (i + x < n) ? a[i + x].max_end : last, e = a[i].ref_end;
+			e = (left > e) ? left : e;
+			a[i].max_end = (right > e) ? right : e;
+		}
+		last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+		if (last_i < n && a[last_i].max_end > last)
+			last = a[last_i].max_end;
+	}
+	return k - 1;
+}
+
+static void add_run(struct lift_interval ** list, pos_t * num, pos_t * capacity, pos_t ref_start, pos_t ref_end, pos_t src_start, int reverse) {
+/* Appends an aligned run, merged with the last one when it goes on along both the source and the reference. */
+	if (*num > 0) {
+		struct lift_interval * last = &(*list)[*num - 1];
+		pos_t last_len = last->ref_end - last->ref_start;
+		if (last->reverse == reverse && last->src_start + last_len == src_start) {
+			if (!reverse && last->ref_end == ref_start) {
+				last->ref_end = ref_end;
+				return;
+			}
+			if (reverse && last->ref_start == ref_end) {
+				last->ref_start = ref_start;
+				return;
+			}
+		}
+	}
+	if (*num == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : 256;
+		*list = realloc(*list, *capacity * sizeof(struct lift_interval));
+	}
+	struct lift_interval * run = &(*list)[(*num)++];
+	run->ref_start = ref_start;
+	run->ref_end = ref_end;
+	run->src_start = src_start;
+	run->max_end = ref_end;
+	run->reverse = reverse;
+}
+
+struct liftover_index * liftover_index_build(char * reference, csb * comp_source) {
+/* This function returns the inverse index of comp_source: its maximal aligned runs sorted by reference start,
+with the largest ends of the implicit tree. It takes 4 offsets per run, counted as phrase memory.
+The copies of the padding after the references are left out, as liftover_positions reports them as novel. */
+	struct trace_span span = trace_begin("liftover index");
+	struct liftover_index * index = malloc(sizeof(struct liftover_index));
+	pos_t * lens = comp_source->lens->arr, p, num = 0, capacity = 0, length = reference_length(reference);
+	struct lift_interval * list = NULL;
+	for (p = 1; p < comp_source->size; ++p) {
+		// the copied part, and the mismatch if it is a substitution
+		pos_t n = lens[p] - lens[p - 1] - 1, s = comp_source->starts[p], src = lens[p - 1];
+		int reverse = PHRASE_IS_REVERSE(comp_source, p);
+		if (n > 0 && closes_in_place(comp_source, p) && is_reference_base(reference, length, reverse ? s - n : s + n))
+			n++;
+		// a copy that runs into the padding is cut where the reference ends (a copy never holds a REF_SEPARATOR)
+		if (!reverse && s + n > length)
+			n = (length > s) ? length - s : 0;
+		if (reverse && s >= length) {
+			pos_t cut = s - length + 1;
+			n = (n > cut) ? n - cut : 0;
+			src += cut;
+			s = length - 1;
+		}
+		if (n == 0)
+			continue;
+		add_run(&list, &num, &capacity, reverse ? s - n + 1 : s, reverse ? s + 1 : s + n, src, reverse);
+	}
+	list = realloc(list, (num ? num : 1) * sizeof(struct lift_interval));
+	qsort(list, num, sizeof(struct lift_interval), compare_intervals);
+	index->intervals = list;
+	index->num = num;
+	index->max_level = (num > 0) ? index_prepare(list, num) : 0;
+	mem_alloc(MEM_PHRASES, num * sizeof(struct lift_interval));
+	trace_end(span, comp_source->size);
+	return index;
+}
+
+void liftover_index_free(struct liftover_index * index) {
+	if (index == NULL)
+		return;
+	mem_release(MEM_PHRASES, index->num * sizeof(struct lift_interval));
+	free(index->intervals);
+	free(index);
+}
+
+static void add_hit(struct lift_interval ** hits, pos_t * num, pos_t * capacity, struct lift_interval * run, pos_t start, pos_t end) {
+/* Appends the part of run in the reference interval [start, end). */
+	if (*num == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : 16;
+		*hits = realloc(*hits, *capacity * sizeof(struct lift_interval));
+	}
+	struct lift_interval * hit = &(*hits)[(*num)++];
+	hit->ref_start = (run->ref_start > start) ? run->ref_start : start;
+	hit->ref_end = (run->ref_end < end) ? run->ref_end : end;
+	hit->src_start = run->reverse ? run->src_start + (run->ref_end - hit->ref_end) : run->src_start + (hit->ref_start - run->ref_start);
+	hit->max_end = hit->ref_end;
+	hit->reverse = run->reverse;
+}
+
+pos_t liftover_reference(struct liftover_index * index, pos_t start, pos_t end, struct lift_interval ** hits) {
+/* This function stores in *hits (to be freed by the caller) the parts of the aligned runs that cover the reference interval [start, end),
+sorted by reference start, and returns their number. A reference position copied by several phrases has several hits. */
+	struct lift_interval * a = index->intervals;
+	pos_t n = index->num, num = 0, capacity = 0, i;
+	struct { pos_t x; int k, w; } stack[64];
+	int t = 0;
+	*hits = NULL;
+	if (n == 0 || start >= end)
+		return 0;
+	// depth first from the root; w is set once the left child of the node has been visited
+	stack[t].x = (1LL << index->max_level) - 1;
+	stack[t].k = index->max_level;
+	stack[t++].w = 0;
+	while (t > 0) {
+		pos_t x = stack[--t].x;
+		int k = stack[t].k, w = stack[t].w;
+		if (k <= 3) {
+			// small subtrees are scanned
+			pos_t i0 = x >> k << k, i1 = i0 + (1LL << (k + 1)) - 1;
+			if (i1 > n)
+				i1 = n;
+			for (i = i0; i < i1 && a[i].ref_start < end; ++i)
+				if (a[i].ref_end > start)
+					add_hit(hits, &num, &capacity, &a[i], start, end);
+		}
+		else if (w == 0) {
+			pos_t y = x - (1LL << (k - 1)); // the left child, it may be beyond n
+			stack[t].x = x;
+			stack[t].k = k;
+			stack[t++].w = 1;
+			if (y >= n || a[y].max_end > start) {
+				stack[t].x = y;
+				stack[t].k = k - 1;
+				stack[t++].w = 0;
+			}
+		}
+		else if (x < n && a[x].ref_start < end) {
+			if (a[x].ref_end > start)
+				add_hit(hits, &num, &capacity, &a[x], start, end);
+			stack[t].x = x + (1LL << (k - 1));
+			stack[t].k = k - 1;
+			stack[t++].w = 0;
+		}
+	}
+	return num;
+}
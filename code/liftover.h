@@ -0,0 +1,28 @@
+#define LIFT_COPIED 0 // the character is copied from the reference
+#define LIFT_MISMATCH 1 // a substitution in place: an exception of the tolerant parse, or a mismatch followed by the next reference position
+#define LIFT_NOVEL 2 // any other mismatch (an insertion, a breakpoint), or a copy of the padding after the references: the character has no reference position
+#define LIFT_UNMAPPED 3 // the position is out of the source
+
+struct lift {
+	pos_t ref_pos; // in the indexed reference text, -1 for LIFT_NOVEL and LIFT_UNMAPPED
+	char kind;
+	char reverse; // the character is aligned to the complement of reference[ref_pos]
+};
+
+struct lift_interval {
+	pos_t ref_start, ref_end; // reference positions, end excluded
+	pos_t src_start; // source position of ref_start, or of ref_end - 1 on the reverse strand
+	pos_t max_end; // largest ref_end in the subtree of the interval, see liftover_index_build
+	char reverse;
+};
+
+struct liftover_index {
+	struct lift_interval * intervals; // sorted by ref_start
+	pos_t num;
+	int max_level; // level of the root of the implicit tree
+};
+
+void liftover_positions(char * reference, csb * comp_source, pos_t * positions, pos_t num, struct lift * lifts);
+struct liftover_index * liftover_index_build(char * reference, csb * comp_source);
+void liftover_index_free(struct liftover_index * index);
+pos_t liftover_reference(struct liftover_index * index, pos_t start, pos_t end, struct lift_interval ** hits);
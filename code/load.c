@@ -4,10 +4,18 @@ as well as store the compressed structures in readable text or bytes files.
 
 Functions: 
 load_file
+unload_file
+load_references
+check_references
+find_reference
+reference_length
 file_to_csb
+file_to_csb_end
+csb_append_to_file
 txt_to_csb
 csb_to_txt
 csb_to_file
+offset_width
 -------------------------------------------------------------------------------------------------
 */
 
@@ -15,41 +23,54 @@ csb_to_file
 #include <stdio.h>
 #include <string.h> 
 #include <stdlib.h>
+#include <math.h>
 
+#include "types.h"
 #include "interpolation.h"
 #include "suffix_tree.h"
 #include "rlz.h"
 #include "load.h"
+#include "archive.h"
+#include "mem.h"
+#include "trace.h"
 
 char* load_file(char * filename, int add_N) {
 /* This funtions receives as input the file path and returns its content. 
 If add_N=1, some N chars are added to the reference. 
 This behaviour is meant to be used when the reference file does not contained any undetermined DNA base, 
-because suffix_tree cannot handle characters in the source that do not appear in the reference. */
+because suffix_tree cannot handle characters in the source that do not appear in the reference. 
+It returns NULL if the file cannot be read, or if its positions do not fit in pos_t (see LOAD_MAX_REFERENCE). */
 
 	FILE    *infile;
 	char    *buffer;
 	long    numbytes;
 	char extra_char[30] = "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNN";
-	int n_extra = 30;
+	int n_extra = REF_PADDING;
+	struct trace_span span = trace_begin(add_N ? "load reference" : "load source");
 	infile = fopen(filename, "r");
 	if (infile == NULL)
-		return 1;
+		return NULL;
 
 	fseek(infile, 0L, SEEK_END); 	// Get the number of bytes
 	numbytes = ftell(infile);
 	fseek(infile, 0L, SEEK_SET);
+	if (numbytes > (add_N ? LOAD_MAX_REFERENCE : LOAD_MAX_SOURCE)) {
+		printf("Error. %s has %ld bytes, more than the positions of this build can address \n", filename, numbytes);
+		fclose(infile);
+		trace_end(span, 0);
+		return NULL;
+	}
 	// grab sufficient memory for the buffer to hold the text
-	buffer = (char*)calloc(sizeof(char), numbytes + 1 + 1 + n_extra);
+	buffer = (char*)calloc(sizeof(char), numbytes + 1 + 1 + n_extra + LOAD_TAIL);
 
 	// memory error
 	if (buffer == NULL)
-		return 1;
+		return NULL;
 	// copy all the text into the buffer. Add a dollar sign in the end, and N char if needed
-	fread(buffer, numbytes, sizeof(char), infile);
-	int size = strlen(buffer);
+	fread(buffer, sizeof(char), numbytes, infile);
+	pos_t size = strlen(buffer);
 	if (add_N) {
-		strcat(buffer, extra_char);
+		memcpy(&buffer[size], extra_char, n_extra);
 		buffer[size + n_extra] = '$';
 		buffer[size + n_extra + 1] = '\0';
 	} 
@@ -58,36 +79,312 @@ because suffix_tree cannot handle characters in the source that do not appear in
 		buffer[size + 1] = '\0';
 	}
 	fclose(infile);
+	mem_alloc(add_N ? MEM_REFERENCE : MEM_SOURCE, strlen(buffer) + 1);
+	trace_end(span, numbytes);
 	return buffer; 
 }
 
+void unload_file(char * buffer, int add_N) {
+/* This function frees a buffer returned by load_file. add_N must be the value used to load it. */
+	if (buffer == NULL)
+		return;
+	mem_release(add_N ? MEM_REFERENCE : MEM_SOURCE, strlen(buffer) + 1);
+	free(buffer);
+}
+
+char * load_references(char * filenames, struct ref_table ** table) {
+/* This function loads the reference side of a compression. -filenames- is a comma separated list of files. 
+A single file is loaded as load_file(filename, 1) and *table is set to NULL. 
+Several files are indexed together: they are concatenated, each one followed by REF_SEPARATOR so no phrase 
+can run from one reference into the next, then the N padding and '$' of load_file are added. 
+*table receives the name, starting position and hash of every reference. It returns NULL on error. */
+	char extra_char[30] = "NNNNNNNNNNNNNNNNNNNNNNNNNNNNNN";
+	int n_extra = REF_PADDING, k, num = 1;
+	char * p, * name, * save;
+	*table = NULL;
+	if (strchr(filenames, ',') == NULL)
+		return load_file(filenames, 1);
+	for (p = filenames; *p; ++p)
+		num += (*p == ',');
+
+	struct ref_table * t = malloc(sizeof(struct ref_table));
+	char ** parts = calloc(num, sizeof(char *));
+	char * list = malloc(strlen(filenames) + 1);
+	strcpy(list, filenames);
+	t->num = 0;
+	t->names = calloc(num, sizeof(char *));
+	t->starts = malloc((num + 1) * sizeof(pos_t));
+	t->hashes = malloc(num * sizeof(unsigned long long));
+	pos_t total = 0;
+	for (name = strtok_r(list, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		k = t->num;
+		parts[k] = load_file(name, 0);
+		if (parts[k] == NULL) {
+			printf("Error. Cannot read reference %s \n", name);
+			for (k = 0; k < t->num; ++k)
+				unload_file(parts[k], 0);
+			free(parts);
+			free(list);
+			free_ref_table(t);
+			return NULL;
+		}
+		t->names[k] = malloc(strlen(name) + 1);
+		strcpy(t->names[k], name);
+		t->starts[k] = total;
+		total += strlen(parts[k]); // the '$' added by load_file is replaced by the separator
+		t->hashes[k] = 0xcbf29ce484222325ULL;
+		for (p = parts[k]; *p && *p != '$'; ++p)
+			t->hashes[k] = (t->hashes[k] ^ (unsigned char)*p) * 0x100000001b3ULL;
+		t->num++;
+		if (total > LOAD_MAX_REFERENCE) {
+			printf("Error. The references add up to more bases than the positions of this build can address \n");
+			for (k = 0; k < t->num; ++k)
+				unload_file(parts[k], 0);
+			free(parts);
+			free(list);
+			free_ref_table(t);
+			return NULL;
+		}
+	}
+	t->starts[t->num] = total;
+
+	char * buffer = calloc(total + n_extra + 2 + LOAD_TAIL, 1);
+	for (k = 0; k < t->num; ++k) {
+		pos_t len = t->starts[k + 1] - t->starts[k] - 1;
+		memcpy(&buffer[t->starts[k]], parts[k], len);
+		buffer[t->starts[k] + len] = REF_SEPARATOR;
+		unload_file(parts[k], 0);
+	}
+	memcpy(&buffer[total], extra_char, n_extra);
+	buffer[total + n_extra] = '$';
+	buffer[total + n_extra + 1] = '\0';
+	mem_alloc(MEM_REFERENCE, total + n_extra + 2);
+	free(parts);
+	free(list);
+	*table = t;
+	return buffer;
+}
+
+int check_references(struct ref_table * stored, struct ref_table * given) {
+/* This function returns 0 if the references -given- to decompress or access are the ones -stored- in the compressed file, in the same order, 
+and 1 otherwise, after printing what was expected. Names are not compared (files can be moved), only the lengths and hashes of the references. */
+	int k, same = (stored == NULL) == (given == NULL);
+	if (same && stored != NULL) {
+		same = stored->num == given->num;
+		for (k = 0; same && k <= stored->num; ++k)
+			same = stored->starts[k] == given->starts[k] && (k == stored->num || stored->hashes[k] == given->hashes[k]);
+	}
+	if (same)
+		return 0;
+	if (stored == NULL)
+		printf("Error. The source was compressed against a single reference \n");
+	else {
+		printf("Error. The source was compressed against %d references, given as a comma separated list:", stored->num);
+		for (k = 0; k < stored->num; ++k)
+			printf("%s%s (%lld bases)", k ? "," : " ", stored->names[k], (long long)(stored->starts[k + 1] - stored->starts[k] - 1));
+		printf("\n");
+	}
+	return 1;
+}
+
+int find_reference(struct ref_table * refs, pos_t pos) {
+/* Returns the reference of the index that holds text position pos, 0 for a single reference. */
+	if (refs == NULL)
+		return 0;
+	int low = 0, high = refs->num - 1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (refs->starts[middle] <= pos)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+pos_t reference_length(char * reference) {
+/* Returns the length of a text loaded by load_file(filename, 1) or load_references without the N padding and the '$' added after it. 
+Positions at or past it are not reference bases, nor are the REF_SEPARATOR that end every reference of an index. */
+	return strlen(reference) - REF_PADDING - 1;
+}
+
+static void write_ref_table(FILE * fp, struct ref_table * table) {
+/* Writes the number of references (4 bytes), then the name (2-byte length and chars), start and hash (8 bytes each) of each one, 
+then the end of the last one (8 bytes). */
+	int num = table->num, k;
+	long long start;
+	fwrite(&num, sizeof(int), 1, fp);
+	for (k = 0; k <= num; ++k) {
+		if (k < num) {
+			unsigned short len = strlen(table->names[k]);
+			fwrite(&len, sizeof(unsigned short), 1, fp);
+			fwrite(table->names[k], 1, len, fp);
+		}
+		start = table->starts[k];
+		fwrite(&start, sizeof(long long), 1, fp);
+		if (k < num)
+			fwrite(&table->hashes[k], sizeof(unsigned long long), 1, fp);
+	}
+}
+
+static long long bytes_left(FILE * fp) {
+/* Returns the number of bytes of fp after the current position. */
+	long long pos = ftell(fp), end;
+	fseek(fp, 0L, SEEK_END);
+	end = ftell(fp);
+	fseek(fp, pos, SEEK_SET);
+	return end - pos;
+}
+
+static struct ref_table * read_ref_table(FILE * fp) {
+/* Reads a table written by write_ref_table. It returns NULL if the number of references does not fit in the rest of the file,
+every one taking at least 18 bytes. */
+	int k, num = -1;
+	long long start;
+	fread(&num, sizeof(int), 1, fp);
+	if (num < 0 || num > bytes_left(fp) / 18)
+		return NULL;
+	struct ref_table * table = malloc(sizeof(struct ref_table));
+	table->num = num;
+	table->names = calloc(table->num, sizeof(char *));
+	table->starts = malloc((table->num + 1) * sizeof(pos_t));
+	table->hashes = malloc(table->num * sizeof(unsigned long long));
+	for (k = 0; k <= table->num; ++k) {
+		if (k < table->num) {
+			unsigned short len = 0;
+			fread(&len, sizeof(unsigned short), 1, fp);
+			table->names[k] = calloc(len + 1, 1);
+			fread(table->names[k], 1, len, fp);
+		}
+		fread(&start, sizeof(long long), 1, fp);
+		table->starts[k] = start;
+		if (k < table->num)
+			fread(&table->hashes[k], sizeof(unsigned long long), 1, fp);
+	}
+	return table;
+}
+
 void csb_to_txt(csb * compression, char * filename){
 /* This function receives as input a compressed source (csb struct) and writes the compression on the -filename- file. 
 The information is written in integers and char text, so it is readable.   */
 	FILE * fp;
-    int phrase, len; 
+    pos_t phrase, len; 
 
 	len = compression->size; 
     fp = fopen (filename,"w");
-	fprintf(fp, "%d \n", len);
+	fprintf(fp, "%lld \n", (long long)len);
 	for(phrase = 0; phrase < len;phrase++){
-		fprintf(fp, "%d %d %d \n", compression->starts[phrase], compression->lens->arr[phrase], compression->mismatches[phrase]);
+		fprintf(fp, "%lld %lld %d \n", (long long)compression->starts[phrase], (long long)compression->lens->arr[phrase], compression->mismatches[phrase]);
 	}; 
 	fclose(fp); 
 }
+
+int offset_width(csb * compression) {
+/* This function returns the number of bytes needed to store every offset of the compressed source: 
+the reference starts, the cumulative lengths and the bin starts. It is never less than 4 bytes, 
+so small genomes keep the same layout as before, and it grows to 5 bytes (40-bit offsets) and beyond only when needed. */
+	pos_t i, max = compression->lens->arr[compression->size - 1];
+	for (i = 0; i < compression->size; ++i)
+		if (compression->starts[i] > max)
+			max = compression->starts[i];
+	int width = 4;
+	while (width < 8 && (unsigned long long)max >> (8 * width) != 0)
+		width++;
+	return width;
+}
+
+static void write_offsets(FILE * fp, pos_t * arr, pos_t n, int width) {
+/* Writes n offsets using -width- little-endian bytes for each one. */
+	unsigned char buffer[8 * 4096];
+	pos_t i, k = 0;
+	int b;
+	for (i = 0; i < n; ++i) {
+		unsigned long long v = (unsigned long long)arr[i];
+		for (b = 0; b < width; ++b)
+			buffer[k++] = (unsigned char)(v >> (8 * b));
+		if (k == width * 4096) {
+			fwrite(buffer, 1, k, fp);
+			k = 0;
+		}
+	}
+	fwrite(buffer, 1, k, fp);
+}
+
+static void read_offsets(FILE * fp, pos_t * arr, pos_t n, int width) {
+/* Reads n offsets written by write_offsets. */
+	unsigned char buffer[8 * 4096];
+	pos_t i = 0;
+	int b;
+	while (i < n) {
+		pos_t chunk = (n - i < 4096) ? n - i : 4096;
+		fread(buffer, 1, chunk * width, fp);
+		pos_t j;
+		for (j = 0; j < chunk; ++j, ++i) {
+			unsigned long long v = 0;
+			for (b = 0; b < width; ++b)
+				v |= (unsigned long long)buffer[j * width + b] << (8 * b);
+			arr[i] = (pos_t)v;
+		}
+	}
+}
+
 void csb_to_file(csb * compression, char * filename){ 
 /* This function receives as input a compressed source (csb struct) and writes the compression on the -filename- file. 
-The information is written as bytes, so it requires minimum space.   */
+The information is written as bytes, so it requires minimum space. 
+A small header (magic, version, offset width) is followed by the table of references if there are several (version 2), 
+and then by the arrays, each offset using offset_width bytes. 
+A source parsed with exceptions or extended by append_bins (version 3) has a byte of flags after the header, followed by 
+the phrases covered by the bins and their last key if phrases were appended after them. The mismatches are then followed by the strand bits 
+of the phrases if the reverse complement was searched, and the exceptions (8-byte count, positions and characters) if there are any.   */
+	struct trace_span span = trace_begin("write csb");
 	FILE * fp;
-	fp = fopen (filename,"w");
-	fwrite(&compression->size, sizeof(int), 1, fp);
-	fwrite(&compression->lens->size, sizeof(int), 1, fp);
-	fwrite(compression->starts, sizeof(int), compression->size, fp);
+	unsigned char version = CSB_VERSION, width = offset_width(compression), flags = 0;
+	long long size = compression->size, num_bins = compression->lens->size, num_exceptions = compression->num_exceptions;
+	long long covered = compression->lens->covered, last_key = compression->lens->last_key;
+	if (compression->refs != NULL) {
+		version = CSB_VERSION_REFS;
+		flags |= CSB_HAS_REFS;
+	}
+	if (num_exceptions > 0) {
+		version = CSB_VERSION_EXCEPTIONS;
+		flags |= CSB_HAS_EXCEPTIONS;
+	}
+	if (compression->strands != NULL) {
+		version = CSB_VERSION_EXCEPTIONS;
+		flags |= CSB_HAS_STRANDS;
+	}
+	if (covered < size || last_key != compression->lens->arr[size - 1]) {
+		version = CSB_VERSION_EXCEPTIONS;
+		flags |= CSB_HAS_TAIL;
+	}
+	fp = fopen (filename,"wb");
+	fwrite(CSB_MAGIC, 1, 4, fp);
+	fwrite(&version, 1, 1, fp);
+	fwrite(&width, 1, 1, fp);
+	fwrite(&size, sizeof(long long), 1, fp);
+	fwrite(&num_bins, sizeof(long long), 1, fp);
+	if (version >= CSB_VERSION_EXCEPTIONS)
+		fwrite(&flags, 1, 1, fp);
+	if (flags & CSB_HAS_TAIL) {
+		fwrite(&covered, sizeof(long long), 1, fp);
+		fwrite(&last_key, sizeof(long long), 1, fp);
+	}
+	if (compression->refs != NULL)
+		write_ref_table(fp, compression->refs);
+	write_offsets(fp, compression->starts, compression->size, width);
 	
-	fwrite(compression->lens->arr, sizeof(int), compression->size, fp);
-	fwrite(compression->lens->starts, sizeof(int), compression->lens->size, fp);
+	write_offsets(fp, compression->lens->arr, compression->size, width);
+	write_offsets(fp, compression->lens->starts, compression->lens->size, width);
 
 	fwrite(compression->mismatches, sizeof(char), compression->size, fp);
+	if (compression->strands != NULL)
+		fwrite(compression->strands, 1, MEM_STRAND_BYTES(size), fp);
+	if (num_exceptions > 0) {
+		fwrite(&num_exceptions, sizeof(long long), 1, fp);
+		write_offsets(fp, compression->exception_pos, num_exceptions, width);
+		fwrite(compression->exception_chars, sizeof(char), num_exceptions, fp);
+	}
+	trace_end(span, ftell(fp));
 	fclose(fp); 
 }
 
@@ -95,55 +392,435 @@ csb * txt_to_csb(char * filename, int bin_factor){
 /* This function receives as input a -filename- file of a compressed source writen using csb_to_txt function. 
 It creates a csb struct with a number of bins depending on the bin_factor specified. 
 For ISRLZ implementation, use bin_factor=1.   */
-    int phrase, size; 
+    long long phrase, size; 
 	FILE* fp = fopen ( filename, "r" );
-    fscanf(fp, "%d", &size); 
+    fscanf(fp, "%lld", &size); 
 	csb * compressed_source = malloc(sizeof(csb));
-	int *starts = malloc(size * sizeof(int));
-	int *lens = malloc(size * sizeof(int));
+	pos_t *starts = malloc(size * sizeof(pos_t));
+	pos_t *lens = malloc(size * sizeof(pos_t));
 	char *mismatches = malloc(size * sizeof(char)); 
+	mem_alloc(MEM_PHRASES, MEM_PHRASE_BYTES(size));
 
 	for(phrase = 0; phrase < size;phrase++){
-		fscanf(fp, "%d %d %d", &starts[phrase], &lens[phrase], &mismatches[phrase]); 
+		long long start, len;
+		int mismatch;
+		fscanf(fp, "%lld %lld %d", &start, &len, &mismatch); 
+		starts[phrase] = start;
+		lens[phrase] = len;
+		mismatches[phrase] = mismatch;
 	}; 
 	fclose(fp); 
-	int num_bins = ceil((double)(phrase + 1) / bin_factor);
+	pos_t num_bins = ceil((double)(phrase + 1) / bin_factor);
 	compressed_source->starts = starts;
 	compressed_source->lens = create_bins(lens, size, num_bins);
 	compressed_source->size = size;
 	compressed_source->mismatches = mismatches;
+	compressed_source->refs = NULL;
+	compressed_source->num_exceptions = 0;
+	compressed_source->exception_pos = NULL;
+	compressed_source->exception_chars = NULL;
+	compressed_source->exception_index = NULL;
+	compressed_source->strands = NULL;
 	return compressed_source;
 }
 
+struct csb_layout {
+/* Where the parts of a .csb file are, see read_csb_layout. */
+	long long size, num_bins, covered, last_key; // last_key is -1 if the header has none
+	int width;
+	unsigned char flags;
+	struct ref_table * refs;
+	long long arrays; // file offset of the starts, followed by the lens, the bin starts, the mismatches and the strand bits
+	long long num_exceptions, exceptions; // file offset of the exception positions, followed by their characters
+	long long end; // file offset of the first segment written by csb_append_to_file, or of the end of the file
+};
+
+struct csb_segment {
+	long long first, count, num_exceptions; // the segment replaces phrase -first- and the ones after it with -count- phrases
+	int width;
+	long long arrays; // file offset of the starts, followed by the lens, the mismatches, the strand bits and the exceptions
+	long long end;
+};
+
+static int read_csb_layout(FILE * fp, struct csb_layout * layout) {
+/* Reads the header of the .csb file fp (or of a headerless one) and its number of exceptions, and stores where every part of the file is. 
+It returns 1, with no table of references left to free, if the sizes do not fit in the file (any file without the magic is taken for 
+a headerless one, so its first 8 bytes are only trusted that far), and 0 otherwise. */
+	char magic[4];
+	memset(layout, 0, sizeof(struct csb_layout));
+	layout->width = 4;
+	layout->last_key = -1;
+	fseek(fp, 0L, SEEK_SET);
+	if (fread(magic, 1, 4, fp) == 4 && memcmp(magic, CSB_MAGIC, 4) == 0) {
+		unsigned char version = 0, w = 0;
+		fread(&version, 1, 1, fp);
+		fread(&w, 1, 1, fp);
+		fread(&layout->size, sizeof(long long), 1, fp);
+		fread(&layout->num_bins, sizeof(long long), 1, fp);
+		layout->width = w;
+		layout->covered = layout->size;
+		if (version == CSB_VERSION_REFS)
+			layout->flags = CSB_HAS_REFS;
+		else if (version >= CSB_VERSION_EXCEPTIONS)
+			fread(&layout->flags, 1, 1, fp);
+		if (layout->flags & CSB_HAS_TAIL) {
+			fread(&layout->covered, sizeof(long long), 1, fp);
+			fread(&layout->last_key, sizeof(long long), 1, fp);
+		}
+		if ((layout->flags & CSB_HAS_REFS) && (layout->refs = read_ref_table(fp)) == NULL)
+			return 1;
+	}
+	else {
+		int header[2] = { 0, 0 };
+		fseek(fp, 0L, SEEK_SET);
+		fread(header, sizeof(int), 2, fp);
+		layout->size = header[0];
+		layout->num_bins = header[1];
+		layout->covered = layout->size;
+	}
+	// the offsets and the mismatches must fit in the file before anything is allocated for them
+	long long size = layout->size, num_bins = layout->num_bins, width = layout->width, left = bytes_left(fp);
+	layout->arrays = ftell(fp);
+	if (size < 1 || num_bins < 1 || width < 4 || width > (int)sizeof(pos_t) || size > left || num_bins > left 
+		|| (2 * size + num_bins) * width + size > left || layout->covered < 0 || layout->covered > size) {
+		free_ref_table(layout->refs);
+		return 1;
+	}
+	layout->end = layout->arrays + (2 * size + num_bins) * width + size + ((layout->flags & CSB_HAS_STRANDS) ? MEM_STRAND_BYTES(size) : 0);
+	if (layout->flags & CSB_HAS_EXCEPTIONS) {
+		fseek(fp, layout->end, SEEK_SET);
+		if (fread(&layout->num_exceptions, sizeof(long long), 1, fp) != 1 || layout->num_exceptions < 0 
+			|| layout->num_exceptions > bytes_left(fp) / (width + 1)) {
+			free_ref_table(layout->refs);
+			return 1;
+		}
+		layout->exceptions = layout->end + sizeof(long long);
+		layout->end = layout->exceptions + layout->num_exceptions * (width + 1);
+	}
+	if (layout->end > layout->arrays + left) {
+		free_ref_table(layout->refs);
+		return 1;
+	}
+	return 0;
+}
+
+static int read_csb_segment(FILE * fp, struct csb_layout * layout, long long size, struct csb_segment * segment) {
+/* Reads the header of the segment at the current position of fp, written after a source of -size- phrases, and leaves fp at its end. 
+It returns 1 if there is no segment there, if it does not start at the last phrase or if it does not fit in the file, and 0 otherwise. */
+	char magic[4];
+	unsigned char w = 0;
+	long long left = bytes_left(fp) - CSB_SEGMENT_HEADER_BYTES;
+	if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, CSB_SEGMENT_MAGIC, 4) != 0 || fread(&w, 1, 1, fp) != 1 
+		|| fread(&segment->first, sizeof(long long), 1, fp) != 1 || fread(&segment->count, sizeof(long long), 1, fp) != 1 
+		|| fread(&segment->num_exceptions, sizeof(long long), 1, fp) != 1)
+		return 1;
+	long long count = segment->count, num_exceptions = segment->num_exceptions;
+	long long strand_bytes = (layout->flags & CSB_HAS_STRANDS) ? MEM_STRAND_BYTES(count) : 0;
+	segment->width = w;
+	segment->arrays = ftell(fp);
+	if (segment->first != size - 1 || count < 1 || count > left || count > POS_MAX - size || w < 4 || w > sizeof(pos_t) 
+		|| num_exceptions < 0 || num_exceptions > left / (w + 1) || count * (2 * w + 1) + strand_bytes + num_exceptions * (w + 1) > left)
+		return 1;
+	segment->end = segment->arrays + count * (2 * w + 1) + strand_bytes + num_exceptions * (w + 1);
+	fseek(fp, segment->end, SEEK_SET);
+	return 0;
+}
+
+static void write_strands(FILE * fp, unsigned char * strands, pos_t first, pos_t count) {
+/* Writes the strand bits of phrases first to first + count - 1, packed from the first bit of the first byte. */
+	unsigned char * bits = calloc(MEM_STRAND_BYTES(count), 1);
+	pos_t j;
+	for (j = 0; j < count; ++j)
+		bits[j >> 3] |= (strands[(first + j) >> 3] >> ((first + j) & 7) & 1) << (j & 7);
+	fwrite(bits, 1, MEM_STRAND_BYTES(count), fp);
+	free(bits);
+}
+
+static void read_strands(FILE * fp, unsigned char * strands, pos_t first, pos_t count) {
+/* Reads the strand bits written by write_strands into the bits of phrases first to first + count - 1. */
+	unsigned char * bits = malloc(MEM_STRAND_BYTES(count));
+	pos_t j;
+	fread(bits, 1, MEM_STRAND_BYTES(count), fp);
+	for (j = 0; j < count; ++j) {
+		pos_t p = first + j;
+		strands[p >> 3] = (strands[p >> 3] & ~(1 << (p & 7))) | ((bits[j >> 3] >> (j & 7) & 1) << (p & 7));
+	}
+	free(bits);
+}
+
+static pos_t read_offset_at(FILE * fp, long long offset, int width) {
+/* Reads the offset written by write_offsets at file offset -offset-. */
+	pos_t value;
+	fseek(fp, offset, SEEK_SET);
+	read_offsets(fp, &value, 1, width);
+	return value;
+}
+
 csb * file_to_csb(char * filename) {
-/* This function receives as input a -filename- file of a compressed source writen using csb_to_file function. 
-It returns a csb struct.   */
-    int phrase, size, num_bins; 
-	FILE* fp = fopen ( filename, "r" );
-	fread(&size, sizeof(int), 1, fp); 
-	fread(&num_bins, sizeof(int), 1, fp); 
+/* This function receives as input a -filename- file of a compressed source writen using csb_to_file function, 
+followed by the segments written by csb_append_to_file if it was extended. 
+Files written with csb_to_archive are also accepted, in which case every block is decoded, 
+as well as files written before the header was introduced (plain 4-byte integers). 
+It returns a csb struct, or NULL if the file cannot be read, its header gives sizes that do not fit in it 
+or what follows the arrays is not a valid segment (see read_csb_layout and read_csb_segment).   */
+	struct csb_layout layout;
+	if (is_archive(filename)) {
+		struct archive * arc = archive_open(filename);
+		if (arc == NULL)
+			return NULL;
+		csb * compressed_source = archive_to_csb(arc);
+		archive_close(arc);
+		return compressed_source;
+	}
+	FILE* fp = fopen ( filename, "rb" );
+	if (fp == NULL)
+		return NULL;
+	struct trace_span span = trace_begin("read csb");
+	if (read_csb_layout(fp, &layout) != 0) {
+		trace_end(span, 0);
+		fclose(fp);
+		return NULL;
+	}
+	pos_t size = layout.size, num_bins = layout.num_bins, num_exceptions = layout.num_exceptions;
+	int width = layout.width;
 
 	csb * compressed_source = malloc(sizeof(csb));
-	int *starts = malloc(size * sizeof(int));
-	int *lens = malloc(size * sizeof(int));
-
+	pos_t *starts = malloc(size * sizeof(pos_t));
+	pos_t *lens = malloc(size * sizeof(pos_t));
 	char *mismatches = malloc(size * sizeof(char)); 
-	fread(starts, sizeof(int), size, fp); 
-
-	fread(lens, sizeof(int), size, fp);
-	int *bin_starts = malloc(num_bins * sizeof(int));
-	fread(bin_starts, sizeof(int), num_bins, fp);
+	pos_t *bin_starts = malloc((num_bins + 1) * sizeof(pos_t));
+	mem_alloc(MEM_BINS, MEM_BINS_BYTES(num_bins));
+	fseek(fp, layout.arrays, SEEK_SET);
+	read_offsets(fp, starts, size, width);
+	read_offsets(fp, lens, size, width);
+	read_offsets(fp, bin_starts, num_bins, width);
+	set_last_bin(bin_starts, layout.covered, num_bins);
 
 	fread(mismatches, sizeof(char), size, fp);
+	unsigned char * strands = NULL;
+	if (layout.flags & CSB_HAS_STRANDS) {
+		strands = malloc(MEM_STRAND_BYTES(size));
+		fread(strands, 1, MEM_STRAND_BYTES(size), fp);
+	}
+	pos_t * exception_pos = malloc(num_exceptions * sizeof(pos_t) + 1);
+	char * exception_chars = malloc(num_exceptions * sizeof(char) + 1);
+	fseek(fp, layout.exceptions, SEEK_SET);
+	read_offsets(fp, exception_pos, num_exceptions, width);
+	fread(exception_chars, sizeof(char), num_exceptions, fp);
+	pos_t last_key = (layout.last_key >= 0) ? layout.last_key : lens[size - 1], covered_size = size;
+
+	// every segment replaces the last phrase, and the exceptions from its start on, with the phrases parsed by append_bins
+	struct csb_segment segment;
+	int failed = 0;
+	fseek(fp, layout.end, SEEK_SET);
+	while (bytes_left(fp) > 0) {
+		if (read_csb_segment(fp, &layout, size, &segment) != 0) {
+			failed = 1;
+			break;
+		}
+		pos_t first = segment.first, count = segment.count, from = (first > 0) ? lens[first - 1] : 0;
+		starts = realloc(starts, (first + count) * sizeof(pos_t));
+		lens = realloc(lens, (first + count) * sizeof(pos_t));
+		mismatches = realloc(mismatches, (first + count) * sizeof(char));
+		fseek(fp, segment.arrays, SEEK_SET);
+		read_offsets(fp, &starts[first], count, segment.width);
+		read_offsets(fp, &lens[first], count, segment.width);
+		fread(&mismatches[first], sizeof(char), count, fp);
+		if (strands != NULL) {
+			strands = realloc(strands, MEM_STRAND_BYTES(first + count));
+			read_strands(fp, strands, first, count);
+		}
+		while (num_exceptions > 0 && exception_pos[num_exceptions - 1] >= from)
+			num_exceptions--;
+		exception_pos = realloc(exception_pos, (num_exceptions + segment.num_exceptions) * sizeof(pos_t) + 1);
+		exception_chars = realloc(exception_chars, num_exceptions + segment.num_exceptions + 1);
+		read_offsets(fp, &exception_pos[num_exceptions], segment.num_exceptions, segment.width);
+		fread(&exception_chars[num_exceptions], sizeof(char), segment.num_exceptions, fp);
+		num_exceptions += segment.num_exceptions;
+		size = first + count;
+		fseek(fp, segment.end, SEEK_SET);
+	}
+	mem_alloc(MEM_PHRASES, MEM_PHRASE_BYTES(size) + MEM_EXCEPTION_BYTES(num_exceptions));
+	if (strands != NULL)
+		mem_alloc(MEM_PHRASES, MEM_STRAND_BYTES(size));
+	trace_end(span, ftell(fp));
+	fclose(fp);
 
 	compressed_source->size = size; 
 	compressed_source->starts = starts;
 	struct bins * mybins = malloc(sizeof(struct bins));
 	mybins->size = num_bins; 
-	compressed_source->lens = mybins; 
-	compressed_source->lens->arr = lens;
-	compressed_source->lens->starts = bin_starts;
+	mybins->covered = layout.covered;
+	mybins->last_key = last_key;
+	mybins->arr = lens;
+	mybins->starts = bin_starts;
+	compressed_source->lens = (size > covered_size) ? extend_bins(mybins, lens, size) : mybins; 
 	compressed_source->mismatches = mismatches;
+	compressed_source->refs = layout.refs;
+	compressed_source->num_exceptions = num_exceptions;
+	compressed_source->exception_pos = exception_pos;
+	compressed_source->exception_chars = exception_chars;
+	compressed_source->exception_index = NULL;
+	compressed_source->strands = strands;
+	if (failed) {
+		free_csb(compressed_source);
+		return NULL;
+	}
+	index_exceptions(compressed_source, 0);
 	return compressed_source; 
 }
 
+static void read_phrase_at(FILE * fp, long long arrays, long long count, long long gap, int width, int strands, pos_t index, 
+	pos_t * start, pos_t * len, char * mismatch, unsigned char * strand) {
+/* Reads phrase -index- of the -count- phrases whose arrays start at file offset -arrays-, with -gap- bytes (the bin starts) 
+between the lens and the mismatches. */
+	*start = read_offset_at(fp, arrays + index * width, width);
+	*len = read_offset_at(fp, arrays + (count + index) * width, width);
+	fseek(fp, arrays + 2 * count * width + gap + index, SEEK_SET);
+	fread(mismatch, 1, 1, fp);
+	*strand = 0;
+	if (strands) {
+		fseek(fp, arrays + 2 * count * width + gap + count + index / 8, SEEK_SET);
+		fread(strand, 1, 1, fp);
+		*strand = *strand >> (index & 7) & 1;
+	}
+}
+
+csb * file_to_csb_end(char * filename, pos_t * first) {
+/* This function reads from the .csb file -filename- what append_bins needs to extend it: its table of references and its last two 
+phrases, with the exceptions of the last one, in a csb of two phrases (one if the source has a single phrase) whose positions are those 
+of the whole source. *first receives the index of its first phrase in the source, for csb_append_to_file. Only the header, the headers 
+of the segments and these phrases are read, so the cost does not grow with the source. It returns NULL if the file cannot be read, 
+if it is an archive or if file_to_csb would refuse its header or its segments. */
+	struct csb_layout layout;
+	if (is_archive(filename))
+		return NULL;
+	FILE * fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return NULL;
+	if (read_csb_layout(fp, &layout) != 0) {
+		fclose(fp);
+		return NULL;
+	}
+	int num_segments = 0, capacity = 16, failed = 0, s, k, strands = (layout.flags & CSB_HAS_STRANDS) != 0;
+	struct csb_segment * segments = malloc(capacity * sizeof(struct csb_segment));
+	long long size = layout.size;
+	fseek(fp, layout.end, SEEK_SET);
+	while (bytes_left(fp) > 0) {
+		if (num_segments == capacity) {
+			capacity *= 2;
+			segments = realloc(segments, capacity * sizeof(struct csb_segment));
+		}
+		if (read_csb_segment(fp, &layout, size, &segments[num_segments]) != 0) {
+			failed = 1;
+			break;
+		}
+		size = segments[num_segments].first + segments[num_segments].count;
+		num_segments++;
+	}
+	if (failed) {
+		free(segments);
+		free_ref_table(layout.refs);
+		fclose(fp);
+		return NULL;
+	}
+	// a phrase is read from the last segment that holds it, every segment going on from the last phrase of the one before
+	pos_t n = (size > 1) ? 2 : 1;
+	*first = size - n;
+	pos_t * starts = malloc(n * sizeof(pos_t)), * lens = malloc(n * sizeof(pos_t));
+	char * mismatches = malloc(n);
+	unsigned char * strand_bits = strands ? calloc(1, 1) : NULL, strand;
+	for (k = 0; k < n; ++k) {
+		pos_t p = *first + k;
+		for (s = num_segments - 1; s >= 0 && segments[s].first > p; --s)
+			;
+		if (s >= 0)
+			read_phrase_at(fp, segments[s].arrays, segments[s].count, 0, segments[s].width, strands, p - segments[s].first, 
+				&starts[k], &lens[k], &mismatches[k], &strand);
+		else
+			read_phrase_at(fp, layout.arrays, layout.size, layout.num_bins * layout.width, layout.width, strands, p, 
+				&starts[k], &lens[k], &mismatches[k], &strand);
+		if (strands)
+			strand_bits[0] |= strand << k;
+	}
+	// the exceptions of the last phrase, at the end of the exceptions of the last segment (or of the arrays)
+	long long num_exceptions = layout.num_exceptions, exceptions = layout.exceptions, e, found = 0;
+	int width = layout.width;
+	if (num_segments > 0) {
+		struct csb_segment * last = &segments[num_segments - 1];
+		num_exceptions = last->num_exceptions;
+		exceptions = last->arrays + last->count * (2 * last->width + 1) + (strands ? MEM_STRAND_BYTES(last->count) : 0);
+		width = last->width;
+	}
+	pos_t from = (n > 1) ? lens[0] : 0;
+	while (found < num_exceptions && read_offset_at(fp, exceptions + (num_exceptions - found - 1) * width, width) >= from)
+		found++;
+	pos_t * exception_pos = malloc(found * sizeof(pos_t) + 1);
+	char * exception_chars = malloc(found + 1);
+	fseek(fp, exceptions + (num_exceptions - found) * width, SEEK_SET);
+	read_offsets(fp, exception_pos, found, width);
+	fseek(fp, exceptions + num_exceptions * width + num_exceptions - found, SEEK_SET);
+	fread(exception_chars, 1, found, fp);
+	free(segments);
+	fclose(fp);
+
+	csb * end = malloc(sizeof(csb));
+	end->size = n;
+	end->starts = starts;
+	end->lens = create_bins(lens, n, 1);
+	end->mismatches = mismatches;
+	end->refs = layout.refs;
+	end->num_exceptions = found;
+	end->exception_pos = exception_pos;
+	end->exception_chars = exception_chars;
+	end->exception_index = NULL;
+	end->strands = strand_bits;
+	mem_alloc(MEM_PHRASES, MEM_PHRASE_BYTES(n) + MEM_EXCEPTION_BYTES(found));
+	if (strands)
+		mem_alloc(MEM_PHRASES, MEM_STRAND_BYTES(n));
+	index_exceptions(end, 0);
+	for (e = 1; e < found; ++e)
+		if (exception_pos[e] <= exception_pos[e - 1])
+			failed = 1;
+	if (failed || lens[n - 1] <= from) {
+		free_csb(end);
+		return NULL;
+	}
+	return end;
+}
+
+int csb_append_to_file(csb * end, pos_t first, char * filename) {
+/* This function writes at the end of the .csb file -filename- the phrases of -end- after its first one and their exceptions, -end- 
+being returned by file_to_csb_end (which gives -first-) and extended by append_bins. This segment replaces the last phrase of the file 
+and goes on from there, the rest of the file is left as it is: appending costs time and I/O proportional to the new phrases. 
+It returns 1 if the file cannot be written, and 0 otherwise. */
+	FILE * fp = fopen(filename, "ab");
+	if (fp == NULL)
+		return 1;
+	struct trace_span span = trace_begin("append csb");
+	long long from = first + 1, count = end->size - 1, num_exceptions;
+	unsigned char width = offset_width(end);
+	pos_t e = 0;
+	while (e < end->num_exceptions && end->exception_pos[e] < end->lens->arr[0])
+		e++;
+	num_exceptions = end->num_exceptions - e;
+	fwrite(CSB_SEGMENT_MAGIC, 1, 4, fp);
+	fwrite(&width, 1, 1, fp);
+	fwrite(&from, sizeof(long long), 1, fp);
+	fwrite(&count, sizeof(long long), 1, fp);
+	fwrite(&num_exceptions, sizeof(long long), 1, fp);
+	write_offsets(fp, &end->starts[1], count, width);
+	write_offsets(fp, &end->lens->arr[1], count, width);
+	fwrite(&end->mismatches[1], sizeof(char), count, fp);
+	if (end->strands != NULL)
+		write_strands(fp, end->strands, 1, count);
+	if (num_exceptions > 0) {
+		write_offsets(fp, &end->exception_pos[e], num_exceptions, width);
+		fwrite(&end->exception_chars[e], sizeof(char), num_exceptions, fp);
+	}
+	int failed = ferror(fp) != 0;
+	trace_end(span, CSB_SEGMENT_HEADER_BYTES + count * (2 * width + 1) + num_exceptions * (width + 1));
+	if (fclose(fp) != 0)
+		failed = 1;
+	return failed;
+}
@@ -1,5 +1,29 @@
+#define REF_PADDING 30 // N characters added after the references by load_file and load_references, before the '$'
+#define LOAD_MAX_SOURCE (POS_MAX - 2) // bytes of a source file, so its positions and the '$' fit in pos_t
+#define LOAD_MAX_REFERENCE (POS_MAX - REF_PADDING - 2) // bytes of the references, so the padding and the '$' fit in pos_t
+#define LOAD_TAIL 64 // zero bytes left after the '\0' of every loaded text, which the vector kernels of cpu_match may read
+
+#define CSB_MAGIC "ISRZ"
+#define CSB_VERSION 1
+#define CSB_VERSION_REFS 2 // the header is followed by the table of references, see write_ref_table
+#define CSB_VERSION_EXCEPTIONS 3 // the header is followed by a byte of CSB_HAS_ flags
+#define CSB_HAS_REFS 1
+#define CSB_HAS_EXCEPTIONS 2 // the arrays are followed by the exceptions of the tolerant parse
+#define CSB_HAS_STRANDS 8 // the mismatches are followed by one strand bit per phrase
+#define CSB_HAS_TAIL 4 // the flags are followed by the phrases covered by the bins and their last key (8 bytes each), see extend_bins
+#define CSB_HEADER_BYTES 22 // magic, version, offset width, size and number of bins
+#define CSB_SEGMENT_MAGIC "ISRA" // a segment written by csb_append_to_file
+#define CSB_SEGMENT_HEADER_BYTES 29 // magic, offset width, first phrase, number of phrases and of exceptions
 char * load_file(char* filename, int add_N);
+void unload_file(char * buffer, int add_N);
+char * load_references(char * filenames, struct ref_table ** table);
+int check_references(struct ref_table * stored, struct ref_table * given);
+int find_reference(struct ref_table * refs, pos_t pos);
+pos_t reference_length(char * reference);
 void csb_to_file(csb * compression, char * filename); 
 csb * file_to_csb(char * filename);  
+csb * file_to_csb_end(char * filename, pos_t * first);
+int csb_append_to_file(csb * end, pos_t first, char * filename);
 void csb_to_txt(csb * compression, char * filename); 
 csb * txt_to_csb(char * filename, int bin_factor);  
+int offset_width(csb * compression);
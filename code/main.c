@@ -3,56 +3,204 @@
 #include <stdbool.h>
 #include <dirent.h>
 #include <string.h>
+#include <stdint.h>
 
+#include "types.h"
 #include "interpolation.h"
 #include "suffix_tree.h"
 #include "rlz.h"
 #include "load.h"
 #include "measures.h"
+#include "archive.h"
+#include "perf.h"
+#include "bench.h"
+#include "rng.h"
+#include "gen.h"
+#include "mem.h"
+#include "trace.h"
+#include "search.h"
+#include "composition.h"
+#include "variants.h"
+#include "diff.h"
+#include "blocks.h"
+#include "extract.h"
+#include "liftover.h"
+#include "cpu.h"
+#include "sketch.h"
+#include "check.h"
 // ----------------------------------------------------
 
 int main(int argc, char * argv[]) {
-	
+	// '--trace FILE' and '--threads N' are accepted anywhere and removed before the action reads its arguments
+	int a, b;
+	cpu_init();
+	for (a = 1; a + 1 < argc; ) {
+		if (strcmp(argv[a], "--trace") == 0)
+			trace_enable(argv[a + 1]);
+		else if (strcmp(argv[a], "--threads") == 0) {
+			treeThreads = atoi(argv[a + 1]);
+			if (treeThreads < 1) {
+				printf("Incorrect command. --threads must be positive \n");
+				return 1;
+			}
+		}
+		else {
+			++a;
+			continue;
+		}
+		for (b = a; b + 2 < argc; ++b)
+			argv[b] = argv[b + 2];
+		argc -= 2;
+	}
 
 	if (argc == 1 || (argc == 2 && strcmp(argv[1],"-h") == 0) || (argc == 2 && strcmp(argv[1], "help") == 0)){
 		printf("--------------------------------------------------------------------------------------------------------\n");
 		printf("--------------------------------------------------------------------------------------------------------\n");
 		printf("                                                 ISRLZ HELP \n");
 		printf("--------------------------------------------------------------------------------------------------------\n");
-		printf("There are four possible actions, determined by the first input: \n'compress', 'decompress', 'access', 'test' \n\n");
-		printf("COMPRESS command-line input: \n [reference filename] [source filename] [output filename] (optional)[bin factor] \n\n");
+		printf("There are sixteen possible actions, determined by the first input: \n'compress', 'archive', 'decompress', 'access', 'append', 'search', 'composition', 'variants', 'diff', 'blocks', 'extract', 'liftover', 'select', 'test', 'bench', 'gen' \n\n");
+		printf("COMPRESS command-line input: \n [reference filename] [source filename] [output filename] (optional)[bin factor] (optional)[snp run] (optional)[reverse complement] \n\n");
+		printf("ARCHIVE command-line input: \n [reference filename] [source filename] [output filename] (optional)[bin factor] (optional)[block size] \n");
+		printf("Same as COMPRESS, but the phrases are entropy coded in independent blocks for cold storage. DECOMPRESS and ACCESS accept both formats. \n\n");
 		printf("DECOMPRESS command-line input: \n [reference filename] [compressed source filename] [output filename] \n\n");
 		printf("ACCESS command-line input: \n [reference filename] [compressed source filename] [index] (optional)[range length] \n\n");
+		printf("APPEND command-line input: \n [reference filename] [compressed source filename] [new data filenames] (optional)[snp run] \n");
+		printf("Extends a .csb file with the data of new files, a comma separated list appended in order: only the last phrase is parsed again, \nfollowed by the new data, and the new phrases are written at the end of the file. \n\n");
+		printf("SEARCH command-line input: \n [reference filename] [compressed source filename] [pattern] (optional)[max positions] \n");
+		printf("Counts and locates the occurrences of [pattern] without decompressing the source. [compressed source filename] can be \na comma separated list, searched in parallel with '--threads N'. The first [max positions] positions are printed (10 by default, -1 for all). \n\n");
+		printf("COMPOSITION command-line input: \n [reference filename] [compressed source filename] [index] [range length] (optional)[window] \n");
+		printf("Prints the counts of A, C, G, T and N and the GC content of the range, or of every window of the range, in time proportional to its phrases. \n\n");
+		printf("VARIANTS command-line input: \n [reference filename] [compressed source filename] [output filename] (optional)[index] (optional)[range length] \n");
+		printf("Writes the substitutions, indels and breakends of the source (or of the range) against the reference as VCF, '-' for stdout, without decompressing it. \n\n");
+		printf("DIFF command-line input: \n [reference filename] [compressed source filename] [compressed source filename] (optional)[max intervals] \n");
+		printf("Prints the source intervals where two sources compressed against the same reference differ, position by position, \ndecoding only where their phrases do not copy the same reference offsets. The first [max intervals] are printed (10 by default, -1 for all). \n\n");
+		printf("BLOCKS command-line input: \n [compressed source filename] [output filename] (optional)[bin factor] \n");
+		printf("Writes the phrases interleaved in blocks of one cache line, so each ACCESS query reads one line of phrases. ACCESS accepts this format too. \n\n");
+		printf("EXTRACT command-line input: \n [reference filename] [compressed source filename] [regions filename] [output filename] \n");
+		printf("Writes every region of a BED file (source positions, 0-based, end excluded) as a FASTA record, '-' for stdout, in the order of the file. \nThe regions are decoded in position order by '--threads N' threads. \n\n");
+		printf("LIFTOVER command-line input: \n [reference filename] [compressed source filename] to-reference [positions filename] [output filename] \n");
+		printf(" [reference filename] [compressed source filename] to-source [regions filename] [output filename] \n");
+		printf("Maps source positions (one per line) to their reference positions, or reference regions (BED) to the source intervals that cover them, \nfrom the phrases alone, '-' for stdout. \n\n");
+		printf("SELECT command-line input: \n [reference filenames] [source filenames] [output filename] (optional flags, see 'isrlz select') \n");
+		printf("Picks for every source the reference expected to give the fewest phrases, from k-mer sketches, and can check the estimates \nagainst actual compressions of a sample of the sources (--validate N) or compress every source against its reference (--compress DIR). \n\n");
 		printf("TEST command-line input: \n [reference filename] [source filename] [bin factor] [nr of index trials] [nr of range trials] [range length]\n");
-		printf("This action will return time measures for access queries (length 1 and length range), compression time, and some statistics of the compression. \n\n");
+		printf("This action will return time measures for access queries (length 1 and length range), compression time, and some statistics of the compression. \n");
+		printf("'isrlz test check' runs the regression checks instead, on generated inputs (see 'make check'). \n\n");
+		printf("BENCH command-line input: \n [reference filename] [source filename] (optional flags, see 'isrlz bench') \n");
+		printf("This action benchmarks tree build, compression, decompression, archive decoding, predecessor, find_substring, access and range access with warmup, \na fixed seed and per-operation latency percentiles, optionally with hardware counters (--perf 1). Results can be written as text, JSON or CSV. \n\n");
+		printf("GEN command-line input: \n [output prefix] [reference length] [number of strains] (optional flags, see 'isrlz gen') \n");
+		printf("This action writes a synthetic (uniform or Markov) reference and strains derived from it, with SNPs, indels, \nstructural rearrangements, N runs and mutation hotspots, for scaling benchmarks. \n\n");
+		printf("Any action accepts '--trace FILE': the time, bytes and throughput of every phase are printed on stderr, \nand the phases are written to FILE as a Chrome trace (chrome://tracing or ui.perfetto.dev). \n\n");
+		printf("Any action accepts '--threads N': the suffix tree of the reference is built by N threads instead of Ukkonen's algorithm, with the same result. \nSEARCH searches N sources at a time, and EXTRACT decodes the regions with N threads. \n\n");
+		printf("The vectorized kernels are selected at startup for the processor (SSE4.2, AVX2 or AVX-512). The environment variable ISRLZ_CPU \n(portable, sse2, sse4.2, avx2 or avx512) caps the level, for instance to check the portable kernels on the same binary. \n\n");
 		printf("for example, you can type:  isrlz compress reference.fsa source_to_compress.fsa compressed_file.csb  \n\n");
-		printf("Please notice that [bin factor] command is optional in COMPRESS action. By default, value is 1. \nAlso, [range length] is optional in ACCESS action. By default, only 1 char is returned.  \n");
+		printf("Please notice that [bin factor] command is optional in COMPRESS action. By default, value is 1. \n");
+		printf("With [snp run] K > 0, a substitution followed by K matching bases does not end the phrase, it is stored as an exception. \n");
+		printf("With [reverse complement] 1, phrases are also searched on the reverse strand of the reference, so inversions compress well. \n");
+		printf("[reference filename] can be a comma separated list of references, indexed together. DECOMPRESS and ACCESS need the same list. \n");
+		printf("[block size] is the number of phrases per block in ARCHIVE action. By default, value is %d. \nAlso, [range length] is optional in ACCESS action. By default, only 1 char is returned.  \n", ARCHIVE_BLOCK_SIZE);
 		printf("--------------------------------------------------------------------------------------------------------\n");
 		printf("--------------------------------------------------------------------------------------------------------\n");
 		return 1; 
 	}
 	else if (strcmp(argv[1], "compress") == 0){
-		if (argc != 5 && argc != 6){
+		if (argc < 5 || argc > 8){
 			printf("leete la ayuda macho \n");
 			return 1;
 		}
 		int bin_factor; 
+		struct parse_options opt = { 0, 0 };
 		char * ref_filename = argv[2];
 		char * source_filename = argv[3];
 		char * output_filename = argv[4];
-		if (argc == 6)
+		if (argc >= 6)
 			bin_factor = atoi(argv[5]);
 		else  
 			bin_factor = 1;
+		if (argc >= 7)
+			opt.snp_run = atoi(argv[6]);
+		if (argc == 8)
+			opt.reverse_complement = atoi(argv[7]);
+		if (bin_factor < 1 || opt.snp_run < 0){
+			printf("Incorrect command. [bin factor] must be positive and [snp run] cannot be negative  \n");
+			return 1;
+		}
 		 
-		char * reference = load_file(ref_filename, 1);
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
 		char * source = load_file(source_filename, 0);
-		Node * suffix_tree = (Node*)malloc(sizeof(Node));
-		suffix_tree = buildSuffixTree(reference);
-		csb * compressed_source = compress_bins(suffix_tree, reference, source, bin_factor);
+		if (reference == NULL || source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		SuffixTree * suffix_tree = buildSuffixTree(reference, treeThreads);
+		csb * compressed_source = compress_bins_ext(suffix_tree, reference, source, bin_factor, &opt);
+		if (compressed_source == NULL) {
+			printf("Error. %s has a character that is not in the reference \n", source_filename);
+			return 1;
+		}
+		compressed_source->refs = refs;
 		csb_to_file(compressed_source, output_filename);
 		printf("Source string %s has been compressed and stored in file:",source_filename);
 		printf(" %s \n", output_filename);  
+		if (opt.snp_run > 0)
+			printf("%lld phrases, %lld substitutions kept inside them as exceptions \n", (long long)(compressed_source->size - 1), (long long)compressed_source->num_exceptions);
+		if (opt.reverse_complement) {
+			pos_t phrase, reverse = 0;
+			for (phrase = 1; phrase < compressed_source->size; ++phrase)
+				reverse += PHRASE_IS_REVERSE(compressed_source, phrase);
+			printf("%lld phrases, %lld of them from the reverse complement \n", (long long)(compressed_source->size - 1), (long long)reverse);
+		}
+		if (refs != NULL) {
+			// phrases taken from every reference
+			pos_t * counts = calloc(refs->num, sizeof(pos_t)), phrase;
+			int k;
+			for (phrase = 1; phrase < compressed_source->size; ++phrase)
+				counts[phrase_reference(compressed_source, phrase)]++;
+			printf("%lld phrases:", (long long)(compressed_source->size - 1));
+			for (k = 0; k < refs->num; ++k)
+				printf("%s %lld from %s", k ? "," : "", (long long)counts[k], refs->names[k]);
+			printf("\n");
+			free(counts);
+		}
+	}
+
+	else if (strcmp(argv[1], "archive") == 0){
+		if (argc < 5 || argc > 7){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		int bin_factor = 1, block_size = ARCHIVE_BLOCK_SIZE; 
+		char * ref_filename = argv[2];
+		char * source_filename = argv[3];
+		char * output_filename = argv[4];
+		if (argc >= 6)
+			bin_factor = atoi(argv[5]);
+		if (argc == 7)
+			block_size = atoi(argv[6]);
+		if (bin_factor < 1 || block_size < 1){
+			printf("Incorrect command. [bin factor] and [block size] must be positive  \n");
+			return 1;
+		}
+
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		char * source = load_file(source_filename, 0);
+		if (reference == NULL || source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		SuffixTree * suffix_tree = buildSuffixTree(reference, treeThreads);
+		csb * compressed_source = compress_bins(suffix_tree, reference, source, bin_factor);
+		if (compressed_source == NULL) {
+			printf("Error. %s has a character that is not in the reference \n", source_filename);
+			return 1;
+		}
+		// the archive does not store the table, the same list of references must be given to decompress it
+		free_ref_table(refs);
+		csb_to_archive(compressed_source, output_filename, block_size);
+		printf("Source string %s has been archived and stored in file:",source_filename);
+		printf(" %s \n", output_filename);  
 	}
 
 	else if (strcmp(argv[1], "decompress") == 0){
@@ -63,8 +211,15 @@ int main(int argc, char * argv[]) {
 		char * ref_filename = argv[2];
 		char * source_filename = argv[3];
 		char * output_filename = argv[4];
-		char * reference = load_file(ref_filename, 1);
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
 		csb * compressed_source = file_to_csb(source_filename); 
+		if (reference == NULL || compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		if (!is_archive(source_filename) && check_references(compressed_source->refs, refs) != 0)
+			return 1;
 		char * source = decompress_bins(reference, compressed_source); 
 		FILE *fp = fopen(output_filename, "w");
 		fputs(source, fp);
@@ -80,24 +235,511 @@ int main(int argc, char * argv[]) {
 		}
 		char * ref_filename = argv[2];
 		char * source_filename = argv[3];
-		int index = atoi(argv[4]);	
-		int len; 
+		pos_t index = atoll(argv[4]);	
+		pos_t len; 
 		if (argc == 6)
-			len = atoi(argv[5]);
+			len = atoll(argv[5]);
 		else 
 			len = 0; 
-		char * reference = load_file(ref_filename, 1);
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		if (reference == NULL) {
+			printf("Error. Cannot read %s \n", ref_filename);
+			return 1;
+		}
+		if (is_archive(source_filename)) {
+			// only the block covering the query is decoded
+			struct archive * arc = archive_open(source_filename);
+			if (arc == NULL) {
+				printf("Error. Cannot read %s \n", source_filename);
+				return 1;
+			}
+			if (index < 0 || index >= arc->bases[arc->num_blocks]) {
+				printf("Error. [index] must be in [0, %lld) \n", (long long)arc->bases[arc->num_blocks]);
+				archive_close(arc);
+				return 1;
+			}
+			if (len > 0) {
+				char * output = archive_access_range(reference, arc, index, len); 
+				printf("source[%lld..%lld] = %s\n", (long long)index, (long long)(index+len), output); 
+			}
+			else {
+				char output = archive_access(reference, arc, index); 
+				printf("source[%lld] = %c \n", (long long)index, output); 	
+			}
+			archive_close(arc);
+			return 0;
+		}
+		if (is_phrase_blocks(source_filename)) {
+			struct phrase_blocks * blocks = file_to_phrase_blocks(source_filename);
+			if (blocks == NULL) {
+				printf("Error. Cannot read %s \n", source_filename);
+				return 1;
+			}
+			if (index < 0 || index >= blocks->length) {
+				printf("Error. [index] must be in [0, %lld) \n", (long long)blocks->length);
+				free_phrase_blocks(blocks);
+				return 1;
+			}
+			if (len > 0) {
+				char * output = access_blocks_range(reference, blocks, index, len); 
+				printf("source[%lld..%lld] = %s\n", (long long)index, (long long)(index+len), output); 
+			}
+			else {
+				char output = access_blocks(reference, blocks, index); 
+				printf("source[%lld] = %c \n", (long long)index, output); 	
+			}
+			free_phrase_blocks(blocks);
+			return 0;
+		}
 		csb * compressed_source = file_to_csb(source_filename); 
+		if (compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", source_filename);
+			return 1;
+		}
+		if (check_references(compressed_source->refs, refs) != 0)
+			return 1;
 		if (len > 0) {
 			char * output = access_bins_range(reference, compressed_source, index, len); 
-			printf("source[%d..%d] = %s\n", index, index+len, output); 
+			printf("source[%lld..%lld] = %s\n", (long long)index, (long long)(index+len), output); 
 		}
 		else {
 			char output = access_bins(reference, compressed_source, index); 
-			printf("source[%d] = %c \n", index, output); 	
+			printf("source[%lld] = %c \n", (long long)index, output); 	
 		}
 	}		
+	else if (strcmp(argv[1], "append") == 0){
+		if (argc != 5 && argc != 6){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * compressed_filename = argv[3];
+		char * data_filenames = strdup(argv[4]);
+		struct parse_options opt = { (argc == 6) ? atoi(argv[5]) : 0, 0 };
+		if (opt.snp_run < 0 || is_archive(compressed_filename)) {
+			printf("Incorrect command. [snp run] cannot be negative, and archives cannot be extended (append to the .csb file and archive it again)  \n");
+			return 1;
+		}
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		if (reference == NULL) {
+			printf("Error. Cannot read %s \n", ref_filename);
+			return 1;
+		}
+		// only the end of the file is read, and the new phrases are written after it
+		pos_t first;
+		csb * compressed_source = file_to_csb_end(compressed_filename, &first);
+		if (compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", compressed_filename);
+			return 1;
+		}
+		if (check_references(compressed_source->refs, refs) != 0)
+			return 1;
+		pos_t old_size = compressed_source->size;
+		// a source compressed against both strands keeps searching both
+		opt.reverse_complement = compressed_source->strands != NULL;
+		SuffixTree * suffix_tree = buildSuffixTree(reference, treeThreads);
+		// every file is appended with the same tree, and all of them are written in one segment
+		char * data_filename = strtok(data_filenames, ",");
+		for (; data_filename != NULL; data_filename = strtok(NULL, ",")) {
+			char * data = load_file(data_filename, 0);
+			if (data == NULL) {
+				printf("Error. Cannot read %s \n", data_filename);
+				return 1;
+			}
+			if (append_bins(suffix_tree, reference, compressed_source, data, &opt) != 0)
+				return 1;
+			unload_file(data, 0);
+		}
+		if (csb_append_to_file(compressed_source, first, compressed_filename) != 0) {
+			printf("Error. Cannot write %s \n", compressed_filename);
+			return 1;
+		}
+		printf("%s has been appended to %s: %lld phrases (%lld new) \n", argv[4], compressed_filename, 
+			(long long)(first + compressed_source->size - 1), (long long)(compressed_source->size - old_size));
+	}
+	else if (strcmp(argv[1], "search") == 0){
+		if (argc != 5 && argc != 6){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * pattern = argv[4];
+		pos_t max_positions = (argc == 6) ? atoll(argv[5]) : 10;
+		if (strlen(pattern) == 0 || strpbrk(pattern, "$#") != NULL) {
+			printf("Incorrect command. [pattern] cannot be empty nor contain '$' or '#' \n");
+			return 1;
+		}
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		if (reference == NULL) {
+			printf("Error. Cannot read %s \n", ref_filename);
+			return 1;
+		}
+		// every source of the comma separated list is loaded first, then they are searched in parallel
+		char * list = strdup(argv[3]), * name;
+		char ** names = NULL;
+		csb ** sources = NULL;
+		int num_sources = 0, k;
+		for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+			csb * compressed_source = file_to_csb(name);
+			if (compressed_source == NULL) {
+				printf("Error. Cannot read %s \n", name);
+				return 1;
+			}
+			if (!is_archive(name) && check_references(compressed_source->refs, refs) != 0)
+				return 1;
+			names = realloc(names, (num_sources + 1) * sizeof(char *));
+			sources = realloc(sources, (num_sources + 1) * sizeof(csb *));
+			names[num_sources] = name;
+			sources[num_sources++] = compressed_source;
+		}
+		SuffixTree * suffix_tree = buildSuffixTree(reference, treeThreads);
+		struct trace_span span = trace_begin("search");
+		struct search_result * results = search_sources(suffix_tree, reference, sources, num_sources, pattern, treeThreads);
+		trace_end(span, 0);
+		for (k = 0; k < num_sources; ++k) {
+			pos_t j;
+			printf("%s: %lld occurrences", names[k], (long long)results[k].count);
+			for (j = 0; j < results[k].count && (max_positions < 0 || j < max_positions); ++j)
+				printf("%s%lld", j ? " " : " at ", (long long)results[k].positions[j]);
+			printf("%s\n", (j < results[k].count) ? " ..." : "");
+		}
+		free_search_results(results, num_sources);
+		for (k = 0; k < num_sources; ++k)
+			free_csb(sources[k]);
+		free(sources);
+		free(names);
+		free(list);
+	}
+	else if (strcmp(argv[1], "composition") == 0){
+		if (argc != 6 && argc != 7){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * source_filename = argv[3];
+		pos_t index = atoll(argv[4]);
+		pos_t len = atoll(argv[5]);
+		pos_t window = (argc == 7) ? atoll(argv[6]) : 0;
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		csb * compressed_source = file_to_csb(source_filename);
+		if (reference == NULL || compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		if (!is_archive(source_filename) && check_references(compressed_source->refs, refs) != 0)
+			return 1;
+		// the terminator is not part of the source
+		pos_t source_len = compressed_source->lens->arr[compressed_source->size - 1] - 1;
+		if (index < 0 || len < 1 || window < 0 || index + len > source_len) {
+			printf("Incorrect command. The range must be inside the source (%lld characters) and [window] cannot be negative \n", (long long)source_len);
+			return 1;
+		}
+		struct composition_index * comp_index = composition_index_build(reference, COMPOSITION_SAMPLE);
+		if (window == 0)
+			window = len;
+		pos_t num_windows = (len + window - 1) / window, w;
+		pos_t * counts = malloc(num_windows * COMPOSITION_BASES * sizeof(pos_t));
+		composition_windows(comp_index, reference, compressed_source, index, index + len, window, counts);
+		printf("start\tend\tA\tC\tG\tT\tN\tGC\n");
+		for (w = 0; w < num_windows; ++w) {
+			pos_t * c = &counts[w * COMPOSITION_BASES];
+			pos_t acgt = c[0] + c[1] + c[2] + c[3];
+			printf("%lld\t%lld\t%lld\t%lld\t%lld\t%lld\t%lld\t%.4f\n", (long long)(index + w * window), (long long)((index + (w + 1) * window < index + len) ? index + (w + 1) * window : index + len),
+				(long long)c[0], (long long)c[1], (long long)c[2], (long long)c[3], (long long)c[4], acgt ? (double)(c[1] + c[2]) / acgt : 0);
+		}
+		free(counts);
+		composition_index_free(comp_index);
+	}
+	else if (strcmp(argv[1], "variants") == 0){
+		if (argc != 5 && argc != 7){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * source_filename = argv[3];
+		char * output_filename = argv[4];
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		csb * compressed_source = file_to_csb(source_filename);
+		if (reference == NULL || compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		if (!is_archive(source_filename) && check_references(compressed_source->refs, refs) != 0)
+			return 1;
+		pos_t index = (argc == 7) ? atoll(argv[5]) : 0;
+		pos_t len = (argc == 7) ? atoll(argv[6]) : compressed_source->lens->arr[compressed_source->size - 1] - 1;
+		if (index < 0 || len < 0) {
+			printf("Incorrect command. [index] and [range length] cannot be negative \n");
+			return 1;
+		}
+		struct variant * variants;
+		pos_t num = find_variants(reference, compressed_source, index, len, &variants);
+		FILE * fp = (strcmp(output_filename, "-") == 0) ? stdout : fopen(output_filename, "w");
+		if (fp == NULL) {
+			printf("Error. Cannot write %s \n", output_filename);
+			return 1;
+		}
+		// a single reference is named after its file
+		char * name = strrchr(ref_filename, '/') ? strrchr(ref_filename, '/') + 1 : ref_filename;
+		write_vcf(fp, reference, refs, name, variants, num);
+		if (fp != stdout) {
+			fclose(fp);
+			printf("%lld variants written to %s \n", (long long)num, output_filename);
+		}
+		free_variants(variants, num);
+	}
+	else if (strcmp(argv[1], "diff") == 0){
+		if (argc != 5 && argc != 6){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * filenames[2] = { argv[3], argv[4] };
+		pos_t max_intervals = (argc == 6) ? atoll(argv[5]) : 10;
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		if (reference == NULL) {
+			printf("Error. Cannot read %s \n", ref_filename);
+			return 1;
+		}
+		csb * sources[2];
+		int k;
+		for (k = 0; k < 2; ++k) {
+			sources[k] = file_to_csb(filenames[k]);
+			if (sources[k] == NULL) {
+				printf("Error. Cannot read %s \n", filenames[k]);
+				return 1;
+			}
+			if (!is_archive(filenames[k]) && check_references(sources[k]->refs, refs) != 0)
+				return 1;
+		}
+		struct diff_interval * intervals;
+		struct diff_stats stats;
+		pos_t num = diff_sources(reference, sources[0], sources[1], &intervals, &stats), j;
+		printf("%lld differing positions in %lld intervals. %lld positions skipped from the phrases alone, %lld decoded \n", 
+			(long long)stats.differing, (long long)num, (long long)stats.skipped, (long long)stats.decoded);
+		for (j = 0; j < num && (max_intervals < 0 || j < max_intervals); ++j)
+			printf("[%lld, %lld) \n", (long long)intervals[j].start, (long long)intervals[j].end);
+		if (j < num)
+			printf("... \n");
+		free(intervals);
+		free_csb(sources[0]);
+		free_csb(sources[1]);
+	}
+	else if (strcmp(argv[1], "blocks") == 0){
+		if (argc != 4 && argc != 5){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		int bin_factor = (argc == 5) ? atoi(argv[4]) : 1;
+		if (bin_factor < 1) {
+			printf("Incorrect command. [bin factor] must be positive  \n");
+			return 1;
+		}
+		csb * compressed_source = file_to_csb(argv[2]);
+		if (compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", argv[2]);
+			return 1;
+		}
+		struct phrase_blocks * blocks = build_phrase_blocks(compressed_source, bin_factor);
+		if (blocks == NULL) {
+			printf("Error. Some phrases span 2^32 source positions or more, they do not fit in phrase blocks \n");
+			return 1;
+		}
+		phrase_blocks_to_file(blocks, argv[3]);
+		free_phrase_blocks(blocks);
+		free_csb(compressed_source);
+	}
+	else if (strcmp(argv[1], "extract") == 0){
+		if (argc != 6){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * source_filename = argv[3];
+		char * regions_filename = argv[4];
+		char * output_filename = argv[5];
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		csb * compressed_source = file_to_csb(source_filename);
+		if (reference == NULL || compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		if (!is_archive(source_filename) && check_references(compressed_source->refs, refs) != 0)
+			return 1;
+		pos_t num, error_line, j;
+		struct region * regions = read_bed(regions_filename, &num, &error_line);
+		if (regions == NULL) {
+			if (error_line == 0)
+				printf("Error. Cannot read %s \n", regions_filename);
+			else
+				printf("Error. Line %lld of %s is not a BED region \n", (long long)error_line, regions_filename);
+			return 1;
+		}
+		pos_t len = compressed_source->lens->arr[compressed_source->size - 1] - 1;
+		for (j = 0; j < num; ++j) {
+			if (regions[j].end > len) {
+				printf("Error. Region %s:%lld-%lld ends after the source (%lld characters) \n", regions[j].chrom, (long long)regions[j].start, (long long)regions[j].end, (long long)len);
+				return 1;
+			}
+		}
+		FILE * fp = (strcmp(output_filename, "-") == 0) ? stdout : fopen(output_filename, "w");
+		if (fp == NULL) {
+			printf("Error. Cannot write %s \n", output_filename);
+			return 1;
+		}
+		uint64_t t0 = bench_now_ns();
+		pos_t bases = extract_regions(reference, compressed_source, regions, num, fp, treeThreads);
+		double seconds = (bench_now_ns() - t0) / 1e9;
+		if (fp != stdout)
+			fclose(fp);
+		// the report goes to stderr when the records go to stdout
+		fprintf((fp == stdout) ? stderr : stdout, "%lld regions (%lld bases) extracted to %s in %.3f s: %.0f regions/s, %.0f bases/s \n",
+			(long long)num, (long long)bases, output_filename, seconds, num / seconds, bases / seconds);
+		free_regions(regions, num);
+		free_csb(compressed_source);
+	}
+	else if (strcmp(argv[1], "liftover") == 0){
+		if (argc != 7 || (strcmp(argv[4], "to-reference") != 0 && strcmp(argv[4], "to-source") != 0)){
+			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
+			return 1;
+		}
+		char * ref_filename = argv[2];
+		char * source_filename = argv[3];
+		char * input_filename = argv[5];
+		char * output_filename = argv[6];
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
+		csb * compressed_source = file_to_csb(source_filename);
+		if (reference == NULL || compressed_source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		if (!is_archive(source_filename) && check_references(compressed_source->refs, refs) != 0)
+			return 1;
+		// a single reference is named after its file
+		char * name = strrchr(ref_filename, '/') ? strrchr(ref_filename, '/') + 1 : ref_filename;
+		pos_t len = compressed_source->lens->arr[compressed_source->size - 1] - 1, num = 0, j;
+		FILE * fp;
+		if (strcmp(argv[4], "to-reference") == 0) {
+			FILE * in = fopen(input_filename, "r");
+			if (in == NULL) {
+				printf("Error. Cannot read %s \n", input_filename);
+				return 1;
+			}
+			pos_t capacity = 1024, counts[4] = { 0, 0, 0, 0 };
+			pos_t * positions = malloc(capacity * sizeof(pos_t));
+			long long value;
+			while (fscanf(in, "%lld", &value) == 1) {
+				if (num == capacity) {
+					capacity *= 2;
+					positions = realloc(positions, capacity * sizeof(pos_t));
+				}
+				positions[num++] = value;
+			}
+			if (!feof(in)) {
+				printf("Error. %s must hold one source position per line \n", input_filename);
+				return 1;
+			}
+			fclose(in);
+			struct lift * lifts = malloc((num ? num : 1) * sizeof(struct lift));
+			liftover_positions(reference, compressed_source, positions, num, lifts);
+			fp = (strcmp(output_filename, "-") == 0) ? stdout : fopen(output_filename, "w");
+			if (fp == NULL) {
+				printf("Error. Cannot write %s \n", output_filename);
+				return 1;
+			}
+			const char * kinds[4] = { "copied", "mismatch", "novel", "unmapped" };
+			for (j = 0; j < num; ++j) {
+				counts[(int)lifts[j].kind]++;
+				if (lifts[j].ref_pos < 0) {
+					// same columns as the aligned positions, with no reference
+					fprintf(fp, "%lld\t.\t.\t.\t%s\n", (long long)positions[j], kinds[(int)lifts[j].kind]);
+					continue;
+				}
+				int chrom = find_reference(refs, lifts[j].ref_pos);
+				fprintf(fp, "%lld\t%s\t%lld\t%c\t%s\n", (long long)positions[j], refs ? refs->names[chrom] : name,
+					(long long)(lifts[j].ref_pos - (refs ? refs->starts[chrom] : 0)), lifts[j].reverse ? '-' : '+', kinds[(int)lifts[j].kind]);
+			}
+			if (fp != stdout) {
+				fclose(fp);
+				printf("%lld positions lifted to %s: %lld copied, %lld mismatches, %lld novel, %lld out of the source (%lld characters) \n", (long long)num, output_filename,
+					(long long)counts[LIFT_COPIED], (long long)counts[LIFT_MISMATCH], (long long)counts[LIFT_NOVEL], (long long)counts[LIFT_UNMAPPED], (long long)len);
+			}
+			free(positions);
+			free(lifts);
+		}
+		else {
+			pos_t error_line, hits_total = 0;
+			struct region * regions = read_bed(input_filename, &num, &error_line);
+			if (regions == NULL) {
+				if (error_line == 0)
+					printf("Error. Cannot read %s \n", input_filename);
+				else
+					printf("Error. Line %lld of %s is not a BED region \n", (long long)error_line, input_filename);
+				return 1;
+			}
+			// the chrom of every region is one of the references, by name or file name
+			pos_t * offsets = malloc((num ? num : 1) * sizeof(pos_t));
+			int k;
+			for (j = 0; j < num; ++j) {
+				for (k = 0; refs != NULL && k < refs->num; ++k) {
+					char * base = strrchr(refs->names[k], '/') ? strrchr(refs->names[k], '/') + 1 : refs->names[k];
+					if (strcmp(regions[j].chrom, refs->names[k]) == 0 || strcmp(regions[j].chrom, base) == 0)
+						break;
+				}
+				if (refs != NULL && k == refs->num) {
+					printf("Error. %s is not one of the references \n", regions[j].chrom);
+					return 1;
+				}
+				offsets[j] = refs ? refs->starts[k] : 0;
+				if (regions[j].end > (refs ? refs->starts[k + 1] - refs->starts[k] - 1 : (pos_t)strlen(reference))) {
+					printf("Error. Region %s:%lld-%lld ends after its reference \n", regions[j].chrom, (long long)regions[j].start, (long long)regions[j].end);
+					return 1;
+				}
+			}
+			fp = (strcmp(output_filename, "-") == 0) ? stdout : fopen(output_filename, "w");
+			if (fp == NULL) {
+				printf("Error. Cannot write %s \n", output_filename);
+				return 1;
+			}
+			struct liftover_index * index = liftover_index_build(reference, compressed_source);
+			for (j = 0; j < num; ++j) {
+				struct lift_interval * hits;
+				pos_t num_hits = liftover_reference(index, offsets[j] + regions[j].start, offsets[j] + regions[j].end, &hits), h;
+				for (h = 0; h < num_hits; ++h) {
+					pos_t length = hits[h].ref_end - hits[h].ref_start;
+					fprintf(fp, "%s\t%lld\t%lld\t%lld\t%lld\t%c", regions[j].chrom, (long long)(hits[h].ref_start - offsets[j]), (long long)(hits[h].ref_end - offsets[j]),
+						(long long)hits[h].src_start, (long long)(hits[h].src_start + length), hits[h].reverse ? '-' : '+');
+					// the region a hit belongs to, by its name or its coordinates
+					if (regions[j].name != NULL)
+						fprintf(fp, "\t%s\n", regions[j].name);
+					else
+						fprintf(fp, "\t%s:%lld-%lld\n", regions[j].chrom, (long long)regions[j].start, (long long)regions[j].end);
+				}
+				hits_total += num_hits;
+				free(hits);
+			}
+			if (fp != stdout) {
+				fclose(fp);
+				printf("%lld regions lifted to %s: %lld source intervals (%lld aligned runs in the index) \n", (long long)num, output_filename,
+					(long long)hits_total, (long long)index->num);
+			}
+			liftover_index_free(index);
+			free(offsets);
+			free_regions(regions, num);
+		}
+		free_csb(compressed_source);
+	}
 	else if (strcmp(argv[1], "test") == 0){
+		if (argc >= 3 && strcmp(argv[2], "check") == 0)
+			return check_main(argc - 3, argv + 3);
 		if (argc != 8){
 			printf("Incorrect command. Please type 'help' or '-h' for a list of the command-line options  \n");
 			return 1;
@@ -108,32 +750,76 @@ int main(int argc, char * argv[]) {
 		int num_query_ind = atoi(argv[5]);
 		int num_range_ind = atoi(argv[6]);
 		int range_len = atoi(argv[7]);
+		// the construction and compression times are read from the trace instead of building everything twice,
+		// its summary is only printed if --trace was given
+		trace_record();
 		
-		char * reference = load_file(ref_filename, 1);
+		struct ref_table * refs;
+		char * reference = load_references(ref_filename, &refs);
 		char * source = load_file(source_filename, 0);
-		Node * suffix_tree = (Node*)malloc(sizeof(Node));
+		if (reference == NULL || source == NULL) {
+			printf("Error. Cannot read %s \n", reference == NULL ? ref_filename : source_filename);
+			return 1;
+		}
+		SuffixTree * suffix_tree;
 		double tree_time, access_time, access_time_worst, range_time;
 		printf("Building Suffix Tree...  \n"); 
-		suffix_tree = buildSuffixTree(reference);
-		tree_time = build_tree_time(reference);
+		suffix_tree = buildSuffixTree(reference, treeThreads);
+		tree_time = (trace_total_ns("build tree") + trace_total_ns("suffix index dfs")) / 1e9;
 		printf("Suffix Tree construction time: %.3fs\n", tree_time);
-		int source_len = strlen(source);
+		pos_t source_len = strlen(source);
 		printf("Compressing...\n");
 		csb * compressed_source = compress_bins(suffix_tree, reference, source, bin_factor);
-		double comp_time = compress_time(source_filename, reference, suffix_tree, bin_factor);
+		if (compressed_source == NULL) {
+			printf("Error. %s has a character that is not in the reference \n", source_filename);
+			return 1;
+		}
+		compressed_source->refs = refs;
+		double comp_time = (trace_total_ns("parse") + trace_total_ns("build bins")) / 1e9;
 		printf("Running queries...\n");
 		access_time = query_time(compressed_source, reference, num_query_ind, source_len);
 		access_time_worst = query_time_worst(compressed_source, reference, num_query_ind);
 		range_time = range_query_time(compressed_source, reference, range_len, num_range_ind, source_len);
+		char archive_filename[] = "/tmp/isrlz_archive_XXXXXX";
+		int archive_fd = mkstemp(archive_filename);
+		double archive_time = -1;
+		long archive_bytes = 0;
+		if (archive_fd != -1) {
+			fclose(fdopen(archive_fd, "w"));
+			csb_to_archive(compressed_source, archive_filename, ARCHIVE_BLOCK_SIZE);
+			archive_time = archive_decode_time(archive_filename);
+			FILE * afp = fopen(archive_filename, "rb");
+			fseek(afp, 0L, SEEK_END);
+			archive_bytes = ftell(afp);
+			fclose(afp);
+			remove(archive_filename);
+		}
 		double delta = get_delta(compressed_source->lens, compressed_source->size);
-		int large_bin = largest_bin(compressed_source->lens, compressed_source->size);
+		pos_t large_bin = largest_bin(compressed_source->lens, compressed_source->size);
 		printf("Results:\n");
 		printf("Compression time: %.3fs\n", comp_time);		
-		printf("Original length: %d. \nNumber of phrases: %d. \nNumber of bins: %d.\n", source_len, compressed_source->size, compressed_source->lens->size);
-		printf("Delta: %.2f. \nLargest bin: %d. \n", delta, large_bin);
+		printf("Original length: %lld. \nNumber of phrases: %lld. \nNumber of bins: %lld.\n", (long long)source_len, (long long)compressed_source->size, (long long)compressed_source->lens->size);
+		printf("Delta: %.2f. \nLargest bin: %lld. \n", delta, (long long)large_bin);
 		printf("Average time to access %d random indices: %.3fns\n", num_query_ind, access_time);
 		printf("Average time to access %d random indices on the fullest bin (worst-case): %.3fns\n", num_query_ind, access_time_worst);
-		printf("Average time to access %d random ranges of length %d: %.3fns\n\n", num_range_ind, range_len, range_time);
+		printf("Average time to access %d random ranges of length %d: %.3fns\n", num_range_ind, range_len, range_time);
+		if (archive_time >= 0) {
+			int width = offset_width(compressed_source);
+			long csb_bytes = CSB_HEADER_BYTES + compressed_source->size * (2 * width + sizeof(char)) + compressed_source->lens->size * width;
+			printf("Size of .csb: %ld bytes. Size of archive: %ld bytes (%.2fx smaller).\n", csb_bytes, archive_bytes, (double)csb_bytes / archive_bytes);
+			printf("Archive decode throughput per core: %.2f Mphrases/s, %.2f MB/s of source\n", compressed_source->size / archive_time / 1e6, source_len / archive_time / 1e6);
+		}
+		mem_print_report(stdout, strlen(reference), source_len);
+		printf("\n");
+	}
+	else if (strcmp(argv[1], "select") == 0){
+		return select_main(argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "bench") == 0){
+		return bench_main(argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "gen") == 0){
+		return gen_main(argc - 2, argv + 2);
 	}
 	else
 		printf("Incorrect command. Please type 'isrlz help' or 'isrlz -h' for a list of the command-line options  \n"); 
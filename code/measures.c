@@ -10,9 +10,11 @@ compress_time
 query_time
 query_time_worst
 range_query_time
+archive_decode_time
 -----------------------------------------------------------------------------------------
 */
 
+#include "types.h"
 #include "interpolation.h"
 #include "suffix_tree.h"
 #include "rlz.h"
@@ -24,6 +26,8 @@ range_query_time
 #include <dirent.h>
 #include <stdbool.h>
 
+#include "archive.h"
+
 // call this function to start a nanosecond-resolution timer
 struct timespec timer_start(){
     struct timespec start_time;
@@ -38,53 +42,62 @@ long timer_end(struct timespec start_time){
     return diffInNanos;
 }
 
+static pos_t random_index(pos_t n) {
+/* rand() only returns 31 bits, so two calls are combined to draw indices of sources beyond 2^31 bases. */
+	unsigned long long r = ((unsigned long long)rand() << 31) ^ (unsigned long long)rand();
+	return (pos_t)(r % (unsigned long long)n);
+}
+
 double build_tree_time(char * reference) {
 /* this function returns the time it takes to function 'buildSuffixTree' from module suffix_tree.c to create a suffix tree from 'reference'.*/ 
 	int i;
 	clock_t t, t2;
-	Node * tree = (Node*)malloc(sizeof(Node));
+	SuffixTree * tree;
 	t = clock();
 	for (i = 0; i < 1; ++i) {
-		tree = buildSuffixTree(reference);
+		tree = buildSuffixTree(reference, treeThreads);
 		t2 = clock();
-		free(tree);
+		freeSuffixTree(tree);
 		t += clock() - t2;	
 	}
 	t = clock() - t;
 	return (double)t / CLOCKS_PER_SEC / 1.0;
 }
 
-double compress_time(char * filename, char * reference, Node * suffix_tree, int bin_factor) {
+double compress_time(char * filename, char * reference, SuffixTree * suffix_tree, int bin_factor) {
 /* This function returns the time it takes to function 'compress_bins' from module rlz.c to create an object 'csb' that contains 
 the matching of the source in 'filaname' file with respect to the 'reference'. */ 
 	char * source = load_file(filename, 0);
 	int i;
-	csb * compressed_bins = malloc(sizeof(csb));
+	csb * compressed_bins;
 	clock_t t, t2;
 	t = clock();
 	for (i = 0; i < 1; ++i) {
 		compressed_bins = compress_bins(suffix_tree, reference, source, bin_factor);
 		t2 = clock();
-		free(compressed_bins);
+		if (compressed_bins != NULL)
+			free_csb(compressed_bins);
 		t += clock() - t2;
 	}
 	t = clock() - t;
+	unload_file(source, 0);
 	return ((double)t) / CLOCKS_PER_SEC / 1.0;
 }
 
-double query_time(csb * compressed_bins, char * reference, int num_ind, int source_len) {
+double query_time(csb * compressed_bins, char * reference, int num_ind, pos_t source_len) {
 /* This function returns the average time it takes to function access_bins from module rlz.c 
 to return num_ind random indices of the source compressed in csb structure related to 'reference'.  */ 
 	srand(time(0));
-	int ind, i, j;
+	pos_t ind;
+	int i, j;
 	struct timespec vartime = timer_start();
 	for (i = 0; i < num_ind; ++i) {
-		ind = rand() % source_len;
+		ind = random_index(source_len);
 	}
 	long time_elapsed_nanos = timer_end(vartime);
 	struct timespec vartime2 = timer_start();
 	for (i = 0; i < num_ind; ++i) {
-		ind = rand() % source_len;
+		ind = random_index(source_len);
 
 		for (j = 0; j < 5; ++j) {
 			access_bins(reference, compressed_bins, ind);
@@ -99,21 +112,22 @@ double query_time_worst(csb * compressed_bins, char * reference, int num_ind) {
 to return num_ind random indices. 
 The indices are only queried in the fullest bin in the source compressed in csb structure related to 'reference'.  */ 
 	srand(time(0));
-	int ind, i, j;
-	int bin = largest_bin_index(compressed_bins->lens, compressed_bins->size);
-	int start = compressed_bins->lens->arr[compressed_bins->lens->starts[bin] + 1];
-	int end;
+	pos_t ind;
+	int i, j;
+	pos_t bin = largest_bin_index(compressed_bins->lens, compressed_bins->size);
+	pos_t start = compressed_bins->lens->arr[compressed_bins->lens->starts[bin] + 1];
+	pos_t end = compressed_bins->lens->arr[compressed_bins->size - 1];
 	if (bin < compressed_bins->lens->size - 1)
 		end = compressed_bins->lens->arr[compressed_bins->lens->starts[bin + 1] + 1];
-	int len = end - start;
+	pos_t len = (end > start) ? end - start : 1;
 	struct timespec vartime = timer_start();
 	for (i = 0; i < num_ind; ++i) {
-		ind = start + (rand() % len);
+		ind = start + random_index(len);
 	}
 	long time_elapsed_nanos = timer_end(vartime);	
 	struct timespec vartime2 = timer_start();
 	for (i = 0; i < num_ind; ++i) {
-		ind = start + (rand() % len);
+		ind = start + random_index(len);
 		for (j = 0; j < 5; ++j) {
 			access_bins(reference, compressed_bins, ind);
 		};
@@ -122,20 +136,21 @@ The indices are only queried in the fullest bin in the source compressed in csb
 	return (time_elapsed_nanos2 - time_elapsed_nanos) / 5.0 / num_ind;
 }
 
-double range_query_time(csb * compressed_bins, char * reference, int range_len, int num_ind, int source_len) {
+double range_query_time(csb * compressed_bins, char * reference, int range_len, int num_ind, pos_t source_len) {
 /* This function returns the average time it takes to function access_bins from module rlz.c 
 to return num_ind random ranges of indices of length range_len. 
 The string queried is the source compressed in csb structure related to 'reference'.  */ 
 	srand(time(0));
-	int ind, i, j;
+	pos_t ind;
+	int i, j;
 	struct timespec vartime = timer_start();
 	for (i = 0; i < num_ind; ++i) {
-		ind = rand() % (source_len - range_len);
+		ind = random_index(source_len - range_len);
 	}
 	long time_elapsed_nanos = timer_end(vartime);
 	struct timespec vartime2 = timer_start();
 	for (i = 0; i < num_ind; ++i) {
-		ind = rand() % (source_len - range_len);
+		ind = random_index(source_len - range_len);
 
 		for (j = 0; j < 5; ++j) {
 			access_bins_range(reference, compressed_bins, ind, range_len);
@@ -144,3 +159,18 @@ The string queried is the source compressed in csb structure related to 'referen
 	long time_elapsed_nanos2 = timer_end(vartime2);
 	return (time_elapsed_nanos2 - time_elapsed_nanos) / 5.0 / num_ind;
 }
+
+double archive_decode_time(char * filename) {
+/* This function returns the time it takes to decode every block of the archive stored in 'filename' (written with csb_to_archive).
+The blocks are decoded one after the other on a single core, so size / time gives the decode throughput per core. */
+	struct archive * arc = archive_open(filename);
+	if (arc == NULL)
+		return -1;
+	int b;
+	struct timespec vartime = timer_start();
+	for (b = 0; b < arc->num_blocks; ++b)
+		archive_load_block(arc, b);
+	long time_elapsed_nanos = timer_end(vartime);
+	archive_close(arc);
+	return time_elapsed_nanos / 1e9;
+}
@@ -0,0 +1,84 @@
+/*
+Mem module keeps count of the bytes allocated for the main structures: suffix tree nodes and edge ends,
+the reference and source buffers, the phrase arrays (starts, lens and mismatches), the bins and the block
+caches of the archives. Every allocation site calls mem_alloc and every free calls mem_release, so the counters
+hold the live bytes and their peak per category. The counters are updated atomically, since the threads of the
+library and of the actions allocate concurrently. Counted bytes are the requested sizes; the allocator overhead
+(8 to 16 bytes per block, relevant for the tree nodes) shows up in the peak RSS reported by the kernel.
+
+Functions:
+mem_alloc
+mem_release
+mem_total_bytes
+mem_total_peak
+mem_peak_rss
+mem_print_report
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "types.h"
+#include "mem.h"
+
+struct mem_counter mem_counters[MEM_NUM];
+const char * mem_category_names[MEM_NUM] = { "tree_nodes", "tree_ends", "reference", "source", "phrases", "bins", "archive_cache" };
+
+static long long total_bytes = 0, total_peak = 0;
+
+static void raise_peak(long long * peak, long long value) {
+/* Sets *peak to value if it is higher, with a compare and swap so concurrent updates are not lost. */
+	long long seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+	while (value > seen && !__atomic_compare_exchange_n(peak, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void mem_alloc(int category, long long bytes) {
+	struct mem_counter * c = &mem_counters[category];
+	__atomic_add_fetch(&c->blocks, 1, __ATOMIC_RELAXED);
+	raise_peak(&c->peak, __atomic_add_fetch(&c->bytes, bytes, __ATOMIC_RELAXED));
+	raise_peak(&total_peak, __atomic_add_fetch(&total_bytes, bytes, __ATOMIC_RELAXED));
+}
+
+void mem_release(int category, long long bytes) {
+	__atomic_sub_fetch(&mem_counters[category].bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&mem_counters[category].blocks, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&total_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+long long mem_total_bytes() {
+	return total_bytes;
+}
+
+long long mem_total_peak() {
+/* Returns the peak of the sum of all categories, which is at most the sum of their peaks. */
+	return total_peak;
+}
+
+long long mem_peak_rss() {
+/* Returns the peak resident set size of the process in bytes, or -1 if it is not available. */
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+#ifdef __APPLE__
+	return usage.ru_maxrss; // bytes on macOS
+#else
+	return (long long)usage.ru_maxrss * 1024; // kilobytes on Linux
+#endif
+}
+
+void mem_print_report(FILE * fp, pos_t reference_len, pos_t source_len) {
+/* Prints the live and peak bytes of every category, the peak RSS and the live bytes per base of the tree (per reference base)
+and of the compressed source (phrases and bins, per source base). */
+	int c;
+	fprintf(fp, "Memory (requested bytes, allocator overhead not included):\n");
+	fprintf(fp, "%-16s %16s %12s %16s\n", "structure", "live bytes", "blocks", "peak bytes");
+	for (c = 0; c < MEM_NUM; ++c)
+		fprintf(fp, "%-16s %16lld %12lld %16lld\n", mem_category_names[c], mem_counters[c].bytes, mem_counters[c].blocks, mem_counters[c].peak);
+	fprintf(fp, "%-16s %16lld %12s %16lld\n", "total", total_bytes, "", total_peak);
+	fprintf(fp, "Peak RSS: %lld bytes\n", mem_peak_rss());
+	if (reference_len > 0)
+		fprintf(fp, "Suffix tree bytes per reference base: %.2f\n", (double)(mem_counters[MEM_TREE_NODES].bytes + mem_counters[MEM_TREE_ENDS].bytes) / reference_len);
+	if (source_len > 0)
+		fprintf(fp, "Phrases and bins bytes per source base: %.4f\n", (double)(mem_counters[MEM_PHRASES].bytes + mem_counters[MEM_BINS].bytes) / source_len);
+}
@@ -0,0 +1,24 @@
+enum mem_category { MEM_TREE_NODES, MEM_TREE_ENDS, MEM_REFERENCE, MEM_SOURCE, MEM_PHRASES, MEM_BINS, MEM_ARCHIVE_CACHE, MEM_NUM };
+
+struct mem_counter {
+	long long bytes; // bytes currently allocated
+	long long blocks; // allocations currently alive
+	long long peak; // highest value of bytes
+};
+
+extern struct mem_counter mem_counters[MEM_NUM];
+extern const char * mem_category_names[MEM_NUM];
+
+void mem_alloc(int category, long long bytes);
+void mem_release(int category, long long bytes);
+long long mem_total_bytes();
+long long mem_total_peak();
+long long mem_peak_rss();
+void mem_print_report(FILE * fp, pos_t reference_len, pos_t source_len);
+
+// bytes of 'n' phrases (starts, lens and mismatches) and of the bins over them
+#define MEM_PHRASE_BYTES(n) ((long long)(n) * (2 * sizeof(pos_t) + sizeof(char)))
+#define MEM_STRAND_BYTES(n) (((long long)(n) + 7) / 8)
+#define MEM_EXCEPTION_BYTES(n) ((long long)(n) * (sizeof(pos_t) + sizeof(char)))
+#define MEM_BINS_BYTES(num_bins) ((long long)sizeof(struct bins) + ((long long)(num_bins) + 1) * sizeof(pos_t))
+#define MEM_DIRECTORY_BYTES(num) ((long long)sizeof(struct directory) + ((long long)(num) + 1) * sizeof(pos_t))
@@ -0,0 +1,185 @@
+/*
+Perf module contains an optional wrapper around the Linux perf_event_open interface, used by the bench action
+to count hardware events (cycles, instructions, L1 data and last level cache misses, branch misses and dTLB misses)
+around a phase.
+
+The counters are opened as one group, led by the first one that opens: the kernel schedules a group on the PMU all
+at once, so the counts cover the same instructions and ratios such as the IPC are not skewed by multiplexing, and one
+read of the leader returns all of them (PERF_FORMAT_GROUP). A counter the group does not take (the machine lacks the
+event, as virtual machines often do, or the PMU has no room left for it) is opened on its own instead, multiplexed and
+scaled, so the machine still reports it. Counters that cannot be opened at all are reported as unavailable (-1), and on
+systems without perf_event_open (or with perf_event_paranoid too high) every counter is unavailable and the benchmark
+runs as usual.
+Only user space is counted, which is what an unprivileged process is allowed to measure.
+
+Functions:
+perf_open
+perf_close
+perf_start
+perf_stop
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "perf.h"
+
+const char * perf_event_names[PERF_NUM] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses" };
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static int open_event(unsigned int type, unsigned long long config, int group_fd) {
+/* Opens a counter in the group of group_fd, or on its own (and as a leader) when group_fd is -1. Members start enabled,
+so they count whenever their leader does. */
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = group_fd < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	// when the PMU has fewer counters than requested they are multiplexed, so the times are read to scale the counts
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING | PERF_FORMAT_GROUP;
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static int group_runs(struct perf_counters * pc) {
+/* Enables the group for a moment and returns 1 if the PMU scheduled it. The kernel checks that a group fits the PMU when
+it is opened, but not against counters held by others (such as the NMI watchdog), and a group that never fits never counts. */
+	unsigned long long group[3 + PERF_NUM];
+	volatile int spin;
+	size_t group_bytes = (3 + pc->group_size) * sizeof(unsigned long long);
+	ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	for (spin = 0; spin < 10000; ++spin);
+	ioctl(pc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	return read(pc->leader, group, group_bytes) == (ssize_t)group_bytes && group[2] > 0;
+}
+
+int perf_open(struct perf_counters * pc) {
+/* Opens every counter that the machine supports, in the group of the first one if it fits there, and returns how many
+of them are available. Members leave the group, last first, to be counted on their own until the group gets scheduled. */
+	unsigned long long cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	unsigned int types[PERF_NUM] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+	unsigned long long configs[PERF_NUM] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_L1D | cache_read_miss,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_DTLB | cache_read_miss };
+	int e;
+	pc->leader = -1;
+	pc->group_size = 0;
+	pc->num_available = 0;
+	for (e = 0; e < PERF_NUM; ++e) {
+		pc->slots[e] = -1;
+		pc->fds[e] = open_event(types[e], configs[e], pc->leader);
+		if (pc->fds[e] >= 0 && pc->leader < 0)
+			pc->leader = pc->fds[e];
+		if (pc->fds[e] >= 0)
+			pc->slots[e] = pc->group_size++;
+		else if (pc->leader >= 0)
+			pc->fds[e] = open_event(types[e], configs[e], -1); // the group cannot take it, it is counted on its own
+		if (pc->fds[e] >= 0)
+			pc->num_available++;
+	}
+	for (e = PERF_NUM - 1; e > 0 && pc->group_size > 1 && !group_runs(pc); --e) {
+		if (pc->slots[e] <= 0)
+			continue;
+		close(pc->fds[e]);
+		pc->fds[e] = open_event(types[e], configs[e], -1);
+		pc->slots[e] = -1;
+		pc->group_size--;
+		if (pc->fds[e] < 0)
+			pc->num_available--;
+	}
+	return pc->num_available;
+}
+
+void perf_close(struct perf_counters * pc) {
+	int e;
+	// the members go before the leader
+	for (e = PERF_NUM - 1; e >= 0; --e) {
+		if (pc->fds[e] >= 0)
+			close(pc->fds[e]);
+		pc->fds[e] = -1;
+		pc->slots[e] = -1;
+	}
+	pc->leader = -1;
+	pc->group_size = 0;
+	pc->num_available = 0;
+}
+
+void perf_start(struct perf_counters * pc) {
+/* Resets and enables the group at once through its leader, and every counter opened on its own. */
+	int e;
+	if (pc->leader >= 0) {
+		ioctl(pc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	for (e = 0; e < PERF_NUM; ++e) {
+		if (pc->fds[e] >= 0 && pc->slots[e] < 0) {
+			ioctl(pc->fds[e], PERF_EVENT_IOC_RESET, 0);
+			ioctl(pc->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+void perf_stop(struct perf_counters * pc, double * values) {
+/* Disables the counters and stores their counts in values[], scaled when the counter (or its group) was multiplexed.
+The group comes in one read of the leader: the number of counters, the times enabled and running, and their values in
+the order they joined. Unavailable counters are stored as -1, and so are counters that never ran (time running 0), since 
+the PMU was taken by other events the whole time and their count says nothing. */
+	int e;
+	unsigned long long group[3 + PERF_NUM], data[4]; // number of counters, time enabled, time running, values
+	if (pc->leader >= 0)
+		ioctl(pc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	for (e = 0; e < PERF_NUM; ++e)
+		if (pc->fds[e] >= 0 && pc->slots[e] < 0)
+			ioctl(pc->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+	size_t group_bytes = (3 + pc->group_size) * sizeof(unsigned long long);
+	int group_read = pc->leader >= 0 && read(pc->leader, group, group_bytes) == (ssize_t)group_bytes && group[0] == (unsigned long long)pc->group_size && group[2] > 0;
+	for (e = 0; e < PERF_NUM; ++e) {
+		values[e] = -1;
+		if (pc->fds[e] < 0)
+			continue;
+		if (pc->slots[e] >= 0) {
+			if (group_read)
+				values[e] = (double)group[3 + pc->slots[e]] * group[1] / group[2];
+			continue;
+		}
+		// a counter on its own is a group of one
+		if (read(pc->fds[e], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+			values[e] = (double)data[3] * data[1] / data[2];
+	}
+}
+
+#else
+
+int perf_open(struct perf_counters * pc) {
+	int e;
+	for (e = 0; e < PERF_NUM; ++e) {
+		pc->fds[e] = -1;
+		pc->slots[e] = -1;
+	}
+	pc->leader = -1;
+	pc->group_size = 0;
+	pc->num_available = 0;
+	return 0;
+}
+
+void perf_close(struct perf_counters * pc) {
+}
+
+void perf_start(struct perf_counters * pc) {
+}
+
+void perf_stop(struct perf_counters * pc, double * values) {
+	int e;
+	for (e = 0; e < PERF_NUM; ++e)
+		values[e] = -1;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#define PERF_NUM 6
+
+enum perf_event_id { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_DTLB_MISSES };
+
+struct perf_counters {
+	int fds[PERF_NUM]; // -1 when the counter could not be opened
+	int slots[PERF_NUM]; // place of the counter in the group read of the leader, -1 for a counter opened on its own
+	int leader; // fd of the group leader, -1 when no counter could be opened
+	int group_size;
+	int num_available;
+};
+
+extern const char * perf_event_names[PERF_NUM];
+
+int perf_open(struct perf_counters * pc);
+void perf_close(struct perf_counters * pc);
+void perf_start(struct perf_counters * pc);
+void perf_stop(struct perf_counters * pc, double * values);
@@ -0,0 +1,273 @@
+/*
+Predbench is a standalone microbenchmark of the predecessor structures (build it with 'make predbench').
+
+The bins (create_bins and predecessor) are only exercised through real genomes by the 'bench' action, so this
+program generates synthetic cumulative-length arrays (the lens array of a csb) whose gaps follow distributions
+that are hard for the interpolation search:
+uniform     gaps drawn uniformly in [1, 2 * mean gap)
+zipf        power-law gaps (exponent 'skew', 1.2 by default), a few huge phrases among many short ones
+burst       bursts of 64 gaps in [1, 4] (mutation clusters) separated by gaps of 'skew' times the mean gap
+two-regime  the first half of the array has gaps in [1, 2], the second half gaps of 'skew' times the mean gap,
+            so most keys fall into a few bins
+For each array, its delta (get_delta) and, for every bin factor, the build time of create_bins, the bytes of the bins,
+the largest bin and the latency of predecessor on random keys are reported, against bs_predecessor over the
+whole array (no extra bytes). The same is reported for the directory (create_directory) with every k, where the
+factor column holds k, the bins column the windows and the largest column the largest window. Results are checked against bs_predecessor before timing.
+After one untimed pass over the keys, every query is timed on its own (timer overhead subtracted) in each repetition,
+and the mean and the percentiles are both taken from those samples.
+
+Functions:
+main
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "rng.h"
+#include "perf.h"
+#include "bench.h"
+#include "cpu.h"
+#include "mem.h"
+
+#define PREDBENCH_MAX_FACTORS 16
+
+struct predbench_options {
+	pos_t n; // keys per array
+	long queries;
+	int reps;
+	unsigned long long seed;
+	pos_t mean_gap;
+	double skew; // 0 for the default of each distribution
+	char * dists;
+	int factors[PREDBENCH_MAX_FACTORS];
+	int num_factors;
+	int dir_ks[PREDBENCH_MAX_FACTORS]; // k of the directories
+	int num_dir_ks;
+	char * format; // text or csv
+};
+
+static volatile pos_t sink;
+
+static pos_t * generate(char * dist, struct predbench_options * opt, struct rng * rng) {
+/* Returns a strictly increasing array of opt->n keys starting at 0 whose gaps follow 'dist', or NULL if 'dist' is unknown. */
+	pos_t * arr = malloc(opt->n * sizeof(pos_t));
+	pos_t i, m = opt->mean_gap;
+	arr[0] = 0;
+	for (i = 1; i < opt->n; ++i) {
+		pos_t gap;
+		if (strcmp(dist, "uniform") == 0)
+			gap = 1 + rng_below(rng, 2 * m - 1);
+		else if (strcmp(dist, "zipf") == 0) {
+			double alpha = opt->skew > 0 ? opt->skew : 1.2;
+			double x = pow(1 - rng_double(rng), -1 / alpha);
+			gap = x > 1e9 ? (pos_t)1e9 : (pos_t)x;
+		}
+		else if (strcmp(dist, "burst") == 0)
+			gap = (i % 65 == 0) ? (pos_t)(m * (opt->skew > 0 ? opt->skew : 100)) : 1 + rng_below(rng, 4);
+		else if (strcmp(dist, "two-regime") == 0)
+			gap = (i < opt->n / 2) ? 1 + rng_below(rng, 2) : 1 + rng_below(rng, 2 * (pos_t)(m * (opt->skew > 0 ? opt->skew : 10)) - 1);
+		else {
+			free(arr);
+			return NULL;
+		}
+		arr[i] = arr[i - 1] + (gap < 1 ? 1 : gap);
+	}
+	return arr;
+}
+
+static void free_bins(struct bins * bins) {
+	mem_release(MEM_BINS, MEM_BINS_BYTES(bins->size));
+	free(bins->starts);
+	free(bins);
+}
+
+static int parse_list(char * list, int * values) {
+/* Parses a comma separated list of integers into values, PREDBENCH_MAX_FACTORS at most, and returns their number. */
+	int num = 0;
+	while (*list && num < PREDBENCH_MAX_FACTORS) {
+		values[num++] = atoi(list);
+		list += strcspn(list, ",");
+		if (*list == ',')
+			list++;
+	}
+	return num;
+}
+
+static void print_row(struct predbench_options * opt, char * dist, double delta, char * structure, int factor, pos_t num_bins, pos_t largest, double build_ns, long long bytes, double mean_ns, struct bench_phase * phase) {
+	if (strcmp(opt->format, "csv") == 0)
+		printf("%s,%lld,%.2f,%s,%d,%lld,%lld,%.3f,%lld,%.4f,%.2f,%.2f,%.2f,%.2f,%.2f\n", dist, (long long)opt->n, delta, structure, factor, (long long)num_bins, (long long)largest,
+			build_ns / 1e6, bytes, (double)bytes / opt->n, mean_ns, bench_percentile(phase, 50), bench_percentile(phase, 90), bench_percentile(phase, 99), bench_percentile(phase, 99.9));
+	else
+		printf("%-11s %12.1f %-7s %6d %10lld %9lld %10.3f %12lld %8.3f %9.1f %9.1f %9.1f %9.1f %9.1f\n", dist, delta, structure, factor, (long long)num_bins, (long long)largest,
+			build_ns / 1e6, bytes, (double)bytes / opt->n, mean_ns, bench_percentile(phase, 50), bench_percentile(phase, 90), bench_percentile(phase, 99), bench_percentile(phase, 99.9));
+}
+
+static int run_dist(char * dist, struct predbench_options * opt, double overhead) {
+/* Generates one array with distribution 'dist' and prints one row per structure. Returns 1 on error. */
+	struct rng rng;
+	rng_seed(&rng, opt->seed);
+	pos_t * arr = generate(dist, opt, &rng);
+	if (arr == NULL) {
+		printf("Error. Unknown distribution %s \n", dist);
+		return 1;
+	}
+	pos_t n = opt->n, last = arr[n - 1];
+	pos_t * keys = malloc(opt->queries * sizeof(pos_t));
+	long q;
+	int f, rep;
+	for (q = 0; q < opt->queries; ++q)
+		keys[q] = rng_below(&rng, last);
+
+	struct bins whole; // only for get_delta
+	whole.arr = arr;
+	double delta = get_delta(&whole, n);
+
+	for (f = 0; f <= opt->num_factors + opt->num_dir_ks; ++f) {
+		int binary = f == opt->num_factors + opt->num_dir_ks; // the last row is the baseline
+		int directory = !binary && f >= opt->num_factors;
+		int factor = binary ? 0 : directory ? opt->dir_ks[f - opt->num_factors] : opt->factors[f];
+		pos_t num_bins = (binary || directory) ? 0 : (pos_t)ceil((double)n / factor);
+		struct bins * bins = NULL;
+		struct directory * dir = NULL;
+		double build_ns = 0;
+		for (rep = 0; rep < opt->reps && !binary; ++rep) {
+			if (bins != NULL)
+				free_bins(bins);
+			free_directory(dir);
+			bins = NULL;
+			uint64_t t0 = bench_now_ns();
+			if (directory)
+				dir = create_directory(arr, n, factor);
+			else
+				bins = create_bins(arr, n, num_bins);
+			uint64_t t1 = bench_now_ns();
+			if (rep == 0 || t1 - t0 < build_ns)
+				build_ns = t1 - t0;
+		}
+		for (q = 0; q < opt->queries && !binary; ++q) {
+			pos_t found = directory ? directory_predecessor(dir, keys[q], n) : predecessor(bins, keys[q], n);
+			if (found != bs_predecessor(arr, n - 1, keys[q])) {
+				printf("Error. %s(%lld) differs from binary search on %s with %s %d \n", directory ? "directory_predecessor" : "predecessor", (long long)keys[q], dist,
+					directory ? "k" : "bin factor", factor);
+				if (bins != NULL)
+					free_bins(bins);
+				free_directory(dir);
+				free(keys);
+				free(arr);
+				return 1;
+			}
+		}
+
+		// one untimed pass warms the caches, then every query is timed on its own for the mean and the percentiles alike
+		struct bench_phase phase;
+		memset(&phase, 0, sizeof(phase));
+		for (rep = 0; rep <= opt->reps; ++rep)
+			for (q = 0; q < opt->queries; ++q) {
+				uint64_t t0 = bench_now_ns();
+				sink = binary ? bs_predecessor(arr, n - 1, keys[q]) : directory ? directory_predecessor(dir, keys[q], n) : predecessor(bins, keys[q], n);
+				uint64_t t1 = bench_now_ns();
+				if (rep > 0)
+					bench_record(&phase, (double)(t1 - t0) - overhead);
+			}
+		double mean_ns = phase.num_samples ? bench_total_ns(&phase) / phase.num_samples : 0;
+		if (directory)
+			print_row(opt, dist, delta, "dir", factor, dir->num, largest_window(dir), build_ns, MEM_DIRECTORY_BYTES(dir->num), mean_ns, &phase);
+		else
+			print_row(opt, dist, delta, binary ? "binary" : "bins", factor, num_bins, binary ? n : largest_bin(bins, n), build_ns,
+				binary ? 0 : MEM_BINS_BYTES(num_bins), mean_ns, &phase);
+		free(phase.samples);
+		if (bins != NULL)
+			free_bins(bins);
+		free_directory(dir);
+	}
+	free(keys);
+	free(arr);
+	return 0;
+}
+
+static void usage() {
+	printf("predbench (optional flags) \n");
+	printf("  --n N          keys per array (default 1000000) \n");
+	printf("  --queries N    random keys per structure (default 1000000) \n");
+	printf("  --reps N       repetitions of the build (the best one is kept) and timed passes over the keys, after a warmup pass (default 3) \n");
+	printf("  --seed S       seed of the arrays and keys (default 42) \n");
+	printf("  --mean-gap G   mean phrase length of the uniform gaps (default 300) \n");
+	printf("  --skew F       zipf exponent, or long gap multiplier of burst and two-regime (default 1.2, 100 and 10) \n");
+	printf("  --dists LIST   comma separated subset of uniform,zipf,burst,two-regime (default all) \n");
+	printf("  --factors LIST comma separated bin factors (default 1,2,4,8,16) \n");
+	printf("  --dir-ks LIST  comma separated k of the directories, windows of 2^k positions (default 8,10,12,14) \n");
+	printf("  --format F     text or csv (default text) \n");
+}
+
+int main(int argc, char * argv[]) {
+	struct predbench_options opt = { 1000000, 1000000, 3, 42, 300, 0, "uniform,zipf,burst,two-regime", { 1, 2, 4, 8, 16 }, 5, { 8, 10, 12, 14 }, 4, "text" };
+	int a;
+	cpu_init();
+	for (a = 1; a < argc; a += 2) {
+		if (a + 1 >= argc) {
+			printf("Missing value for %s \n", argv[a]);
+			return 1;
+		}
+		if (strcmp(argv[a], "--n") == 0)
+			opt.n = atoll(argv[a + 1]);
+		else if (strcmp(argv[a], "--queries") == 0)
+			opt.queries = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--reps") == 0)
+			opt.reps = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--seed") == 0)
+			opt.seed = strtoull(argv[a + 1], NULL, 10);
+		else if (strcmp(argv[a], "--mean-gap") == 0)
+			opt.mean_gap = atoll(argv[a + 1]);
+		else if (strcmp(argv[a], "--skew") == 0)
+			opt.skew = atof(argv[a + 1]);
+		else if (strcmp(argv[a], "--dists") == 0)
+			opt.dists = argv[a + 1];
+		else if (strcmp(argv[a], "--factors") == 0)
+			opt.num_factors = parse_list(argv[a + 1], opt.factors);
+		else if (strcmp(argv[a], "--dir-ks") == 0)
+			opt.num_dir_ks = parse_list(argv[a + 1], opt.dir_ks);
+		else if (strcmp(argv[a], "--format") == 0)
+			opt.format = argv[a + 1];
+		else {
+			printf("Unknown flag %s \n", argv[a]);
+			usage();
+			return 1;
+		}
+	}
+	int f;
+	for (f = 0; f < opt.num_factors; ++f)
+		if (opt.factors[f] < 1)
+			opt.n = 0;
+	for (f = 0; f < opt.num_dir_ks; ++f)
+		if (opt.dir_ks[f] < 0 || opt.dir_ks[f] > DIRECTORY_MAX_K)
+			opt.n = 0;
+	if (opt.n < 3 || opt.queries < 1 || opt.reps < 1 || opt.mean_gap < 1) {
+		printf("Incorrect command. Numeric flags must be positive, and --n at least 3 \n");
+		return 1;
+	}
+	if (strcmp(opt.format, "text") != 0 && strcmp(opt.format, "csv") != 0) {
+		printf("Error. Unknown format %s, it must be text or csv \n", opt.format);
+		return 1;
+	}
+
+	double overhead = bench_timer_overhead();
+	if (strcmp(opt.format, "csv") == 0)
+		printf("dist,n,delta,structure,bin_factor,bins,largest_bin,build_ms,bytes,bytes_per_key,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns\n");
+	else {
+		printf("n=%lld queries=%ld seed=%llu cpu level %s timer overhead %.1fns (subtracted from every sample)\n", (long long)opt.n, opt.queries, opt.seed, cpu_level_name(cpu_level()), overhead);
+		printf("%-11s %12s %-7s %6s %10s %9s %10s %12s %8s %9s %9s %9s %9s %9s\n", "dist", "delta", "struct", "factor", "bins", "largest", "build ms", "bytes", "B/key",
+			"mean ns", "p50 ns", "p90 ns", "p99 ns", "p999 ns");
+	}
+	char * dists = strdup(opt.dists), * dist;
+	int status = 0;
+	for (dist = strtok(dists, ","); dist != NULL && status == 0; dist = strtok(NULL, ","))
+		status = run_dist(dist, &opt, overhead);
+	free(dists);
+	return status;
+}
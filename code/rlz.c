@@ -7,12 +7,26 @@ Both definitions can be found in rlz.h header file.
 
 Functions: 
 find_substring
+extend_phrase
+complement_base
+copy_phrase
+parse_phrases
 compress_bins
+compress_bins_ext
+append_bins
 access_bins
+access_directory
+apply_exceptions
+access_bins_range
+access_bins_into
 decompress_bins
 compress
 access
 decompress
+index_exceptions
+free_csb
+free_ref_table
+phrase_reference
 -----------------------------------------------------------------------------------------
 */
 
@@ -20,10 +34,20 @@ decompress
 #include <stdio.h> 
 #include <string.h> 
 #include <stdlib.h> 
+#include <math.h>
 
+#include "types.h"
 #include "interpolation.h"
 #include "suffix_tree.h"
 #include "rlz.h"
+#include "load.h"
+#include "cpu.h"
+#include "mem.h"
+#include "trace.h"
+
+#define REVERSE_SEED 32 // characters of the seeds of reverse phrases, see find_reverse
+#define REVERSE_CANDIDATES 64 // occurrences of a seed extended at most
+#define REVERSE_STACK 256 // nodes below a seed waiting to be visited
 
 // Look-up table to codify ASCII chars into positions of a small array (trick for the suffix_tree)
 short lookup2[256] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -44,30 +68,36 @@ short lookup2[256] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-char find_substring(Node* ref_st, char * reference, char * source, int * tuple) {
-/*  This function finds the longest common prefix between the reference and the source. 
-In order to do it, it walks through the suffix_tree of the reference string (ref_st node). 
-The compression (ref_index, length) is stored on the tuple parameter. 
-The function returns the fist mismatch character of the source, to be used on the compression.  */
+static inline Node * match_child(SuffixTree * tree, Node * node, char * reference, unsigned char c, const int wide) {
+/* The child of node that the source follows with c. A reference separator never matches, so no phrase spans two references. */
+	if (wide)
+		return (c != REF_SEPARATOR && c != '\0') ? findChild(tree, node, reference, c) : NULL;
+	return lookup2[c] != 0 ? node->children[lookup2[c] - 1] : NULL;
+}
+
+static inline char match_phrase(SuffixTree * ref_st, char * reference, char * source, pos_t * tuple, const int wide) {
+/* The body of find_substring. -wide- is a constant in both calls, so each one is compiled for its node layout. */
 	tuple[1] = 0;
-	char curr_char = source[0];
-	Node * curr_node = ref_st;
-	int curr_len = 0;
-	while (curr_node->children[lookup2[curr_char] - 1] != NULL) {
-		curr_node = curr_node->children[lookup2[curr_char] - 1];
-		int j;
-		for (j = 0; j < *curr_node->end - curr_node->start + 1; ++j) {
-			if (reference[curr_node->start + j] != source[curr_len]) {
-				tuple[0] = curr_node->suffixIndex;
-				tuple[1] = curr_len + 1;
-				return source[curr_len];
-			}
-			else {
-				++curr_len;
-			}
+	unsigned char curr_char = source[0];
+	Node * curr_node = ref_st->root, * next;
+	pos_t curr_len = 0;
+	while ((next = match_child(ref_st, curr_node, reference, curr_char, wide)) != NULL) {
+		curr_node = next;
+		pos_t j, edge = *curr_node->end - curr_node->start + 1;
+		// long edges are compared by the vectorized kernel, short ones in place
+		if (edge >= CPU_MATCH_MIN)
+			j = cpu_match(&reference[curr_node->start], &source[curr_len], edge);
+		else
+			for (j = 0; j < edge && reference[curr_node->start + j] == source[curr_len + j]; ++j);
+		curr_len += j;
+		if (j < edge) {
+			tuple[0] = curr_node->suffixIndex;
+			tuple[1] = curr_len + 1;
+			return source[curr_len];
 		}
-		if (curr_char == "$")
+		if (source[curr_len - 1] == '$')
 		{
+			// the terminator of the source has been matched, so it closes the phrase as its mismatch character
 			tuple[0] = curr_node->suffixIndex;
 			tuple[1] = curr_len;
 			return '$';
@@ -79,34 +109,224 @@ The function returns the fist mismatch character of the source, to be used on th
 	return source[curr_len];
 }
 
+char find_substring(SuffixTree * ref_st, char * reference, char * source, pos_t * tuple) {
+/*  This function finds the longest common prefix between the reference and the source. 
+In order to do it, it walks through the suffix_tree of the reference string (ref_st). 
+The compression (ref_index, length) is stored on the tuple parameter. 
+The function returns the fist mismatch character of the source, to be used on the compression. 
+DNA trees index the children with lookup2, trees of other alphabets search their sorted lists (see SuffixTree).  */
+	return ref_st->wide ? match_phrase(ref_st, reference, source, tuple, 1) : match_phrase(ref_st, reference, source, tuple, 0);
+}
+
+static int is_base(unsigned char c, int wide) {
+/* Returns 1 for a character of the reference that a substitution can replace: anything but the terminator, the separator and padding. */
+	return wide ? (c != '$' && c != REF_SEPARATOR && c != '\0') : lookup2[c] > 2;
+}
+
+char complement_base(char c) {
+/* This function returns the character that a reverse phrase reads for reference character c: A <-> T (xor 0x15) and C <-> G (xor 4), 
+in either case, and any other character (N, IUPAC codes, protein) as it is, so any alphabet can be searched on both strands. */
+	char l = c | 0x20;
+	if (l == 'a' || l == 't')
+		return c ^ 0x15;
+	if (l == 'c' || l == 'g')
+		return c ^ 4;
+	return c;
+}
+
+static inline char phrase_char(char * reference, pos_t start, pos_t k, int reverse) {
+/* Character k of a phrase copied from reference[start], read backwards and complemented if -reverse-. A reverse phrase reads 0, 
+which no source character matches, before the reference and on a separator. */
+	if (!reverse)
+		return reference[start + k];
+	return (k <= start && reference[start - k] != REF_SEPARATOR) ? complement_base(reference[start - k]) : 0;
+}
+
+static pos_t extend_phrase(char * reference, char * source, pos_t start, pos_t len, int reverse, int snp_run, int wide, pos_t ** exceptions, 
+	pos_t * num, pos_t * capacity) {
+/* This function continues the phrase copied from reference[start] (backwards if -reverse-) over source[0..len), whose last character is a mismatch, 
+as long as that mismatch is an isolated substitution: the reference has a base at the same place and the next snp_run characters match again. 
+The offset of every absorbed mismatch is appended to -exceptions- (grown as needed). It returns the new length, the last character being a mismatch as usual. */
+	while (source[len - 1] != '$' && is_base((unsigned char)phrase_char(reference, start, len - 1, reverse), wide)) {
+		pos_t j;
+		for (j = 0; j < snp_run; ++j)
+			if (source[len + j] == '$' || source[len + j] != phrase_char(reference, start, len + j, reverse))
+				return len;
+		if (*num == *capacity) {
+			*capacity = *capacity ? 2 * *capacity : 1024;
+			*exceptions = realloc(*exceptions, *capacity * sizeof(pos_t));
+		}
+		(*exceptions)[(*num)++] = len - 1;
+		len += snp_run;
+		while (source[len] != '$' && source[len] == phrase_char(reference, start, len, reverse))
+			len++;
+		len++; // the new mismatch, or the terminator of the source
+	}
+	return len;
+}
+
+static pos_t find_reverse(SuffixTree * ref_st, char * reference, char * source, pos_t available, pos_t need, pos_t * start) {
+/* This function looks for a reverse phrase at the beginning of source (-available- characters before its terminator) that copies at 
+least -need- characters: a substring of the reference that gives them read backwards and complemented. The tree of the forward reference 
+is enough: a seed, the reverse complement of the last REVERSE_SEED characters of source[0..need) (all of them if there are fewer), 
+is looked up in it, and the first REVERSE_CANDIDATES occurrences are extended from source[0]. Every reverse phrase that long holds an 
+occurrence of the seed, so the longest one is found unless the seed occurs more often. It returns the characters copied by the longest 
+one, with the reference position it reads first in *start, or 0 if there is none. */
+	if (need < 1 || need > available)
+		return 0;
+	pos_t s = (need < REVERSE_SEED) ? need : REVERSE_SEED, matched = 0, j, best = 0;
+	char seed[REVERSE_SEED];
+	for (j = 0; j < s; ++j)
+		seed[j] = complement_base(source[need - 1 - j]);
+	Node * node = ref_st->root;
+	while (matched < s) {
+		if (seed[matched] == REF_SEPARATOR || (node = findChild(ref_st, node, reference, seed[matched])) == NULL)
+			return 0;
+		pos_t edge = *node->end - node->start + 1;
+		for (j = 0; j < edge && matched < s; ++j, ++matched)
+			if (reference[node->start + j] != seed[matched])
+				return 0;
+	}
+	// the leaves below the seed are its occurrences: seed[0] at reference[q] is the complement of source[need - 1]
+	Node * stack[REVERSE_STACK];
+	int sp = 0, candidates = 0;
+	stack[sp++] = node;
+	while (sp > 0 && candidates < REVERSE_CANDIDATES) {
+		Node * n = stack[--sp], * child;
+		int slot, leaf = 1;
+		for (child = firstChild(ref_st, n, &slot); child != NULL; child = nextChild(ref_st, n, child, &slot)) {
+			leaf = 0;
+			if (sp < REVERSE_STACK)
+				stack[sp++] = child;
+		}
+		if (!leaf)
+			continue;
+		candidates++;
+		pos_t first = n->suffixIndex + need - 1, k = 0;
+		if (first >= ref_st->size)
+			continue;
+		while (k < available && source[k] == phrase_char(reference, first, k, 1))
+			k++;
+		if (k >= need && k > best) {
+			best = k;
+			*start = first;
+		}
+	}
+	return best;
+}
+
+static void copy_phrase(char * dst, char * reference, csb * comp_source, pos_t phrase, pos_t offset, pos_t n) {
+/* This function writes the -n- characters of phrase -phrase- that start at -offset-, which must all be copied from the reference 
+(not the mismatch), into dst, reading the reference backwards and complementing it for a reverse phrase. */
+	if (n <= 0)
+		return;
+	if (PHRASE_IS_REVERSE(comp_source, phrase))
+		cpu_reverse_complement(dst, &reference[comp_source->starts[phrase] - offset], n);
+	else
+		memcpy(dst, &reference[comp_source->starts[phrase] + offset], n);
+}
+
+static void grow_strands(unsigned char ** strands, pos_t old_capacity, pos_t capacity) {
+/* Resizes the strand bits from 'old_capacity' to 'capacity' phrases, the new bits are clear. */
+	if (old_capacity > 0)
+		mem_release(MEM_PHRASES, MEM_STRAND_BYTES(old_capacity));
+	mem_alloc(MEM_PHRASES, MEM_STRAND_BYTES(capacity));
+	*strands = realloc(*strands, MEM_STRAND_BYTES(capacity));
+	if (capacity > old_capacity)
+		memset(*strands + MEM_STRAND_BYTES(old_capacity), 0, MEM_STRAND_BYTES(capacity) - MEM_STRAND_BYTES(old_capacity));
+}
+
+static void grow_phrases(pos_t ** starts, pos_t ** lens, char ** mismatches, pos_t old_capacity, pos_t capacity) {
+/* Resizes the three phrase arrays from 'old_capacity' to 'capacity' phrases. */
+	if (old_capacity > 0)
+		mem_release(MEM_PHRASES, MEM_PHRASE_BYTES(old_capacity));
+	mem_alloc(MEM_PHRASES, MEM_PHRASE_BYTES(capacity));
+	*starts = realloc(*starts, capacity * sizeof(pos_t));
+	*lens = realloc(*lens, capacity * sizeof(pos_t));
+	*mismatches = realloc(*mismatches, capacity * sizeof(char));
+}
 
-cs * compress(Node* ref_st, char * reference, char * source) {
+
+static pos_t parse_phrases(SuffixTree * ref_st, char * reference, char * source, struct parse_options * opt, pos_t phrase, pos_t * capacity, 
+	pos_t ** starts, pos_t ** lens, char ** mismatches, unsigned char ** strands, pos_t ** exceptions, pos_t * num_exceptions, pos_t * exceptions_capacity) {
+/*  This function parses source (ending with '$') into the phrases that follow phrase -phrase-, which ends where source starts, 
+growing the phrase arrays (-capacity- phrases) and the exceptions (source positions) as needed. It returns the last phrase, 
+or -1 if source has a character that is not in the reference (see known_characters). 
+With opt->reverse_complement, a reverse phrase (see find_reverse) that copies more characters than the forward one replaces it, 
+and is stored as the reference position where it starts when read backwards, with its strand bit set.  */
+	pos_t i = 0, first, start, copied;
+	pos_t source_len = strlen(source);
+	pos_t tuple[2];
+	tuple[0] = 0;
+	tuple[1] = 0;
+	while (i < source_len) {
+		phrase += 1;
+		if (phrase == *capacity) {
+			grow_phrases(starts, lens, mismatches, *capacity, 2 * *capacity);
+			if (opt->reverse_complement)
+				grow_strands(strands, *capacity, 2 * *capacity);
+			*capacity *= 2;
+		}
+		(*mismatches)[phrase] = find_substring(ref_st, reference, &source[i], tuple);
+		int reverse = 0;
+		if (opt->reverse_complement && (copied = find_reverse(ref_st, reference, &source[i], source_len - 1 - i, tuple[1], &start)) > 0) {
+			reverse = 1;
+			tuple[0] = start;
+			tuple[1] = copied + 1;
+			(*mismatches)[phrase] = source[i + copied];
+		}
+		if (opt->snp_run > 0 && tuple[1] > 1) {
+			first = *num_exceptions;
+			tuple[1] = extend_phrase(reference, &source[i], tuple[0], tuple[1], reverse, opt->snp_run, ref_st->wide, exceptions, num_exceptions, 
+				exceptions_capacity);
+			for (; first < *num_exceptions; ++first)
+				(*exceptions)[first] += (*lens)[phrase - 1];
+			(*mismatches)[phrase] = source[i + tuple[1] - 1];
+		}
+		if (opt->reverse_complement) {
+			(*strands)[phrase >> 3] &= ~(1 << (phrase & 7));
+			(*strands)[phrase >> 3] |= reverse << (phrase & 7);
+		}
+		(*starts)[phrase] = tuple[0];
+		(*lens)[phrase] = (*lens)[phrase - 1] + tuple[1];
+		i = i + tuple[1];
+		if (tuple[1] == 0)
+			return -1;
+	}
+	return phrase;
+}
+
+cs * compress(SuffixTree * ref_st, char * reference, char * source) {
 /*  This function finds the compression of source relative to reference. 
 In order to do it, it calls the find_substring function and stores the subsequently results on 
 the 3 arrays containing starts, lengths and mismatches.   */
-	int i = 0;
-	int source_len = strlen(source);
+	pos_t i = 0;
+	pos_t source_len = strlen(source);
+	pos_t capacity = 1024;
 	cs * compressed_source = malloc(sizeof(cs));
-	int *starts = malloc(source_len * sizeof(int));
-	int *lens = malloc(source_len * sizeof(int));
-	char *mismatches = malloc(source_len * sizeof(char));
-	int *tuple = malloc(2 * sizeof(int));
+	pos_t *starts = NULL;
+	pos_t *lens = NULL;
+	char *mismatches = NULL;
+	pos_t tuple[2];
+	grow_phrases(&starts, &lens, &mismatches, 0, capacity);
 	starts[0] = 0;
 	lens[0] = 0;
 	mismatches[0] = 0;
 	tuple[0] = 0;
 	tuple[1] = 0;
-	int phrase = 0;
+	pos_t phrase = 0;
 	while (i < source_len) {
 		phrase += 1;
+		if (phrase == capacity) {
+			grow_phrases(&starts, &lens, &mismatches, capacity, 2 * capacity);
+			capacity *= 2;
+		}
 		mismatches[phrase] = find_substring(ref_st, reference, &source[i], tuple);
 		starts[phrase] = tuple[0];
 		lens[phrase] = lens[phrase - 1] + tuple[1];
 		i = i + tuple[1];
 	}
-	realloc(*starts, phrase * sizeof(int));
-	realloc(*lens, phrase * sizeof(int));
-	realloc(*mismatches, (phrase) * sizeof(char));
+	grow_phrases(&starts, &lens, &mismatches, capacity, phrase + 1);
 	compressed_source->starts = starts;
 	compressed_source->lens = lens;
 	compressed_source->size = phrase + 1;
@@ -115,78 +335,228 @@ the 3 arrays containing starts, lengths and mismatches.   */
 }
 
 
-csb * compress_bins(Node* ref_st, char * reference, char * source, int bin_factor) {
+csb * compress_bins(SuffixTree * ref_st, char * reference, char * source, int bin_factor) {
 /*  This function finds the compression of source relative to reference. 
 In order to do it, it calls the find_substring function and stores the subsequently results on 
 the 3 arrays containing starts, lengths and mismatches. 
 Finally, the lengths are stored on a bins_array with number of bins depending on the bin_factor.
 For ISRLZ implementation, use bin_factor=1  */
+	struct parse_options opt = { 0, 0 };
+	return compress_bins_ext(ref_st, reference, source, bin_factor, &opt);
+}
+
+csb * compress_bins_ext(SuffixTree * ref_st, char * reference, char * source, int bin_factor, struct parse_options * opt) {
+/*  Same as compress_bins, with two options. If opt->snp_run > 0 a phrase is not closed by a substitution followed by at least snp_run 
+matching characters (see extend_phrase). Those substitutions are stored apart, as a list of exceptions sorted by source position, so a strain 
+with isolated SNPs needs one phrase per indel or rearrangement instead of one per SNP. 
+If opt->reverse_complement is set, phrases are also matched against the reverse complement of the reference, with the same tree 
+(see find_reverse), so an inversion in the source is copied in a few reverse phrases instead of many short ones. Both options off give exactly the compress_bins parse. 
+It returns NULL if the source has a character that is not in the reference.  */
 
-	int i = 0;
-	int source_len = strlen(source);
+	struct trace_span span = trace_begin("parse");
+	pos_t i;
+	pos_t source_len = strlen(source);
+	pos_t capacity = 1024;
 	csb * compressed_source = malloc(sizeof(csb));
-	int *starts = malloc(source_len * sizeof(int));
-	int *lens = malloc(source_len * sizeof(int));
-	char *mismatches = malloc(source_len * sizeof(char)); 
-	int *tuple = malloc(2 * sizeof(int));
+	pos_t *starts = NULL;
+	pos_t *lens = NULL;
+	char *mismatches = NULL; 
+	unsigned char * strands = NULL;
+	pos_t * exceptions = NULL, num_exceptions = 0, exceptions_capacity = 0;
+	grow_phrases(&starts, &lens, &mismatches, 0, capacity);
+	if (opt->reverse_complement)
+		grow_strands(&strands, 0, capacity);
 	starts[0] = 0;
 	lens[0] = 0;
 	mismatches[0] = 0; 
-	tuple[0] = 0;
-	tuple[1] = 0;
-	int phrase = 0;
-	while (i < source_len) {
-		phrase += 1;
-		mismatches[phrase] = find_substring(ref_st, reference, &source[i], tuple);
-		starts[phrase] = tuple[0];
-		lens[phrase] = lens[phrase - 1] + tuple[1];
-		i = i + tuple[1];
-		if (tuple[1] == 0) {
-			printf("Error. Character in source not in ref\n");
-			break;
-		}
+	pos_t phrase = parse_phrases(ref_st, reference, source, opt, 0, &capacity, &starts, &lens, &mismatches, &strands, &exceptions, &num_exceptions, &exceptions_capacity);
+	if (phrase < 0) {
+		mem_release(MEM_PHRASES, MEM_PHRASE_BYTES(capacity));
+		if (opt->reverse_complement)
+			mem_release(MEM_PHRASES, MEM_STRAND_BYTES(capacity));
+		free(starts);
+		free(lens);
+		free(mismatches);
+		free(strands);
+		free(exceptions);
+		free(compressed_source);
+		trace_end(span, 0);
+		return NULL;
 	}
-	realloc(*starts, phrase * sizeof(int));
-	realloc(*lens, phrase * sizeof(int));
-	realloc(*mismatches, (phrase) * sizeof(char));
+	grow_phrases(&starts, &lens, &mismatches, capacity, phrase + 1);
+	if (opt->reverse_complement)
+		grow_strands(&strands, capacity, phrase + 1);
+	trace_end(span, source_len);
 	compressed_source->starts = starts;
-	int num_bins = ceil((double)(phrase + 1) / bin_factor);
+	pos_t num_bins = ceil((double)(phrase + 1) / bin_factor);
 	compressed_source->lens = create_bins(lens, phrase + 1, num_bins);
 	compressed_source->size = phrase + 1;
 	compressed_source->mismatches = mismatches;
+	compressed_source->refs = NULL;
+	compressed_source->num_exceptions = num_exceptions;
+	compressed_source->exception_pos = realloc(exceptions, num_exceptions * sizeof(pos_t));
+	compressed_source->exception_chars = malloc(num_exceptions * sizeof(char));
+	for (i = 0; i < num_exceptions; ++i)
+		compressed_source->exception_chars[i] = source[compressed_source->exception_pos[i]];
+	mem_alloc(MEM_PHRASES, MEM_EXCEPTION_BYTES(num_exceptions));
+	compressed_source->exception_index = NULL;
+	index_exceptions(compressed_source, 0);
+	compressed_source->strands = strands;
 	return compressed_source;
 }
 
-char access(char * reference, cs * comp_source, int i) {
+int append_bins(SuffixTree * ref_st, char * reference, csb * comp_source, char * data, struct parse_options * opt) {
+/*  This function appends -data- (ending with '$', as returned by load_file) to the source compressed in comp_source. 
+Only the last phrase, which holds the terminator of the old source, is parsed again followed by the new data, so the parse costs 
+time proportional to the appended data: the phrase arrays grow in place and the bins are updated by extend_bins. 
+comp_source can hold only the end of the source (see file_to_csb_end), so that csb_append_to_file writes the new phrases at the end of its file. 
+opt->reverse_complement must be set if and only if comp_source has strand bits. 
+It returns 1, leaving comp_source as it was, if comp_source does not end with the terminator, the extended source would have more 
+positions than pos_t holds (see LOAD_MAX_SOURCE) or the parse fails (see parse_phrases), and 0 otherwise.  */
+	pos_t last = comp_source->size - 1, old_size = comp_source->size;
+	if (last < 1 || comp_source->mismatches[last] != '$') {
+		printf("Error. The compressed source does not end with the terminator, it cannot be extended \n");
+		return 1;
+	}
+	if (opt->reverse_complement != (comp_source->strands != NULL)) {
+		printf("Error. The reverse strand must be searched if and only if it was searched to compress the source \n");
+		return 1;
+	}
+	if (strlen(data) > (size_t)(LOAD_MAX_SOURCE - comp_source->lens->arr[last])) {
+		printf("Error. The extended source would have more bases than the positions of this build can address \n");
+		return 1;
+	}
+	struct trace_span span = trace_begin("parse");
+	pos_t base = comp_source->lens->arr[last - 1];
+	pos_t kept = comp_source->lens->arr[last] - base - 1; // characters of the last phrase before the terminator
+	pos_t data_len = strlen(data), e;
+	char * source = calloc(kept + data_len + 1 + LOAD_TAIL, 1);
+	copy_phrase(source, reference, comp_source, last, 0, kept);
+	memcpy(&source[kept], data, data_len + 1);
+
+	// the exceptions of the last phrase are written back into its text, the parse finds them again
+	pos_t num_exceptions = comp_source->num_exceptions, exceptions_capacity = num_exceptions;
+	mem_release(MEM_PHRASES, MEM_EXCEPTION_BYTES(num_exceptions));
+	if (comp_source->exception_index != NULL)
+		mem_release(MEM_PHRASES, (old_size + 1) * sizeof(pos_t));
+	while (num_exceptions > 0 && comp_source->exception_pos[num_exceptions - 1] >= base) {
+		num_exceptions--;
+		source[comp_source->exception_pos[num_exceptions] - base] = comp_source->exception_chars[num_exceptions];
+	}
+	pos_t first = num_exceptions;
+	// what the parse overwrites, to put it back if it fails
+	pos_t last_start = comp_source->starts[last], last_len = comp_source->lens->arr[last];
+	char last_mismatch = comp_source->mismatches[last];
+	unsigned char last_strands = opt->reverse_complement ? comp_source->strands[last >> 3] : 0;
+	pos_t * last_exceptions = malloc((comp_source->num_exceptions - first) * sizeof(pos_t) + 1);
+	if (comp_source->num_exceptions > first) // exception_pos is NULL for a parse without exceptions
+		memcpy(last_exceptions, &comp_source->exception_pos[first], (comp_source->num_exceptions - first) * sizeof(pos_t));
+
+	pos_t capacity = old_size;
+	pos_t * lens = comp_source->lens->arr;
+	pos_t phrase = parse_phrases(ref_st, reference, source, opt, last - 1, &capacity, &comp_source->starts, &lens, &comp_source->mismatches, 
+		&comp_source->strands, &comp_source->exception_pos, &num_exceptions, &exceptions_capacity);
+	if (phrase < 0) {
+		grow_phrases(&comp_source->starts, &lens, &comp_source->mismatches, capacity, old_size);
+		if (opt->reverse_complement) {
+			grow_strands(&comp_source->strands, capacity, old_size);
+			comp_source->strands[last >> 3] = last_strands;
+		}
+		comp_source->starts[last] = last_start;
+		comp_source->lens->arr = lens;
+		lens[last] = last_len;
+		comp_source->mismatches[last] = last_mismatch;
+		comp_source->exception_pos = realloc(comp_source->exception_pos, comp_source->num_exceptions * sizeof(pos_t) + 1);
+		memcpy(&comp_source->exception_pos[first], last_exceptions, (comp_source->num_exceptions - first) * sizeof(pos_t));
+		mem_alloc(MEM_PHRASES, MEM_EXCEPTION_BYTES(comp_source->num_exceptions));
+		index_exceptions(comp_source, last);
+		free(last_exceptions);
+		free(source);
+		trace_end(span, 0);
+		return 1;
+	}
+	free(last_exceptions);
+	grow_phrases(&comp_source->starts, &lens, &comp_source->mismatches, capacity, phrase + 1);
+	if (opt->reverse_complement)
+		grow_strands(&comp_source->strands, capacity, phrase + 1);
+	trace_end(span, kept + data_len);
+	comp_source->size = phrase + 1;
+	comp_source->lens = extend_bins(comp_source->lens, lens, phrase + 1);
+
+	comp_source->num_exceptions = num_exceptions;
+	comp_source->exception_pos = realloc(comp_source->exception_pos, num_exceptions * sizeof(pos_t));
+	comp_source->exception_chars = realloc(comp_source->exception_chars, num_exceptions * sizeof(char));
+	for (e = first; e < num_exceptions; ++e)
+		comp_source->exception_chars[e] = source[comp_source->exception_pos[e] - base];
+	mem_alloc(MEM_PHRASES, MEM_EXCEPTION_BYTES(num_exceptions));
+	index_exceptions(comp_source, last);
+	free(source);
+	return 0;
+}
+
+char access(char * reference, cs * comp_source, pos_t i) {
 /* This function returns the character in position i of the original source that is compressed on the comp_source structure. 
 It works as a naive implementation using binary search for predecessor queries. */
-	int index = bs_predecessor(comp_source->lens, comp_source->size, i);
-	int char_index = i - comp_source->lens[index]; 
-	return (char_index == comp_source->lens[index + 1] - 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
+	pos_t index = bs_predecessor(comp_source->lens, comp_source->size, i);
+	pos_t char_index = i - comp_source->lens[index]; 
+	return (i == comp_source->lens[index + 1] - 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
 	
 }
 
 
-char access_bins(char * reference, csb * comp_source, int i) {
+static char access_phrase(char * reference, csb * comp_source, pos_t index, pos_t i) {
+/* Returns the character in position i of the source, which lies in phrase index + 1 (index is the predecessor of i in the lens). */
+	pos_t char_index = i - comp_source->lens->arr[index];
+	if (comp_source->exception_index != NULL) {
+		// the phrase holds a few exceptions at most, a linear scan is cheaper than another search
+		pos_t e, end = comp_source->exception_index[index + 2];
+		for (e = comp_source->exception_index[index + 1]; e < end && comp_source->exception_pos[e] <= i; ++e)
+			if (comp_source->exception_pos[e] == i)
+				return comp_source->exception_chars[e];
+	}
+	if (i == comp_source->lens->arr[index + 1] - 1)
+		return comp_source->mismatches[index + 1];
+	if (PHRASE_IS_REVERSE(comp_source, index + 1)) {
+		return complement_base(reference[comp_source->starts[index + 1] - char_index]);
+	}
+	return reference[char_index + comp_source->starts[index + 1]];
+	// this +1 will never go out because the last element in the cumsum list is the length of the array and the access index will always be lower than the length (at most len - 1)
+}
+
+char access_bins(char * reference, csb * comp_source, pos_t i) {
 /* This function returns the character in position i of the original source that is compressed on the comp_source structure. 
 It is based on interpolation search predecessor. */
-	int index = predecessor(comp_source->lens, i, comp_source->size);
-	int char_index = i - comp_source->lens->arr[index];
-	return (char_index == comp_source->lens->arr[index + 1] - 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
-	// this +1 will never go out because the last element in the cumsum list is the length of the array and the access index will always be lower than the length (at most len - 1)
+	return access_phrase(reference, comp_source, predecessor(comp_source->lens, i, comp_source->size), i);
 }
 
-char * access_range(char * reference, cs * comp_source, int i, int len) {
+char access_directory(char * reference, csb * comp_source, struct directory * dir, pos_t i) {
+/* Same as access_bins, with the predecessor taken from the directory of comp_source->lens->arr (see create_directory) instead of the bins. */
+	return access_phrase(reference, comp_source, directory_predecessor(dir, i, comp_source->size), i);
+}
+
+static void apply_exceptions(csb * comp_source, char * res, pos_t i, pos_t len, pos_t phrase) {
+/* This function writes the exceptions of the tolerant parse that fall in source[i, i+len) over res, which holds those characters as copied from the reference. 
+-phrase- is the phrase that contains position i. */
+	if (comp_source->exception_index == NULL)
+		return;
+	pos_t e = comp_source->exception_index[phrase];
+	while (e < comp_source->num_exceptions && comp_source->exception_pos[e] < i)
+		e++;
+	for (; e < comp_source->num_exceptions && comp_source->exception_pos[e] < i + len; ++e)
+		res[comp_source->exception_pos[e] - i] = comp_source->exception_chars[e];
+}
+
+char * access_range(char * reference, cs * comp_source, pos_t i, pos_t len) {
 /* This function returns the characters in position [i, i+len] of the original source that is compressed on the comp_source structure. 
 It is based on binary search. */
 	char * res = malloc(len * sizeof(char) + 1);
-	int index = bs_predecessor(comp_source->lens, comp_source->size, i);
-	int char_index = i - comp_source->lens[index];
-	res[0] = (char_index == comp_source->lens[index + 1] - 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
-	int count = 1;
+	pos_t index = bs_predecessor(comp_source->lens, comp_source->size, i);
+	pos_t char_index = i - comp_source->lens[index];
+	res[0] = (i == comp_source->lens[index + 1] - 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
+	pos_t count = 1;
 	char_index += 1;
 	while (count < len && ((index - 1) < comp_source->size)) {
-		int check = comp_source->lens[index + 1] - comp_source->lens[index] - char_index;
+		pos_t check = comp_source->lens[index + 1] - comp_source->lens[index] - char_index;
 		if (check > 0) {
 			res[count] = (check == 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
 			char_index += 1;
@@ -201,39 +571,58 @@ It is based on binary search. */
 	return res;
 }
 
-char * access_bins_range(char * reference, csb * comp_source, int i, int len) {
+char * access_bins_range(char * reference, csb * comp_source, pos_t i, pos_t len) {
 /* This function returns the characters in position [i, i+len] of the original source that is compressed on the comp_source structure. 
 It is based on interpolation search for predecesor queries. */
 	char * res = malloc(len * sizeof(char) + 1);
-	int index = predecessor(comp_source->lens, i, comp_source->size);
-	int char_index = i - comp_source->lens->arr[index];
-	res[0] = (char_index == comp_source->lens->arr[index + 1] - 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
-	int count = 1;
-	char_index += 1;
-	while (count < len && ((index-1) < comp_source->size)){
-		int check = comp_source->lens->arr[index + 1] - comp_source->lens->arr[index] - char_index;
-		if (check > 0) {
-			res[count] = (check == 1) ? comp_source->mismatches[index + 1] : reference[char_index + comp_source->starts[index + 1]];
-			char_index += 1;
-			count += 1;
-		}
-		else {
-			index += 1;
-			char_index = 0;
+	pos_t count = access_bins_into(reference, comp_source, i, len, res, NULL) - i;
+	res[count] = '\0';
+	return res;
+}
+
+pos_t access_bins_into(char * reference, csb * comp_source, pos_t i, pos_t len, char * dst, pos_t * phrase) {
+/* This function writes the characters in position [i, i+len) of the source into dst (no terminator) and returns where they end, 
+before i+len only if the source does. If -phrase- is not NULL, it is a cursor kept between calls: the phrase that contains i 
+is taken from it when it still holds, instead of a predecessor query, and it is left at the phrase that contains the end. 
+Ranges given in increasing order (the regions of a BED file, consecutive windows) thus only search the bins once in a while. */
+	pos_t * lens = comp_source->lens->arr;
+	pos_t index;
+	if (phrase != NULL && *phrase > 0 && *phrase < comp_source->size && lens[*phrase - 1] <= i && i < lens[*phrase])
+		index = *phrase - 1;
+	else
+		index = predecessor(comp_source->lens, i, comp_source->size);
+	pos_t first = index;
+	pos_t pos = i, count = 0;
+	// every phrase is copied in one piece, then its mismatch
+	while (count < len && index + 1 < comp_source->size) {
+		pos_t n = lens[index + 1] - 1 - pos;
+		if (n > len - count)
+			n = len - count;
+		copy_phrase(&dst[count], reference, comp_source, index + 1, pos - lens[index], n);
+		count += n;
+		pos += n;
+		if (count < len) {
+			dst[count++] = comp_source->mismatches[index + 1];
+			pos++;
 		}
+		if (pos < lens[index + 1])
+			break;
+		index += 1;
 	}
-	res[len] = '\0';
-	return res;
+	apply_exceptions(comp_source, dst, i, count, first + 1);
+	if (phrase != NULL)
+		*phrase = index + 1;
+	return i + count;
 }
 
 char * decompress(char * reference, cs * compressed_source) {
 /* This function returns the original string source codified in the compressed_source structure (cs) */
 	char * source = calloc((compressed_source->lens[compressed_source->size - 1] + 1), sizeof(char));
-	int i, j, cont = 0;
-	int * lens = compressed_source->lens;
-	int * starts = compressed_source->starts; // we assume this is a pointer and costs no extra memory
+	pos_t i, j, cont = 0;
+	pos_t * lens = compressed_source->lens;
+	pos_t * starts = compressed_source->starts; // we assume this is a pointer and costs no extra memory
 	for (i = 1; i < compressed_source->size; ++i) {
-		int limit = lens[i] - lens[i - 1];
+		pos_t limit = lens[i] - lens[i - 1];
 		for (j = 0; j < limit; ++j) {
 			source[cont] = (j == limit - 1) ? compressed_source->mismatches[i] : reference[starts[i] + j];
 			cont++;
@@ -244,18 +633,96 @@ char * decompress(char * reference, cs * compressed_source) {
 
 char * decompress_bins(char * reference, csb * compressed_source) {
 /* This function returns the original string source codified in the compressed_source structure (csb) */
+	struct trace_span span = trace_begin("decompress");
 	char * source = calloc((compressed_source->lens->arr[compressed_source->size - 1]+1), sizeof(char));
-	int i, j, cont = 0;
-	int * lens = compressed_source->lens->arr; 
-	int * starts = compressed_source->starts; 
+	pos_t i, cont = 0;
+	pos_t * lens = compressed_source->lens->arr; 
 	for (i = 1; i < compressed_source->size; ++i) {
-		int limit = lens[i] - lens[i - 1];
-		for (j = 0; j < limit; ++j) {
-			source[cont] = (j == limit - 1) ? compressed_source->mismatches[i] : reference[starts[i] + j];
-			cont++;
-		}
+		pos_t limit = lens[i] - lens[i - 1];
+		copy_phrase(&source[cont], reference, compressed_source, i, 0, limit - 1);
+		cont += limit - 1;
+		source[cont++] = compressed_source->mismatches[i];
 	}
+	apply_exceptions(compressed_source, source, 0, cont, 1);
+	trace_end(span, cont);
 	return source; 
 }
 
+void index_exceptions(csb * compressed_source, pos_t from) {
+/* This function builds the exception_index of a compressed source: entry p is the first exception at or after the start of phrase p, 
+so the exceptions of phrase p are [exception_index[p], exception_index[p + 1]). It costs one offset per phrase and is not stored in files. 
+The entries up to phrase -from- are kept from the current index (append_bins only parses the phrases after it again), from = 0 builds it all. */
+	pos_t * index = compressed_source->exception_index;
+	compressed_source->exception_index = NULL;
+	if (compressed_source->num_exceptions == 0) {
+		free(index);
+		return;
+	}
+	if (index == NULL)
+		from = 0;
+	index = realloc(index, (compressed_source->size + 1) * sizeof(pos_t));
+	mem_alloc(MEM_PHRASES, (compressed_source->size + 1) * sizeof(pos_t));
+	if (from == 0)
+		index[0] = 0;
+	pos_t p, e = index[from];
+	for (p = from + 1; p < compressed_source->size; ++p) {
+		while (e < compressed_source->num_exceptions && compressed_source->exception_pos[e] < compressed_source->lens->arr[p - 1])
+			e++;
+		index[p] = e;
+	}
+	index[compressed_source->size] = compressed_source->num_exceptions;
+	compressed_source->exception_index = index;
+}
 
+void free_csb(csb * compressed_source) {
+/* This function frees the compressed source and its bins. The reference is not owned by the csb struct and is not freed. */
+	if (compressed_source == NULL)
+		return;
+	mem_release(MEM_PHRASES, MEM_PHRASE_BYTES(compressed_source->size) + MEM_EXCEPTION_BYTES(compressed_source->num_exceptions));
+	mem_release(MEM_BINS, MEM_BINS_BYTES(compressed_source->lens->size));
+	free(compressed_source->starts);
+	free(compressed_source->lens->arr);
+	free(compressed_source->lens->starts);
+	free(compressed_source->lens);
+	free(compressed_source->mismatches);
+	free(compressed_source->exception_pos);
+	free(compressed_source->exception_chars);
+	if (compressed_source->strands != NULL)
+		mem_release(MEM_PHRASES, MEM_STRAND_BYTES(compressed_source->size));
+	free(compressed_source->strands);
+	if (compressed_source->exception_index != NULL) {
+		mem_release(MEM_PHRASES, (compressed_source->size + 1) * sizeof(pos_t));
+		free(compressed_source->exception_index);
+	}
+	free_ref_table(compressed_source->refs);
+	free(compressed_source);
+}
+
+void free_ref_table(struct ref_table * table) {
+	if (table == NULL)
+		return;
+	int k;
+	for (k = 0; k < table->num; ++k)
+		free(table->names[k]);
+	free(table->names);
+	free(table->starts);
+	free(table->hashes);
+	free(table);
+}
+
+int phrase_reference(csb * comp_source, pos_t phrase) {
+/* This function returns the index of the reference (in comp_source->refs) that phrase -phrase- is copied from, 
+or 0 when the source was compressed against a single reference. */
+	struct ref_table * refs = comp_source->refs;
+	if (refs == NULL)
+		return 0;
+	int low = 0, high = refs->num - 1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (refs->starts[middle] <= comp_source->starts[phrase])
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
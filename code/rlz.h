@@ -1,25 +1,57 @@
 struct CompressedString {
-	int * starts;
-	int * lens; // cumulative
-	int size;
+	pos_t * starts;
+	pos_t * lens; // cumulative
+	pos_t size;
 	char * mismatches; // mismatch stuff
 };
 
+#define REF_SEPARATOR '#'
+
+struct ref_table {
+	int num;
+	char ** names;
+	pos_t * starts; // where every reference starts in the indexed text, followed by a REF_SEPARATOR; num + 1 entries
+	unsigned long long * hashes; // FNV-1a of every reference, to check that decompress and access are given the same ones
+};
+
 struct CompressedStringBins {
-	int * starts;
+	pos_t * starts;
 	struct bins * lens; // cumulative
-	int size;
+	pos_t size;
 	char * mismatches; // mismatch stuff
+	struct ref_table * refs; // references indexed together, NULL for a single reference
+	pos_t num_exceptions; // isolated SNPs kept inside phrases by the tolerant parse, 0 otherwise
+	pos_t * exception_pos; // sorted source positions
+	char * exception_chars;
+	pos_t * exception_index; // first exception of every phrase (size + 1 entries), rebuilt by index_exceptions, NULL without exceptions
+	unsigned char * strands; // one bit per phrase, set if it is copied from the reverse complement of the reference, NULL if that strand was not searched
 };
 
+struct parse_options {
+	int snp_run; // see extend_phrase, 0 closes a phrase at every mismatch
+	int reverse_complement; // phrases can also match the reverse complement of the reference, found with the tree of the reference itself
+};
+
+#define PHRASE_IS_REVERSE(comp_source, p) ((comp_source)->strands != NULL && ((comp_source)->strands[(p) >> 3] >> ((p) & 7) & 1))
+
 typedef struct CompressedString cs;
 typedef struct CompressedStringBins csb;
 
-char find_substring(Node* ref_st, char * reference, char * source, int * tuple);
-cs * compress(Node* ref_st, char * reference, char * source);
-csb * compress_bins(Node* ref_st, char * reference, char * source, int bin_factor);
-char access(char * reference, cs * comp_source, int index);
-char access_bins(char * reference, csb * comp_source, int index);
-char * access_bins_range(char * reference, csb * comp_source, int i, int len);
+char find_substring(SuffixTree * ref_st, char * reference, char * source, pos_t * tuple);
+cs * compress(SuffixTree * ref_st, char * reference, char * source);
+csb * compress_bins(SuffixTree * ref_st, char * reference, char * source, int bin_factor);
+csb * compress_bins_ext(SuffixTree * ref_st, char * reference, char * source, int bin_factor, struct parse_options * opt);
+char complement_base(char c);
+char access(char * reference, cs * comp_source, pos_t index);
+char access_bins(char * reference, csb * comp_source, pos_t index);
+char access_directory(char * reference, csb * comp_source, struct directory * dir, pos_t index);
+char * access_range(char * reference, cs * comp_source, pos_t i, pos_t len);
+char * access_bins_range(char * reference, csb * comp_source, pos_t i, pos_t len);
+pos_t access_bins_into(char * reference, csb * comp_source, pos_t i, pos_t len, char * dst, pos_t * phrase);
 char * decompress(char * reference, cs * compressed_source);
 char * decompress_bins(char * reference, csb * compressed_source);
+int append_bins(SuffixTree * ref_st, char * reference, csb * comp_source, char * data, struct parse_options * opt);
+void index_exceptions(csb * compressed_source, pos_t from);
+void free_csb(csb * compressed_source);
+void free_ref_table(struct ref_table * table);
+int phrase_reference(csb * comp_source, pos_t phrase);
@@ -0,0 +1,37 @@
+/*
+Rng module contains a small seeded pseudo-random generator (splitmix64).
+Unlike rand(), its sequence is the same on every platform and covers 64 bits,
+so benchmarks and synthetic data can be reproduced from the seed alone.
+
+Functions:
+rng_seed
+rng_next
+rng_below
+rng_double
+-----------------------------------------------------------------------------------------
+*/
+
+#include "types.h"
+#include "rng.h"
+
+void rng_seed(struct rng * rng, unsigned long long seed) {
+	rng->state = seed;
+}
+
+unsigned long long rng_next(struct rng * rng) {
+/* Returns the next 64-bit number of the sequence. */
+	unsigned long long z = (rng->state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+pos_t rng_below(struct rng * rng, pos_t n) {
+/* Returns a number in [0, n). */
+	return (pos_t)(rng_next(rng) % (unsigned long long)n);
+}
+
+double rng_double(struct rng * rng) {
+/* Returns a number in [0, 1). */
+	return (rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
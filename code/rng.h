@@ -0,0 +1,8 @@
+struct rng {
+	unsigned long long state;
+};
+
+void rng_seed(struct rng * rng, unsigned long long seed);
+unsigned long long rng_next(struct rng * rng);
+pos_t rng_below(struct rng * rng, pos_t n);
+double rng_double(struct rng * rng);
@@ -0,0 +1,244 @@
+/*
+Search module counts and locates the occurrences of a pattern in compressed sources, without decompressing them.
+
+An occurrence either lies inside the part of a phrase copied from the reference, or it covers a position that is not
+a plain copy: the mismatch that closes a phrase, or an exception of the tolerant parse.
+The first kind are occurrences of the pattern in the reference (of its reverse complement for a reverse phrase),
+located once with the suffix tree of the reference and matched against every phrase with two binary searches.
+The second kind are found by decoding the 2m-1 characters around each of those positions with access_bins_range.
+Every occurrence of the second kind is reported by the first such position it covers, so none is reported twice.
+A collection of sources is searched by a pool of threads, one source at a time per thread.
+
+Functions:
+locate_reference
+search_csb
+search_sources
+free_search_results
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "search.h"
+
+struct search_job {
+	csb ** sources;
+	int num_sources;
+	char * reference;
+	char * pattern;
+	pos_t * forward, num_forward; // occurrences of the pattern in the reference
+	pos_t * reverse, num_reverse; // occurrences of its reverse complement
+	struct search_result * results;
+	int next; // next source to search
+	pthread_mutex_t lock;
+};
+
+static int compare_positions(const void * a, const void * b) {
+	pos_t x = *(const pos_t *)a, y = *(const pos_t *)b;
+	return (x > y) - (x < y);
+}
+
+static pos_t lower_bound(pos_t * arr, pos_t n, pos_t key) {
+/* Returns the first index of the sorted array arr whose value is not below key, n if there is none. */
+	pos_t low = 0, high = n;
+	while (low < high) {
+		pos_t middle = (low + high) / 2;
+		if (arr[middle] < key)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+static void add_position(struct search_result * res, pos_t pos) {
+	if (res->count == res->capacity) {
+		res->capacity = res->capacity ? 2 * res->capacity : 64;
+		res->positions = realloc(res->positions, res->capacity * sizeof(pos_t));
+	}
+	res->positions[res->count++] = pos;
+}
+
+pos_t * locate_reference(SuffixTree * ref_st, char * reference, char * pattern, pos_t * count) {
+/* This function returns the sorted positions where pattern occurs in reference, whose suffix tree is ref_st, and their number in count.
+It walks down the tree as find_substring does and collects the suffix indexes of the leaves below the node where the pattern ends. */
+	pos_t m = strlen(pattern), matched = 0;
+	Node * node = ref_st->root;
+	*count = 0;
+	while (matched < m) {
+		if (pattern[matched] == REF_SEPARATOR || (node = findChild(ref_st, node, reference, pattern[matched])) == NULL)
+			return NULL;
+		pos_t j;
+		for (j = 0; j < *node->end - node->start + 1 && matched < m; ++j, ++matched)
+			if (reference[node->start + j] != pattern[matched])
+				return NULL;
+	}
+
+	// the subtree is walked with an explicit stack, since repeats make it deep
+	pos_t stack_capacity = 64, sp = 0, capacity = 64;
+	Node ** stack = malloc(stack_capacity * sizeof(Node *));
+	pos_t * positions = malloc(capacity * sizeof(pos_t));
+	stack[sp++] = node;
+	while (sp > 0) {
+		Node * n = stack[--sp];
+		int slot, leaf = 1;
+		Node * child;
+		for (child = firstChild(ref_st, n, &slot); child != NULL; child = nextChild(ref_st, n, child, &slot)) {
+			leaf = 0;
+			if (sp == stack_capacity) {
+				stack_capacity *= 2;
+				stack = realloc(stack, stack_capacity * sizeof(Node *));
+			}
+			stack[sp++] = child;
+		}
+		if (leaf) {
+			if (*count == capacity) {
+				capacity *= 2;
+				positions = realloc(positions, capacity * sizeof(pos_t));
+			}
+			positions[(*count)++] = n->suffixIndex;
+		}
+	}
+	free(stack);
+	qsort(positions, *count, sizeof(pos_t), compare_positions);
+	return positions;
+}
+
+static void search_around(char * reference, csb * comp_source, char * pattern, pos_t m, pos_t x, pos_t previous, struct search_result * res) {
+/* This function adds the occurrences that cover source position x but not the previous position that is not a plain copy (-previous-). */
+	pos_t total = comp_source->lens->arr[comp_source->size - 1];
+	pos_t from = x - m + 1, q;
+	if (from <= previous)
+		from = previous + 1;
+	if (from < 0)
+		from = 0;
+	pos_t len = x + m - from;
+	if (from + len > total)
+		len = total - from;
+	if (len < m)
+		return;
+	char * window = access_bins_range(reference, comp_source, from, len);
+	for (q = from; q <= x && q + m <= from + len; ++q)
+		if (memcmp(&window[q - from], pattern, m) == 0)
+			add_position(res, q);
+	free(window);
+}
+
+static int covers_exception(csb * comp_source, pos_t phrase, pos_t pos, pos_t m) {
+	if (comp_source->exception_index == NULL)
+		return 0;
+	pos_t e;
+	for (e = comp_source->exception_index[phrase]; e < comp_source->exception_index[phrase + 1]; ++e)
+		if (comp_source->exception_pos[e] >= pos && comp_source->exception_pos[e] < pos + m)
+			return 1;
+	return 0;
+}
+
+void search_csb(char * reference, csb * comp_source, char * pattern, pos_t * forward, pos_t num_forward, pos_t * reverse, pos_t num_reverse,
+	struct search_result * res) {
+/* This function stores in res the sorted source positions where pattern occurs. -forward- and -reverse- are the sorted occurrences
+of the pattern and of its reverse complement in the reference (see locate_reference), the latter only needed if the source has strand bits.
+A forward phrase copies reference[s, s+c), so an occurrence o of the pattern with s <= o <= s+c-m is at source position base+o-s.
+A reverse phrase copies reference[s-c+1, s] backwards and complemented, so an occurrence o of the reverse complement with
+s-c+1 <= o <= s-m+1 is at base+s-m+1-o. */
+	pos_t * lens = comp_source->lens->arr, p, k, e;
+	pos_t m = strlen(pattern), previous = -1;
+	res->count = 0;
+	res->capacity = 0;
+	res->positions = NULL;
+	for (p = 1; p < comp_source->size; ++p) {
+		pos_t base = lens[p - 1], c = lens[p] - base - 1, s = comp_source->starts[p];
+		if (c >= m && !PHRASE_IS_REVERSE(comp_source, p)) {
+			pos_t last = lower_bound(forward, num_forward, s + c - m + 1);
+			for (k = lower_bound(forward, num_forward, s); k < last; ++k)
+				if (!covers_exception(comp_source, p, base + forward[k] - s, m))
+					add_position(res, base + forward[k] - s);
+		}
+		else if (c >= m) {
+			pos_t last = lower_bound(reverse, num_reverse, s - m + 2);
+			for (k = lower_bound(reverse, num_reverse, s - c + 1); k < last; ++k)
+				if (!covers_exception(comp_source, p, base + s - m + 1 - reverse[k], m))
+					add_position(res, base + s - m + 1 - reverse[k]);
+		}
+		if (comp_source->exception_index != NULL) {
+			for (e = comp_source->exception_index[p]; e < comp_source->exception_index[p + 1]; ++e) {
+				search_around(reference, comp_source, pattern, m, comp_source->exception_pos[e], previous, res);
+				previous = comp_source->exception_pos[e];
+			}
+		}
+		search_around(reference, comp_source, pattern, m, lens[p] - 1, previous, res);
+		previous = lens[p] - 1;
+	}
+	// without hits the positions are still NULL, which qsort must not receive
+	if (res->count == 0)
+		return;
+	qsort(res->positions, res->count, sizeof(pos_t), compare_positions);
+}
+
+static void * search_worker(void * arg) {
+	struct search_job * job = arg;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		int i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->num_sources)
+			return NULL;
+		search_csb(job->reference, job->sources[i], job->pattern, job->forward, job->num_forward, job->reverse, job->num_reverse, &job->results[i]);
+	}
+}
+
+struct search_result * search_sources(SuffixTree * ref_st, char * reference, csb ** sources, int num_sources, char * pattern, int threads) {
+/* This function searches pattern in every source, all compressed against reference (whose suffix tree is ref_st), with -threads- threads.
+It returns one result per source, to be freed with free_search_results. The pattern is located in the reference once for all the sources,
+its reverse complement too if any source has strand bits. */
+	struct search_job job;
+	pos_t m = strlen(pattern), j;
+	int i, started = 0;
+	job.sources = sources;
+	job.num_sources = num_sources;
+	job.reference = reference;
+	job.pattern = pattern;
+	job.forward = locate_reference(ref_st, reference, pattern, &job.num_forward);
+	job.reverse = NULL;
+	job.num_reverse = 0;
+	for (i = 0; i < num_sources; ++i) {
+		if (sources[i]->strands != NULL) {
+			char * rc = malloc(m + 1);
+			for (j = 0; j < m; ++j)
+				rc[j] = complement_base(pattern[m - 1 - j]);
+			rc[m] = '\0';
+			job.reverse = locate_reference(ref_st, reference, rc, &job.num_reverse);
+			free(rc);
+			break;
+		}
+	}
+	job.results = calloc(num_sources, sizeof(struct search_result));
+	job.next = 0;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_t * ids = malloc(threads * sizeof(pthread_t));
+	for (i = 1; i < threads && i < num_sources; ++i)
+		if (pthread_create(&ids[started], NULL, search_worker, &job) == 0)
+			started++;
+	search_worker(&job);
+	for (i = 0; i < started; ++i)
+		pthread_join(ids[i], NULL);
+	free(ids);
+	pthread_mutex_destroy(&job.lock);
+	free(job.forward);
+	free(job.reverse);
+	return job.results;
+}
+
+void free_search_results(struct search_result * results, int num_sources) {
+	int i;
+	for (i = 0; i < num_sources; ++i)
+		free(results[i].positions);
+	free(results);
+}
@@ -0,0 +1,11 @@
+struct search_result {
+	pos_t count;
+	pos_t * positions; // sorted source positions
+	pos_t capacity;
+};
+
+pos_t * locate_reference(SuffixTree * ref_st, char * reference, char * pattern, pos_t * count);
+void search_csb(char * reference, csb * comp_source, char * pattern, pos_t * forward, pos_t num_forward, pos_t * reverse, pos_t num_reverse, 
+	struct search_result * res);
+struct search_result * search_sources(SuffixTree * ref_st, char * reference, csb ** sources, int num_sources, char * pattern, int threads);
+void free_search_results(struct search_result * results, int num_sources);
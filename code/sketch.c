@@ -0,0 +1,511 @@
+/*
+Sketch module picks, for every source, the candidate reference expected to give the fewest phrases, from k-mer sketches
+instead of compressing the source against every candidate.
+
+A sketch keeps the hashes of the k-mers of a sequence that fall below a threshold, one out of 'scale' on average
+(FracMinHash, the scaled variant of MinHash, so sketches of sequences of any length can be compared).
+The containment of a source in a reference, the fraction of the source k-mers that occur in the reference, is estimated
+as the fraction of the source sketch found in the reference sketch. A source that differs from the reference at a rate d
+per base keeps about (1-d)^k of its k-mers, and every difference ends a phrase, so the source is expected to take about
+length * -ln(containment) / k phrases. Phrases cannot be shorter, on average, than the random matches of log4 of the
+reference length, which bounds the estimate of unrelated sequences.
+The 'select' action writes the estimates, can check them against the phrases of the actual compression on a sample of
+the sources, and can compress every source against its selected reference.
+
+Functions:
+sketch_sequence
+sketch_files
+sketch_common
+sketch_containment
+estimate_phrases
+select_reference
+free_sketch
+select_main
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "sketch.h"
+#include "trace.h"
+
+struct sketch_job {
+	char ** filenames;
+	int num;
+	int k, canonical;
+	long scale;
+	struct sketch * sketches;
+	int next; // next file to sketch
+	int failed; // first file that cannot be read, -1 if none
+	pthread_mutex_t lock;
+};
+
+static unsigned long long mix(unsigned long long z) {
+/* The finalizer of splitmix64, a bijection, so distinct k-mers never share a hash. */
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int compare_hashes(const void * a, const void * b) {
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return (x > y) - (x < y);
+}
+
+void sketch_sequence(char * text, int k, long scale, int canonical, struct sketch * sk) {
+/* This function stores in sk the sketch of text: the distinct hashes of its k-mers (2 <= k <= 31) below 2^64 / scale.
+K-mers with a character other than A, C, G and T are skipped. With -canonical- set, a k-mer and its reverse complement
+are hashed as the smaller of the two, so the sketch does not depend on the strand. */
+	struct trace_span span = trace_begin("sketch");
+	unsigned long long mask = (1ULL << (2 * k)) - 1, threshold = ~0ULL / scale;
+	unsigned long long forward = 0, reverse = 0;
+	pos_t capacity = 1024, i;
+	int valid = 0, code;
+	sk->hashes = malloc(capacity * sizeof(unsigned long long));
+	sk->num = 0;
+	sk->k = k;
+	sk->scale = scale;
+	sk->canonical = canonical;
+	for (i = 0; text[i] != '\0' && text[i] != '$'; ++i) {
+		switch (text[i]) {
+			case 'A': code = 0; break;
+			case 'C': code = 1; break;
+			case 'G': code = 2; break;
+			case 'T': code = 3; break;
+			default: code = -1;
+		}
+		if (code < 0) {
+			valid = 0;
+			continue;
+		}
+		forward = ((forward << 2) | code) & mask;
+		reverse = (reverse >> 2) | ((unsigned long long)(3 - code) << (2 * (k - 1)));
+		if (++valid < k)
+			continue;
+		unsigned long long h = mix((canonical && reverse < forward) ? reverse : forward);
+		if (h > threshold)
+			continue;
+		if (sk->num == capacity) {
+			capacity *= 2;
+			sk->hashes = realloc(sk->hashes, capacity * sizeof(unsigned long long));
+		}
+		sk->hashes[sk->num++] = h;
+	}
+	sk->length = i;
+	// sorted and distinct
+	qsort(sk->hashes, sk->num, sizeof(unsigned long long), compare_hashes);
+	pos_t distinct = 0;
+	for (i = 0; i < sk->num; ++i)
+		if (distinct == 0 || sk->hashes[i] != sk->hashes[distinct - 1])
+			sk->hashes[distinct++] = sk->hashes[i];
+	sk->num = distinct;
+	trace_end(span, sk->length);
+}
+
+static void * sketch_worker(void * arg) {
+	struct sketch_job * job = arg;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		int i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->num)
+			return NULL;
+		char * text = load_file(job->filenames[i], 0);
+		if (text == NULL) {
+			pthread_mutex_lock(&job->lock);
+			if (job->failed < 0 || i < job->failed)
+				job->failed = i;
+			pthread_mutex_unlock(&job->lock);
+			memset(&job->sketches[i], 0, sizeof(struct sketch));
+			continue;
+		}
+		sketch_sequence(text, job->k, job->scale, job->canonical, &job->sketches[i]);
+		unload_file(text, 0);
+	}
+}
+
+int sketch_files(char ** filenames, int num, int k, long scale, int canonical, struct sketch * sketches, int threads) {
+/* This function stores in sketches[i] the sketch of the file filenames[i], with -threads- threads, one file at a time per thread.
+It returns the first file that cannot be read (its sketch is left empty), or -1 if all of them were read. */
+	struct sketch_job job;
+	int i, started = 0;
+	job.filenames = filenames;
+	job.num = num;
+	job.k = k;
+	job.scale = scale;
+	job.canonical = canonical;
+	job.sketches = sketches;
+	job.next = 0;
+	job.failed = -1;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_t * ids = malloc(threads * sizeof(pthread_t));
+	for (i = 1; i < threads && i < num; ++i)
+		if (pthread_create(&ids[started], NULL, sketch_worker, &job) == 0)
+			started++;
+	sketch_worker(&job);
+	for (i = 0; i < started; ++i)
+		pthread_join(ids[i], NULL);
+	free(ids);
+	pthread_mutex_destroy(&job.lock);
+	return job.failed;
+}
+
+pos_t sketch_common(struct sketch * a, struct sketch * b) {
+/* Returns the number of hashes in both sketches, which must have the same k, scale and strand setting. */
+	pos_t i = 0, j = 0, common = 0;
+	while (i < a->num && j < b->num) {
+		if (a->hashes[i] < b->hashes[j])
+			i++;
+		else if (a->hashes[i] > b->hashes[j])
+			j++;
+		else {
+			common++;
+			i++;
+			j++;
+		}
+	}
+	return common;
+}
+
+double sketch_containment(struct sketch * source, struct sketch * reference) {
+/* Returns the estimated fraction of the k-mers of source that occur in reference, 0 if the source sketch is empty. */
+	if (source->num == 0)
+		return 0;
+	return (double)sketch_common(source, reference) / source->num;
+}
+
+double estimate_phrases(struct sketch * source, struct sketch * reference) {
+/* This function returns the expected number of phrases of source compressed against reference (see the header of this module):
+length * -ln(containment) / k, at least one phrase and at most the phrases of random matches. */
+	double c = sketch_containment(source, reference);
+	double random_len = log(reference->length > 4 ? (double)reference->length : 4.0) / log(4.0) + 1;
+	double most = source->length / random_len + 1;
+	if (c <= 0)
+		return most;
+	double phrases = 1 + source->length * (-log(c) / source->k);
+	return (phrases < most) ? phrases : most;
+}
+
+int select_reference(struct sketch * source, struct sketch * references, int num, double * estimates) {
+/* This function returns the reference with the fewest estimated phrases for source, the first one on ties.
+If estimates is not NULL, it receives the estimate of every reference. */
+	int r, best = 0;
+	double best_phrases = 0;
+	for (r = 0; r < num; ++r) {
+		double phrases = estimate_phrases(source, &references[r]);
+		if (estimates != NULL)
+			estimates[r] = phrases;
+		if (r == 0 || phrases < best_phrases) {
+			best = r;
+			best_phrases = phrases;
+		}
+	}
+	return best;
+}
+
+void free_sketch(struct sketch * sk) {
+	free(sk->hashes);
+	sk->hashes = NULL;
+	sk->num = 0;
+}
+
+// ----------------------------------------------------
+// The 'select' action
+
+static void usage() {
+	printf("SELECT command-line input: \n [reference filenames] [source filenames] [output filename] (optional flags) \n");
+	printf("Both lists are comma separated. Writes, for every source, the reference expected to give the fewest phrases and the estimate \n");
+	printf("for every reference, as tab separated values, '-' for stdout. \n");
+	printf("  --k K                  k-mer length, at most 31 (default %d) \n", SKETCH_K);
+	printf("  --scale S              one k-mer out of S is kept in the sketches (default %d) \n", SKETCH_SCALE);
+	printf("  --reverse-complement R 1 to count k-mers on both strands, and to compress with [reverse complement] 1 (default 0) \n");
+	printf("  --validate N           compress N sources, evenly spaced in the list, against every reference and compare \n");
+	printf("                         the phrases with the estimates (default 0) \n");
+	printf("  --compress DIR         compress every source against its reference into DIR, named after the source with .csb \n");
+	printf("  --bin-factor B         bin factor of the compressions (default 1) \n");
+}
+
+static char ** split_list(char * list, int * num) {
+/* Returns the names of a comma separated list, to be freed with free_list. */
+	char * copy = malloc(strlen(list) + 1), * name, * save, * p;
+	int capacity = 1;
+	for (p = list; *p; ++p)
+		capacity += (*p == ',');
+	char ** names = malloc(capacity * sizeof(char *));
+	strcpy(copy, list);
+	*num = 0;
+	for (name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		names[*num] = malloc(strlen(name) + 1);
+		strcpy(names[(*num)++], name);
+	}
+	free(copy);
+	return names;
+}
+
+static void free_list(char ** names, int num) {
+	int i;
+	for (i = 0; i < num; ++i)
+		free(names[i]);
+	free(names);
+}
+
+static void output_name(char * directory, char * source, char * name, size_t size) {
+/* Writes in name the .csb file of source in directory: the file name of source without its extension. */
+	char * base = strrchr(source, '/'), * dot;
+	base = (base == NULL) ? source : base + 1;
+	snprintf(name, size, "%s/%s", directory, base);
+	dot = strrchr(name + strlen(directory) + 1, '.');
+	if (dot != NULL && dot != name + strlen(directory) + 1)
+		*dot = '\0';
+	strncat(name, ".csb", size - strlen(name) - 1);
+}
+
+static SuffixTree * index_reference(char * filename, char ** reference) {
+/* Loads a reference and builds its tree, as the 'compress' action does. */
+	*reference = load_file(filename, 1);
+	if (*reference == NULL)
+		return NULL;
+	return buildSuffixTree(*reference, treeThreads);
+}
+
+static void free_index(SuffixTree * tree, char * reference) {
+	freeSuffixTree(tree);
+	unload_file(reference, 1);
+}
+
+static int validate(char ** references, int num_references, char ** sources, int num_sources, int sample, double * estimates, int * selected,
+	struct parse_options * opt, int bin_factor, FILE * info) {
+/* Compresses -sample- sources, evenly spaced in the list, against every reference and prints their phrases next to the estimates.
+estimates[s * num_references + r] is the estimate of source s against reference r. It returns 1 if a file cannot be read,
+or if a source has a character that is not in a reference. */
+	int i, r, agree = 0;
+	int * sampled = malloc(sample * sizeof(int));
+	char ** texts = malloc(sample * sizeof(char *));
+	pos_t * actual = malloc((pos_t)sample * num_references * sizeof(pos_t));
+	double worse = 0, error = 0;
+	for (i = 0; i < sample; ++i) {
+		sampled[i] = (int)((long long)i * num_sources / sample);
+		texts[i] = load_file(sources[sampled[i]], 0);
+	}
+	for (r = 0; r < num_references; ++r) {
+		char * reference;
+		SuffixTree * tree = index_reference(references[r], &reference);
+		if (tree == NULL) {
+			fprintf(info, "Error. Cannot read %s \n", references[r]);
+			break;
+		}
+		for (i = 0; i < sample; ++i) {
+			if (texts[i] == NULL)
+				continue;
+			csb * compressed_source = compress_bins_ext(tree, reference, texts[i], bin_factor, opt);
+			if (compressed_source == NULL) {
+				fprintf(info, "Error. %s has a character that is not in %s \n", sources[sampled[i]], references[r]);
+				break;
+			}
+			actual[i * num_references + r] = compressed_source->size - 1;
+			free_csb(compressed_source);
+		}
+		free_index(tree, reference);
+		if (i < sample)
+			break;
+	}
+	int failed = r < num_references;
+	for (i = 0; i < sample && !failed; ++i) {
+		int s = sampled[i], best = 0;
+		if (texts[i] == NULL) {
+			fprintf(info, "Error. Cannot read %s \n", sources[s]);
+			failed = 1;
+			break;
+		}
+		for (r = 0; r < num_references; ++r) {
+			pos_t phrases = actual[i * num_references + r];
+			if (phrases < actual[i * num_references + best])
+				best = r;
+			error += fabs(estimates[(pos_t)s * num_references + r] - phrases) / phrases;
+		}
+		pos_t chosen = actual[i * num_references + selected[s]], fewest = actual[i * num_references + best];
+		agree += (chosen == fewest);
+		worse += (double)chosen / fewest - 1;
+		fprintf(info, "%s: selected %s, %.0f phrases estimated, %lld actual; fewest %lld phrases with %s \n", sources[s], references[selected[s]],
+			estimates[(pos_t)s * num_references + selected[s]], (long long)chosen, (long long)fewest, references[best]);
+	}
+	if (!failed) {
+		fprintf(info, "Validation on %d sources: the selected reference gives the fewest phrases for %d, %.2f%% more phrases than the best on average, \n", sample, agree, 100 * worse / sample);
+		fprintf(info, "mean relative error of the estimates %.2f%% \n", 100 * error / ((double)sample * num_references));
+	}
+	for (i = 0; i < sample; ++i)
+		unload_file(texts[i], 0);
+	free(texts);
+	free(sampled);
+	free(actual);
+	return failed;
+}
+
+static int compress_selected(char ** references, int num_references, char ** sources, int num_sources, int * selected, char * directory,
+	struct parse_options * opt, int bin_factor, FILE * info) {
+/* Compresses every source against its selected reference into directory, building the tree of each reference once.
+It returns 1 if a file cannot be read or written, or if a source has a character that is not in its reference. */
+	int r, s;
+	char name[4096];
+	for (r = 0; r < num_references; ++r) {
+		for (s = 0; s < num_sources && selected[s] != r; ++s);
+		if (s == num_sources)
+			continue;
+		char * reference;
+		SuffixTree * tree = index_reference(references[r], &reference);
+		if (tree == NULL) {
+			fprintf(info, "Error. Cannot read %s \n", references[r]);
+			return 1;
+		}
+		for (s = 0; s < num_sources; ++s) {
+			if (selected[s] != r)
+				continue;
+			char * source = load_file(sources[s], 0);
+			output_name(directory, sources[s], name, sizeof(name));
+			FILE * fp = (source == NULL) ? NULL : fopen(name, "wb");
+			if (fp == NULL) {
+				fprintf(info, "Error. Cannot %s %s \n", source == NULL ? "read" : "write", source == NULL ? sources[s] : name);
+				unload_file(source, 0);
+				free_index(tree, reference);
+				return 1;
+			}
+			fclose(fp);
+			csb * compressed_source = compress_bins_ext(tree, reference, source, bin_factor, opt);
+			if (compressed_source == NULL) {
+				fprintf(info, "Error. %s has a character that is not in %s \n", sources[s], references[r]);
+				remove(name);
+				unload_file(source, 0);
+				free_index(tree, reference);
+				return 1;
+			}
+			csb_to_file(compressed_source, name);
+			fprintf(info, "%s compressed against %s in %s: %lld phrases \n", sources[s], references[r], name, (long long)(compressed_source->size - 1));
+			free_csb(compressed_source);
+			unload_file(source, 0);
+		}
+		free_index(tree, reference);
+	}
+	return 0;
+}
+
+int select_main(int argc, char * argv[]) {
+/* Entry point of the 'select' action. argv[0] is the list of references, argv[1] the list of sources, argv[2] the output and the rest are flags. */
+	int k = SKETCH_K, sample = 0, bin_factor = 1, a, r, s, failed = 0;
+	long scale = SKETCH_SCALE;
+	char * directory = NULL;
+	struct parse_options opt = { 0, 0 };
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+	for (a = 3; a < argc; a += 2) {
+		if (a + 1 >= argc) {
+			printf("Missing value for %s \n", argv[a]);
+			return 1;
+		}
+		if (strcmp(argv[a], "--k") == 0)
+			k = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--scale") == 0)
+			scale = atol(argv[a + 1]);
+		else if (strcmp(argv[a], "--reverse-complement") == 0)
+			opt.reverse_complement = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--validate") == 0)
+			sample = atoi(argv[a + 1]);
+		else if (strcmp(argv[a], "--compress") == 0)
+			directory = argv[a + 1];
+		else if (strcmp(argv[a], "--bin-factor") == 0)
+			bin_factor = atoi(argv[a + 1]);
+		else {
+			printf("Unknown flag %s \n", argv[a]);
+			usage();
+			return 1;
+		}
+	}
+	if (k < 2 || k > 31 || scale < 1 || sample < 0 || bin_factor < 1) {
+		printf("Incorrect command. Check the numeric arguments \n");
+		return 1;
+	}
+
+	int num_references, num_sources;
+	char ** references = split_list(argv[0], &num_references);
+	char ** sources = split_list(argv[1], &num_sources);
+	if (num_references == 0 || num_sources == 0) {
+		printf("Incorrect command. Give at least one reference and one source \n");
+		free_list(references, num_references);
+		free_list(sources, num_sources);
+		return 1;
+	}
+	if (sample > num_sources)
+		sample = num_sources;
+	struct sketch * ref_sketches = calloc(num_references, sizeof(struct sketch));
+	struct sketch * src_sketches = calloc(num_sources, sizeof(struct sketch));
+	int missing = sketch_files(references, num_references, k, scale, opt.reverse_complement, ref_sketches, treeThreads);
+	if (missing >= 0)
+		printf("Error. Cannot read %s \n", references[missing]);
+	else if ((missing = sketch_files(sources, num_sources, k, scale, opt.reverse_complement, src_sketches, treeThreads)) >= 0)
+		printf("Error. Cannot read %s \n", sources[missing]);
+	FILE * out = NULL;
+	if (missing < 0) {
+		out = (strcmp(argv[2], "-") == 0) ? stdout : fopen(argv[2], "w");
+		if (out == NULL)
+			printf("Error. Cannot write %s \n", argv[2]);
+	}
+	if (out == NULL) {
+		for (r = 0; r < num_references; ++r)
+			free_sketch(&ref_sketches[r]);
+		for (s = 0; s < num_sources; ++s)
+			free_sketch(&src_sketches[s]);
+		free(ref_sketches);
+		free(src_sketches);
+		free_list(references, num_references);
+		free_list(sources, num_sources);
+		return 1;
+	}
+
+	// one row per source: the selected reference, its estimate and containment, and the estimate of every reference
+	double * estimates = malloc((pos_t)num_sources * num_references * sizeof(double));
+	int * selected = malloc(num_sources * sizeof(int));
+	fprintf(out, "#source\tselected\testimated_phrases\tcontainment");
+	for (r = 0; r < num_references; ++r)
+		fprintf(out, "\t%s", references[r]);
+	fprintf(out, "\n");
+	for (s = 0; s < num_sources; ++s) {
+		double * row = &estimates[(pos_t)s * num_references];
+		selected[s] = select_reference(&src_sketches[s], ref_sketches, num_references, row);
+		fprintf(out, "%s\t%s\t%.0f\t%.6f", sources[s], references[selected[s]], row[selected[s]], sketch_containment(&src_sketches[s], &ref_sketches[selected[s]]));
+		for (r = 0; r < num_references; ++r)
+			fprintf(out, "\t%.0f", row[r]);
+		fprintf(out, "\n");
+	}
+	// the report goes to stderr when the rows go to stdout
+	FILE * info = (out == stdout) ? stderr : stdout;
+	if (out != stdout) {
+		fclose(out);
+		fprintf(info, "%d sources sketched against %d references (k %d, scale %ld), selection written to %s \n", num_sources, num_references, k, scale, argv[2]);
+	}
+	for (r = 0; r < num_references; ++r)
+		free_sketch(&ref_sketches[r]);
+	for (s = 0; s < num_sources; ++s)
+		free_sketch(&src_sketches[s]);
+	free(ref_sketches);
+	free(src_sketches);
+
+	if (sample > 0)
+		failed = validate(references, num_references, sources, num_sources, sample, estimates, selected, &opt, bin_factor, info);
+	if (!failed && directory != NULL)
+		failed = compress_selected(references, num_references, sources, num_sources, selected, directory, &opt, bin_factor, info);
+	free(estimates);
+	free(selected);
+	free_list(references, num_references);
+	free_list(sources, num_sources);
+	return failed;
+}
@@ -0,0 +1,20 @@
+#define SKETCH_K 21 // default k-mer length, at most 31 so a k-mer fits in 64 bits
+#define SKETCH_SCALE 100 // default scale: about one k-mer out of 'scale' is kept
+
+struct sketch {
+	unsigned long long * hashes; // sorted and distinct, every hash of a k-mer below the threshold of the scale
+	pos_t num;
+	pos_t length; // bases of the sequence, N included
+	int k;
+	long scale;
+	int canonical; // a k-mer and its reverse complement have the same hash
+};
+
+void sketch_sequence(char * text, int k, long scale, int canonical, struct sketch * sk);
+int sketch_files(char ** filenames, int num, int k, long scale, int canonical, struct sketch * sketches, int threads);
+pos_t sketch_common(struct sketch * a, struct sketch * b);
+double sketch_containment(struct sketch * source, struct sketch * reference);
+double estimate_phrases(struct sketch * source, struct sketch * reference);
+int select_reference(struct sketch * source, struct sketch * references, int num, double * estimates);
+void free_sketch(struct sketch * sk);
+int select_main(int argc, char * argv[]);
@@ -4,6 +4,23 @@ Ukkonen's Suffix Tree algorithm.
 
 the implementation is based on https://www.geeksforgeeks.org/ukkonens-suffix-tree-construction-part-1/ to part-6
 although some modifications have been performed. 
+
+Ukkonen's algorithm is sequential (it goes through the active point of struct Ukkonen), so when threads > 1 
+buildSuffixTree calls buildSuffixTreeParallel instead: the suffixes are split into buckets by their first 
+characters, every bucket is sorted and turned into its subtree by a pool of threads, and the subtrees are 
+hung from a shared root. The sort compares suffixes character by character, which repetitive text (satellites, 
+tandem repeats) makes quadratic, so it gives up past a budget of compared characters and the tree is built 
+with Ukkonen's algorithm instead. The threads are capped by the online processors. The suffix tree of a text 
+ending in a unique '$' is unique, so both builds give the same nodes, children and suffix indexes, and
+find_substring returns the same results.
+
+Nodes of DNA texts keep one child pointer per slot of lookup. A text with any other character (IUPAC codes, 
+soft-masked lowercase, protein) sets the wide field of its SuffixTree, and its nodes keep a sorted list of children instead (two pointers 
+per node whatever the alphabet), so DNA trees never pay for a large alphabet. Children are read with getChild, 
+specialized for each layout, and walked with firstChild and nextChild. Wide trees are always built serially.
+
+The state of a build (the active point) lives in the stack of buildSuffixTree, and what the nodes of a tree share 
+(the end of the leaves, the layout) in its SuffixTree, so several trees can be built and queried at the same time.
 -----------------------------------------------------------------------------------------
 */
 
@@ -11,13 +28,19 @@ although some modifications have been performed.
 #include <stdio.h> 
 #include <string.h> 
 #include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#include "types.h"
 #include "suffix_tree.h"
+#include "mem.h"
+#include "trace.h"
 
 #define MAX_CHAR 7
 short lookup[256] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+0, 0, 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 0, 3, 0, 4, 0, 0, 0, 5, 0, 0, 0, 0, 0, 0, 6, 0,
 0, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -34,44 +57,111 @@ short lookup[256] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
 // This are the ASCII codes for $,A,C,G,N,T : { 36,65,67,71,78,84 }
+// '#' (35) separates the references of a multi-reference index (see load_references). It shares the slot of '\0', 
+// which never appears in the text, and it is not in lookup2 of rlz.c, so no phrase of a source can contain it. 
+
+struct Ukkonen {
+	SuffixTree *tree;
+
+	/*lastNewNode will point to newly created internal node,
+	waiting for it's suffix link to be set, which might get
+	a new suffix link (other than root) in next extension of
+	same phase. lastNewNode will be set to NULL when last
+	newly created internal node (if there is any) got it's
+	suffix link reset to new internal node created in next
+	extension of same phase. */
+	Node *lastNewNode;
+	Node *activeNode;
+
+	/*activeEdge is represeted as input string character
+	index (not the character itself)*/
+	pos_t activeEdge;
+	pos_t activeLength;
+
+	// remainingSuffixCount tells how many suffixes yet to 
+	// be added in tree 
+	pos_t remainingSuffixCount;
+};
+
+int treeThreads = 1; // threads that the actions of the command line pass to buildSuffixTree
+
+#define WIDE_NODE_BYTES (offsetof(Node, children) + 2 * sizeof(Node*))
+#define NODE_BYTES(tree) ((tree)->wide ? WIDE_NODE_BYTES : sizeof(Node))
+
+static Node *wideChild(Node *n, char *text, unsigned char c)
+{
+	/* the list is sorted by first character, so the scan stops at the first child not below c */
+	Node *child = n->children[0];
+	while (child != NULL && (unsigned char)text[child->start] < c)
+		child = child->children[1];
+	return (child != NULL && (unsigned char)text[child->start] == c) ? child : NULL;
+}
+
+#define getChild(tree, n, text, c) ((tree)->wide ? wideChild(n, text, c) : (n)->children[lookup[(unsigned char)(c)] - 1])
 
-Node *root = NULL; //Pointer to root node 
-
-/*lastNewNode will point to newly created internal node,
-waiting for it's suffix link to be set, which might get
-a new suffix link (other than root) in next extension of
-same phase. lastNewNode will be set to NULL when last
-newly created internal node (if there is any) got it's
-suffix link reset to new internal node created in next
-extension of same phase. */
-Node *lastNewNode = NULL;
-Node *activeNode = NULL;
-
-/*activeEdge is represeted as input string character
-index (not the character itself)*/
-int activeEdge = -1;
-int activeLength = 0;
-
-// remainingSuffixCount tells how many suffixes yet to 
-// be added in tree 
-int remainingSuffixCount = 0;
-int leafEnd = -1;
-int *rootEnd = NULL;
-int *splitEnd = NULL;
-int size = -1; //Length of input string 
-
-Node *newNode(int start, int *end)
+static void setChild(SuffixTree *tree, Node *n, char *text, unsigned char c, Node *child)
 {
-	Node *node = (Node*)malloc(sizeof(Node));
+	/* hangs child from n, in place of the child whose edge starts with c if there is one */
+	if (!tree->wide) {
+		n->children[lookup[c] - 1] = child;
+		return;
+	}
+	Node **link = &n->children[0];
+	while (*link != NULL && (unsigned char)text[(*link)->start] < c)
+		link = &(*link)->children[1];
+	if (*link != NULL && (unsigned char)text[(*link)->start] == c) {
+		child->children[1] = (*link)->children[1];
+		(*link)->children[1] = NULL;
+	}
+	else
+		child->children[1] = *link;
+	*link = child;
+}
+
+Node *findChild(SuffixTree *tree, Node *n, char *text, char c)
+{
+	/* the child of n whose edge starts with c, NULL if there is none */
+	if (!tree->wide && lookup[(unsigned char)c] == 0)
+		return NULL;
+	return getChild(tree, n, text, c);
+}
+
+Node *firstChild(SuffixTree *tree, Node *n, int *slot)
+{
+	/* walks the children of n in the order of their first character, with nextChild:
+	for (child = firstChild(tree, n, &slot); child != NULL; child = nextChild(tree, n, child, &slot)) */
+	if (tree->wide)
+		return n->children[0];
+	for (*slot = 0; *slot < MAX_CHAR; ++*slot)
+		if (n->children[*slot] != NULL)
+			return n->children[*slot];
+	return NULL;
+}
+
+Node *nextChild(SuffixTree *tree, Node *n, Node *child, int *slot)
+{
+	if (tree->wide)
+		return child->children[1];
+	for (++*slot; *slot < MAX_CHAR; ++*slot)
+		if (n->children[*slot] != NULL)
+			return n->children[*slot];
+	return NULL;
+}
+
+static Node *allocNode(SuffixTree *tree, pos_t start, pos_t *end)
+{
+	/* newNode without the memory counters: the workers of buildSuffixTreeParallel count 
+	their nodes and add them after the join, instead of updating the shared counters for each one */
+	Node *node = (Node*)malloc(NODE_BYTES(tree));
 	int i;
-	for (i = 0; i < MAX_CHAR; i++)
+	for (i = 0; i < (tree->wide ? 2 : MAX_CHAR); i++)
 		node->children[i] = NULL;
 
 	/*For root node, suffixLink will be set to NULL
 	For internal nodes, suffixLink will be set to root
 	by default in current extension and may change in
 	next extension*/
-	node->suffixLink = root;
+	node->suffixLink = tree->root;
 	node->start = start;
 	node->end = end;
 
@@ -82,23 +172,29 @@ Node *newNode(int start, int *end)
 	return node;
 }
 
-int edgeLength(Node *n) {
+static Node *newNode(SuffixTree *tree, pos_t start, pos_t *end)
+{
+	mem_alloc(MEM_TREE_NODES, NODE_BYTES(tree));
+	return allocNode(tree, start, end);
+}
+
+pos_t edgeLength(Node *n) {
 	return *(n->end) - (n->start) + 1;
 }
 
-int walkDown(Node *currNode, int pos, char * text)
+static int walkDown(struct Ukkonen *u, Node *currNode)
 {
 	/*activePoint change for walk down (APCFWD) using
 	Skip/Count Trick (Trick 1). If activeLength is greater
 	than current edge length, set next internal node as
 	activeNode and adjust activeEdge and activeLength
 	accordingly to represent same activePoint*/
-	if (activeLength >= edgeLength(currNode))
+	if (u->activeLength >= edgeLength(currNode))
 	{
-		activeEdge += edgeLength(currNode); 
-		activeLength -= edgeLength(currNode);
-		activeNode = currNode;
-		if (activeEdge == 0) {
+		u->activeEdge += edgeLength(currNode); 
+		u->activeLength -= edgeLength(currNode);
+		u->activeNode = currNode;
+		if (u->activeEdge == 0) {
 			printf("WARNING. activeEdge letter is 0 (NULL) \n"); 
 		}
 		return 1;
@@ -106,34 +202,35 @@ int walkDown(Node *currNode, int pos, char * text)
 	return 0;
 }
 
-void extendSuffixTree(int pos, char* text)
+static void extendSuffixTree(struct Ukkonen *u, pos_t pos, char* text)
 {
+	SuffixTree *tree = u->tree;
 	/*Extension Rule 1, this takes care of extending all
 	leaves created so far in tree*/
-	leafEnd = pos;
+	tree->leafEnd = pos;
 
 	/*Increment remainingSuffixCount indicating that a
 	new suffix added to the list of suffixes yet to be
 	added in tree*/
-	remainingSuffixCount++;
+	u->remainingSuffixCount++;
 
 	/*set lastNewNode to NULL while starting a new phase,
 	indicating there is no internal node waiting for
 	it's suffix link reset in current phase*/
-	lastNewNode = NULL;
+	u->lastNewNode = NULL;
 
 	//Add all suffixes (yet to be added) one by one in tree 
-	while (remainingSuffixCount > 0) {
+	while (u->remainingSuffixCount > 0) {
 
-		if (activeLength == 0)
-			activeEdge = pos;
+		if (u->activeLength == 0)
+			u->activeEdge = pos;
 
 		// There is no outgoing edge starting with 
 		// activeEdge from activeNode 
-		if (activeNode->children[lookup[text[activeEdge]] - 1] == NULL) 
+		if (getChild(tree, u->activeNode, text, text[u->activeEdge]) == NULL) 
 		{
 			//Extension Rule 2 (A new leaf edge gets created) 
-			activeNode->children[lookup[text[activeEdge]] - 1] = newNode(pos, &leafEnd);
+			setChild(tree, u->activeNode, text, text[u->activeEdge], newNode(tree, pos, &tree->leafEnd));
 
 			/*A new leaf edge is created in above line starting
 			from an existng node (the current activeNode), and
@@ -142,10 +239,10 @@ void extendSuffixTree(int pos, char* text)
 			internal node to current activeNode. Then set lastNewNode
 			to NULL indicating no more node waiting for suffix link
 			reset.*/
-			if (lastNewNode != NULL)
+			if (u->lastNewNode != NULL)
 			{
-				lastNewNode->suffixLink = activeNode;
-				lastNewNode = NULL;
+				u->lastNewNode->suffixLink = u->activeNode;
+				u->lastNewNode = NULL;
 			}
 		}
 		// There is an outgoing edge starting with activeEdge 
@@ -154,27 +251,27 @@ void extendSuffixTree(int pos, char* text)
 		{
 			// Get the next node at the end of edge starting 
 			// with activeEdge 
-			Node *next = activeNode->children[lookup[text[activeEdge]] - 1];
-			if (walkDown(next, pos, text))//Do walkdown 
+			Node *next = getChild(tree, u->activeNode, text, text[u->activeEdge]);
+			if (walkDown(u, next))//Do walkdown 
 			{
 				//Start from next node (the new activeNode) 
 				continue;
 			}
 			/*Extension Rule 3 (current character being processed
 			is already on the edge)*/
-			if (text[next->start + activeLength] == text[pos])
+			if (text[next->start + u->activeLength] == text[pos])
 			{
 				//If a newly created node waiting for it's 
 				//suffix link to be set, then set suffix link 
 				//of that waiting node to curent active node 
-				if (lastNewNode != NULL && activeNode != root)
+				if (u->lastNewNode != NULL && u->activeNode != tree->root)
 				{
-					lastNewNode->suffixLink = activeNode;
-					lastNewNode = NULL;
+					u->lastNewNode->suffixLink = u->activeNode;
+					u->lastNewNode = NULL;
 				}
 
 				//APCFER3 
-				activeLength++;
+				u->activeLength++;
 				/*STOP all further processing in this phase
 				and move on to next phase*/
 				break;
@@ -187,27 +284,28 @@ void extendSuffixTree(int pos, char* text)
 			and a new leaf edge going out of that new node. This
 			is Extension Rule 2, where a new leaf edge and a new
 			internal node get created*/
-			splitEnd = (int*)malloc(sizeof(int));
-			*splitEnd = next->start + activeLength - 1;
+			pos_t *splitEnd = (pos_t*)malloc(sizeof(pos_t));
+			mem_alloc(MEM_TREE_ENDS, sizeof(pos_t));
+			*splitEnd = next->start + u->activeLength - 1;
 
 			//New internal node 
-			Node *split = newNode(next->start, splitEnd);
-			activeNode->children[lookup[text[activeEdge]] - 1] = split;
+			Node *split = newNode(tree, next->start, splitEnd);
+			setChild(tree, u->activeNode, text, text[u->activeEdge], split);
 
 			//New leaf coming out of new internal node 
-			split->children[lookup[text[pos]] - 1] = newNode(pos, &leafEnd);
-			next->start += activeLength;
-			split->children[lookup[text[next->start]] - 1] = next;
+			setChild(tree, split, text, text[pos], newNode(tree, pos, &tree->leafEnd));
+			next->start += u->activeLength;
+			setChild(tree, split, text, text[next->start], next);
 
 			/*We got a new internal node here. If there is any
 			internal node created in last extensions of same
 			phase which is still waiting for it's suffix link
 			reset, do it now.*/
-			if (lastNewNode != NULL)
+			if (u->lastNewNode != NULL)
 			{
 				/*suffixLink of lastNewNode points to current newly
 				created internal node*/
-				lastNewNode->suffixLink = split;
+				u->lastNewNode->suffixLink = split;
 			}
 
 			/*Make the current newly created internal node waiting
@@ -218,27 +316,27 @@ void extendSuffixTree(int pos, char* text)
 			Extension Rule 2 applies is any of the next extension
 			of same phase) at that point, suffixLink of this node
 			will point to that internal node.*/
-			lastNewNode = split;
+			u->lastNewNode = split;
 		}
 
 		/* One suffix got added in tree, decrement the count of
 		suffixes yet to be added.*/
-		remainingSuffixCount--;
-		if (activeNode == root && activeLength > 0) //APCFER2C1 
+		u->remainingSuffixCount--;
+		if (u->activeNode == tree->root && u->activeLength > 0) //APCFER2C1 
 		{
-			activeLength--;
-			activeEdge = pos - remainingSuffixCount + 1; 
+			u->activeLength--;
+			u->activeEdge = pos - u->remainingSuffixCount + 1; 
 		}
-		else if (activeNode != root) //APCFER2C2 
+		else if (u->activeNode != tree->root) //APCFER2C2 
 		{
-			activeNode = activeNode->suffixLink;
+			u->activeNode = u->activeNode->suffixLink;
 		}
 	}
 }
 
-void print(int i, int j, char* text)
+void print(pos_t i, pos_t j, char* text)
 {
-	int k;
+	pos_t k;
 	for (k = i; k <= j; k++)
 		printf("%c", text[k]);
 }
@@ -246,9 +344,9 @@ void print(int i, int j, char* text)
 //Print the suffix tree as well along with setting suffix index 
 //So tree will be printed in DFS manner 
 //Each edge along with it's suffix index will be printed 
-Node * setSuffixIndexByDFS(Node *n, int labelHeight, Node * lastSeenLeaf)
+Node * setSuffixIndexByDFS(SuffixTree *tree, Node *n, pos_t labelHeight, Node * lastSeenLeaf)
 {
-	if (n == NULL) return;
+	if (n == NULL) return NULL;
 	/* if (n->start != -1) //A non-root node 
 	{
 		//Print the label on edge from parent to current node 
@@ -259,100 +357,474 @@ Node * setSuffixIndexByDFS(Node *n, int labelHeight, Node * lastSeenLeaf)
 		n->suffixIndex = -1;
 	else if (n->suffixIndex == -1)
 		n->suffixIndex = lastSeenLeaf->suffixIndex;
-	int i;
-	for (i = 0; i < MAX_CHAR; i++)
+	int slot;
+	Node *child;
+	for (child = firstChild(tree, n, &slot); child != NULL; child = nextChild(tree, n, child, &slot))
 	{
-		if (n->children[i] != NULL)
-		{
-
-			//Current node is not a leaf as it has outgoing 
-			//edges from it. 
-			leaf = 0;
-			lastSeenLeaf = setSuffixIndexByDFS(n->children[i], labelHeight +
-				edgeLength(n->children[i]), lastSeenLeaf);
-			if (n->suffixIndex == -2)
-				n->suffixIndex = -1;
-			else if (n->suffixIndex == -1)
-				n->suffixIndex = lastSeenLeaf->suffixIndex;
-		}
+		//Current node is not a leaf as it has outgoing 
+		//edges from it. 
+		leaf = 0;
+		lastSeenLeaf = setSuffixIndexByDFS(tree, child, labelHeight +
+			edgeLength(child), lastSeenLeaf);
+		if (n->suffixIndex == -2)
+			n->suffixIndex = -1;
+		else if (n->suffixIndex == -1)
+			n->suffixIndex = lastSeenLeaf->suffixIndex;
 	}
 	if (leaf == 1) {
 
-		n->suffixIndex = size - labelHeight;
+		n->suffixIndex = tree->size - labelHeight;
 		lastSeenLeaf = n;
 	}
 	return lastSeenLeaf; 
 }
 
-void freeSuffixTreeByPostOrder(Node *n)
+static void freeSuffixTreeByPostOrder(SuffixTree *tree, Node *n)
 {
 	if (n == NULL)
 		return;
-	int i;
-	for (i = 0; i < MAX_CHAR; i++)
+	int slot;
+	Node *child = firstChild(tree, n, &slot), *next;
+	while (child != NULL)
 	{
-		if (n->children[i] != NULL)
-		{
-			freeSuffixTreeByPostOrder(n->children[i]);
-		}
+		// the sibling is read before the child is freed
+		next = nextChild(tree, n, child, &slot);
+		freeSuffixTreeByPostOrder(tree, child);
+		child = next;
 	}
-	if (n->suffixIndex == -1)
+	// leaves share leafEnd, every other node owns its end
+	if (n->end != &tree->leafEnd) {
 		free(n->end);
+		mem_release(MEM_TREE_ENDS, sizeof(pos_t));
+	}
 	free(n);
+	mem_release(MEM_TREE_NODES, NODE_BYTES(tree));
 }
 
-void printSuffixTreeByPostOrder(Node *n)
+void freeSuffixTree(SuffixTree *tree)
+{
+	/* frees the nodes, their ends and the tree itself */
+	if (tree == NULL)
+		return;
+	freeSuffixTreeByPostOrder(tree, tree->root);
+	free(tree);
+}
+
+void printSuffixTreeByPostOrder(SuffixTree *tree, Node *n)
 {
 	if (n == NULL)
 		return;
-	int i;
-	for (i = 0; i < MAX_CHAR; i++)
-	{
-		if (n->children[i] != NULL)
-		{
-			printSuffixTreeByPostOrder(n->children[i]);
-		}
-	}
-	printf("%d\n",n->suffixIndex);
+	int slot;
+	Node *child;
+	for (child = firstChild(tree, n, &slot); child != NULL; child = nextChild(tree, n, child, &slot))
+		printSuffixTreeByPostOrder(tree, child);
+	printf("%lld\n",(long long)n->suffixIndex);
 }
 
-int countNodesSuffixTree(Node *n, int counter)
+pos_t countNodesSuffixTree(SuffixTree *tree, Node *n, pos_t counter)
 {
 	if (n == NULL)
 		return counter;
-	int i;
-	for (i = 0; i < MAX_CHAR; i++)
+	int slot;
+	Node *child;
+	for (child = firstChild(tree, n, &slot); child != NULL; child = nextChild(tree, n, child, &slot))
 	{
-		if (n->children[i] != NULL)
-		{
-			counter++;
-			int partial_count = countNodesSuffixTree(n->children[i], 0);
-			counter += partial_count; 
-		}
+		counter++;
+		pos_t partial_count = countNodesSuffixTree(tree, child, 0);
+		counter += partial_count; 
 	}
 	return counter; 
 }
 
+static SuffixTree *newTree(char *text, int wide)
+{
+	/* an empty tree of text: its root, which is a special node with start and end indices as -1,
+	as it has no parent from where an edge comes to root */
+	SuffixTree *tree = (SuffixTree*)malloc(sizeof(SuffixTree));
+	pos_t *rootEnd = (pos_t*)malloc(sizeof(pos_t));
+	mem_alloc(MEM_TREE_ENDS, sizeof(pos_t));
+	*rootEnd = -1;
+	tree->size = strlen(text);
+	tree->leafEnd = -1;
+	tree->wide = wide;
+	tree->root = NULL;
+	tree->root = newNode(tree, -1, rootEnd);
+	return tree;
+}
+
 /*Build the suffix tree and print the edge labels along with
 suffixIndex. suffixIndex for leaf edges will be >= 0 and
 for non-leaf edges will be -1*/
-Node * buildSuffixTree(char* text)
+SuffixTree * buildSuffixTree(char* text, int threads)
+{
+	/* 'threads' > 1 builds DNA trees with buildSuffixTreeParallel, with at most one thread per online processor */
+	unsigned char *c;
+	int wide = 0;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cores >= 1 && threads > cores)
+		threads = (int)cores;
+	for (c = (unsigned char*)text; *c != '\0' && !wide; ++c)
+		wide = lookup[*c] == 0;
+	if (threads > 1 && text[0] != '\0' && !wide)
+		return buildSuffixTreeParallel(text, threads);
+	struct trace_span span = trace_begin("build tree");
+	SuffixTree *tree = newTree(text, wide);
+	struct Ukkonen u;
+	pos_t i;
+
+	u.tree = tree;
+	u.activeNode = tree->root; //First activeNode will be root 
+	u.lastNewNode = NULL;
+	u.activeEdge = -1;
+	u.activeLength = 0;
+	u.remainingSuffixCount = 0;
+	for (i = 0; i < tree->size; i++)
+		extendSuffixTree(&u, i, text);
+	trace_end(span, tree->size);
+	// the first pass marks the internal nodes, the second one gives them the index of a leaf below
+	span = trace_begin("suffix index dfs");
+	pos_t labelHeight = 0;
+	setSuffixIndexByDFS(tree, tree->root, labelHeight, NULL);
+	setSuffixIndexByDFS(tree, tree->root, labelHeight, NULL);
+	trace_end(span, tree->size);
+	return tree;
+}
+
+/* Parallel construction ----------------------------------------------------------------
+A bucket holds the suffixes whose first k characters have the same slots in lookup. Every worker sorts 
+the suffixes of a bucket and builds its subtree from the sorted order, as a stack of the rightmost path: 
+the common prefix with the previous suffix says how many nodes of the path are closed, and where a new 
+internal node goes. The bucket tops are then hung from the root the same way, with common prefixes 
+shorter than k.
+The buckets are all sorted first, and their common prefixes kept, before any node is allocated: a bucket whose 
+sort compares more than TREE_SORT_WORK characters per suffix and merge pass stops every worker, and the serial 
+build runs instead, so the parallel build never costs more than O(n log n) character comparisons plus Ukkonen's. */
+
+#define TREE_MAX_PREFIX 7 // 8^7 bucket counters at most
+#define TREE_SORT_WORK 64
+
+struct tree_entry {
+	Node *node;
+	pos_t s; // a suffix below node
+	pos_t depth; // string depth of node
+};
+
+struct tree_bucket {
+	pos_t first, count; // range of the bucket in the suffix array
+	Node *top; // the leaf of a single suffix, or the deepest node above all the suffixes of the bucket
+	pos_t s, depth;
+	pos_t nodes, ends; // allocated by the worker, counted after the join
+	pos_t work; // characters compared by the sort
+};
+
+struct tree_job {
+	SuffixTree *tree;
+	char *text;
+	pos_t prefix; // k
+	unsigned int *runs; // runs[i] is the length of the run of text[i] starting at i (capped)
+	pos_t *sa, *tmp; // once a bucket is sorted, tmp holds the common prefix of every suffix with the previous one
+	struct tree_bucket *buckets;
+	pos_t num_buckets;
+	pos_t next; // next bucket to sort or build
+	int build; // 0 while the buckets are sorted, 1 while their subtrees are built
+	int repetitive; // set by the bucket that went over its budget, read and written atomically
+	pthread_mutex_t lock;
+};
+
+static pos_t bucketKey(char *text, pos_t size, pos_t i, pos_t k)
+{
+	/* the slots of the first k characters of suffix i in base 8, with 0 past the end */
+	pos_t key = 0, j;
+	for (j = 0; j < k; ++j)
+		key = key * 8 + ((i + j < size) ? lookup[(unsigned char)text[i + j]] : 0);
+	return key;
+}
+
+static pos_t suffixLcp(struct tree_job *job, pos_t a, pos_t b, pos_t from, pos_t *work)
+{
+	/* length of the longest common prefix of the different suffixes a and b, which share their first 'from' 
+	characters. A run of one character is skipped at once, so runs of N do not make the sort quadratic. 
+	The steps are added to *work. */
+	char *text = job->text;
+	pos_t d = from, steps = 0;
+	while (text[a + d] == text[b + d]) {
+		unsigned int ra = job->runs[a + d], rb = job->runs[b + d];
+		d += ra < rb ? ra : rb;
+		steps++;
+	}
+	*work += steps;
+	return d;
+}
+
+static int suffixLess(struct tree_job *job, pos_t a, pos_t b, pos_t *work)
+{
+	/* characters are ordered by their slot first, as in the bucket keys */
+	pos_t d = suffixLcp(job, a, b, job->prefix, work);
+	unsigned char ca = job->text[a + d], cb = job->text[b + d];
+	return (lookup[ca] << 8 | ca) < (lookup[cb] << 8 | cb);
+}
+
+static void sortBucket(struct tree_job *job, struct tree_bucket *b)
+{
+	/* bottom-up merge sort, so repeats cost longer comparisons but never more of them. The common prefixes of 
+	consecutive suffixes are then left in tmp. Every pass adds TREE_SORT_WORK characters per suffix to the budget of the 
+	bucket; past it, job->repetitive is set and the sort stops. */
+	pos_t *src = job->sa + b->first, *dst = job->tmp + b->first, *swap;
+	pos_t n = b->count, width, i, budget = 0;
+	for (width = 1; width < n; width *= 2) {
+		budget += TREE_SORT_WORK * n;
+		for (i = 0; i < n; i += 2 * width) {
+			pos_t mid = (i + width < n) ? i + width : n, hi = (i + 2 * width < n) ? i + 2 * width : n;
+			pos_t x = i, y = mid, k = i;
+			if (b->work > budget || __atomic_load_n(&job->repetitive, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&job->repetitive, 1, __ATOMIC_RELAXED);
+				return;
+			}
+			while (x < mid && y < hi)
+				dst[k++] = suffixLess(job, src[y], src[x], &b->work) ? src[y++] : src[x++];
+			while (x < mid)
+				dst[k++] = src[x++];
+			while (y < hi)
+				dst[k++] = src[y++];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != job->sa + b->first)
+		memcpy(job->sa + b->first, src, n * sizeof(pos_t));
+	pos_t *sa = job->sa + b->first, *lcp = job->tmp + b->first;
+	lcp[0] = 0;
+	budget += TREE_SORT_WORK * n;
+	for (i = 1; i < n; ++i) {
+		if ((i & 1023) == 0 && (b->work > budget || __atomic_load_n(&job->repetitive, __ATOMIC_RELAXED))) {
+			__atomic_store_n(&job->repetitive, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		lcp[i] = suffixLcp(job, sa[i - 1], sa[i], job->prefix, &b->work);
+	}
+}
+
+static void hangEntry(char *text, struct tree_entry *parent, struct tree_entry *child)
+{
+	child->node->start = child->s + parent->depth;
+	parent->node->children[lookup[(unsigned char)text[child->node->start]] - 1] = child->node;
+}
+
+static void pushSorted(SuffixTree *tree, char *text, struct tree_entry *stack, pos_t *sp, struct tree_entry e, pos_t lcp, pos_t *nodes, pos_t *ends)
+{
+	/* closes the entries of the stack deeper than 'lcp' (the common prefix of e and the previous entry), 
+	splitting with a new internal node at depth lcp if there is none, and pushes e */
+	while (stack[*sp].depth > lcp) {
+		struct tree_entry child = stack[(*sp)--];
+		if (stack[*sp].depth < lcp) {
+			struct tree_entry split;
+			pos_t *end = (pos_t*)malloc(sizeof(pos_t));
+			*end = child.s + lcp - 1;
+			split.node = allocNode(tree, -1, end);
+			split.s = child.s;
+			split.depth = lcp;
+			(*nodes)++;
+			(*ends)++;
+			stack[++(*sp)] = split;
+		}
+		hangEntry(text, &stack[*sp], &child);
+	}
+	stack[++(*sp)] = e;
+}
+
+static struct tree_entry closeSorted(char *text, struct tree_entry *stack, pos_t sp)
+{
+	/* closes the rest of the stack and returns the entry hung from stack[0] */
+	struct tree_entry child = stack[sp];
+	while (sp > 0) {
+		child = stack[sp--];
+		hangEntry(text, &stack[sp], &child);
+	}
+	return child;
+}
+
+static void buildBucket(struct tree_job *job, struct tree_bucket *b)
+{
+	/* The suffixes of a bucket share k characters, so they hang from one top whose edge start is only 
+	known when it is hung from the shared tree. The suffix indexes only depend on the subtree and on the 
+	depth of its top, so the worker runs the DFS of buildSuffixTree on it. */
+	pos_t *sa = job->sa + b->first, *lcp = job->tmp + b->first, j, sp = 0;
+	struct tree_entry *stack = (struct tree_entry*)malloc((b->count + 1) * sizeof(struct tree_entry));
+	Node holder; // stands for the shared tree
+	stack[0].node = &holder;
+	stack[0].s = 0;
+	stack[0].depth = 0;
+	for (j = 0; j < b->count; ++j) {
+		struct tree_entry e;
+		e.node = allocNode(job->tree, -1, &job->tree->leafEnd);
+		e.s = sa[j];
+		e.depth = job->tree->size - sa[j];
+		b->nodes++;
+		pushSorted(job->tree, job->text, stack, &sp, e, lcp[j], &b->nodes, &b->ends);
+	}
+	struct tree_entry top = closeSorted(job->text, stack, sp);
+	free(stack);
+	b->top = top.node;
+	b->s = top.s;
+	b->depth = top.depth;
+	setSuffixIndexByDFS(job->tree, b->top, b->depth, NULL);
+	setSuffixIndexByDFS(job->tree, b->top, b->depth, NULL);
+}
+
+static void *treeWorker(void *arg)
+{
+	struct tree_job *job = (struct tree_job*)arg;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		pos_t i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->num_buckets || __atomic_load_n(&job->repetitive, __ATOMIC_RELAXED))
+			return NULL;
+		if (job->build)
+			buildBucket(job, &job->buckets[i]);
+		else
+			sortBucket(job, &job->buckets[i]);
+	}
+}
+
+static Node *lastLeaf(Node *n)
 {
-	size = strlen(text);
 	int i;
-	rootEnd = (int*)malloc(sizeof(int));
-	*rootEnd = -1;
+	for (;;) {
+		for (i = MAX_CHAR - 1; i >= 0 && n->children[i] == NULL; --i);
+		if (i < 0)
+			return n;
+		n = n->children[i];
+	}
+}
 
-	/*Root is a special node with start and end indices as -1,
-	as it has no parent from where an edge comes to root*/
-	root = newNode(-1, rootEnd);
-
-	activeNode = root; //First activeNode will be root 
-	for (i = 0; i < size; i++)
-		extendSuffixTree(i, text);
-	int labelHeight = 0;
-	setSuffixIndexByDFS(root, labelHeight, NULL);
-	setSuffixIndexByDFS(root, labelHeight, NULL);
-	return root;
+static void indexTop(Node *n)
+{
+	/* the index setSuffixIndexByDFS gives to the nodes above the buckets: the one of the last leaf 
+	below their first child. Bucket nodes already have theirs. */
+	int i, first = -1;
+	if (n->suffixIndex != -2)
+		return;
+	for (i = 0; i < MAX_CHAR; i++) {
+		if (n->children[i] != NULL) {
+			if (first < 0)
+				first = i;
+			indexTop(n->children[i]);
+		}
+	}
+	n->suffixIndex = lastLeaf(n->children[first])->suffixIndex;
+}
+
+static void runWorkers(struct tree_job *job, int threads)
+{
+	/* runs treeWorker on 'threads' threads, the calling one included, until every bucket is taken */
+	pthread_t *ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	int t, started = 0;
+	job->next = 0;
+	for (t = 1; t < threads; ++t)
+		if (pthread_create(&ids[started], NULL, treeWorker, job) == 0)
+			started++;
+	treeWorker(job);
+	for (t = 0; t < started; ++t)
+		pthread_join(ids[t], NULL);
+	free(ids);
 }
 
+/* Builds the same tree as the serial buildSuffixTree with 'threads' threads. k grows with the threads so 
+there are enough buckets to balance them, and the threads take the buckets one by one. Suffix links are 
+left pointing to root, since only Ukkonen's construction follows them. Repetitive text falls back to the 
+serial build (see TREE_SORT_WORK). */
+SuffixTree * buildSuffixTreeParallel(char* text, int threads)
+{
+	struct trace_span span = trace_begin("build tree");
+	struct tree_job job;
+	SuffixTree *tree = newTree(text, 0);
+	pos_t i, j, k, keys, sp = 0, nodes = 0, ends = 0, size = tree->size;
+	tree->leafEnd = size - 1;
+
+	for (k = 1; k < TREE_MAX_PREFIX && (1LL << (2 * k)) < 16LL * threads; ++k);
+	for (keys = 1, j = 0; j < k; ++j)
+		keys *= 8;
+	// the scratch arrays are counted with the nodes while they live
+	long long scratch = size * (2 * sizeof(pos_t) + sizeof(unsigned int)) + (keys + 1) * sizeof(pos_t);
+	mem_alloc(MEM_TREE_NODES, scratch);
+	job.tree = tree;
+	job.text = text;
+	job.prefix = k;
+	job.runs = (unsigned int*)malloc(size * sizeof(unsigned int));
+	job.sa = (pos_t*)malloc(size * sizeof(pos_t));
+	job.tmp = (pos_t*)malloc(size * sizeof(pos_t));
+	job.build = 0;
+	job.repetitive = 0;
+	pthread_mutex_init(&job.lock, NULL);
+	for (i = size - 1; i >= 0; --i)
+		job.runs[i] = (i + 1 < size && text[i] == text[i + 1] && job.runs[i + 1] < 0xffffffffu) ? job.runs[i + 1] + 1 : 1;
+
+	// counting sort of the suffixes by key, the keys wait in tmp
+	pos_t *counts = (pos_t*)calloc(keys + 1, sizeof(pos_t));
+	for (i = 0; i < size; ++i) {
+		job.tmp[i] = bucketKey(text, size, i, k);
+		counts[job.tmp[i] + 1]++;
+	}
+	job.num_buckets = 0;
+	for (j = 0; j < keys; ++j)
+		job.num_buckets += counts[j + 1] != 0;
+	job.buckets = (struct tree_bucket*)calloc(job.num_buckets, sizeof(struct tree_bucket));
+	for (i = 0, j = 0; j < keys; ++j) {
+		if (counts[j + 1]) {
+			job.buckets[i].first = counts[j];
+			job.buckets[i++].count = counts[j + 1];
+		}
+		counts[j + 1] += counts[j];
+	}
+	for (i = 0; i < size; ++i)
+		job.sa[counts[job.tmp[i]]++] = i;
+	free(counts);
+
+	runWorkers(&job, threads);
+	if (job.repetitive) {
+		pthread_mutex_destroy(&job.lock);
+		free(job.buckets);
+		free(job.runs);
+		free(job.sa);
+		free(job.tmp);
+		mem_release(MEM_TREE_NODES, scratch);
+		freeSuffixTree(tree);
+		trace_end(span, 0);
+		return buildSuffixTree(text, 1);
+	}
+	job.build = 1;
+	runWorkers(&job, threads);
+	pthread_mutex_destroy(&job.lock);
+
+	// hang the bucket tops from the root, in key order
+	struct tree_entry *stack = (struct tree_entry*)malloc((job.num_buckets + 1) * sizeof(struct tree_entry));
+	stack[0].node = tree->root;
+	stack[0].s = 0;
+	stack[0].depth = 0;
+	for (j = 0; j < job.num_buckets; ++j) {
+		struct tree_bucket *b = &job.buckets[j];
+		struct tree_entry e;
+		e.node = b->top;
+		e.s = b->s;
+		e.depth = b->depth;
+		nodes += b->nodes;
+		ends += b->ends;
+		pos_t work = 0;
+		pushSorted(tree, text, stack, &sp, e, j ? suffixLcp(&job, job.sa[b[-1].first + b[-1].count - 1], job.sa[b->first], 0, &work) : 0, &nodes, &ends);
+	}
+	closeSorted(text, stack, sp);
+	mem_alloc(MEM_TREE_NODES, nodes * NODE_BYTES(tree));
+	mem_alloc(MEM_TREE_ENDS, ends * sizeof(pos_t));
+	indexTop(tree->root);
+
+	free(stack);
+	free(job.buckets);
+	free(job.runs);
+	free(job.sa);
+	free(job.tmp);
+	mem_release(MEM_TREE_NODES, scratch);
+	trace_end(span, size);
+	return tree;
+}
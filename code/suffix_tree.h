@@ -1,7 +1,5 @@
 #define MAX_CHAR 7
 struct SuffixTreeNode {
-	struct SuffixTreeNode *children[MAX_CHAR];
-
 	//pointer to other node via suffix link 
 	struct SuffixTreeNode *suffixLink;
 
@@ -12,23 +10,44 @@ struct SuffixTreeNode {
 	in the child node. Lets say there are two nodes A and B
 	connected by an edge with indices (5, 8) then this
 	indices (5, 8) will be stored in node B. */
-	int start;
-	int *end;
+	pos_t start;
+	pos_t *end;
 
 	/*for leaf nodes, it stores the index of suffix for
 	the path from root to leaf*/
-	int suffixIndex;
+	pos_t suffixIndex;
+
+	/*children by slot of lookup when the text is DNA. Nodes of a tree with any 
+	other character (see SuffixTree) only have the first two pointers: children[0] 
+	is the first child and children[1] the next sibling, sorted by the first 
+	character of their edges. It must be the last field.*/
+	struct SuffixTreeNode *children[MAX_CHAR];
 };
 
 typedef struct SuffixTreeNode Node;
 
-Node *newNode(int start, int *end);
-int edgeLength(Node *n);
-int walkDown(Node *currNode, int pos, char * text);
-void extendSuffixTree(int pos, char * text);
-void print(int i, int j, char * text);
-Node * setSuffixIndexByDFS(Node *n, int labelHeight, Node *lastSeenLeaf);
-void freeSuffixTreeByPostOrder(Node *n);
-void printSuffixTreeByPostOrder(Node *n);
-Node * buildSuffixTree(char * text);
-int countNodesSuffixTree(Node *n, int counter); 
+/*a suffix tree and what all its nodes share. Building or freeing a tree only 
+touches its own SuffixTree, and a built tree is only read, so any number of 
+threads can query it, and several trees can be built at the same time.*/
+struct SuffixTree {
+	Node *root;
+	pos_t size; // length of the text
+	pos_t leafEnd; // end of every leaf edge, the leaves point to it
+	int wide; // 1 if the text has characters other than $ACGNT and the nodes keep a sorted list of children, 0 for the dense DNA nodes
+};
+
+typedef struct SuffixTree SuffixTree;
+
+extern int treeThreads; // threads that the actions of the command line pass to buildSuffixTree
+
+Node *findChild(SuffixTree *tree, Node *n, char *text, char c);
+Node *firstChild(SuffixTree *tree, Node *n, int *slot);
+Node *nextChild(SuffixTree *tree, Node *n, Node *child, int *slot);
+pos_t edgeLength(Node *n);
+void print(pos_t i, pos_t j, char * text);
+Node * setSuffixIndexByDFS(SuffixTree *tree, Node *n, pos_t labelHeight, Node *lastSeenLeaf);
+void freeSuffixTree(SuffixTree *tree);
+void printSuffixTreeByPostOrder(SuffixTree *tree, Node *n);
+SuffixTree * buildSuffixTree(char * text, int threads);
+SuffixTree * buildSuffixTreeParallel(char * text, int threads);
+pos_t countNodesSuffixTree(SuffixTree *tree, Node *n, pos_t counter); 
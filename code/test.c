@@ -22,7 +22,7 @@ long timer_end(struct timespec start_time){
     return diffInNanos;
 }
 
-double * test(char * filename, bool bins, Node * suffix_tree){
+double * test(char * filename, bool bins, SuffixTree * suffix_tree){
 	srand(time(0)); 
 	double *times = malloc(4*sizeof(double));
 
@@ -33,7 +33,7 @@ double * test(char * filename, bool bins, Node * suffix_tree){
 	int source_len = strlen(source);
 	clock_t t;
 	t = clock();
-	//Node * suffix_tree = buildSuffixTree(reference);
+	//SuffixTree * suffix_tree = buildSuffixTree(reference, 1);
 	printf("Suffix tree built. Proceding to compress...\n");
 	if (bins) {
 		csb * compressed_bins = compress_bins(suffix_tree, reference, source, 10);
@@ -175,7 +175,7 @@ void test5() {
 	char * source = "CATTACATTAGAGACATTAGAGA$";
 	clock_t t;
 	t = clock();
-	Node * suffix_tree = buildSuffixTree(reference);
+	SuffixTree * suffix_tree = buildSuffixTree(reference, 1);
 	printf("Suffix tree built. Proceding to compress...\n");
 	cs * compressed = compress(suffix_tree, reference, source);
 	csb * compressed_bins = compress_bins(suffix_tree, reference, source, 1);
@@ -194,8 +194,8 @@ void test5() {
 void test6() {
 	char * myfile1 = "../../Data/SCRef/all_data.fsa";
 	char * reference = load_file(myfile1, 1);
-	Node * suffix_tree = buildSuffixTree(reference);
-	int counter = countNodesSuffixTree(suffix_tree, 0);
+	SuffixTree * suffix_tree = buildSuffixTree(reference, 1);
+	int counter = countNodesSuffixTree(suffix_tree, suffix_tree->root, 0);
 	// printf("Suffix tree built. Proceding to compress...\n");
 	csb ** strains = malloc(36*sizeof(csb));  // We know that we have 36 files in the folder 
 	int ind = 0; 
@@ -265,7 +265,7 @@ double * test_(){
 	char * source = load_file(myfile2, 0);
 	clock_t t;
 	t = clock();
-	//Node * suffix_tree = buildSuffixTree(reference);
+	//SuffixTree * suffix_tree = buildSuffixTree(reference, 1);
 	//printf("Suffix tree built. Proceding to compress...\n");
 	//csb * compressed = compress_bins(suffix_tree, reference, source, 1);
 	//csb_to_file(compressed, "./mytrial1.csb"); 
@@ -0,0 +1,183 @@
+/*
+Trace module contains a lightweight scoped tracer for the phases of the pipeline (load, tree construction,
+suffix indexing, parse, bins, decompression and file output).
+A phase is wrapped with
+	struct trace_span span = trace_begin("name");
+	...
+	trace_end(span, bytes processed);
+and, while tracing is disabled (the default), both calls return right away.
+Once enabled (the global '--trace FILE' option of main.c), every span is recorded with its wall time (CLOCK_MONOTONIC),
+bytes and thread ID. At exit, a summary per phase (calls, time, bytes and throughput) is printed on stderr and,
+if a file was given, the spans are written in the Chrome trace-event format, which chrome://tracing and
+Perfetto (ui.perfetto.dev) open directly.
+Spans are appended with an atomic counter, so threads can record them concurrently.
+trace_record records the spans without the summary or the file, for actions that read their own timings with trace_total_ns.
+
+Functions:
+trace_enable
+trace_record
+trace_is_enabled
+trace_begin
+trace_end
+trace_total_ns
+trace_print_summary
+trace_write
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "trace.h"
+
+struct trace_event {
+	char * name;
+	double start_ns;
+	double dur_ns;
+	long long bytes;
+	int tid;
+};
+
+static int enabled = 0;
+static int summary = 0; // tracing was requested, not only recorded
+static char * output = NULL;
+static struct trace_event * events = NULL;
+static long num_events = 0; // may exceed TRACE_MAX_EVENTS, the extra spans are dropped
+static double origin_ns = 0;
+
+static double now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int thread_id() {
+#if defined(__linux__) && defined(SYS_gettid)
+	return (int)syscall(SYS_gettid);
+#else
+	return 0;
+#endif
+}
+
+static void finish() {
+	if (summary) {
+		fflush(stdout); // so the summary comes after the output of the action
+		trace_print_summary(stderr);
+		if (output != NULL && trace_write(output) != 0)
+			fprintf(stderr, "Error. Cannot write the trace to %s \n", output);
+	}
+	free(events);
+	events = NULL;
+	enabled = 0;
+}
+
+void trace_record() {
+/* Starts recording spans, without printing or writing anything at exit. */
+	if (enabled)
+		return;
+	events = malloc(TRACE_MAX_EVENTS * sizeof(struct trace_event));
+	if (events == NULL)
+		return;
+	origin_ns = now_ns();
+	enabled = 1;
+	atexit(finish);
+}
+
+void trace_enable(char * filename) {
+/* Starts recording spans. At exit, the summary is printed on stderr and, if filename is not NULL, the trace is written there. */
+	trace_record();
+	if (!enabled)
+		return;
+	output = filename;
+	summary = 1;
+}
+
+int trace_is_enabled() {
+	return enabled;
+}
+
+struct trace_span trace_begin(char * name) {
+	struct trace_span span;
+	span.name = name;
+	span.start_ns = enabled ? now_ns() : 0;
+	return span;
+}
+
+void trace_end(struct trace_span span, long long bytes) {
+/* Records the span that started at trace_begin, with the number of bytes it processed (0 if not meaningful). */
+	if (!enabled)
+		return;
+	double end = now_ns();
+	long e = __sync_fetch_and_add(&num_events, 1);
+	if (e >= TRACE_MAX_EVENTS)
+		return;
+	events[e].name = span.name;
+	events[e].start_ns = span.start_ns - origin_ns;
+	events[e].dur_ns = end - span.start_ns;
+	events[e].bytes = bytes;
+	events[e].tid = thread_id();
+}
+
+double trace_total_ns(char * name) {
+/* Returns the wall time of all the recorded spans called 'name', in nanoseconds. */
+	long e, n = num_events < TRACE_MAX_EVENTS ? num_events : TRACE_MAX_EVENTS;
+	double total = 0;
+	for (e = 0; e < n; ++e)
+		if (strcmp(events[e].name, name) == 0)
+			total += events[e].dur_ns;
+	return total;
+}
+
+void trace_print_summary(FILE * fp) {
+/* Prints, per phase name and in order of first appearance, the number of spans, the total wall time, the bytes and the throughput. */
+	long e, n = num_events < TRACE_MAX_EVENTS ? num_events : TRACE_MAX_EVENTS;
+	char * names[TRACE_MAX_PHASES];
+	long calls[TRACE_MAX_PHASES];
+	double time[TRACE_MAX_PHASES], bytes[TRACE_MAX_PHASES];
+	int p, num_phases = 0;
+	if (!enabled || n == 0)
+		return;
+	for (e = 0; e < n; ++e) {
+		for (p = 0; p < num_phases && strcmp(names[p], events[e].name) != 0; ++p);
+		if (p == num_phases) {
+			if (num_phases == TRACE_MAX_PHASES)
+				continue;
+			names[p] = events[e].name;
+			calls[p] = 0;
+			time[p] = bytes[p] = 0;
+			num_phases++;
+		}
+		calls[p]++;
+		time[p] += events[e].dur_ns;
+		bytes[p] += events[e].bytes;
+	}
+	fprintf(fp, "%-20s %8s %14s %16s %12s\n", "phase", "calls", "time (ms)", "bytes", "MB/s");
+	for (p = 0; p < num_phases; ++p)
+		fprintf(fp, "%-20s %8ld %14.3f %16.0f %12.2f\n", names[p], calls[p], time[p] / 1e6, bytes[p], time[p] > 0 ? bytes[p] / (time[p] / 1e9) / 1e6 : 0);
+	if (num_events > TRACE_MAX_EVENTS)
+		fprintf(fp, "(%ld spans dropped, only the first %d are kept)\n", num_events - TRACE_MAX_EVENTS, TRACE_MAX_EVENTS);
+}
+
+int trace_write(char * filename) {
+/* Writes the recorded spans as Chrome trace events ("X" complete events, times in microseconds). Returns 0 on success. */
+	long e, n = num_events < TRACE_MAX_EVENTS ? num_events : TRACE_MAX_EVENTS;
+	FILE * fp = fopen(filename, "w");
+	if (fp == NULL)
+		return 1;
+	int pid = (int)getpid();
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (e = 0; e < n; ++e) {
+		struct trace_event * ev = &events[e];
+		fprintf(fp, "%s\n{\"name\": \"%s\", \"cat\": \"isrlz\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"bytes\": %lld, \"MB/s\": %.2f}}",
+			e ? "," : "", ev->name, ev->start_ns / 1e3, ev->dur_ns / 1e3, pid, ev->tid, ev->bytes, ev->dur_ns > 0 ? ev->bytes / (ev->dur_ns / 1e9) / 1e6 : 0);
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	return 0;
+}
@@ -0,0 +1,16 @@
+#define TRACE_MAX_EVENTS 65536
+#define TRACE_MAX_PHASES 64
+
+struct trace_span {
+	char * name;
+	double start_ns;
+};
+
+void trace_enable(char * filename);
+void trace_record();
+int trace_is_enabled();
+struct trace_span trace_begin(char * name);
+void trace_end(struct trace_span span, long long bytes);
+double trace_total_ns(char * name);
+void trace_print_summary(FILE * fp);
+int trace_write(char * filename);
@@ -0,0 +1,14 @@
+/*
+Coordinate type shared by all modules. Positions in the reference and in the source, phrase lengths and
+suffix indices are stored as pos_t, which is 64 bits wide so references and sources beyond 2^31 bases are supported.
+Builds that only ever handle small genomes can define ISRLZ_POS32 to keep 32-bit coordinates in memory;
+load.c then refuses inputs whose positions would pass POS_MAX (see LOAD_MAX_SOURCE).
+On disk, the .csb format picks the offset width per file, so small genomes keep the compact 4-byte layout anyway.
+*/
+#ifdef ISRLZ_POS32
+typedef int pos_t;
+#define POS_MAX 0x7fffffff
+#else
+typedef long long pos_t;
+#define POS_MAX 0x7fffffffffffffffLL
+#endif
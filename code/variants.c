@@ -0,0 +1,424 @@
+/*
+Variants module lists the differences between a compressed source and its reference, in reference coordinates,
+by walking the phrase arrays of the csb over a source interval (no decompression, no alignment).
+
+Every phrase copies reference characters and ends with a mismatch. The mismatches of a phrase and of the phrases
+that copy nothing after it (length 1) form the inserted string S, and the next phrase that copies something says where
+the source goes on in the reference. With r the reference position right after the copy and s' the start of the
+next copy, the gap g = s' - r (mirrored for reverse phrases) classifies the boundary:
+g == |S|            a substitution (SNV, or MNV for several characters)
+small g != |S|      a deletion (g > |S|) or an insertion, with the preceding reference base as padding as in VCF
+g < 0, small        an insertion of S followed by the copy of reference[s', r) again (tandem duplication)
+large g > 0         a symbolic <DEL>, when S is the end of the skipped reference (a plain deletion)
+anything else       a breakend (strand change, another reference of the index, long jump), with the VCF breakend notation
+Short phrases that jump elsewhere are taken as chance matches and join S (see find_variants). The alleles of an event are then
+trimmed to the bases that differ and indels are left-aligned, as VCF normalization does (see normalize).
+Exceptions of the tolerant parse are SNVs. Phrases copied from the reverse strand report their substitutions on the
+forward strand, other events of a reverse run are breakends.
+The time is proportional to the phrases and exceptions in the interval.
+
+Functions:
+find_variants
+free_variants
+write_vcf
+-----------------------------------------------------------------------------------------
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "interpolation.h"
+#include "suffix_tree.h"
+#include "rlz.h"
+#include "load.h"
+#include "variants.h"
+
+static struct variant * add_variant(struct variant ** list, pos_t * num, pos_t * capacity) {
+	if (*num == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : 256;
+		*list = realloc(*list, *capacity * sizeof(struct variant));
+	}
+	struct variant * v = &(*list)[(*num)++];
+	memset(v, 0, sizeof(struct variant));
+	return v;
+}
+
+static char * copy_text(char * text, pos_t len) {
+	char * res = malloc(len + 1);
+	memcpy(res, text, len);
+	res[len] = '\0';
+	return res;
+}
+
+static void classify(char * reference, csb * comp_source, pos_t p, pos_t q, char * inserted, pos_t k, struct variant * v) {
+/* This function fills v with the event between phrase p, which copies something, and phrase q, the next one that does:
+-inserted- holds the k mismatches between both copies. */
+	pos_t * lens = comp_source->lens->arr;
+	pos_t c = lens[p] - lens[p - 1] - 1, c_next = lens[q] - lens[q - 1] - 1;
+	int reverse = PHRASE_IS_REVERSE(comp_source, p), reverse_next = PHRASE_IS_REVERSE(comp_source, q);
+	pos_t r = reverse ? comp_source->starts[p] - c : comp_source->starts[p] + c; // next reference position of the copy
+	pos_t next = comp_source->starts[q];
+	pos_t g = reverse ? r - next : next - r, j;
+	v->source_pos = lens[p] - 1;
+	v->reverse = reverse;
+	if (reverse == reverse_next && phrase_reference(comp_source, p) == phrase_reference(comp_source, q)) {
+		if (g == k && k <= VARIANT_MAX_ALLELE) {
+			v->type = (k == 1) ? VARIANT_SNV : VARIANT_MNV;
+			v->ref_pos = reverse ? r - k + 1 : r;
+			v->ref_len = k;
+			v->alt = malloc(k + 1);
+			for (j = 0; j < k; ++j)
+				v->alt[j] = reverse ? complement_base(inserted[k - 1 - j]) : inserted[j];
+			v->alt[k] = '\0';
+			return;
+		}
+		if (!reverse && g >= 0 && g <= VARIANT_MAX_ALLELE && k <= VARIANT_MAX_ALLELE) {
+			v->type = (g > k) ? VARIANT_DEL : VARIANT_INS;
+			v->ref_pos = r - 1;
+			v->ref_len = g + 1;
+			v->alt = malloc(k + 2);
+			v->alt[0] = reference[r - 1];
+			memcpy(&v->alt[1], inserted, k);
+			v->alt[k + 1] = '\0';
+			return;
+		}
+		if (!reverse && g < 0 && -g + k <= VARIANT_MAX_ALLELE && c_next > -g) {
+			// the next copy reads reference[next, r) again before going on past r
+			v->type = VARIANT_INS;
+			v->ref_pos = r - 1;
+			v->ref_len = 1;
+			v->alt = malloc(k - g + 2);
+			v->alt[0] = reference[r - 1];
+			memcpy(&v->alt[1], inserted, k);
+			memcpy(&v->alt[1 + k], &reference[next], -g);
+			v->alt[k - g + 1] = '\0';
+			return;
+		}
+		if (!reverse && g > VARIANT_MAX_ALLELE && g <= VARIANT_MAX_DELETION && g > k && memcmp(&reference[next - k], inserted, k) == 0) {
+			// S is the end of the skipped reference, so only reference[r, r+g-k) is deleted
+			v->type = VARIANT_DEL;
+			v->ref_pos = r - 1;
+			v->ref_len = 1;
+			v->sv_len = g - k;
+			v->alt = copy_text("<DEL>", 5);
+			return;
+		}
+	}
+	// breakend: the last copied base, joined to the copy that starts at next (see the VCF breakend notation)
+	v->type = VARIANT_BND;
+	v->ref_pos = reverse ? r + 1 : r - 1;
+	v->ref_len = 1;
+	v->mate_pos = next;
+	v->mate_reverse = reverse_next;
+	v->alt = malloc(k + 1);
+	for (j = 0; j < k; ++j)
+		v->alt[j] = reverse ? complement_base(inserted[k - 1 - j]) : inserted[j];
+	v->alt[k] = '\0';
+}
+
+static void insertion(char * reference, pos_t ref_pos, int before, int reverse, char * inserted, pos_t k, struct variant * v) {
+/* This function fills v with the insertion of the k characters of -inserted- next to the reference base ref_pos, before it if -before- is set
+and after it otherwise (VCF pads an insertion with the base before it, or after it at the start of the copied reference). The characters are
+reverse complemented if the source copies the reverse strand there. Longer insertions than VARIANT_MAX_ALLELE are written as <INS>. */
+	pos_t j;
+	v->type = VARIANT_INS;
+	v->ref_pos = ref_pos;
+	v->ref_len = 1;
+	v->reverse = reverse;
+	if (k > VARIANT_MAX_ALLELE) {
+		v->alt = copy_text("<INS>", 5);
+		v->sv_len = k;
+		return;
+	}
+	v->alt = malloc(k + 2);
+	char * s = before ? v->alt : &v->alt[1];
+	for (j = 0; j < k; ++j)
+		s[j] = reverse ? complement_base(inserted[k - 1 - j]) : inserted[j];
+	v->alt[before ? k : 0] = reference[ref_pos];
+	v->alt[k + 1] = '\0';
+}
+
+static int copies_reference(csb * comp_source, pos_t q, pos_t length) {
+/* Returns 0 if the copy of phrase q runs into the N padding after the references, at or past -length- (see reference_length).
+Those characters are not reference bases, they are inserted characters like the mismatches. */
+	pos_t c = comp_source->lens->arr[q] - comp_source->lens->arr[q - 1] - 1;
+	if (PHRASE_IS_REVERSE(comp_source, q))
+		return comp_source->starts[q] < length;
+	return comp_source->starts[q] + c <= length;
+}
+
+static int is_anchor(csb * comp_source, pos_t q, int reverse, pos_t r, pos_t k, pos_t length) {
+/* A phrase anchors the event that follows a copy ending at reference position r and k inserted characters if its copy is long enough
+not to be a chance match, if it goes on exactly where expected, or if it is not that short and goes on a small indel away.
+A short copy that goes back must read again all the reference it goes back over and go on past it (a tandem duplication), otherwise
+the events before and after it would overlap. Copies of the padding never anchor, and reverse = -1 only takes the long copies. */
+	pos_t c = comp_source->lens->arr[q] - comp_source->lens->arr[q - 1] - 1;
+	pos_t s = comp_source->starts[q];
+	pos_t shift = s - (reverse ? r - k : r + k), back = reverse ? s - r : r - s;
+	if (!copies_reference(comp_source, q, length))
+		return 0;
+	if (c >= VARIANT_MIN_ANCHOR)
+		return 1;
+	if (c == 0 || PHRASE_IS_REVERSE(comp_source, q) != reverse)
+		return 0;
+	if (back > 0 && c <= back)
+		return 0;
+	return shift == 0 || (c >= VARIANT_NEAR_ANCHOR && shift >= -VARIANT_NEAR_SHIFT && shift <= VARIANT_NEAR_SHIFT);
+}
+
+static pos_t gather(char * reference, csb * comp_source, pos_t q, int reverse, pos_t r, pos_t length, char ** inserted, pos_t * capacity, pos_t * k) {
+/* This function appends to the *k characters of *inserted the copy and the mismatch of phrase q, and of the phrases after it up to the next anchor
+of the event after reference position r, which it returns. It returns comp_source->size if the source ends first (the '$' is not appended). */
+	pos_t * lens = comp_source->lens->arr, j, e;
+	for (;; ++q) {
+		pos_t cq = lens[q] - lens[q - 1] - 1;
+		if (*k + cq + 1 > *capacity) {
+			*capacity = 2 * (*k + cq + 1);
+			*inserted = realloc(*inserted, *capacity);
+		}
+		for (j = 0; j < cq; ++j)
+			(*inserted)[*k + j] = PHRASE_IS_REVERSE(comp_source, q) ? complement_base(reference[comp_source->starts[q] - j]) : reference[comp_source->starts[q] + j];
+		for (e = comp_source->exception_index ? comp_source->exception_index[q] : 0; comp_source->exception_index && e < comp_source->exception_index[q + 1]; ++e)
+			(*inserted)[*k + comp_source->exception_pos[e] - lens[q - 1]] = comp_source->exception_chars[e];
+		*k += cq;
+		if (comp_source->mismatches[q] == '$')
+			return comp_source->size;
+		(*inserted)[(*k)++] = comp_source->mismatches[q];
+		if (is_anchor(comp_source, q + 1, reverse, r, *k, length))
+			return q + 1;
+	}
+}
+
+static int normalize(char * reference, pos_t min_pos, struct variant * v) {
+/* This function makes an explicit allele minimal and left-aligned, the form VCF tools compare records in: the bases REF and ALT share
+at their end and then at their start are trimmed, keeping the padding base before an indel, and an indel moves left while the base before
+it repeats its last one. It does not move the padding base before reference position -min_pos-, where the copy before the event starts
+(or its last exception, or the end of the previous record), so the record never overlaps the ones before it. Substitutions of the reverse strand are trimmed with the source
+position moved along the strand; other reverse events, breakends and symbolic alleles are kept as they are.
+Returns 0 if REF and ALT turn out to be the same, then the event is no variant. */
+	pos_t a = v->ref_pos, rl = v->ref_len, al, u = 0, t = 0;
+	char * alt = v->alt;
+	if (v->type == VARIANT_BND || v->sv_len > 0 || (v->reverse && v->type != VARIANT_SNV && v->type != VARIANT_MNV))
+		return 1;
+	al = strlen(alt);
+	if (v->type == VARIANT_SNV || v->type == VARIANT_MNV) {
+		while (rl > 0 && reference[a + rl - 1] == alt[al - 1]) {
+			rl--;
+			al--;
+			t++;
+		}
+		while (u < rl && reference[a + u] == alt[u])
+			u++;
+		if (rl == u)
+			return 0;
+		memmove(alt, &alt[u], al - u);
+		alt[al - u] = '\0';
+		v->source_pos += v->reverse ? t : u;
+		v->ref_pos = a + u;
+		v->ref_len = rl - u;
+		v->type = (v->ref_len == 1) ? VARIANT_SNV : VARIANT_MNV;
+		return 1;
+	}
+	// drop the shared last base, and take the base before the alleles when one of them runs out
+	while (reference[a + rl - 1] == alt[al - 1] && ((rl > 1 && al > 1) || (a > min_pos && reference[a - 1] != REF_SEPARATOR))) {
+		rl--;
+		al--;
+		if (rl == 0 || al == 0) {
+			a--;
+			rl++;
+			memmove(&alt[1], alt, al++);
+			alt[0] = reference[a];
+		}
+	}
+	while (rl > 1 && al > 1 && reference[a] == alt[0]) {
+		a++;
+		rl--;
+		memmove(alt, &alt[1], --al);
+	}
+	alt[al] = '\0';
+	v->source_pos += a - v->ref_pos;
+	v->ref_pos = a;
+	v->ref_len = rl;
+	return 1;
+}
+
+static int in_interval(pos_t x, pos_t i, pos_t end) {
+	return x >= i && x < end;
+}
+
+pos_t find_variants(char * reference, csb * comp_source, pos_t i, pos_t len, struct variant ** variants) {
+/* This function stores in *variants (to be freed with free_variants) the variants of source[i, i+len), in source order,
+and returns their number. A variant belongs to the interval if its first source position does, before normalize trims or moves it.
+Phrases shorter than VARIANT_MIN_ANCHOR are usually chance matches elsewhere in the reference after a mismatch, so unless they
+go on where the previous copy would (give or take a small indel), their characters join the inserted string S and the event ends at the next anchor.
+Copies of the N padding after the references join S as well. A breakend that a short copy undoes (the next anchor goes on a small event away
+from the copy before it) is merged with that copy and the next event into one record, so the records never overlap.
+Characters before the first anchor and after the last one are insertions next to it. */
+	pos_t * lens = comp_source->lens->arr, end = i + len, num = 0, capacity = 0, e, length = reference_length(reference);
+	struct variant * list = NULL;
+	char * inserted = malloc(64);
+	pos_t inserted_capacity = 64;
+	pos_t p = predecessor(comp_source->lens, i, comp_source->size) + 1;
+	// start from an anchor, the phrases after it may belong to its event, and from the anchor before it, whose event bounds how far
+	// left the first one can move (see normalize)
+	int anchors;
+	for (anchors = 0; anchors < 2 && p > 1; ++anchors) {
+		if (anchors)
+			p--;
+		while (p > 1 && (lens[p] - lens[p - 1] - 1 < VARIANT_MIN_ANCHOR || !copies_reference(comp_source, p, length)))
+			p--;
+	}
+	if (p == 1 && (lens[1] - 1 == 0 || !copies_reference(comp_source, 1, length))) {
+		// the source starts with inserted characters
+		pos_t k = 0, q = gather(reference, comp_source, 1, -1, 0, length, &inserted, &inserted_capacity, &k);
+		if (q < comp_source->size && in_interval(0, i, end))
+			insertion(reference, comp_source->starts[q], !PHRASE_IS_REVERSE(comp_source, q), PHRASE_IS_REVERSE(comp_source, q), inserted, k, add_variant(&list, &num, &capacity));
+		p = q;
+	}
+	pos_t prev_end = -1; // end of the REF allele of the last event, if it is a forward one that may bound the next
+	while (p < comp_source->size && lens[p - 1] < end) {
+		pos_t base = lens[p - 1], c = lens[p] - base - 1, s = comp_source->starts[p];
+		int reverse = PHRASE_IS_REVERSE(comp_source, p);
+		// where the reference goes on unchanged up to the event: the copy, or the bases the previous event trimmed off its end
+		pos_t min_pos = (!reverse && prev_end >= 0 && prev_end < s) ? prev_end : s;
+		if (comp_source->exception_index != NULL) {
+			for (e = comp_source->exception_index[p]; e < comp_source->exception_index[p + 1]; ++e) {
+				pos_t x = comp_source->exception_pos[e];
+				min_pos = s + (x - base) + 1;
+				if (!in_interval(x, i, end))
+					continue;
+				struct variant * v = add_variant(&list, &num, &capacity);
+				v->type = VARIANT_SNV;
+				v->source_pos = x;
+				v->ref_pos = reverse ? s - (x - base) : s + (x - base);
+				v->ref_len = 1;
+				v->reverse = reverse;
+				v->alt = malloc(2);
+				v->alt[0] = reverse ? complement_base(comp_source->exception_chars[e]) : comp_source->exception_chars[e];
+				v->alt[1] = '\0';
+			}
+		}
+		if (c == 0 || comp_source->mismatches[p] == '$') {
+			// a mismatch with no copy before it belongs to the variant of an earlier phrase
+			p++;
+			continue;
+		}
+		// gather S up to the next anchor, or to the end of the source
+		pos_t r = reverse ? s - c : s + c, k = 1, q = p + 1;
+		inserted[0] = comp_source->mismatches[p];
+		if (!is_anchor(comp_source, q, reverse, r, k, length))
+			q = gather(reference, comp_source, q, reverse, r, length, &inserted, &inserted_capacity, &k);
+		if (q == comp_source->size) {
+			// the source ends after the inserted characters
+			if (in_interval(lens[p] - 1, i, end))
+				insertion(reference, reverse ? r + 1 : r - 1, reverse, reverse, inserted, k, add_variant(&list, &num, &capacity));
+			break;
+		}
+		struct variant event, merged;
+		memset(&event, 0, sizeof(struct variant));
+		classify(reference, comp_source, p, q, inserted, k, &event);
+		pos_t k2 = k, q2 = q;
+		while (event.type == VARIANT_BND && reverse == PHRASE_IS_REVERSE(comp_source, q) && phrase_reference(comp_source, p) == phrase_reference(comp_source, q)
+			&& k2 <= VARIANT_MAX_ALLELE) {
+			// a short detour inside one event: the copies up to an anchor that makes it a plain event join S
+			q2 = gather(reference, comp_source, q2, reverse, r, length, &inserted, &inserted_capacity, &k2);
+			if (q2 == comp_source->size)
+				break;
+			memset(&merged, 0, sizeof(struct variant));
+			classify(reference, comp_source, p, q2, inserted, k2, &merged);
+			if (merged.type != VARIANT_BND) {
+				free(event.alt);
+				event = merged;
+				q = q2;
+				k = k2;
+				break;
+			}
+			free(merged.alt);
+		}
+		int kept = normalize(reference, min_pos, &event);
+		prev_end = (event.type == VARIANT_BND || event.reverse) ? -1 : event.ref_pos + (event.sv_len > 0 ? 1 + event.sv_len : event.ref_len);
+		if (!kept) // the source copies the reference from min_pos on after all
+			prev_end = reverse ? -1 : min_pos;
+		if (kept && in_interval(lens[p] - 1, i, end))
+			*add_variant(&list, &num, &capacity) = event;
+		else
+			free(event.alt);
+		p = q;
+	}
+	free(inserted);
+	*variants = list;
+	return num;
+}
+
+void free_variants(struct variant * variants, pos_t num) {
+	pos_t j;
+	for (j = 0; j < num; ++j)
+		free(variants[j].alt);
+	free(variants);
+}
+
+static const char * variant_names[] = { "SNV", "MNV", "DEL", "INS", "BND" };
+
+static int compare_variants(const void * a, const void * b) {
+	const struct variant * x = *(struct variant * const *)a, * y = *(struct variant * const *)b;
+	if (x->ref_pos != y->ref_pos)
+		return (x->ref_pos > y->ref_pos) - (x->ref_pos < y->ref_pos);
+	return (x->source_pos > y->source_pos) - (x->source_pos < y->source_pos);
+}
+
+void write_vcf(FILE * fp, char * reference, struct ref_table * refs, char * name, struct variant * variants, pos_t num) {
+/* This function writes the variants as VCF 4.2 records. The chromosome is the reference of the index that holds the variant
+(-name- for a single reference), positions are 1-based in that reference, and INFO keeps the source position and the type.
+The records are sorted by chromosome, in the order of the index, and position, as VCF requires. */
+	pos_t j;
+	int k;
+	struct variant ** sorted = malloc(num * sizeof(struct variant *));
+	for (j = 0; j < num; ++j)
+		sorted[j] = &variants[j];
+	qsort(sorted, num, sizeof(struct variant *), compare_variants);
+	fprintf(fp, "##fileformat=VCFv4.2\n##source=isrlz\n");
+	if (refs == NULL)
+		fprintf(fp, "##contig=<ID=%s>\n", name);
+	for (k = 0; refs != NULL && k < refs->num; ++k)
+		fprintf(fp, "##contig=<ID=%s,length=%lld>\n", refs->names[k], (long long)(refs->starts[k + 1] - refs->starts[k] - 1));
+	fprintf(fp, "##INFO=<ID=TYPE,Number=1,Type=String,Description=\"SNV, MNV, DEL, INS or BND\">\n");
+	fprintf(fp, "##INFO=<ID=SRC,Number=1,Type=Integer,Description=\"0-based source position\">\n");
+	fprintf(fp, "##INFO=<ID=STRAND,Number=1,Type=String,Description=\"- if the source copies the reverse strand there\">\n");
+	fprintf(fp, "##INFO=<ID=SVTYPE,Number=1,Type=String,Description=\"Type of structural variant\">\n");
+	fprintf(fp, "##INFO=<ID=SVLEN,Number=1,Type=Integer,Description=\"Length of the structural variant\">\n");
+	fprintf(fp, "##INFO=<ID=END,Number=1,Type=Integer,Description=\"End position of the structural variant\">\n");
+	fprintf(fp, "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n");
+	for (j = 0; j < num; ++j) {
+		struct variant * v = sorted[j];
+		int chrom = find_reference(refs, v->ref_pos);
+		pos_t offset = refs ? refs->starts[chrom] : 0;
+		fprintf(fp, "%s\t%lld\t.\t", refs ? refs->names[chrom] : name, (long long)(v->ref_pos - offset + 1));
+		fwrite(&reference[v->ref_pos], 1, v->ref_len, fp);
+		fputc('\t', fp);
+		if (v->type == VARIANT_BND) {
+			int mate = find_reference(refs, v->mate_pos);
+			char bracket = v->mate_reverse ? ']' : '[';
+			char mate_text[512];
+			snprintf(mate_text, sizeof(mate_text), "%c%s:%lld%c", bracket, refs ? refs->names[mate] : name, (long long)(v->mate_pos - (refs ? refs->starts[mate] : 0) + 1), bracket);
+			if (v->reverse)
+				fprintf(fp, "%s%s%c", mate_text, v->alt, reference[v->ref_pos]);
+			else
+				fprintf(fp, "%c%s%s", reference[v->ref_pos], v->alt, mate_text);
+		}
+		else
+			fputs(v->alt, fp);
+		fprintf(fp, "\t.\tPASS\tTYPE=%s;SRC=%lld", variant_names[v->type], (long long)v->source_pos);
+		if (v->reverse)
+			fprintf(fp, ";STRAND=-");
+		if (v->type == VARIANT_BND)
+			fprintf(fp, ";SVTYPE=BND");
+		if (v->sv_len > 0 && v->type == VARIANT_DEL)
+			fprintf(fp, ";SVTYPE=DEL;SVLEN=%lld;END=%lld", -(long long)v->sv_len, (long long)(v->ref_pos - offset + 1 + v->sv_len));
+		if (v->sv_len > 0 && v->type == VARIANT_INS)
+			fprintf(fp, ";SVTYPE=INS;SVLEN=%lld", (long long)v->sv_len);
+		fputc('\n', fp);
+	}
+	free(sorted);
+}
@@ -0,0 +1,23 @@
+#define VARIANT_MAX_ALLELE 200 // longest allele written explicitly, a cluster of nearby mutations is one event
+#define VARIANT_MIN_ANCHOR 20 // shorter copies that jump elsewhere are taken as inserted characters
+#define VARIANT_NEAR_ANCHOR 8 // shorter copies anchor an event only where the previous copy goes on
+#define VARIANT_NEAR_SHIFT 50 // longer ones also anchor an event up to this many positions away from there
+#define VARIANT_MAX_DELETION 100000 // longest deletion written as <DEL>, longer jumps are breakends
+
+enum variant_type { VARIANT_SNV, VARIANT_MNV, VARIANT_DEL, VARIANT_INS, VARIANT_BND };
+
+struct variant {
+	int type;
+	pos_t source_pos; // first source position of the event
+	pos_t ref_pos; // first base of the REF allele, in the indexed text
+	pos_t ref_len;
+	char * alt; // ALT allele, or the inserted characters of a breakend
+	pos_t sv_len; // bases of a symbolic <DEL> or <INS>, 0 otherwise
+	pos_t mate_pos; // breakend: where the source goes on in the reference
+	int reverse; // the source copies the reverse strand before the event
+	int mate_reverse; // and after it (breakend)
+};
+
+pos_t find_variants(char * reference, csb * comp_source, pos_t i, pos_t len, struct variant ** variants);
+void free_variants(struct variant * variants, pos_t num);
+void write_vcf(FILE * fp, char * reference, struct ref_table * refs, char * name, struct variant * variants, pos_t num);